@@ -33,6 +33,8 @@ typedef struct ChidbSchema ChidbSchema;
 #define CHIDB_EMISMATCH (6)
 #define CHIDB_EIO (7)
 #define CHIDB_EMISUSE (8)
+#define CHIDB_EBUSY (11)
+#define CHIDB_ERANGE (12)
 
 #define CHIDB_ROW (100)
 #define CHIDB_DONE (101)
@@ -48,7 +50,8 @@ typedef struct ChidbSchema ChidbSchema;
  *       other words, an API user should not be concerned with what
  *       is contained in a variable of type chidb, and should simply
  *       use it as a representation of a chidb database to pass along
- *       to other API functions.
+ *       to other API functions. If the database cannot be opened,
+ *       *db is set to NULL.
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -59,6 +62,44 @@ typedef struct ChidbSchema ChidbSchema;
  */
 int chidb_open(const char *file, chidb **db);
 
+/* Flags for chidb_open_v2 */
+#define CHIDB_OPEN_DEFAULT (0)
+#define CHIDB_OPEN_MMAP (1 << 0)   /* Read pages through a memory mapping of the file */
+#define CHIDB_OPEN_WAL (1 << 1)    /* Use a write-ahead log (FILE-wal) */
+#define CHIDB_OPEN_THREADSAFE (1 << 2) /* Allow statements to run on several threads at once */
+
+/* Opens a chidb file, with additional options.
+ *
+ * Same as chidb_open, but also allows the caller to specify
+ * how the database file is accessed.
+ *
+ * With CHIDB_OPEN_THREADSAFE, statements prepared on the same database
+ * can be stepped on different threads at the same time (a statement
+ * itself must only be used by one thread at a time). Any number of
+ * statements that only read can run at once, but a statement that
+ * modifies the database (or a transaction started with BEGIN, until it
+ * ends) waits for them to finish, and runs alone. A thread that has a
+ * read statement in progress and tries to step a statement that writes
+ * while another thread is also doing so gets CHIDB_EBUSY, instead of
+ * waiting forever.
+ *
+ * Parameters
+ * - file: Filename of the chidb file to open/create
+ * - db: Out parameter. Returns a pointer to a chidb struct.
+ * - flags: Bitwise OR of CHIDB_OPEN_* flags.
+ * - cache_size: Maximum number of pages to keep in memory. The
+ *               cache may temporarily hold more pages if more
+ *               than this many are in use at once.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECANTOPEN: Unable to open the database file
+ * - CHIDB_ECORRUPT: The database file is not well formed
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_open_v2(const char *file, chidb **db, int flags, uint32_t cache_size);
+
 /* Prepares a SQL statement for execution
  *
  * Parameters
@@ -87,17 +128,164 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt);
  * to access all the rows returned by the query. Once there are no
  * more rows left, or if the statement is not meant to produce any
  * results, then CHIDB_DONE is returned (note that this function does
- * not return CHIDB_OK).
+ * not return CHIDB_OK). Once the statement has finished (or failed),
+ * chidb_step keeps returning CHIDB_DONE until the statement is reset
+ * with chidb_reset.
  *
  * Parameters
  * - stmt: Prepared SQL statement
  *
+ * If the database was opened with CHIDB_OPEN_WAL, the statement reads
+ * from a snapshot of the database taken when it starts running, and
+ * any changes it makes are committed once it finishes.
+ *
  * Return
  * - CHIDB_ROW: Statement returned a row.
  * - CHIDB_DONE: Statement has finished executing.
+ * - CHIDB_EBUSY: The statement modifies the database, and another
+ *                connection is writing to it.
  */
 int chidb_step(chidb_stmt *stmt);
 
+/* Resets a SQL statement, so it can be run again
+ *
+ * A prepared statement can be run any number of times, without having to
+ * parse and compile the SQL statement again: after chidb_step returns
+ * CHIDB_DONE (or before, if the remaining rows are not needed), reset the
+ * statement, optionally bind new parameter values, and call chidb_step.
+ * Parameter values are kept across resets (see chidb_clear_bindings).
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_reset(chidb_stmt *stmt);
+
+/* Returns the number of parameters in a SQL statement
+ *
+ * A SQL statement can include parameters in place of literal values:
+ * anonymous parameters (?) and named parameters (:name). Parameters
+ * are numbered from 1, in the order they first appear in the statement;
+ * a named parameter that appears more than once is a single parameter.
+ * A parameter that has not been bound has the value NULL.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - Number of parameters (i.e., the largest parameter number)
+ */
+int chidb_bind_parameter_count(chidb_stmt *stmt);
+
+/* Returns the number of a named parameter
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - name: Parameter name, including the leading ':'
+ *
+ * Return
+ * - Parameter number, or 0 if the statement has no such parameter
+ */
+int chidb_bind_parameter_index(chidb_stmt *stmt, const char *name);
+
+/* Binds an integer to a parameter
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - i: Parameter (parameters are numbered from 1)
+ * - value: Integer value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ERANGE: The statement has no parameter i
+ * - CHIDB_EMISMATCH: The parameter is stored in or compared to a column
+ *                    that is not of integer type
+ * - CHIDB_EMISUSE: The statement is running (it must be reset first)
+ */
+int chidb_bind_int(chidb_stmt *stmt, int i, int value);
+
+/* Binds a string to a parameter
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - i: Parameter (parameters are numbered from 1)
+ * - value: Null-terminated string. The string is copied, so the API
+ *          client can free or modify it once this function returns.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ERANGE: The statement has no parameter i
+ * - CHIDB_EMISMATCH: The parameter is stored in or compared to a column
+ *                    that is not of string type
+ * - CHIDB_EMISUSE: The statement is running (it must be reset first)
+ */
+int chidb_bind_text(chidb_stmt *stmt, int i, const char *value);
+
+/* Sets all the parameters of a SQL statement back to NULL
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The statement is running (it must be reset first)
+ */
+int chidb_clear_bindings(chidb_stmt *stmt);
+
+/* Splits a table into ranges of its primary key
+ *
+ * Chooses up to nparts - 1 keys that split a table into ranges with
+ * roughly the same number of rows, following the structure of the
+ * table's B-Tree. Range i (numbered from 0) contains the rows with
+ * bounds[i - 1] < key <= bounds[i]; the first range has no lower bound,
+ * and the last one has no upper bound. A small table may be split into
+ * fewer ranges than requested (or not split at all).
+ *
+ * Together with chidb_scan_range, this allows a query to be run over
+ * a large table by several threads (see CHIDB_OPEN_THREADSAFE), each
+ * one scanning a range with its own statement, and then merging their
+ * results.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Table name
+ * - nparts: Number of ranges to split the table into
+ * - bounds: Array with room for nparts - 1 keys, where the keys that
+ *           split the table are stored in increasing order
+ * - nbounds: Out parameter. Returns the number of keys stored in bounds
+ *            (one less than the number of ranges)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no table with that name
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_partition(chidb *db, const char *table, uint32_t nparts, uint32_t *bounds, uint32_t *nbounds);
+
+/* Restricts the table scan of a SQL statement to a range of keys
+ *
+ * A SELECT statement that scans a table then only visits the rows with
+ * min <= key <= max (the rows outside of the range are skipped without
+ * being read). The range is kept across resets, and can be removed
+ * by setting it to (0, UINT32_MAX).
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - min: Smallest key in the range
+ * - max: Largest key in the range
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The statement is running (it must be reset first),
+ *                  or it is not a SELECT statement that scans a table
+ *                  (e.g., it finds its rows with an index)
+ */
+int chidb_scan_range(chidb_stmt *stmt, uint32_t min, uint32_t max);
+
 /* Finalizes a SQL statement, freeing all resources associated with it.
  *
  * Parameters
@@ -18,6 +18,9 @@
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_BEGIN (4)
+#define STMT_COMMIT (5)
+#define STMT_ROLLBACK (6)
 
 typedef struct chisql_statement
 {
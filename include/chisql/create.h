@@ -25,7 +25,9 @@ typedef struct TableReference_s {
 } TableReference_t;
 
 typedef struct Index_s {
-   char *name, *table_name, *column_name;
+   char *name, *table_name, *column_name; /* column_name is the first column */
+   StrList_t *columns;                    /* Indexed columns, in order */
+   StrList_t *include;                    /* INCLUDE columns (NULL if none) */
    int unique;
 } Index_t;
 
@@ -51,8 +53,9 @@ KeyDec_t *  PrimaryKeyDec(StrList_t *col_names);
 TableReference_t *TableReference_make(char *table_name, char *alias);
 void        TableReference_free(TableReference_t *tref);
 
-Index_t *   Index_make(char *name, char *table_name, char *column_name);
+Index_t *   Index_make(char *name, char *table_name, StrList_t *columns);
 Index_t *   Index_makeUnique(Index_t *idx);
+Index_t *   Index_addInclude(Index_t *idx, StrList_t *include);
 void        Index_print(Index_t *idx);
 void        Index_free(Index_t *idx);
 
@@ -55,6 +55,7 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
 int chidb_stmt_optimize(chidb *db,
 												chisql_statement_t *sql_stmt,
 												chisql_statement_t **sql_stmt_opt);
+int chidb_stmt_peephole(chidb_stmt *stmt);
 
 /* your code */
 
@@ -81,7 +82,7 @@ void schema_free(ChidbSchema *schema)
 	free(schema->sql); // REMOVE IF CAUSES BAD BEHAVIOR
 }
 
-int load_schema(chidb *db)
+static void schema_clear(chidb *db)
 {
 	if (db->nSchema > 0 && db->schema_list != NULL)
 	{
@@ -91,6 +92,52 @@ int load_schema(chidb *db)
 			schema_free(db->schema_list + i);
 		}
 	}
+	free(db->schema_list);
+	free(db->schema_hash);
+	db->schema_list = NULL;
+	db->schema_hash = NULL;
+	db->nSchema = 0;
+	db->nSchemaBuckets = 0;
+	db->schema_loaded = false;
+}
+
+/* Builds the hash table used by schema_exists to look up schemas by name */
+static int schema_index(chidb *db)
+{
+	int nBuckets = 16;
+	while (nBuckets < 2 * db->nSchema)
+		nBuckets *= 2;
+	db->schema_hash = malloc(nBuckets * sizeof(int));
+	if (db->schema_hash == NULL)
+		return CHIDB_ENOMEM;
+	db->nSchemaBuckets = nBuckets;
+	for (int i = 0; i < nBuckets; i++)
+		db->schema_hash[i] = -1;
+	for (int i = 0; i < db->nSchema; i++)
+	{
+		uint32_t b = schema_hash(db->schema_list[i].name) & (nBuckets - 1);
+		db->schema_list[i].hash_next = db->schema_hash[b];
+		db->schema_hash[b] = i;
+	}
+	return CHIDB_OK;
+}
+
+/* Forces the schema to be reloaded by the next call to load_schema */
+void schema_invalidate(chidb *db)
+{
+	db->schema_loaded = false;
+}
+
+int load_schema(chidb *db)
+{
+	uint32_t cookie;
+	int rc = chidb_Btree_getSchemaCookie(db->bt, &cookie);
+	if (rc != CHIDB_OK)
+		return rc;
+	if (db->schema_loaded && cookie == db->schema_cookie)
+		return CHIDB_OK;
+
+	schema_clear(db);
 	// load database schema into the chidb struct.
 	db->schema_list = malloc(sizeof(ChidbSchema));
 	db->nSchema = 0;
@@ -107,6 +154,14 @@ int load_schema(chidb *db)
 			uint32_t type;
 			uint32_t offset;
 			uint8_t *data = cell.fields.tableLeaf.data;
+			uint8_t *record = NULL;
+			if (cell.fields.tableLeaf.overflow_page != 0)
+			{
+				// long statements continue in overflow pages
+				record = malloc(cell.fields.tableLeaf.data_size);
+				chidb_Btree_readPayload(db->bt, &cell, 0, cell.fields.tableLeaf.data_size, record);
+				data = record;
+			}
 			// get column 4, which holds the sql statement
 			getRecordCol(data, 4, &type, &offset);
 			uint32_t len = (type - 13) / 2;
@@ -122,6 +177,7 @@ int load_schema(chidb *db)
 			// get column 3, which holds the root page number of the table/index
 			getRecordCol(data, 3, &type, &offset);
 			curr_schema.root_npage = get4byte(data + offset);
+			free(record);
 			curr_schema.type = create->t;
 			if (curr_schema.type == CREATE_INDEX)
 			{
@@ -140,12 +196,11 @@ int load_schema(chidb *db)
 				// debugging logging
 				chilog(DEBUG, "key %d SCHEMA %d, TABLE %s: root %d, assoc %s, sql %s",
 							 cell.key, nSchema, curr_schema.name, curr_schema.root_npage, curr_schema.assoc_table_name, curr_schema.sql);
-				Column_t *currcol = curr_schema.table->columns;
-				while (currcol != NULL)
-				{
-					currcol = currcol->next;
-				}
 			}
+			// the table/index is kept; the rest of the parsed statement is not needed
+			free(create);
+			free(stmt->text);
+			free(stmt);
 			realloc_schema(db, nSchema + 1);
 			db->schema_list[nSchema] = curr_schema;
 			db->nSchema += 1;
@@ -157,27 +212,255 @@ int load_schema(chidb *db)
 		chilog(CRITICAL, "Empty Btree!");
 	}
 	chidb_Cursor_freeCursor(cursor);
+
+	rc = schema_index(db);
+	if (rc != CHIDB_OK)
+		return rc;
+	db->schema_cookie = cookie;
+	db->schema_loaded = true;
 	return CHIDB_OK;
 }
 
+/* The database lock
+ *
+ * In thread-safe mode (see CHIDB_OPEN_THREADSAFE), a statement holds the
+ * database lock from its first step until it is done, reset, or
+ * finalized. Any number of statements can hold the lock to read, but a
+ * statement that writes holds it alone. The thread that holds the writer
+ * lock keeps it until its transaction (if it started one with BEGIN)
+ * ends, and the statements it runs in the meantime do not wait for it.
+ *
+ * New readers wait while a writer is waiting, so that writers are not
+ * starved, unless their thread already holds read locks (the writer
+ * could be waiting for them). For the same reason, a writer whose thread
+ * holds read locks only waits for the other readers, and only one
+ * thread can do that at a time.
+ *
+ * Every statement that holds the lock is part of the pager's read
+ * transaction (which only takes a snapshot when the first one begins
+ * it), and the changes made by the writer are committed when it
+ * releases the lock.
+ */
+
+/* Number of read locks held by the calling thread */
+static uint32_t db_reads_held(chidb *db)
+{
+	return (uint32_t) (uintptr_t) pthread_getspecific(db->reads_key);
+}
+
+static void db_set_reads_held(chidb *db, uint32_t n)
+{
+	pthread_setspecific(db->reads_key, (void *) (uintptr_t) n);
+}
+
+static int db_lock_init(chidb *db)
+{
+	if (pthread_mutex_init(&db->lock_mutex, NULL) != 0 ||
+			pthread_cond_init(&db->lock_cond, NULL) != 0 ||
+			pthread_key_create(&db->reads_key, NULL) != 0 ||
+			pthread_mutex_init(&db->schema_mutex, NULL) != 0)
+		return CHIDB_ENOMEM;
+	db->n_readers = 0;
+	db->writer = false;
+	db->writer_depth = 0;
+	db->n_waiting = 0;
+	db->upgrading = false;
+	db->threadsafe = true;
+
+	return chidb_Pager_enableThreads(db->bt->pager);
+}
+
+static void db_lock_destroy(chidb *db)
+{
+	pthread_mutex_destroy(&db->lock_mutex);
+	pthread_cond_destroy(&db->lock_cond);
+	pthread_key_delete(db->reads_key);
+	pthread_mutex_destroy(&db->schema_mutex);
+}
+
+/* Gives up a lock taken by db_lock. Called with lock_mutex held.
+ * Returns true if the writer lock was released. */
+static bool db_release(chidb *db, chidb_lock_t lock)
+{
+	bool released = false;
+
+	if (lock == CHIDB_LOCK_READ)
+	{
+		db->n_readers--;
+		db_set_reads_held(db, db_reads_held(db) - 1);
+	}
+	else if (--db->writer_depth == 0 && !db->bt->pager->in_txn)
+	{
+		db->writer = false;
+		released = true;
+	}
+	pthread_cond_broadcast(&db->lock_cond);
+	return released;
+}
+
+/* Takes the database lock, to write if "write" is true, or to read
+ * otherwise, and begins the pager's read (and write) transaction.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (the lock is returned in "lock")
+ * - CHIDB_EBUSY: Waiting for the lock could deadlock
+ * - Any error returned by chidb_Pager_beginRead or chidb_Pager_beginWrite
+ */
+static int db_lock(chidb *db, bool write, chidb_lock_t *lock)
+{
+	Pager *pager = db->bt->pager;
+	uint32_t reads = db_reads_held(db);
+	int rc;
+
+	pthread_mutex_lock(&db->lock_mutex);
+	if (db->writer && pthread_equal(db->writer_thread, pthread_self()))
+	{
+		*lock = CHIDB_LOCK_NESTED;
+		db->writer_depth++;
+	}
+	else if (write)
+	{
+		if (reads > 0 && db->upgrading)
+		{
+			pthread_mutex_unlock(&db->lock_mutex);
+			return CHIDB_EBUSY;
+		}
+		db->upgrading = reads > 0;
+		db->n_waiting++;
+		while (db->writer || db->n_readers > reads)
+			pthread_cond_wait(&db->lock_cond, &db->lock_mutex);
+		db->n_waiting--;
+		if (reads > 0)
+			db->upgrading = false;
+		*lock = CHIDB_LOCK_WRITE;
+		db->writer = true;
+		db->writer_thread = pthread_self();
+		db->writer_depth = 1;
+	}
+	else
+	{
+		while (db->writer || (db->n_waiting > 0 && reads == 0))
+			pthread_cond_wait(&db->lock_cond, &db->lock_mutex);
+		*lock = CHIDB_LOCK_READ;
+		db->n_readers++;
+		db_set_reads_held(db, reads + 1);
+	}
+
+	rc = chidb_Pager_beginRead(pager);
+	if (rc == CHIDB_OK && *lock == CHIDB_LOCK_WRITE)
+	{
+		rc = chidb_Pager_beginWrite(pager);
+		if (rc != CHIDB_OK)
+			chidb_Pager_endRead(pager);
+	}
+	if (rc != CHIDB_OK)
+	{
+		db_release(db, *lock);
+		*lock = CHIDB_LOCK_NONE;
+	}
+	pthread_mutex_unlock(&db->lock_mutex);
+
+	return rc;
+}
+
+/* Releases a lock taken by db_lock, ending the pager's read transaction
+ * and, if the writer lock is released, committing the changes made
+ * while it was held */
+static int db_unlock(chidb *db, chidb_lock_t lock)
+{
+	Pager *pager = db->bt->pager;
+	int rc = CHIDB_OK;
+
+	if (lock == CHIDB_LOCK_NONE)
+		return CHIDB_OK;
+
+	pthread_mutex_lock(&db->lock_mutex);
+	if (db_release(db, lock))
+		rc = chidb_Pager_commit(pager);
+	chidb_Pager_endRead(pager);
+	pthread_mutex_unlock(&db->lock_mutex);
+
+	return rc;
+}
+
 int chidb_open(const char *file, chidb **db)
 {
+	return chidb_open_v2(file, db, CHIDB_OPEN_DEFAULT, DEFAULT_CACHE_SIZE);
+}
+
+int chidb_open_v2(const char *file, chidb **db, int flags, uint32_t cache_size)
+{
+	int rc;
+
 	chilog_setloglevel(DEBUG);
 	*db = malloc(sizeof(chidb));
 	if (*db == NULL)
 		return CHIDB_ENOMEM;
-	chidb_Btree_open(file, *db, &(*db)->bt);
+	(*db)->bt = NULL;
+	(*db)->threadsafe = false;
+	(*db)->nSchema = 0;
+	(*db)->schema_list = NULL;
+	(*db)->schema_hash = NULL;
+	(*db)->nSchemaBuckets = 0;
+	(*db)->schema_loaded = false;
+
+	/* The B-Tree may have been opened even if its file header is wrong */
+	rc = chidb_Btree_open(file, *db, &(*db)->bt);
+	if (rc != CHIDB_OK)
+		goto fail;
+	chidb_Pager_setCacheSize((*db)->bt->pager, cache_size);
+	if (flags & CHIDB_OPEN_MMAP)
+	{
+		rc = chidb_Pager_enableMmap((*db)->bt->pager);
+		if (rc != CHIDB_OK)
+			goto fail;
+	}
+	if (flags & CHIDB_OPEN_WAL)
+	{
+		char *wal_file = malloc(strlen(file) + 5);
+		if (wal_file == NULL)
+		{
+			rc = CHIDB_ENOMEM;
+			goto fail;
+		}
+		sprintf(wal_file, "%s-wal", file);
+		rc = chidb_Pager_enableWal((*db)->bt->pager, wal_file);
+		free(wal_file);
+		if (rc != CHIDB_OK)
+			goto fail;
+	}
+	if (flags & CHIDB_OPEN_THREADSAFE)
+	{
+		rc = db_lock_init(*db);
+		if (rc != CHIDB_OK)
+			goto fail;
+	}
 
 	/* Additional initialization code goes here */
 	// load database schema into the chidb struct.
-	(*db)->nSchema = 0;
-	(*db)->schema_list = NULL;
-	return load_schema(*db);
+	rc = load_schema(*db);
+	if (rc != CHIDB_OK)
+		goto fail;
+	return CHIDB_OK;
+
+fail:
+	/* Everything opened so far is closed, and *db is freed */
+	schema_clear(*db);
+	if ((*db)->threadsafe)
+		db_lock_destroy(*db);
+	if ((*db)->bt != NULL)
+		chidb_Btree_close((*db)->bt);
+	free(*db);
+	*db = NULL;
+	return rc;
 }
 
 int chidb_close(chidb *db)
 {
 	chidb_Btree_close(db->bt);
+	schema_clear(db);
+	if (db->threadsafe)
+		db_lock_destroy(db);
 	free(db);
 
 	/* Additional cleanup code goes here */
@@ -188,7 +471,7 @@ int chidb_close(chidb *db)
 int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
 	int rc;
-	chisql_statement_t *sql_stmt, *sql_stmt_opt;
+	chisql_statement_t *sql_stmt = NULL, *sql_stmt_opt = NULL;
 
 	*stmt = malloc(sizeof(chidb_stmt));
 
@@ -203,30 +486,133 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 	rc = chisql_parser(sql, &sql_stmt);
 
 	if (rc != CHIDB_OK)
-	{
-		free(*stmt);
-		return rc;
-	}
+		goto fail;
 
 	rc = chidb_stmt_optimize((*stmt)->db, sql_stmt, &sql_stmt_opt);
 
 	if (rc != CHIDB_OK)
+		goto fail;
+
+	/* Code generation reads the schema, so it needs a consistent snapshot */
+	if (db->threadsafe)
 	{
-		free(*stmt);
-		return rc;
+		chidb_lock_t lock;
+		rc = db_lock(db, false, &lock);
+		if (rc != CHIDB_OK)
+			goto fail;
+		pthread_mutex_lock(&db->schema_mutex);
+		rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
+		pthread_mutex_unlock(&db->schema_mutex);
+		db_unlock(db, lock);
+	}
+	else
+	{
+		chidb_Pager_beginRead(db->bt->pager);
+		rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
+		chidb_Pager_endRead(db->bt->pager);
 	}
 
-	rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
+	if (rc == CHIDB_OK)
+		rc = chidb_stmt_peephole(*stmt);
 
 	free(sql_stmt_opt);
 
 	(*stmt)->explain = sql_stmt->explain;
 
 	return rc;
+
+fail:
+	/* The statement never got a program, so it is released here along
+	 * with whatever was parsed */
+	free(sql_stmt_opt);
+	if (sql_stmt != NULL)
+	{
+		free(sql_stmt->text);
+		free(sql_stmt);
+	}
+	chidb_stmt_free(*stmt);
+	free(*stmt);
+	return rc;
+}
+
+/* Returns true if the statement's program can modify the database */
+static bool stmt_writes(chidb_stmt *stmt)
+{
+	for (int i = 0; i < stmt->endOp; i++)
+	{
+		switch (stmt->ops[i].opcode)
+		{
+		case Op_OpenWrite:
+		case Op_CreateTable:
+		case Op_CreateIndex:
+			return true;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+/* Returns true if, in thread-safe mode, the statement has to run alone:
+ * it can modify the database, or it begins a transaction (which keeps
+ * the database to itself until it ends) */
+static bool stmt_exclusive(chidb_stmt *stmt)
+{
+	for (int i = 0; i < stmt->endOp; i++)
+	{
+		if (stmt->ops[i].opcode == Op_Begin)
+			return true;
+	}
+	return stmt_writes(stmt);
+}
+
+/* Starts the (autocommit) transaction a statement runs in. The statement
+ * reads from a snapshot of the database, and statements that write take
+ * the writer lock up front, so they fail before they have done any work
+ * if another connection is writing */
+static int stmt_begin(chidb_stmt *stmt)
+{
+	if (stmt->db->threadsafe)
+		return db_lock(stmt->db, stmt_exclusive(stmt), &stmt->lock);
+
+	Pager *pager = stmt->db->bt->pager;
+	int rc = chidb_Pager_beginRead(pager);
+
+	if (rc == CHIDB_OK && stmt_writes(stmt))
+	{
+		rc = chidb_Pager_beginWrite(pager);
+		if (rc != CHIDB_OK)
+			chidb_Pager_endRead(pager);
+	}
+	return rc;
+}
+
+/* Ends the transaction started by stmt_begin, committing any changes
+ * (unless the statement is part of an explicit transaction, which is
+ * committed by a COMMIT statement) */
+static int stmt_end(chidb_stmt *stmt)
+{
+	if (stmt->db->threadsafe)
+	{
+		chidb_lock_t lock = stmt->lock;
+		stmt->lock = CHIDB_LOCK_NONE;
+		return db_unlock(stmt->db, lock);
+	}
+
+	Pager *pager = stmt->db->bt->pager;
+	int rc = CHIDB_OK;
+
+	if (!pager->in_txn)
+		rc = chidb_Pager_commit(pager);
+
+	chidb_Pager_endRead(pager);
+	return rc;
 }
 
 int chidb_step(chidb_stmt *stmt)
 {
+	int rc;
+
 	if (stmt->explain)
 	{
 		if (stmt->pc == stmt->endOp)
@@ -237,12 +623,172 @@ int chidb_step(chidb_stmt *stmt)
 			return CHIDB_ROW;
 		}
 	}
+
+	/* The statement has finished, and has to be reset to run again */
+	if (stmt->pc >= stmt->endOp)
+		return CHIDB_DONE;
+
+	if (stmt->pc == 0 && (rc = stmt_begin(stmt)) != CHIDB_OK)
+		return rc;
+
+	rc = chidb_stmt_exec(stmt);
+	if (rc != CHIDB_ROW)
+	{
+		int rc_end = stmt_end(stmt);
+		if (rc == CHIDB_DONE && rc_end != CHIDB_OK)
+			rc = rc_end;
+		stmt->pc = stmt->nOps;
+	}
+	return rc;
+}
+
+/* Returns true if the statement has started running, but has not finished */
+static bool stmt_running(chidb_stmt *stmt)
+{
+	return !stmt->explain && stmt->pc > 0 && stmt->pc < stmt->endOp;
+}
+
+int chidb_reset(chidb_stmt *stmt)
+{
+	/* A statement that returned rows may be reset before it is done */
+	if (stmt_running(stmt))
+		stmt_end(stmt);
+
+	return chidb_stmt_reset(stmt);
+}
+
+int chidb_bind_parameter_count(chidb_stmt *stmt)
+{
+	return stmt->nParams;
+}
+
+int chidb_bind_parameter_index(chidb_stmt *stmt, const char *name)
+{
+	for (int i = 0; i < stmt->nParams; i++)
+	{
+		if (stmt->params[i].name != NULL && strcmp(stmt->params[i].name, name) == 0)
+			return i + 1;
+	}
+	return 0;
+}
+
+/* Returns the parameter a value of the given type can be bound to */
+static int stmt_param(chidb_stmt *stmt, int i, enum data_type type, chidb_dbm_param_t **param)
+{
+	if (stmt_running(stmt))
+		return CHIDB_EMISUSE;
+	if (i < 1 || i > stmt->nParams)
+		return CHIDB_ERANGE;
+	if (stmt->params[i - 1].type != type)
+		return CHIDB_EMISMATCH;
+
+	*param = &stmt->params[i - 1];
+	if ((*param)->value.type == REG_STRING)
+		free((*param)->value.value.s);
+	(*param)->value.type = REG_UNSPECIFIED;
+	return CHIDB_OK;
+}
+
+int chidb_bind_int(chidb_stmt *stmt, int i, int value)
+{
+	chidb_dbm_param_t *param;
+	int rc = stmt_param(stmt, i, TYPE_INT, &param);
+	if (rc != CHIDB_OK)
+		return rc;
+
+	param->value.type = REG_INT32;
+	param->value.value.i = value;
+	return CHIDB_OK;
+}
+
+int chidb_bind_text(chidb_stmt *stmt, int i, const char *value)
+{
+	chidb_dbm_param_t *param;
+	int rc = stmt_param(stmt, i, TYPE_TEXT, &param);
+	if (rc != CHIDB_OK)
+		return rc;
+
+	param->value.value.s = strdup(value);
+	if (param->value.value.s == NULL)
+		return CHIDB_ENOMEM;
+	param->value.type = REG_STRING;
+	param->value.len = strlen(value);
+	return CHIDB_OK;
+}
+
+int chidb_clear_bindings(chidb_stmt *stmt)
+{
+	if (stmt_running(stmt))
+		return CHIDB_EMISUSE;
+
+	for (int i = 0; i < stmt->nParams; i++)
+	{
+		if (stmt->params[i].value.type == REG_STRING)
+			free(stmt->params[i].value.value.s);
+		stmt->params[i].value.type = REG_UNSPECIFIED;
+	}
+	return CHIDB_OK;
+}
+
+int chidb_partition(chidb *db, const char *table, uint32_t nparts, uint32_t *bounds, uint32_t *nbounds)
+{
+	chidb_lock_t lock;
+	int rc;
+
+	*nbounds = 0;
+	if (db->threadsafe)
+	{
+		if ((rc = db_lock(db, false, &lock)) != CHIDB_OK)
+			return rc;
+		pthread_mutex_lock(&db->schema_mutex);
+	}
 	else
-		return chidb_stmt_exec(stmt);
+		chidb_Pager_beginRead(db->bt->pager);
+
+	rc = load_schema(db);
+	int i = rc == CHIDB_OK ? schema_exists(db, (char *) table) : 0;
+	if (rc == CHIDB_OK && (i == 0 || db->schema_list[i - 1].type != CREATE_TABLE))
+		rc = CHIDB_EMISUSE;
+	if (rc == CHIDB_OK)
+		rc = chidb_Btree_partition(db->bt, db->schema_list[i - 1].root_npage, nparts, bounds, nbounds);
+
+	if (db->threadsafe)
+	{
+		pthread_mutex_unlock(&db->schema_mutex);
+		db_unlock(db, lock);
+	}
+	else
+		chidb_Pager_endRead(db->bt->pager);
+
+	return rc;
+}
+
+int chidb_scan_range(chidb_stmt *stmt, uint32_t min, uint32_t max)
+{
+	bool scans = false;
+
+	if (stmt_running(stmt) || stmt->explain || stmt_writes(stmt))
+		return CHIDB_EMISUSE;
+	for (int i = 0; i < stmt->endOp; i++)
+		scans = scans || stmt->ops[i].opcode == Op_Rewind;
+	if (!scans)
+		return CHIDB_EMISUSE;
+
+	stmt->ranged = min != 0 || max != UINT32_MAX;
+	stmt->range_min = min;
+	stmt->range_max = max;
+	return CHIDB_OK;
 }
 
 int chidb_finalize(chidb_stmt *stmt)
 {
+	/* A statement that returned rows may be finalized before it is done */
+	if (stmt_running(stmt))
+	{
+		stmt_end(stmt);
+		chidb_stmt_reset(stmt);
+	}
+
 	return chidb_stmt_free(stmt);
 }
 
@@ -333,7 +879,7 @@ const char *chidb_column_name(chidb_stmt *stmt, int col)
 	}
 	else
 	{
-		if (col < 0 || col >= stmt->nCols)
+		if (col < 0 || col >= stmt->nCols || stmt->cols == NULL)
 			return NULL;
 		else
 			return stmt->cols[col];
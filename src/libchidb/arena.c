@@ -0,0 +1,183 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements an arena (or "bump") allocator.
+ *
+ * An arena hands out memory from large blocks, by advancing a pointer
+ * into the current block, and frees everything it handed out at once,
+ * when it is reset. Resetting an arena keeps its blocks, so an arena
+ * that is reset over and over (e.g., once per row returned by a
+ * statement) stops calling malloc once its blocks are large enough for
+ * the values made between two resets.
+ *
+ * The DBM keeps two arenas in each statement (see chidb_stmt in
+ * dbm-types.h): one for values that only live until the cursor moves
+ * to the next row, and one for values that live until the statement is
+ * reset. Nothing allocated from an arena is ever freed on its own.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Allocations are aligned to this many bytes */
+#define ARENA_ALIGN (8)
+
+/* Initialize an arena
+ *
+ * Blocks are only allocated when the arena is first used.
+ *
+ * Parameters
+ * - arena: Arena
+ * - block_size: Size of each block (allocations larger than this
+ *               get a block of their own)
+ */
+void chidb_Arena_init(Arena *arena, size_t block_size)
+{
+    arena->first = NULL;
+    arena->curr = NULL;
+    arena->block_size = block_size;
+}
+
+/* Allocate memory from an arena
+ *
+ * The memory is valid until the arena is reset or freed.
+ *
+ * Parameters
+ * - arena: Arena
+ * - size: Number of bytes
+ *
+ * Return
+ * - Pointer to the memory, or NULL if a new block could not be allocated
+ */
+void *chidb_Arena_alloc(Arena *arena, size_t size)
+{
+    ArenaBlock *block = arena->curr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (block != NULL && block->size - block->used >= size)
+    {
+        block->used += size;
+        return block->data + block->used - size;
+    }
+
+    /* Move on to the next (empty) block, if it is large enough */
+    if (block != NULL && block->next != NULL && block->next->size >= size)
+    {
+        block = block->next;
+    }
+    else if (block == NULL && arena->first != NULL && arena->first->size >= size)
+    {
+        block = arena->first;
+    }
+    else
+    {
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        ArenaBlock *new_block = malloc(sizeof(ArenaBlock) + block_size);
+        if (new_block == NULL)
+            return NULL;
+        new_block->size = block_size;
+        new_block->used = 0;
+        if (block == NULL)
+        {
+            new_block->next = arena->first;
+            arena->first = new_block;
+        }
+        else
+        {
+            new_block->next = block->next;
+            block->next = new_block;
+        }
+        block = new_block;
+    }
+    arena->curr = block;
+    block->used = size;
+    return block->data;
+}
+
+/* Copy a string into an arena
+ *
+ * Parameters
+ * - arena: Arena
+ * - s: String
+ * - n: Number of bytes of s to copy (a null character is added)
+ *
+ * Return
+ * - The copy, or NULL if the memory could not be allocated
+ */
+char *chidb_Arena_strndup(Arena *arena, const char *s, size_t n)
+{
+    char *copy = chidb_Arena_alloc(arena, n + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+/* Free everything allocated from an arena, keeping its blocks
+ *
+ * Parameters
+ * - arena: Arena
+ */
+void chidb_Arena_reset(Arena *arena)
+{
+    for (ArenaBlock *block = arena->first; block != NULL; block = block->next)
+    {
+        block->used = 0;
+        if (block == arena->curr)
+            break;
+    }
+    arena->curr = NULL;
+}
+
+/* Free an arena's blocks
+ *
+ * Parameters
+ * - arena: Arena
+ */
+void chidb_Arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->first;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->curr = NULL;
+}
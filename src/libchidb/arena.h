@@ -0,0 +1,75 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Arena allocator header. See arena.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Default size of the blocks of an arena */
+#define ARENA_BLOCK_SIZE (4096)
+
+/* A block of memory that allocations are carved from */
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t size;    /* Bytes in data */
+    size_t used;    /* Bytes of data already allocated */
+    uint8_t data[];
+} ArenaBlock;
+
+/* The Arena struct represents a region of memory where many small
+ * allocations are made, and then all freed at once (see arena.c).
+ * Blocks are kept in a list; the ones after curr are empty, and are
+ * reused before any new block is allocated. */
+typedef struct Arena
+{
+    ArenaBlock *first;
+    ArenaBlock *curr;    /* Block allocations are made from */
+    size_t block_size;
+} Arena;
+
+void chidb_Arena_init(Arena *arena, size_t block_size);
+void *chidb_Arena_alloc(Arena *arena, size_t size);
+char *chidb_Arena_strndup(Arena *arena, const char *s, size_t n);
+void chidb_Arena_reset(Arena *arena);
+void chidb_Arena_free(Arena *arena);
+
+#endif /*ARENA_H_*/
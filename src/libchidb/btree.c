@@ -46,6 +46,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
 #include <chidb/log.h>
 #include "chidbInt.h"
 #include "btree.h"
@@ -62,6 +63,30 @@ void reverse_endian(uint8_t *to, uint8_t *from, int n)
     }
 }
 
+// node types
+static inline bool is_leaf(uint8_t type)
+{
+    return type == PGTYPE_TABLE_LEAF || type == PGTYPE_INDEX_LEAF || type == PGTYPE_TEXTINDEX_LEAF;
+}
+
+static inline bool is_internal(uint8_t type)
+{
+    return type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL || type == PGTYPE_TEXTINDEX_INTERNAL;
+}
+
+static inline bool is_text(uint8_t type)
+{
+    return type == PGTYPE_TEXTINDEX_LEAF || type == PGTYPE_TEXTINDEX_INTERNAL;
+}
+
+// type of the internal nodes of a B-Tree with leaves of the given type
+static inline uint8_t internal_type(uint8_t leaf_type)
+{
+    if (leaf_type == PGTYPE_TABLE_LEAF)
+        return PGTYPE_TABLE_INTERNAL;
+    return leaf_type == PGTYPE_TEXTINDEX_LEAF ? PGTYPE_TEXTINDEX_INTERNAL : PGTYPE_INDEX_INTERNAL;
+}
+
 static const uint8_t DEFAULT_FILE_HEADER[100] = {
     'S', 'Q', 'L', 'i', 't', 'e', ' ', 'f', 'o', 'r', 'm', 'a', 't', ' ', '3', '\0',
     0x04, 0x00, 0x01, 0x01, 0x00, 0x40, 0x20, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -99,24 +124,14 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
     // first determine whether the file does not exist/is empty,
     // so that we may initialize the database with a file header and
     // an initial page.
-    FILE *fp = fopen(filename, "r+");
-    if (fp == NULL)
+    struct stat st;
+    if (stat(filename, &st) != 0 || st.st_size == 0)
     {
         exists = 0;
     }
     else
     {
-        fseek(fp, 0, SEEK_END);
-        int file_size = ftell(fp);
-        if (file_size == 0)
-        {
-            exists = 0;
-        }
-        else
-        {
-            exists = 1;
-        }
-        fclose(fp);
+        exists = 1;
     }
     /* Your code goes here */
     Pager *pager;
@@ -132,6 +147,9 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
     BTree *btree = (BTree *)malloc(sizeof(BTree));
     btree->db = db;
     btree->pager = pager;
+    memset(btree->append, 0, sizeof(btree->append));
+    btree->shape = 0;
+    btree->writes = 0;
     db->bt = btree;
     *bt = btree;
 
@@ -149,8 +167,7 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
         }
         memcpy(page->data, DEFAULT_FILE_HEADER, 100);
         int try_write_header = chidb_Pager_writePage(pager, page);
-        free(page->data);
-        free(page);
+        chidb_Pager_releaseMemPage(pager, page);
         if (try_write_header == CHIDB_EPAGENO || try_write_header == CHIDB_EIO)
         {
             return try_write_header;
@@ -208,19 +225,16 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
     ptr += 4;
     ptr += 4;
 
-    uint64_t bytes_32_thru_39;
-    reverse_endian((uint8_t *)&bytes_32_thru_39, ptr, 8);
-    if (bytes_32_thru_39 != 0)
+    /* Freelist trunk page and number of free pages */
+    npage_t freelist_trunk = get4byte(ptr);
+    uint32_t freelist_count = get4byte(ptr + 4);
+    if ((freelist_trunk == 0) != (freelist_count == 0))
     {
         return CHIDB_ECORRUPTHEADER;
     }
     ptr += 8;
 
-    uint32_t schema_version = get4byte(ptr);
-    if (schema_version != 0)
-    {
-        return CHIDB_ECORRUPTHEADER;
-    }
+    /* Schema cookie (any value) */
     ptr += 4;
 
     uint32_t bytes_44_thru_47 = get4byte(ptr);
@@ -282,6 +296,77 @@ int chidb_Btree_close(BTree *bt)
     return CHIDB_OK;
 }
 
+/* Read the schema cookie
+ *
+ * The schema cookie is a counter in the file header that is incremented
+ * every time the schema changes, so the parsed schema can be cached
+ * until the cookie changes.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cookie: Out parameter. Used to return the schema cookie.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_getSchemaCookie(BTree *bt, uint32_t *cookie)
+{
+    MemPage *page;
+    int rc = chidb_Pager_readPageReadOnly(bt->pager, 1, &page);
+    if (rc != CHIDB_OK)
+        return rc;
+    *cookie = get4byte(page->data + HEADER_SCHEMA_COOKIE_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return CHIDB_OK;
+}
+
+/* Write the schema cookie
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cookie: New value of the schema cookie
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_setSchemaCookie(BTree *bt, uint32_t cookie)
+{
+    MemPage *page;
+    int rc = chidb_Pager_readPage(bt->pager, 1, &page);
+    if (rc != CHIDB_OK)
+        return rc;
+    put4byte(page->data + HEADER_SCHEMA_COOKIE_OFFSET, cookie);
+    rc = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return rc;
+}
+
+// loads a node (see chidb_Btree_getNodeByPage), reading its page with chidb_Pager_readPage
+// if it may be modified, and with chidb_Pager_readPageReadOnly otherwise
+static int load_node(BTree *bt, npage_t npage, BTreeNode **btn, bool writable)
+{
+    BTreeNode *_btn = (BTreeNode *)malloc(sizeof(BTreeNode));
+    MemPage *page;
+    int try_read_page = writable ? chidb_Pager_readPage(bt->pager, npage, &page)
+                                 : chidb_Pager_readPageReadOnly(bt->pager, npage, &page);
+    if (try_read_page == CHIDB_EPAGENO || try_read_page == CHIDB_EIO || try_read_page == CHIDB_ENOMEM)
+    {
+        free(_btn);
+        return try_read_page;
+    }
+    _btn->page = page;
+    _btn->page_size = bt->pager->page_size;
+    chidb_Btree_refreshNode(bt, _btn);
+    chilog(DEBUG, "Btree %d, %d free offset, %d cells, %d cells offset %d cell type",
+           npage, _btn->free_offset, _btn->n_cells, _btn->cells_offset, _btn->type);
+    *btn = _btn;
+    return CHIDB_OK;
+}
+
 /* Loads a B-Tree node from disk
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
@@ -306,45 +391,75 @@ int chidb_Btree_close(BTree *bt)
 int counting = 0;
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 {
-    /* Your code goes here */
-    BTreeNode *_btn = (BTreeNode *)malloc(sizeof(BTreeNode));
-    MemPage *page;
-    int try_read_page = chidb_Pager_readPage(bt->pager, npage, &page);
-    if (try_read_page == CHIDB_EPAGENO || try_read_page == CHIDB_EIO || try_read_page == CHIDB_ENOMEM)
-    {
-        return try_read_page;
-    }
-    _btn->page = page;
-    uint8_t *data = page->data;
-    if (npage == 1)
+    return load_node(bt, npage, btn, true);
+}
+
+/* Loads a B-Tree node from disk, for reading only
+ *
+ * Like chidb_Btree_getNodeByPage, but the node must not be modified (see
+ * chidb_Pager_readPageReadOnly), so its page can be read through the
+ * mapping of the file. Used by the code that only searches B-Trees.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - btn: Out parameter. Used to return a pointer to newly creater BTreeNode
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_getNodeByPageReadOnly(BTree *bt, npage_t npage, BTreeNode **btn)
+{
+    return load_node(bt, npage, btn, false);
+}
+
+/* Reloads the header of an in-memory B-Tree node
+ *
+ * Reads the values of the BTreeNode fields again from the in-memory page
+ * of the node. The page is shared with every other BTreeNode of the same
+ * page (see the Pager), so a node that is kept around can be brought up
+ * to date with the changes written through other BTreeNodes without
+ * reading the page again.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: BTreeNode to refresh
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_refreshNode(BTree *bt, BTreeNode *btn)
+{
+    uint8_t *data = btn->page->data;
+    if (btn->page->npage == 1)
     {
         // the page header of page 1 is 100 bytes from the start of the page, as the first 100 bytes are the file header.
         data += 100;
     }
-    _btn->type = *data;
+    btn->type = *data;
     data += 1;
-    _btn->free_offset = get2byte(data);
+    btn->free_offset = get2byte(data);
     data += 2;
-    _btn->n_cells = get2byte(data);
+    btn->n_cells = get2byte(data);
     data += 2;
-    _btn->cells_offset = get2byte(data);
+    btn->cells_offset = get2byte(data);
     data += 2;
+    btn->prefix_size = *data;
     data += 1;
-    uint8_t type = _btn->type;
-    chilog(DEBUG, "Btree %d, %d free offset, %d cells, %d cells offset %d cell type",
-           npage, _btn->free_offset, _btn->n_cells, _btn->cells_offset, type);
-    // 0x05: internal table page, 0x02: internal index page
-    if (type == PGTYPE_INDEX_INTERNAL || type == PGTYPE_TABLE_INTERNAL)
+    // 0x05: internal table page, 0x02: internal index page, 0x03: internal text index page
+    if (is_internal(btn->type))
     {
-        _btn->right_page = get4byte(data);
+        btn->right_page = get4byte(data);
         data += 4;
-        _btn->celloffset_array = data;
+        btn->celloffset_array = data;
     }
-    else if (type == PGTYPE_INDEX_LEAF || type == PGTYPE_TABLE_LEAF)
+    else if (is_leaf(btn->type))
     {
-        _btn->celloffset_array = data;
+        btn->celloffset_array = data;
     }
-    *btn = _btn;
     return CHIDB_OK;
 }
 
@@ -377,11 +492,11 @@ static uint8_t init_header(uint8_t type, uint16_t page_size, npage_t npage, uint
     uint16_t n_cells = 0;
     uint16_t cells_offset = page_size;
     uint8_t _zero = 0;
-    if (type == PGTYPE_INDEX_INTERNAL || type == PGTYPE_TABLE_INTERNAL)
+    if (is_internal(type))
     {
         header_size = 12;
     }
-    else if (type == PGTYPE_INDEX_LEAF || type == PGTYPE_TABLE_LEAF)
+    else if (is_leaf(type))
     {
         header_size = 8;
     }
@@ -406,7 +521,7 @@ static uint8_t init_header(uint8_t type, uint16_t page_size, npage_t npage, uint
     ptr += 2;
     *ptr = _zero;
     ptr += 1;
-    if (type == PGTYPE_INDEX_INTERNAL || type == PGTYPE_TABLE_INTERNAL)
+    if (is_internal(type))
     {
         put4byte(ptr, npage);
     }
@@ -414,16 +529,152 @@ static uint8_t init_header(uint8_t type, uint16_t page_size, npage_t npage, uint
     return header_size;
 }
 
+/* Allocate a page
+ *
+ * Returns a page that is not used by any B-Tree. Pages in the freelist
+ * are reused first: the last leaf page listed in the first trunk page is
+ * taken out of it or, if the trunk page lists no leaf pages, the trunk
+ * page itself is (and the next trunk page becomes the first one). Only
+ * if the freelist is empty is a new page allocated at the end of the file.
+ *
+ * The contents of a reused page are not cleared, so the caller must
+ * initialize the page.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Out parameter. Returns the number of the page that
+ *          was allocated.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The freelist is not well-formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_allocatePage(BTree *bt, npage_t *npage)
+{
+    MemPage *header, *trunk;
+    int rc = chidb_Pager_readPage(bt->pager, 1, &header);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+    npage_t ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    if (ntrunk == 0)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return chidb_Pager_allocatePage(bt->pager, npage);
+    }
+    if (ntrunk > bt->pager->n_pages || (rc = chidb_Pager_readPage(bt->pager, ntrunk, &trunk)) != CHIDB_OK)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return rc == CHIDB_OK ? CHIDB_ECORRUPT : rc;
+    }
+
+    uint32_t nleaves = get4byte(trunk->data + FREELISTPG_NLEAVES_OFFSET);
+    if (nleaves > FREELISTPG_MAX_LEAVES(bt->pager->page_size))
+    {
+        rc = CHIDB_ECORRUPT;
+    }
+    else if (nleaves > 0)
+    {
+        *npage = get4byte(trunk->data + FREELISTPG_LEAVES_OFFSET + 4 * (nleaves - 1));
+        put4byte(trunk->data + FREELISTPG_NLEAVES_OFFSET, nleaves - 1);
+        rc = chidb_Pager_writePage(bt->pager, trunk);
+    }
+    else
+    {
+        *npage = ntrunk;
+        put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, get4byte(trunk->data + FREELISTPG_NEXT_OFFSET));
+    }
+    chidb_Pager_releaseMemPage(bt->pager, trunk);
+
+    if (rc == CHIDB_OK)
+    {
+        uint32_t nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, nfree - 1);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+    return rc;
+}
+
+/* Free a page
+ *
+ * Adds a page that is no longer used by any B-Tree to the freelist (see
+ * chidb_Btree_allocatePage). The page is listed as a leaf page in the
+ * first trunk page if there is room left in it. Otherwise, the page
+ * itself becomes the first trunk page.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page to free (must not be page 1)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page cannot be freed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_freePage(BTree *bt, npage_t npage)
+{
+    MemPage *header, *page;
+    if (npage <= 1 || npage > bt->pager->n_pages)
+    {
+        return CHIDB_EPAGENO;
+    }
+    int rc = chidb_Pager_readPage(bt->pager, 1, &header);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+
+    npage_t ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    bool listed = false;
+    if (ntrunk != 0 && (rc = chidb_Pager_readPage(bt->pager, ntrunk, &page)) == CHIDB_OK)
+    {
+        uint32_t nleaves = get4byte(page->data + FREELISTPG_NLEAVES_OFFSET);
+        if (nleaves < FREELISTPG_MAX_LEAVES(bt->pager->page_size))
+        {
+            put4byte(page->data + FREELISTPG_LEAVES_OFFSET + 4 * nleaves, npage);
+            put4byte(page->data + FREELISTPG_NLEAVES_OFFSET, nleaves + 1);
+            rc = chidb_Pager_writePage(bt->pager, page);
+            listed = true;
+        }
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+    if (rc == CHIDB_OK && !listed && (rc = chidb_Pager_readPage(bt->pager, npage, &page)) == CHIDB_OK)
+    {
+        // the first trunk page is full (or there is none), so the page becomes the first one
+        put4byte(page->data + FREELISTPG_NEXT_OFFSET, ntrunk);
+        put4byte(page->data + FREELISTPG_NLEAVES_OFFSET, 0);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, npage);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        uint32_t nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, nfree + 1);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+    return rc;
+}
+
 /* Create a new B-Tree node
  *
- * Allocates a new page in the file and initializes it as a B-Tree node.
+ * Allocates a new page in the file (reusing a free page if there
+ * is one) and initializes it as a B-Tree node.
  *
  * Parameters
  * - bt: B-Tree file
  * - npage: Out parameter. Returns the number of the page that
  *          was allocated.
  * - type: Type of B-Tree node (PGTYPE_TABLE_INTERNAL, PGTYPE_TABLE_LEAF,
- *         PGTYPE_INDEX_INTERNAL, or PGTYPE_INDEX_LEAF)
+ *         PGTYPE_INDEX_INTERNAL, PGTYPE_INDEX_LEAF, PGTYPE_TEXTINDEX_INTERNAL,
+ *         or PGTYPE_TEXTINDEX_LEAF)
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -433,7 +684,11 @@ static uint8_t init_header(uint8_t type, uint16_t page_size, npage_t npage, uint
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
 {
     /* Your code goes here */
-    chidb_Pager_allocatePage(bt->pager, npage);
+    int rc = chidb_Btree_allocatePage(bt, npage);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
     return chidb_Btree_initEmptyNode(bt, *npage, type);
 }
 
@@ -447,7 +702,8 @@ int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
  * - bt: B-Tree file
  * - npage: Database page where the node will be created.
  * - type: Type of B-Tree node (PGTYPE_TABLE_INTERNAL, PGTYPE_TABLE_LEAF,
- *         PGTYPE_INDEX_INTERNAL, or PGTYPE_INDEX_LEAF)
+ *         PGTYPE_INDEX_INTERNAL, PGTYPE_INDEX_LEAF, PGTYPE_TEXTINDEX_INTERNAL,
+ *         or PGTYPE_TEXTINDEX_LEAF)
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -466,7 +722,9 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
     uint8_t header[12];
     int header_size = init_header(type, bt->pager->page_size, npage, header);
     memcpy(page->data + (npage == 1 ? 100 : 0), header, header_size);
-    return chidb_Pager_writePage(bt->pager, page);
+    int try_write_page = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return try_write_page;
 }
 
 /* Write an in-memory B-Tree node to disk
@@ -475,8 +733,14 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
  * the in-memory page according to the chidb page format. Since the cell
  * offset array and the cells themselves are modified directly on the
  * page, the only thing to do is to store the values of "type",
- * "free_offset", "n_cells", "cells_offset" and "right_page" in the
- * in-memory page.
+ * "free_offset", "n_cells", "cells_offset", "prefix_size" and "right_page"
+ * in the in-memory page.
+ *
+ * Writing an internal node (or turning an internal node into a leaf)
+ * increments the shape counter of the B-Tree file, which tells cursors
+ * that the paths they remember may no longer be valid. Writing any node
+ * increments the writes counter, which tells them that the rows they
+ * have decoded may no longer be valid.
  *
  * Parameters
  * - bt: B-Tree file
@@ -501,6 +765,11 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
     {
         ptr += 100;
     }
+    if (is_internal(*ptr) || is_internal(btn->type))
+    {
+        bt->shape++;
+    }
+    bt->writes++;
     *ptr = btn->type;
     ptr += 1;
     put2byte_le(ptr, btn->free_offset);
@@ -509,16 +778,23 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
     ptr += 2;
     put2byte_le(ptr, btn->cells_offset);
     ptr += 2;
-    uint8_t _zero = 0;
-    *ptr = _zero;
+    *ptr = btn->prefix_size;
     ptr += 1;
-    if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TABLE_INTERNAL)
+    if (is_internal(btn->type))
     {
         put4byte(ptr, btn->right_page);
     }
     return chidb_Pager_writePage(bt->pager, btn->page);
 }
 
+// number of bytes of data of a table leaf entry that are stored in its cell
+// (the rest is stored in overflow pages)
+static uint32_t local_size(uint16_t page_size, uint32_t data_size)
+{
+    uint32_t max_local = BTREE_MAX_LOCAL(page_size);
+    return data_size <= max_local ? data_size : max_local;
+}
+
 /* Read the contents of a cell
  *
  * Reads the contents of a cell from a BTreeNode and stores them in a BTreeCell.
@@ -528,6 +804,12 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
  *     contents (refer to The chidb File Format document for
  *     the format of cells).
  *
+ * The data of a table leaf cell is not copied: the cell points to the
+ * data in the page. If the entry has more data than fits in a cell, only
+ * local_size bytes of it are there (see chidb_Btree_readPayload). The key
+ * of a text index cell is not copied either (in a leaf, its prefix points
+ * to the prefix shared by all the keys in the leaf).
+ *
  * Parameters
  * - btn: BTreeNode where cell is contained
  * - ncell: Cell number
@@ -551,6 +833,7 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     ptr = page->data + ncell_offset; // relative to start of page
     uint8_t type = btn->type;
     cell->type = btn->type;
+    cell->deleted = false;
     if (type == PGTYPE_TABLE_INTERNAL)
     {
         (cell->fields).tableInternal.child_page = get4byte(ptr);
@@ -558,9 +841,14 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     }
     else if (type == PGTYPE_TABLE_LEAF)
     {
-        getVarint32(ptr, &((cell->fields).tableLeaf.data_size));
+        uint32_t data_size, local;
+        getVarint32(ptr, &data_size);
         getVarint32(ptr + 4, &(cell->key));
+        local = local_size(btn->page_size, data_size);
+        (cell->fields).tableLeaf.data_size = data_size;
         (cell->fields).tableLeaf.data = ptr + 8;
+        (cell->fields).tableLeaf.local_size = local;
+        (cell->fields).tableLeaf.overflow_page = local < data_size ? get4byte(ptr + 8 + local) : 0;
     }
     else if (type == PGTYPE_INDEX_INTERNAL)
     {
@@ -573,6 +861,27 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         cell->key = get4byte(ptr + 4);
         (cell->fields).indexLeaf.keyPk = get4byte(ptr + 8);
     }
+    else if (type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+        (cell->fields).indexInternal.child_page = get4byte(ptr + TEXTINTCELL_CHILD_OFFSET);
+        (cell->fields).indexInternal.keyPk = get4byte(ptr + TEXTINTCELL_KEYPK_OFFSET);
+        cell->key = 0;
+        cell->tkey.prefix = NULL;
+        cell->tkey.prefix_size = 0;
+        cell->tkey.suffix = ptr + TEXTINTCELL_KEY_OFFSET;
+        cell->tkey.suffix_size = get2byte(ptr + TEXTINTCELL_SIZE_OFFSET) & ~TEXTCELL_DELETED;
+        cell->deleted = (get2byte(ptr + TEXTINTCELL_SIZE_OFFSET) & TEXTCELL_DELETED) != 0;
+    }
+    else if (type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        (cell->fields).indexLeaf.keyPk = get4byte(ptr + TEXTLEAFCELL_KEYPK_OFFSET);
+        cell->key = 0;
+        cell->tkey.prefix = page->data + btn->page_size - btn->prefix_size;
+        cell->tkey.prefix_size = btn->prefix_size;
+        cell->tkey.suffix = ptr + TEXTLEAFCELL_KEY_OFFSET;
+        cell->tkey.suffix_size = get2byte(ptr + TEXTLEAFCELL_SIZE_OFFSET) & ~TEXTCELL_DELETED;
+        cell->deleted = (get2byte(ptr + TEXTLEAFCELL_SIZE_OFFSET) & TEXTCELL_DELETED) != 0;
+    }
     else
     {
         chilog(CRITICAL, "INVALID CELL TYPE: FATAL.");
@@ -581,6 +890,96 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     return CHIDB_OK;
 }
 
+// number of bytes in a text key
+static inline uint16_t textkey_size(BTreeTextKey *key)
+{
+    return key->prefix_size + key->suffix_size;
+}
+
+// copies the bytes of a text key, starting at byte from, to buf
+static void textkey_copy(BTreeTextKey *key, uint16_t from, uint8_t *buf)
+{
+    if (from < key->prefix_size)
+    {
+        memcpy(buf, key->prefix + from, key->prefix_size - from);
+        buf += key->prefix_size - from;
+        from = key->prefix_size;
+    }
+    memcpy(buf, key->suffix + (from - key->prefix_size), textkey_size(key) - from);
+}
+
+// number of bytes the prefix of a text index leaf has in common with a key
+static uint16_t textleaf_shared(BTreeNode *btn, BTreeTextKey *key)
+{
+    uint8_t *prefix = btn->page->data + btn->page_size - btn->prefix_size;
+    uint16_t n = 0;
+    for (; n < btn->prefix_size && n < textkey_size(key); n++)
+    {
+        uint8_t byte = n < key->prefix_size ? key->prefix[n] : key->suffix[n - key->prefix_size];
+        if (prefix[n] != byte)
+            break;
+    }
+    return n;
+}
+
+// number of bytes of free space a key takes up when it is inserted in a text
+// index leaf (if the prefix of the leaf gets shorter, the other cells grow)
+static uint16_t textleaf_insert_size(BTreeNode *btn, BTreeTextKey *key)
+{
+    if (btn->n_cells == 0)
+    {
+        // the key becomes the prefix
+        return TEXTLEAFCELL_SIZE_WITHOUTKEY + textkey_size(key);
+    }
+    uint16_t shared = textleaf_shared(btn, key);
+    return TEXTLEAFCELL_SIZE_WITHOUTKEY + textkey_size(key) - shared +
+           (btn->n_cells - 1) * (btn->prefix_size - shared);
+}
+
+// makes the prefix of a text index leaf a prefix of key. The prefix of an
+// empty leaf becomes the whole key. The prefix of any other leaf is shortened
+// to the bytes it has in common with the key, and the cells (which are
+// rewritten, without any free space between them) get the rest of it.
+static void textleaf_fit_prefix(BTreeNode *btn, BTreeTextKey *key)
+{
+    uint16_t page_size = btn->page_size;
+    uint8_t *data = btn->page->data;
+
+    if (btn->n_cells == 0)
+    {
+        btn->prefix_size = textkey_size(key);
+        btn->cells_offset = page_size - btn->prefix_size;
+        textkey_copy(key, 0, data + btn->cells_offset);
+        return;
+    }
+    uint16_t shared = textleaf_shared(btn, key);
+    uint16_t grow = btn->prefix_size - shared;
+    if (grow == 0)
+    {
+        return;
+    }
+
+    uint8_t copy[page_size];
+    memcpy(copy, data, page_size);
+    uint8_t *prefix = copy + page_size - btn->prefix_size;
+    uint16_t offset = page_size - shared;
+    memcpy(data + offset, prefix, shared);
+    for (ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        uint8_t *cell = copy + get2byte(btn->celloffset_array + 2 * i);
+        uint16_t deleted = get2byte(cell + TEXTLEAFCELL_SIZE_OFFSET) & TEXTCELL_DELETED;
+        uint16_t suffix_size = get2byte(cell + TEXTLEAFCELL_SIZE_OFFSET) & ~TEXTCELL_DELETED;
+        offset -= TEXTLEAFCELL_SIZE_WITHOUTKEY + grow + suffix_size;
+        put2byte(data + offset + TEXTLEAFCELL_SIZE_OFFSET, (grow + suffix_size) | deleted);
+        memcpy(data + offset + TEXTLEAFCELL_KEYPK_OFFSET, cell + TEXTLEAFCELL_KEYPK_OFFSET, 4);
+        memcpy(data + offset + TEXTLEAFCELL_KEY_OFFSET, prefix + shared, grow);
+        memcpy(data + offset + TEXTLEAFCELL_KEY_OFFSET + grow, cell + TEXTLEAFCELL_KEY_OFFSET, suffix_size);
+        put2byte(btn->celloffset_array + 2 * i, offset);
+    }
+    btn->cells_offset = offset;
+    btn->prefix_size = shared;
+}
+
 /* Insert a new cell into a B-Tree node
  *
  * Inserts a new cell into a B-Tree node at a specified position ncell.
@@ -594,6 +993,12 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
  *     position ncell to be the offset of the newly added cell.
  *
  * This function assumes that there is enough space for this cell in this node.
+ * If the data of a table leaf cell does not fit in a cell (see BTREE_MAX_LOCAL),
+ * only the first part of it is stored in the cell, and the rest must already
+ * have been written to the overflow pages starting at overflow_page (this is
+ * done by chidb_Btree_insert). Inserting a cell in a text index leaf may
+ * shorten the prefix of the leaf, rewriting its other cells (see
+ * PGTYPE_TEXTINDEX_LEAF in btree.h).
  *
  * Parameters
  * - btn: BTreeNode to insert cell in
@@ -626,6 +1031,11 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         3: subtract the size of the cell from cells_offset.
         */
         uint8_t type = btn->type;
+        if (type == PGTYPE_TEXTINDEX_LEAF)
+        {
+            // (this rewrites the cell offset array, so it is done before shifting it)
+            textleaf_fit_prefix(btn, &cell->tkey);
+        }
         if (ncell < n_cells)
         {
             for (int i = n_cells - 1; i >= ncell; i--)
@@ -649,11 +1059,16 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         else if (type == PGTYPE_TABLE_LEAF)
         {
             uint32_t record_size = cell->fields.tableLeaf.data_size;
-            cell_size = 8 + record_size;
+            uint32_t local = local_size(btn->page_size, record_size);
+            cell_size = 8 + local + (local < record_size ? TABLELEAFCELL_OVERFLOW_SIZE : 0);
             new_cell_ptr -= cell_size;
             putVarint32(new_cell_ptr, record_size);
             putVarint32(new_cell_ptr + 4, cell->key);
-            memcpy(new_cell_ptr + 8, cell->fields.tableLeaf.data, record_size);
+            memcpy(new_cell_ptr + 8, cell->fields.tableLeaf.data, local);
+            if (local < record_size)
+            {
+                put4byte(new_cell_ptr + 8 + local, cell->fields.tableLeaf.overflow_page);
+            }
         }
         else if (type == PGTYPE_INDEX_INTERNAL)
         {
@@ -672,6 +1087,25 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
             put4byte(new_cell_ptr + 4, cell->key);
             put4byte(new_cell_ptr + 8, cell->fields.indexLeaf.keyPk);
         }
+        else if (type == PGTYPE_TEXTINDEX_INTERNAL)
+        {
+            uint16_t key_size = textkey_size(&cell->tkey);
+            cell_size = TEXTINTCELL_SIZE_WITHOUTKEY + key_size;
+            new_cell_ptr -= cell_size;
+            put4byte(new_cell_ptr + TEXTINTCELL_CHILD_OFFSET, cell->fields.indexInternal.child_page);
+            put2byte(new_cell_ptr + TEXTINTCELL_SIZE_OFFSET, key_size | (cell->deleted ? TEXTCELL_DELETED : 0));
+            put4byte(new_cell_ptr + TEXTINTCELL_KEYPK_OFFSET, cell->fields.indexInternal.keyPk);
+            textkey_copy(&cell->tkey, 0, new_cell_ptr + TEXTINTCELL_KEY_OFFSET);
+        }
+        else if (type == PGTYPE_TEXTINDEX_LEAF)
+        {
+            uint16_t suffix_size = textkey_size(&cell->tkey) - btn->prefix_size;
+            cell_size = TEXTLEAFCELL_SIZE_WITHOUTKEY + suffix_size;
+            new_cell_ptr -= cell_size;
+            put2byte(new_cell_ptr + TEXTLEAFCELL_SIZE_OFFSET, suffix_size | (cell->deleted ? TEXTCELL_DELETED : 0));
+            put4byte(new_cell_ptr + TEXTLEAFCELL_KEYPK_OFFSET, cell->fields.indexLeaf.keyPk);
+            textkey_copy(&cell->tkey, btn->prefix_size, new_cell_ptr + TEXTLEAFCELL_KEY_OFFSET);
+        }
         else
         {
             return CHIDB_ECORRUPT;
@@ -684,486 +1118,2481 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     return CHIDB_OK;
 }
 
-/* Find an entry in a table B-Tree
+/* Returns the key of a cell, without decoding the rest of the cell */
+static inline chidb_key_t cell_key(BTreeNode *btn, ncell_t ncell)
+{
+    uint8_t *ptr = btn->page->data + get2byte(btn->celloffset_array + 2 * ncell);
+    chidb_key_t key;
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+    case PGTYPE_TABLE_LEAF:
+        getVarint32(ptr + 4, &key);
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        key = get4byte(ptr + 8);
+        break;
+    default:
+        key = get4byte(ptr + 4);
+        break;
+    }
+    return key;
+}
+
+/* Search for a key in a B-Tree node
+ *
+ * Binary searches the cell offset array of a node (cells are sorted by key)
+ * for the first cell with a key greater than or equal to the given key.
+ * Only the keys of the cells that are probed are decoded.
  *
- * Finds the data associated for a given key in a table B-Tree
+ * In an internal node, the cell found this way is the one whose child page
+ * must be followed to find the key (or, if the key is greater than all the
+ * keys in the node, ncell is set to n_cells, meaning the right page must be
+ * followed). In a leaf node, it is the position where the key is, or where
+ * it would have to be inserted.
  *
  * Parameters
- * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want search in
- * - key: Entry key
- * - data: Out-parameter where a copy of the data must be stored
- * - size: Out-parameter where the number of bytes of data must be stored
+ * - btn: BTreeNode to search in
+ * - key: Key to search for
+ * - ncell: Out parameter. Position of the first cell with a key greater
+ *          than or equal to key (n_cells if there is no such cell).
  *
  * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ENOTFOUND: No entry with the given key way found
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_OK: The node contains a cell with the given key
+ * - CHIDB_ENOTFOUND: The node does not contain a cell with the given key
  */
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell)
 {
-    BTreeNode *btn;
-    int try_get_node = chidb_Btree_getNodeByPage(bt, nroot, &btn);
-    if (try_get_node == CHIDB_ECORRUPT)
+    ncell_t lo = 0, hi = btn->n_cells;
+
+    while (lo < hi)
     {
-        chidb_Btree_freeMemNode(bt, btn);
-        return try_get_node;
+        ncell_t mid = lo + (hi - lo) / 2;
+        if (cell_key(btn, mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    uint8_t type = btn->type;
-    // descending recursively down through the BTree
-    chilog(DEBUG, "BTree rooted at %d: %d cells, page %d, right page %d, type %d. Searching for %d",
-           btn->page->npage, btn->n_cells, btn->page->npage, btn->right_page, btn->type, key);
-    if (type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL)
+
+    *ncell = lo;
+    return (lo < btn->n_cells && cell_key(btn, lo) == key) ? CHIDB_OK : CHIDB_ENOTFOUND;
+}
+
+// compares two byte strings, the way text keys are ordered
+static inline int bytes_cmp(const uint8_t *a, uint16_t a_size, const uint8_t *b, uint16_t b_size)
+{
+    int cmp = memcmp(a, b, a_size < b_size ? a_size : b_size);
+    if (cmp != 0)
+        return cmp;
+    return a_size < b_size ? -1 : a_size > b_size;
+}
+
+/* Compare a text key with a byte string
+ *
+ * Text keys are ordered with memcmp, and a key that is a prefix of
+ * another key comes before it.
+ *
+ * Parameters
+ * - tkey: Text key (e.g., the key of a cell returned by chidb_Btree_getCell)
+ * - key: Bytes to compare tkey with
+ * - size: Number of bytes in key
+ *
+ * Return
+ * - A negative number, zero, or a positive number if tkey comes before,
+ *   is equal to, or comes after key
+ */
+int chidb_Btree_compareTextKey(BTreeTextKey *tkey, const uint8_t *key, uint16_t size)
+{
+    if (tkey->prefix_size > 0)
     {
-        for (int i = 0; i < btn->n_cells; i++)
-        {
-            BTreeCell curr_cell;
-            chidb_Btree_getCell(btn, i, &curr_cell);
-            if (key <= curr_cell.key)
-            {
-                chidb_Btree_freeMemNode(bt, btn);
-                if (type == PGTYPE_TABLE_INTERNAL)
-                {
-                    return chidb_Btree_find(bt, curr_cell.fields.tableInternal.child_page, key, data, size);
-                }
-                else if (type == PGTYPE_INDEX_INTERNAL)
-                {
-                    if (key == curr_cell.key)
-                    {
-                        *size = -1;
-                        *data = malloc(1);
-                        return CHIDB_OK;
-                    }
-                    return chidb_Btree_find(bt, curr_cell.fields.indexInternal.child_page, key, data, size);
-                }
-            }
+        uint16_t n = tkey->prefix_size < size ? tkey->prefix_size : size;
+        int cmp = bytes_cmp(tkey->prefix, tkey->prefix_size, key, n);
+        if (cmp != 0)
+            return cmp;
+        key += n;
+        size -= n;
+    }
+    return bytes_cmp(tkey->suffix, tkey->suffix_size, key, size);
+}
+
+/* Search for a key in a text index B-Tree node
+ *
+ * Same as chidb_Btree_searchNode, for the byte string keys of text index
+ * nodes. In a leaf, the key is compared with the prefix that all the keys
+ * in the leaf share only once, and then only with the suffixes of the
+ * cells that are probed.
+ *
+ * Parameters
+ * - btn: BTreeNode to search in (a text index node)
+ * - key: Key to search for
+ * - size: Number of bytes in key
+ * - ncell: Out parameter. Position of the first cell with a key greater
+ *          than or equal to key (n_cells if there is no such cell).
+ *
+ * Return
+ * - CHIDB_OK: The node contains a cell with the given key
+ * - CHIDB_ENOTFOUND: The node does not contain a cell with the given key
+ */
+int chidb_Btree_searchNodeText(BTreeNode *btn, const uint8_t *key, uint16_t size, ncell_t *ncell)
+{
+    ncell_t lo = 0, hi = btn->n_cells;
+    uint16_t size_offset = TEXTINTCELL_SIZE_OFFSET, key_offset = TEXTINTCELL_KEY_OFFSET;
+    int cmp = 1;
+
+    if (btn->type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        size_offset = TEXTLEAFCELL_SIZE_OFFSET;
+        key_offset = TEXTLEAFCELL_KEY_OFFSET;
+        if (hi > 0 && btn->prefix_size > 0)
+        {
+            uint8_t *prefix = btn->page->data + btn->page_size - btn->prefix_size;
+            uint16_t n = btn->prefix_size < size ? btn->prefix_size : size;
+            cmp = bytes_cmp(prefix, btn->prefix_size, key, n);
+            if (cmp != 0)
+            {
+                // the key comes before (or after) all the keys in the leaf
+                *ncell = cmp > 0 ? 0 : hi;
+                return CHIDB_ENOTFOUND;
+            }
+            key += n;
+            size -= n;
+            cmp = 1;
         }
-        npage_t right_page = btn->right_page;
-        chidb_Btree_freeMemNode(bt, btn);
-        return chidb_Btree_find(bt, right_page, key, data, size);
     }
-    else if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+
+    while (lo < hi)
+    {
+        ncell_t mid = lo + (hi - lo) / 2;
+        uint8_t *ptr = btn->page->data + get2byte(btn->celloffset_array + 2 * mid);
+        int c = bytes_cmp(ptr + key_offset, get2byte(ptr + size_offset) & ~TEXTCELL_DELETED, key, size);
+        if (c < 0)
+            lo = mid + 1;
+        else
+        {
+            hi = mid;
+            cmp = c;
+        }
+    }
+
+    // cmp is the result of comparing the key with the cell in position lo (if it was compared)
+    *ncell = lo;
+    return (lo < btn->n_cells && cmp == 0) ? CHIDB_OK : CHIDB_ENOTFOUND;
+}
+
+// searches a node for the key of a cell (see chidb_Btree_searchNode). The key
+// of a text index cell must not be split in a prefix and a suffix.
+static int search_cell(BTreeNode *btn, BTreeCell *btc, ncell_t *ncell)
+{
+    if (is_text(btn->type))
+        return chidb_Btree_searchNodeText(btn, btc->tkey.suffix, btc->tkey.suffix_size, ncell);
+    return chidb_Btree_searchNode(btn, btc->key, ncell);
+}
+
+/* Returns the page that must be followed from position ncell of an internal
+ * node (as returned by chidb_Btree_searchNode) */
+static npage_t child_page(BTreeNode *btn, ncell_t ncell)
+{
+    if (ncell == btn->n_cells)
+        return btn->right_page;
+
+    /* In both table and index internal cells, the child page comes first */
+    return get4byte(btn->page->data + get2byte(btn->celloffset_array + 2 * ncell));
+}
+
+/* Find an entry in a B-Tree, without copying its data
+ *
+ * Finds the entry with a given key, and returns a view of its data that
+ * points into the cached page that contains it (see BTreeView). The page
+ * is pinned until chidb_Btree_releaseView is called, so every successful
+ * call must be matched by a call to chidb_Btree_releaseView.
+ *
+ * Entries in index B-Trees have no data, so a view of an index entry
+ * has no data (and does not pin any page).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - view: Out-parameter where the view of the entry's data is stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EMISUSE: A text index B-Tree (see chidb_Btree_findInTextIndex)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findView(BTree *bt, npage_t nroot, chidb_key_t key, BTreeView *view)
+{
+    npage_t npage = nroot;
+
+    // descending iteratively down through the BTree
+    for (;;)
     {
-        for (int i = 0; i < btn->n_cells; i++)
+        BTreeNode *btn;
+        ncell_t ncell;
+        int rc = chidb_Btree_getNodeByPageReadOnly(bt, npage, &btn);
+        if (rc != CHIDB_OK)
         {
-            BTreeCell curr_cell;
-            chidb_Btree_getCell(btn, i, &curr_cell);
-            if (key == curr_cell.key)
+            return rc;
+        }
+        if (is_text(btn->type))
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return npage == nroot ? CHIDB_EMISUSE : CHIDB_ECORRUPT;
+        }
+        bool found = chidb_Btree_searchNode(btn, key, &ncell) == CHIDB_OK;
+
+        if (btn->type == PGTYPE_TABLE_LEAF)
+        {
+            if (!found)
             {
-                if (btn->type == PGTYPE_TABLE_LEAF)
-                {
-                    uint16_t data_size = curr_cell.fields.tableLeaf.data_size;
-                    uint8_t *ptr = malloc(data_size);
-                    memcpy(ptr, curr_cell.fields.tableLeaf.data, data_size);
-                    *data = ptr;
-                    *size = data_size;
-                    chidb_Btree_freeMemNode(bt, btn);
-                    return CHIDB_OK;
-                }
-                else if (btn->type == PGTYPE_INDEX_LEAF)
+                chidb_Btree_freeMemNode(bt, btn);
+                return CHIDB_ENOTFOUND;
+            }
+            BTreeCell cell;
+            chidb_Btree_getCell(btn, ncell, &cell);
+            view->size = cell.fields.tableLeaf.data_size;
+            if (cell.fields.tableLeaf.overflow_page != 0)
+            {
+                // the data is not contiguous, so the view gets a copy of it
+                view->page = NULL;
+                view->copy = malloc(view->size);
+                rc = view->copy == NULL ? CHIDB_ENOMEM :
+                     chidb_Btree_readPayload(bt, &cell, 0, view->size, view->copy);
+                chidb_Btree_freeMemNode(bt, btn);
+                if (rc != CHIDB_OK)
                 {
-                    *size = -1;
-                    *data = malloc(1);
-                    chilog(DEBUG, "FOUND IN INDEX LEAF");
-                    chidb_Btree_freeMemNode(bt, btn);
-                    return CHIDB_OK;
+                    free(view->copy);
+                    return rc;
                 }
+                view->data = view->copy;
+                return CHIDB_OK;
+            }
+            // the node's page pin is handed over to the view
+            view->page = btn->page;
+            view->data = cell.fields.tableLeaf.data;
+            view->copy = NULL;
+            free(btn);
+            return CHIDB_OK;
+        }
+        else if (btn->type == PGTYPE_INDEX_LEAF || (btn->type == PGTYPE_INDEX_INTERNAL && found))
+        {
+            // index entries carry no data
+            chidb_Btree_freeMemNode(bt, btn);
+            if (!found)
+            {
+                return CHIDB_ENOTFOUND;
             }
+            view->page = NULL;
+            view->data = NULL;
+            view->size = 0;
+            view->copy = NULL;
+            return CHIDB_OK;
+        }
+        else if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_INDEX_INTERNAL)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_ECORRUPT;
         }
+
+        npage = child_page(btn, ncell);
+        chidb_Btree_freeMemNode(bt, btn);
     }
-    chidb_Btree_freeMemNode(bt, btn);
-    return CHIDB_ENOTFOUND;
 }
 
-// return 0 if node has space for an extra cell and an entry in the offset array
-static int node_has_space(BTreeNode *btn, BTreeCell *cell)
+// descends a text index B-Tree looking for the cell with a given key
+// (delete-marked or not), and returns the node that contains it, which
+// the caller must free
+static int find_text_cell(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, BTreeNode **node,
+                          ncell_t *ncell)
 {
-    uint16_t cell_size;
-    if (cell->type == PGTYPE_TABLE_INTERNAL)
-    {
-        cell_size = 8;
-    }
-    else if (cell->type == PGTYPE_TABLE_LEAF)
-    {
-        cell_size = 8 + cell->fields.tableLeaf.data_size;
-    }
-    else if (cell->type == PGTYPE_INDEX_INTERNAL)
-    {
-        cell_size = 16;
-    }
-    else if (cell->type == PGTYPE_INDEX_LEAF)
-    {
-        cell_size = 12;
-    }
-    else
+    npage_t npage = nroot;
+
+    // descending iteratively down through the BTree
+    for (;;)
     {
-        return CHIDB_ECORRUPT;
+        BTreeNode *btn;
+        int rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+        if (rc != CHIDB_OK)
+        {
+            return rc;
+        }
+        if (!is_text(btn->type))
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return npage == nroot ? CHIDB_EMISUSE : CHIDB_ECORRUPT;
+        }
+        if (chidb_Btree_searchNodeText(btn, key, size, ncell) == CHIDB_OK)
+        {
+            *node = btn;
+            return CHIDB_OK;
+        }
+        if (btn->type == PGTYPE_TEXTINDEX_LEAF)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_ENOTFOUND;
+        }
+        npage = child_page(btn, *ncell);
+        chidb_Btree_freeMemNode(bt, btn);
     }
-    return (btn->cells_offset - btn->free_offset - 2) >= cell_size;
 }
 
-/* Insert an entry into a table B-Tree
+// sets (or clears) the delete mark of a text index cell, and its primary key,
+// directly in its page
+static int mark_text_cell(BTree *bt, BTreeNode *btn, ncell_t ncell, bool deleted, chidb_key_t keyPk)
+{
+    uint8_t *ptr = btn->page->data + get2byte(btn->celloffset_array + 2 * ncell);
+    uint16_t size_offset = btn->type == PGTYPE_TEXTINDEX_LEAF ? TEXTLEAFCELL_SIZE_OFFSET : TEXTINTCELL_SIZE_OFFSET;
+    uint16_t size = get2byte(ptr + size_offset) & ~TEXTCELL_DELETED;
+    put2byte(ptr + size_offset, size | (deleted ? TEXTCELL_DELETED : 0));
+    put4byte(ptr + (btn->type == PGTYPE_TEXTINDEX_LEAF ? TEXTLEAFCELL_KEYPK_OFFSET : TEXTINTCELL_KEYPK_OFFSET), keyPk);
+    return chidb_Btree_writeNode(bt, btn);
+}
+
+/* Find an entry in a text index B-Tree
  *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a key and data, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * Delete-marked entries (see chidb_Btree_deleteFromTextIndex) are not found.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
+ * - nroot: Page number of the root node of the B-Tree we want search in
  * - key: Entry key
- * - data: Pointer to data we want to insert
- * - size: Number of bytes of data
+ * - size: Number of bytes in key
+ * - keyPk: Out-parameter where the primary key of the entry is stored
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EMISUSE: Not a text index B-Tree
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+int chidb_Btree_findInTextIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t *keyPk)
 {
-    /* Your code goes here */
-    BTreeCell btc;
-    btc.key = key;
-    btc.type = PGTYPE_TABLE_LEAF;
-    btc.fields.tableLeaf.data_size = size;
-    btc.fields.tableLeaf.data = data;
-    return chidb_Btree_insert(bt, nroot, &btc);
+    BTreeNode *btn;
+    BTreeCell cell;
+    ncell_t ncell;
+    int rc = find_text_cell(bt, nroot, key, size, &btn, &ncell);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+    chidb_Btree_getCell(btn, ncell, &cell);
+    chidb_Btree_freeMemNode(bt, btn);
+    if (cell.deleted)
+    {
+        return CHIDB_ENOTFOUND;
+    }
+    *keyPk = cell.type == PGTYPE_TEXTINDEX_LEAF ? cell.fields.indexLeaf.keyPk : cell.fields.indexInternal.keyPk;
+    return CHIDB_OK;
 }
 
-/* Insert an entry into an index B-Tree
+/* Delete an entry from a text index B-Tree
  *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * The entry is only delete-marked (see PGTYPE_TEXTINDEX_LEAF in btree.h):
+ * its cell stays where it is, so no node has to be balanced, but the space
+ * it takes up is only reused if the same key is inserted again.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
- * - keyIdx: See The chidb File Format.
- * - keyPk: See The chidb File Format.
+ * - nroot: Page number of the root node of the B-Tree we want to delete
+ *          the entry from.
+ * - key: Entry key
+ * - size: Number of bytes in key
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EMISUSE: Not a text index B-Tree
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
-{
-    /* Your code goes here */
-    chilog(DEBUG, "Entering chidb_Btree_insertInIndex for insertion of key %d into page %d", keyIdx, nroot);
-    BTreeCell btc;
-    btc.key = keyIdx;
-    btc.type = PGTYPE_INDEX_LEAF;
-    btc.fields.indexLeaf.keyPk = keyPk;
-    return chidb_Btree_insert(bt, nroot, &btc);
-}
-
-static void transfer_cells(BTree *bt, BTreeNode *to_node, BTreeNode **from_node, int n, BTreeCell *median_cell)
+int chidb_Btree_deleteFromTextIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size)
 {
-    for (int i = 0; i < n - 1; i++)
+    BTreeNode *btn;
+    BTreeCell cell;
+    ncell_t ncell;
+    int rc = find_text_cell(bt, nroot, key, size, &btn, &ncell);
+    if (rc != CHIDB_OK)
     {
-        BTreeCell curr_cell;
-        chidb_Btree_getCell(*from_node, i, &curr_cell);
-        chidb_Btree_insertCell(to_node, i, &curr_cell);
+        return rc;
     }
-    chidb_Btree_getCell(*from_node, n - 1, median_cell);
-    if ((*from_node)->type == PGTYPE_TABLE_LEAF)
+    chidb_Btree_getCell(btn, ncell, &cell);
+    if (cell.deleted)
     {
-        chidb_Btree_insertCell(to_node, n - 1, median_cell);
+        rc = CHIDB_ENOTFOUND;
     }
-    else if ((*from_node)->type == PGTYPE_TABLE_INTERNAL)
+    else
     {
-        to_node->right_page = median_cell->fields.tableInternal.child_page;
+        chidb_key_t keyPk = cell.type == PGTYPE_TEXTINDEX_LEAF ? cell.fields.indexLeaf.keyPk :
+                            cell.fields.indexInternal.keyPk;
+        rc = mark_text_cell(bt, btn, ncell, true, keyPk);
     }
-    else if ((*from_node)->type == PGTYPE_INDEX_INTERNAL)
+    chidb_Btree_freeMemNode(bt, btn);
+    return rc;
+}
+
+/* Release a view returned by chidb_Btree_findView
+ *
+ * Unpins the page the view points into (or frees the view's copy of
+ * the data). The view must not be used after it has been released.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - view: View to release
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_releaseView(BTree *bt, BTreeView *view)
+{
+    if (view->page != NULL)
     {
-        to_node->right_page = median_cell->fields.indexInternal.child_page;
+        chidb_Pager_releaseMemPage(bt->pager, view->page);
     }
-    BTreeNode *new_right_node;
-    chidb_Btree_initEmptyNode(bt, (*from_node)->page->npage, (*from_node)->type);
-    chidb_Btree_getNodeByPage(bt, (*from_node)->page->npage, &new_right_node);
+    free(view->copy);
+    view->page = NULL;
+    view->data = NULL;
+    view->size = 0;
+    view->copy = NULL;
+    return CHIDB_OK;
+}
 
-    for (int i = n; i < (*from_node)->n_cells; i++)
+/* Adds the keys of the cells of an internal table node to keys */
+static void partition_keys(BTreeNode *btn, chidb_key_t *keys, uint32_t *nkeys)
+{
+    for (ncell_t i = 0; i < btn->n_cells; i++)
     {
-        BTreeCell curr_cell;
-        chidb_Btree_getCell(*from_node, i, &curr_cell);
-        chidb_Btree_insertCell(new_right_node, i - n, &curr_cell);
+        BTreeCell cell;
+        chidb_Btree_getCell(btn, i, &cell);
+        keys[(*nkeys)++] = cell.key;
     }
-    new_right_node->right_page = (*from_node)->right_page;
-    *from_node = new_right_node;
 }
 
-/* Insert a BTreeCell into a B-Tree
+/* Split a table B-Tree into ranges of keys
  *
- * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
- * are responsible for inserting new entries into a B-Tree, although
- * chidb_Btree_insertNonFull is the one that actually does the
- * insertion. chidb_Btree_insert, however, first checks if the root
- * has to be split (a splitting operation that is different from
- * splitting any other node). If so, chidb_Btree_split is called
- * before calling chidb_Btree_insertNonFull.
+ * Chooses up to nparts - 1 keys that split the keys of a table B-Tree
+ * into ranges of roughly the same size, so that each range can be
+ * scanned separately (e.g., by a different thread). Range i contains
+ * the keys k with bounds[i - 1] < k <= bounds[i] (the first range has
+ * no lower bound, and the last one no upper bound).
+ *
+ * The keys are taken from the cells of the root node and, if the root
+ * has fewer than nparts children, from the cells of its children, so
+ * each range is made of whole subtrees. A B-Tree that is a single leaf
+ * is not split (*nbounds is 0).
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
+ * - nroot: Page number of the root node of a table B-Tree
+ * - nparts: Number of ranges to split the B-Tree into
+ * - bounds: Array with room for nparts - 1 keys, where the keys that
+ *           split the B-Tree are stored in increasing order
+ * - nbounds: Out-parameter where the number of keys is stored
+ *            (one less than the number of ranges)
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISUSE: Not a table B-Tree
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+int chidb_Btree_partition(BTree *bt, npage_t nroot, uint32_t nparts, chidb_key_t *bounds, uint32_t *nbounds)
 {
-    uint8_t *data;
-    uint16_t size;
-    if (chidb_Btree_find(bt, nroot, btc->key, &data, &size) == 0)
+    BTreeNode *root;
+    chidb_key_t *keys;
+    uint32_t nkeys = 0;
+    int rc;
+
+    *nbounds = 0;
+    if ((rc = chidb_Btree_getNodeByPageReadOnly(bt, nroot, &root)) != CHIDB_OK)
+        return rc;
+    if (root->type != PGTYPE_TABLE_INTERNAL)
     {
-        return CHIDB_EDUPLICATE;
+        rc = root->type == PGTYPE_TABLE_LEAF ? CHIDB_OK : CHIDB_EMISUSE;
+        chidb_Btree_freeMemNode(bt, root);
+        return rc;
     }
-    chilog(DEBUG, "Entering chidb_Btree_insert for key %d into page %d", btc->key, nroot);
-    /* Your code goes here */
-    BTreeNode *root_node;
-    int try_get_page = chidb_Btree_getNodeByPage(bt, nroot, &root_node);
-    if (try_get_page != CHIDB_OK)
+    if (nparts <= 1)
     {
-        return try_get_page;
+        chidb_Btree_freeMemNode(bt, root);
+        return CHIDB_OK;
     }
-    if (!node_has_space(root_node, btc))
-    {
-        chilog(INFO, "ROOT, PAGE %d OUT OF SPACE", nroot);
-        npage_t new_root_n;
-        BTreeNode *new_root_node;
-        uint8_t new_root_type = btc->type == PGTYPE_TABLE_LEAF ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
-        chidb_Btree_newNode(bt, &new_root_n, new_root_type);
-        npage_t left_split_n;
-        chidb_Btree_split(bt, new_root_n, nroot, 0, &left_split_n);
-        chidb_Btree_getNodeByPage(bt, new_root_n, &new_root_node);
-        chidb_Btree_getNodeByPage(bt, nroot, &root_node);
-        new_root_node->right_page = new_root_n;
-        new_root_node->page->npage = nroot;
-        root_node->page->npage = new_root_n;
 
-        // need to account for the fact that the first 100 bytes of page 1 is the file header.
-        if (nroot == 1)
+    if (root->n_cells + 1 >= nparts)
+    {
+        keys = malloc(sizeof(chidb_key_t) * root->n_cells);
+        if (keys == NULL)
         {
-            uint16_t page_size = bt->pager->page_size;
-            uint8_t hold[page_size];
-            memcpy(hold, new_root_node->page->data, new_root_node->free_offset);
-            memcpy(new_root_node->page->data, root_node->page->data, 100);
-            memcpy(new_root_node->page->data + 100, hold, new_root_node->free_offset);
-            memcpy(hold, root_node->page->data + 100, root_node->free_offset - 100);
-            memcpy(root_node->page->data, hold, root_node->free_offset - 100);
-            new_root_node->free_offset += 100;
-            new_root_node->celloffset_array += 100;
-            root_node->free_offset -= 100;
-            root_node->celloffset_array -= 100;
+            chidb_Btree_freeMemNode(bt, root);
+            return CHIDB_ENOMEM;
         }
-        int a1 = chidb_Btree_writeNode(bt, root_node);
-        if (a1 != CHIDB_OK)
+        partition_keys(root, keys, &nkeys);
+    }
+    else
+    {
+        /* The keys of the second level, in order: the keys of each child,
+         * followed by the key of the root cell that points to it */
+        size_t max_keys = (root->n_cells + 1) * (size_t) (root->page_size / (TABLEINTCELL_SIZE + 2) + 1);
+        keys = malloc(sizeof(chidb_key_t) * max_keys);
+        if (keys == NULL)
         {
-            return a1;
+            chidb_Btree_freeMemNode(bt, root);
+            return CHIDB_ENOMEM;
         }
-        int a2 = chidb_Btree_writeNode(bt, new_root_node);
-        if (a2 != CHIDB_OK)
+        for (ncell_t i = 0; i <= root->n_cells; i++)
         {
-            return a2;
+            BTreeNode *child;
+            if ((rc = chidb_Btree_getNodeByPageReadOnly(bt, child_page(root, i), &child)) != CHIDB_OK)
+            {
+                free(keys);
+                chidb_Btree_freeMemNode(bt, root);
+                return rc;
+            }
+            if (child->type == PGTYPE_TABLE_INTERNAL)
+                partition_keys(child, keys, &nkeys);
+            chidb_Btree_freeMemNode(bt, child);
+            if (i < root->n_cells)
+            {
+                BTreeCell cell;
+                chidb_Btree_getCell(root, i, &cell);
+                keys[nkeys++] = cell.key;
+            }
         }
-        chidb_Btree_freeMemNode(bt, new_root_node);
     }
-    chidb_Btree_freeMemNode(bt, root_node);
-    chidb_Btree_insertNonFull(bt, nroot, btc);
+    chidb_Btree_freeMemNode(bt, root);
+
+    /* nkeys keys make nkeys + 1 subtrees, which are spread evenly
+     * over the ranges */
+    for (uint32_t i = 1; i < nparts && i <= nkeys; i++)
+    {
+        uint32_t k = (uint32_t) (((uint64_t) i * (nkeys + 1)) / nparts);
+        if (k == 0 || (*nbounds > 0 && bounds[*nbounds - 1] >= keys[k - 1]))
+            continue;
+        bounds[(*nbounds)++] = keys[k - 1];
+    }
+    free(keys);
+
     return CHIDB_OK;
 }
 
-/* Insert a BTreeCell into a non-full B-Tree node
+/* Read part of the data of a table entry
  *
- * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
- * assumed not to be full (i.e., does not require splitting). If the
- * node is a leaf node, the cell is directly added in the appropriate
- * position according to its key. If the node is an internal node, the
- * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
- * have to be split first.
+ * Copies n bytes of the data of a table leaf cell (as returned by
+ * chidb_Btree_getCell), starting at byte offset, into buf. The part of
+ * the data stored in the cell is read from the cell's page (which must
+ * still be pinned), and the rest from the overflow pages. The overflow
+ * chain is only followed as far as needed to read the requested bytes,
+ * so reading data that is stored in the cell reads no overflow pages.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
+ * - btc: Table leaf cell
+ * - offset: Offset (within the entry's data) of the first byte to read
+ * - n: Number of bytes to read
+ * - buf: Buffer where the bytes are copied
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISUSE: Not a table leaf cell, or the bytes are out of range
+ * - CHIDB_ECORRUPT: The overflow chain ends too soon
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *btc, uint32_t offset, uint32_t n, uint8_t *buf)
+{
+    if (btc->type != PGTYPE_TABLE_LEAF || offset > btc->fields.tableLeaf.data_size ||
+        n > btc->fields.tableLeaf.data_size - offset)
+    {
+        return CHIDB_EMISUSE;
+    }
+
+    uint32_t local = btc->fields.tableLeaf.local_size;
+    if (offset < local)
+    {
+        uint32_t k = n < local - offset ? n : local - offset;
+        memcpy(buf, btc->fields.tableLeaf.data + offset, k);
+        buf += k;
+        offset += k;
+        n -= k;
+    }
+
+    uint32_t per_page = bt->pager->page_size - OVERFLOWPG_DATA_OFFSET;
+    uint32_t start = local; // offset of the first byte stored in npage
+    npage_t npage = btc->fields.tableLeaf.overflow_page;
+    while (n > 0)
+    {
+        MemPage *page;
+        if (npage == 0)
+        {
+            return CHIDB_ECORRUPT;
+        }
+        int rc = chidb_Pager_readPageReadOnly(bt->pager, npage, &page);
+        if (rc != CHIDB_OK)
+        {
+            return rc;
+        }
+        if (offset < start + per_page)
+        {
+            uint32_t k = n < start + per_page - offset ? n : start + per_page - offset;
+            memcpy(buf, page->data + OVERFLOWPG_DATA_OFFSET + (offset - start), k);
+            buf += k;
+            offset += k;
+            n -= k;
+        }
+        npage = get4byte(page->data + OVERFLOWPG_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        start += per_page;
+    }
+    return CHIDB_OK;
+}
+
+// writes the part of the data of a table leaf cell that does not fit in the
+// cell to a new chain of overflow pages, and sets the cell's overflow_page
+static int write_overflow(BTree *bt, BTreeCell *btc)
+{
+    uint32_t size = btc->fields.tableLeaf.data_size;
+    uint32_t offset = local_size(bt->pager->page_size, size);
+    uint32_t per_page = bt->pager->page_size - OVERFLOWPG_DATA_OFFSET;
+    npage_t npage = 0;
+    int rc;
+
+    btc->fields.tableLeaf.overflow_page = 0;
+    if (offset < size && (rc = chidb_Btree_allocatePage(bt, &npage)) != CHIDB_OK)
+    {
+        return rc;
+    }
+    btc->fields.tableLeaf.overflow_page = npage;
+
+    while (offset < size)
+    {
+        MemPage *page;
+        npage_t next = 0;
+        uint32_t k = size - offset < per_page ? size - offset : per_page;
+        if (offset + k < size && (rc = chidb_Btree_allocatePage(bt, &next)) != CHIDB_OK)
+        {
+            return rc;
+        }
+        if ((rc = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
+        {
+            return rc;
+        }
+        put4byte(page->data + OVERFLOWPG_NEXT_OFFSET, next);
+        memcpy(page->data + OVERFLOWPG_DATA_OFFSET, btc->fields.tableLeaf.data + offset, k);
+        memset(page->data + OVERFLOWPG_DATA_OFFSET + k, 0, per_page - k);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        if (rc != CHIDB_OK)
+        {
+            return rc;
+        }
+        offset += k;
+        npage = next;
+    }
+    return CHIDB_OK;
+}
+
+/* Find an entry in a table B-Tree
+ *
+ * Finds the data associated for a given key in a table B-Tree, and
+ * returns a copy of it (see chidb_Btree_findView to avoid the copy)
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - data: Out-parameter where a copy of the data must be stored
+ * - size: Out-parameter where the number of bytes of data must be stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    BTreeView view;
+    int rc = chidb_Btree_findView(bt, nroot, key, &view);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+
+    if (view.data == NULL)
+    {
+        // an index entry: there is no data to copy
+        *size = -1;
+        *data = malloc(1);
+    }
+    else
+    {
+        *data = malloc(view.size);
+        memcpy(*data, view.data, view.size);
+        *size = view.size;
+    }
+    chidb_Btree_releaseView(bt, &view);
+    return *data == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+}
+
+// number of bytes a cell takes up in a node (0 if the cell type is invalid).
+// A text index leaf cell only holds the suffix of its key.
+static uint16_t cell_size(uint16_t page_size, BTreeCell *cell)
+{
+    if (cell->type == PGTYPE_TABLE_INTERNAL)
+    {
+        return TABLEINTCELL_SIZE;
+    }
+    else if (cell->type == PGTYPE_TABLE_LEAF)
+    {
+        uint32_t local = local_size(page_size, cell->fields.tableLeaf.data_size);
+        return TABLELEAFCELL_SIZE_WITHOUTDATA + local +
+               (local < cell->fields.tableLeaf.data_size ? TABLELEAFCELL_OVERFLOW_SIZE : 0);
+    }
+    else if (cell->type == PGTYPE_INDEX_INTERNAL)
+    {
+        return INDEXINTCELL_SIZE;
+    }
+    else if (cell->type == PGTYPE_INDEX_LEAF)
+    {
+        return INDEXLEAFCELL_SIZE;
+    }
+    else if (cell->type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+        return TEXTINTCELL_SIZE_WITHOUTKEY + textkey_size(&cell->tkey);
+    }
+    else if (cell->type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        return TEXTLEAFCELL_SIZE_WITHOUTKEY + cell->tkey.suffix_size;
+    }
+    return 0;
+}
+
+// return 0 if node has space for an extra cell and an entry in the offset array.
+// A text index internal node must have space for a cell with the longest key
+// allowed, since any key may be moved up into it when one of its children is split.
+static int node_has_space(BTreeNode *btn, BTreeCell *cell)
+{
+    uint16_t size;
+    if (btn->type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+        size = TEXTINTCELL_SIZE_WITHOUTKEY + BTREE_MAX_TEXTKEY(btn->page_size);
+    }
+    else if (btn->type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        size = textleaf_insert_size(btn, &cell->tkey);
+    }
+    else if ((size = cell_size(btn->page_size, cell)) == 0)
+    {
+        return CHIDB_ECORRUPT;
+    }
+    return (btn->cells_offset - btn->free_offset - 2) >= size;
+}
+
+/* Remove a cell from a B-Tree node
+ *
+ * Removes the cell in position ncell of a B-Tree node. This involves the
+ * following:
+ *  1. Move the cells below the removed cell in the cell area up, to fill
+ *     the space the removed cell took up (so the free space in the node
+ *     stays contiguous), and modify cells_offset and the cell offset array
+ *     to reflect this.
+ *  2. Shift all values in positions > ncell in the cell offset array one
+ *     position back in the array.
+ *
+ * The overflow pages of a table leaf cell are not freed (this is done
+ * by chidb_Btree_delete).
+ *
+ * Parameters
+ * - btn: BTreeNode to remove the cell from
+ * - ncell: Cell number
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The provided cell number is invalid
+ */
+int chidb_Btree_removeCell(BTreeNode *btn, ncell_t ncell)
+{
+    BTreeCell cell;
+    if (chidb_Btree_getCell(btn, ncell, &cell) != CHIDB_OK)
+    {
+        return CHIDB_ECELLNO;
+    }
+    uint16_t size = cell_size(btn->page_size, &cell);
+    uint16_t offset = get2byte(btn->celloffset_array + 2 * ncell);
+    uint8_t *data = btn->page->data;
+
+    memmove(data + btn->cells_offset + size, data + btn->cells_offset, offset - btn->cells_offset);
+    for (ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        uint16_t ith_cell_offset_value = get2byte(btn->celloffset_array + 2 * i);
+        if (ith_cell_offset_value < offset)
+        {
+            put2byte(btn->celloffset_array + 2 * i, ith_cell_offset_value + size);
+        }
+    }
+    memmove(btn->celloffset_array + 2 * ncell, btn->celloffset_array + 2 * (ncell + 1),
+            2 * (btn->n_cells - ncell - 1));
+
+    btn->free_offset -= 2;
+    btn->n_cells -= 1;
+    btn->cells_offset += size;
+    return CHIDB_OK;
+}
+
+/* Insert an entry into a table B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a key and data, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - key: Entry key
+ * - data: Pointer to data we want to insert
+ * - size: Number of bytes of data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size)
+{
+    /* Your code goes here */
+    BTreeCell btc;
+    btc.key = key;
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.fields.tableLeaf.data_size = size;
+    btc.fields.tableLeaf.data = data;
+    return chidb_Btree_insert(bt, nroot, &btc);
+}
+
+/* Insert an entry into an index B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - keyIdx: See The chidb File Format.
+ * - keyPk: See The chidb File Format.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    /* Your code goes here */
+    chilog(DEBUG, "Entering chidb_Btree_insertInIndex for insertion of key %d into page %d", keyIdx, nroot);
+    BTreeCell btc;
+    btc.key = keyIdx;
+    btc.type = PGTYPE_INDEX_LEAF;
+    btc.fields.indexLeaf.keyPk = keyPk;
+    return chidb_Btree_insert(bt, nroot, &btc);
+}
+
+/* Insert an entry into a text index B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a key (a byte string) and a KeyPk, and creates a BTreeCell
+ * that can be passed along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - key: Entry key (at most BTREE_MAX_TEXTKEY bytes)
+ * - size: Number of bytes in key
+ * - keyPk: See The chidb File Format.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ERANGE: The key is too long
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInTextIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t keyPk)
+{
+    BTreeCell btc;
+    btc.type = PGTYPE_TEXTINDEX_LEAF;
+    btc.key = 0;
+    btc.tkey.prefix = NULL;
+    btc.tkey.prefix_size = 0;
+    btc.tkey.suffix = (uint8_t *) key;
+    btc.tkey.suffix_size = size;
+    btc.deleted = false;
+    btc.fields.indexLeaf.keyPk = keyPk;
+    return chidb_Btree_insert(bt, nroot, &btc);
+}
+
+// makes a copy of a node that reads its cells from a copy of its page (stored
+// in data, which must be page_size bytes long), so that the cells can still be
+// read after the node is re-initialized
+static void snapshot_node_copy(BTreeNode *btn, BTreeNode *copy, MemPage *copy_page, uint8_t *data)
+{
+    memcpy(data, btn->page->data, btn->page_size);
+    *copy_page = *btn->page;
+    copy_page->data = data;
+    *copy = *btn;
+    copy->page = copy_page;
+    copy->celloffset_array = data + (btn->celloffset_array - btn->page->data);
+}
+
+// moves the first n - 1 cells of a node to another node, and returns the nth
+// one in median_cell. The node is re-initialized in place (the pager hands out
+// the same cached page to everyone), so the cells are read from a copy of the
+// page (stored in snapshot, which must be page_size bytes long). The key of
+// median_cell may point into this copy.
+static void transfer_cells(BTree *bt, BTreeNode *to_node, BTreeNode **from_node, int n, BTreeCell *median_cell,
+                           uint8_t *snapshot)
+{
+    BTreeNode *old_node = *from_node;
+    MemPage snapshot_page;
+    BTreeNode snapshot_node;
+    snapshot_node_copy(old_node, &snapshot_node, &snapshot_page, snapshot);
+
+    for (int i = 0; i < n - 1; i++)
+    {
+        BTreeCell curr_cell;
+        chidb_Btree_getCell(&snapshot_node, i, &curr_cell);
+        chidb_Btree_insertCell(to_node, i, &curr_cell);
+    }
+    chidb_Btree_getCell(&snapshot_node, n - 1, median_cell);
+    if (old_node->type == PGTYPE_TABLE_LEAF)
+    {
+        chidb_Btree_insertCell(to_node, n - 1, median_cell);
+    }
+    else if (old_node->type == PGTYPE_TABLE_INTERNAL)
+    {
+        to_node->right_page = median_cell->fields.tableInternal.child_page;
+    }
+    else if (old_node->type == PGTYPE_INDEX_INTERNAL || old_node->type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+        to_node->right_page = median_cell->fields.indexInternal.child_page;
+    }
+
+    BTreeNode *new_right_node;
+    chidb_Btree_initEmptyNode(bt, old_node->page->npage, old_node->type);
+    chidb_Btree_getNodeByPage(bt, old_node->page->npage, &new_right_node);
+
+    for (int i = n; i < snapshot_node.n_cells; i++)
+    {
+        BTreeCell curr_cell;
+        chidb_Btree_getCell(&snapshot_node, i, &curr_cell);
+        chidb_Btree_insertCell(new_right_node, i - n, &curr_cell);
+    }
+    new_right_node->right_page = snapshot_node.right_page;
+    chidb_Btree_freeMemNode(bt, old_node);
+    *from_node = new_right_node;
+}
+
+// removes the cells in positions n and up from a node. The space taken up
+// by the removed cells is only reclaimed if they were the lowest cells in
+// the page (which they are in nodes that were filled by appending cells)
+static void truncate_cells(BTree *bt, BTreeNode *btn, ncell_t n)
+{
+    uint16_t cells_offset = bt->pager->page_size - btn->prefix_size;
+    for (ncell_t i = 0; i < n; i++)
+    {
+        uint16_t offset = get2byte(btn->celloffset_array + 2 * i);
+        if (offset < cells_offset)
+        {
+            cells_offset = offset;
+        }
+    }
+    btn->free_offset -= 2 * (btn->n_cells - n);
+    btn->n_cells = n;
+    btn->cells_offset = cells_offset;
+}
+
+/* Split the rightmost child of a node
+ *
+ * When keys are inserted in increasing order, the node that overflows is
+ * always the rightmost child of its parent, and none of the keys that will
+ * be inserted after the split go to its left. Splitting it down the middle
+ * (see chidb_Btree_split) would leave behind a half-full node that is never
+ * filled again, so instead the node N is left (almost) full, and a new,
+ * (almost) empty node M is created as its right sibling:
+ *
+ * - In a table leaf, all the cells stay in N, and the largest key in N
+ *   is added to the parent.
+ * - In an index leaf (or a text index leaf), the last cell of N is moved
+ *   up to the parent.
+ * - In an internal node, the last cell of N is moved to M (M's right page
+ *   is N's right page), and the cell before it is moved up to the parent
+ *   (its child page becomes N's right page).
+ *
+ * The parent gets a new last cell pointing to N, and its right page is
+ * set to M.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split (must be the parent's
+ *                right page, and contain at least two cells)
+ * - npage_child2: Out parameter. Used to return the page of the new node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int split_rightmost(BTree *bt, npage_t npage_parent, npage_t npage_child, npage_t *npage_child2)
+{
+    BTreeNode *parent_node, *child_node, *new_node;
+    npage_t new_page_n;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage_child, &child_node)) != CHIDB_OK)
+    {
+        return rc;
+    }
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage_parent, &parent_node)) != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, child_node);
+        return rc;
+    }
+    if ((rc = chidb_Btree_newNode(bt, &new_page_n, child_node->type)) != CHIDB_OK ||
+        (rc = chidb_Btree_getNodeByPage(bt, new_page_n, &new_node)) != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, parent_node);
+        chidb_Btree_freeMemNode(bt, child_node);
+        return rc;
+    }
+    chilog(INFO, "SPLIT RIGHTMOST PAGE %d containing %d cells WITH PARENT %d, NEW PAGE IS %d",
+           npage_child, child_node->n_cells, npage_parent, new_page_n);
+
+    ncell_t n = child_node->n_cells;
+    BTreeCell separator;
+    if (child_node->type == PGTYPE_TABLE_LEAF)
+    {
+        chidb_Btree_getCell(child_node, n - 1, &separator);
+    }
+    else if (child_node->type == PGTYPE_INDEX_LEAF || child_node->type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        chidb_Btree_getCell(child_node, n - 1, &separator);
+        truncate_cells(bt, child_node, n - 1);
+    }
+    else
+    {
+        BTreeCell last;
+        chidb_Btree_getCell(child_node, n - 1, &last);
+        chidb_Btree_insertCell(new_node, 0, &last);
+        new_node->right_page = child_node->right_page;
+
+        chidb_Btree_getCell(child_node, n - 2, &separator);
+        child_node->right_page = child_node->type == PGTYPE_TABLE_INTERNAL ?
+                                 separator.fields.tableInternal.child_page :
+                                 separator.fields.indexInternal.child_page;
+        truncate_cells(bt, child_node, n - 2);
+    }
+
+    // (the key of the separator still points into the child's page)
+    BTreeCell insert_parent;
+    insert_parent.type = parent_node->type;
+    insert_parent.key = separator.key;
+    insert_parent.tkey = separator.tkey;
+    insert_parent.deleted = separator.deleted;
+    if (parent_node->type == PGTYPE_TABLE_INTERNAL)
+    {
+        insert_parent.fields.tableInternal.child_page = npage_child;
+    }
+    else
+    {
+        insert_parent.fields.indexInternal.child_page = npage_child;
+        // the separator comes from a leaf when a leaf is split
+        insert_parent.fields.indexInternal.keyPk = is_leaf(separator.type) ?
+                                                   separator.fields.indexLeaf.keyPk :
+                                                   separator.fields.indexInternal.keyPk;
+    }
+    chidb_Btree_insertCell(parent_node, parent_node->n_cells, &insert_parent);
+    parent_node->right_page = new_page_n;
+    *npage_child2 = new_page_n;
+
+    chidb_Btree_writeNode(bt, parent_node);
+    chidb_Btree_writeNode(bt, new_node);
+    chidb_Btree_writeNode(bt, child_node);
+
+    chidb_Btree_freeMemNode(bt, parent_node);
+    chidb_Btree_freeMemNode(bt, new_node);
+    chidb_Btree_freeMemNode(bt, child_node);
+
+    return CHIDB_OK;
+}
+
+// returned by insert_descend when the insertion must start over from the root
+#define INSERT_RESTART (-1)
+
+// compares the key of the cell in position ncell of a node with the key of btc
+static int cell_cmp(BTreeNode *btn, ncell_t ncell, BTreeCell *btc)
+{
+    if (is_text(btn->type))
+    {
+        BTreeCell cell;
+        chidb_Btree_getCell(btn, ncell, &cell);
+        return chidb_Btree_compareTextKey(&cell.tkey, btc->tkey.suffix, btc->tkey.suffix_size);
+    }
+    chidb_key_t key = cell_key(btn, ncell);
+    return key < btc->key ? -1 : key > btc->key;
+}
+
+/* Insert a BTreeCell into a non-full B-Tree node (see chidb_Btree_insertNonFull).
+ *
+ * While descending, this keeps track of whether it is following the rightmost
+ * path of the B-Tree. Full nodes on that path are split with split_rightmost
+ * if the new key is larger than all the keys in them. If nleaf is not NULL,
+ * it is set to the page of the leaf where the cell was inserted if the cell
+ * was appended to the rightmost leaf, and to 0 otherwise.
+ *
+ * Any other full node is split in half by number of cells. If the cells have
+ * different sizes, neither half may have room for the new cell, and the
+ * parent may not have room for the cell moved up by a second split, so
+ * INSERT_RESTART is returned, and the insertion must start over from the
+ * root (which checks every node on the way down again).
+ */
+static int insert_descend(BTree *bt, npage_t npage, BTreeCell *btc, npage_t *nleaf)
+{
+    bool rightmost = true;
+
+    if (nleaf != NULL)
+    {
+        *nleaf = 0;
+    }
+
+    // descending iteratively down through the BTree, splitting full children
+    // before moving into them
+    for (;;)
+    {
+        BTreeNode *btn;
+        ncell_t j;
+        int try_get_page = chidb_Btree_getNodeByPage(bt, npage, &btn);
+        if (try_get_page != CHIDB_OK)
+        {
+            return try_get_page;
+        }
+        // the key of a deleted row can still be a separator in a table internal
+        // node, and then the row goes into the child on its left, which holds it
+        if (search_cell(btn, btc, &j) == CHIDB_OK && btn->type != PGTYPE_TABLE_INTERNAL)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_EDUPLICATE;
+        }
+
+        if (is_leaf(btn->type))
+        {
+            chilog(DEBUG, "Inserting cell into page %d at cell %d.", btn->page->npage, j);
+            if (nleaf != NULL && rightmost && j == btn->n_cells)
+            {
+                *nleaf = npage;
+            }
+            chidb_Btree_insertCell(btn, j, btc);
+            int try_write = chidb_Btree_writeNode(bt, btn);
+            chidb_Btree_freeMemNode(bt, btn);
+            return try_write;
+        }
+        else if (!is_internal(btn->type))
+        {
+            chilog(CRITICAL, "Invalid node type %d!", btn->type);
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_ECORRUPT;
+        }
+
+        rightmost = rightmost && j == btn->n_cells;
+        npage_t insertion_page = child_page(btn, j);
+        BTreeNode *child_node;
+        chidb_Btree_getNodeByPage(bt, insertion_page, &child_node);
+        int child_has_space = node_has_space(child_node, btc);
+        // (internal nodes need a cell to move up and a cell to keep in the new node)
+        bool append = rightmost && child_node->n_cells >= 2 &&
+                      cell_cmp(child_node, child_node->n_cells - 1, btc) < 0;
+        chidb_Btree_freeMemNode(bt, child_node);
+        if (!child_has_space)
+        {
+            npage_t new_child_n;
+            chidb_Btree_freeMemNode(bt, btn);
+            if (append)
+            {
+                // the new key goes into the new (rightmost) node
+                split_rightmost(bt, npage, insertion_page, &new_child_n);
+                insertion_page = new_child_n;
+                npage = insertion_page;
+                continue;
+            }
+            int rc = chidb_Btree_split(bt, npage, insertion_page, j, &new_child_n);
+            return rc == CHIDB_OK ? INSERT_RESTART : rc;
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        npage = insertion_page;
+    }
+}
+
+// the append cursor slot used for the B-Tree rooted at nroot
+static BTreeAppendCursor *append_cursor(BTree *bt, npage_t nroot)
+{
+    return &bt->append[nroot % BTREE_APPEND_CURSORS];
+}
+
+// appends a cell to the rightmost leaf remembered by an append cursor.
+// Returns CHIDB_ENOTFOUND if the cursor cannot be used to insert the cell
+// (it belongs to another B-Tree, is stale, the key is not larger than all
+// the keys in the B-Tree, or the leaf is full).
+static int insert_append(BTree *bt, BTreeAppendCursor *ac, npage_t nroot, BTreeCell *btc)
+{
+    BTreeNode *btn;
+
+    if (ac->nroot != nroot || ac->generation != bt->pager->generation || btc->key <= ac->max_key)
+    {
+        return CHIDB_ENOTFOUND;
+    }
+    if (chidb_Btree_getNodeByPage(bt, ac->nleaf, &btn) != CHIDB_OK)
+    {
+        return CHIDB_ENOTFOUND;
+    }
+    if (btn->type != btc->type || node_has_space(btn, btc) != 1)
+    {
+        chidb_Btree_freeMemNode(bt, btn);
+        return CHIDB_ENOTFOUND;
+    }
+
+    int rc = btc->type == PGTYPE_TABLE_LEAF ? write_overflow(bt, btc) : CHIDB_OK;
+    if (rc != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, btn);
+        return rc;
+    }
+    chidb_Btree_insertCell(btn, btn->n_cells, btc);
+    rc = chidb_Btree_writeNode(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+    if (rc == CHIDB_OK)
+    {
+        ac->max_key = btc->key;
+    }
+    return rc;
+}
+
+// splits the root of a B-Tree if it does not have space for a cell. The
+// root has to stay in page nroot, so its contents are moved to a new page,
+// and the root becomes an internal node with the new page as its only child
+// before this child is split.
+static int split_root(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    BTreeNode *root_node;
+    int try_get_page = chidb_Btree_getNodeByPage(bt, nroot, &root_node);
+    if (try_get_page != CHIDB_OK)
+    {
+        return try_get_page;
+    }
+    if (!node_has_space(root_node, btc))
+    {
+        chilog(INFO, "ROOT, PAGE %d OUT OF SPACE", nroot);
+        // the contents of the root are moved to another page
+        append_cursor(bt, nroot)->nroot = 0;
+        npage_t new_root_n;
+        BTreeNode *new_root_node;
+        uint8_t new_root_type = internal_type(btc->type);
+        chidb_Btree_newNode(bt, &new_root_n, new_root_type);
+        npage_t left_split_n;
+        chidb_Btree_freeMemNode(bt, root_node);
+        chidb_Btree_split(bt, new_root_n, nroot, 0, &left_split_n);
+        chidb_Btree_getNodeByPage(bt, new_root_n, &new_root_node);
+        chidb_Btree_getNodeByPage(bt, nroot, &root_node);
+        new_root_node->right_page = new_root_n;
+
+        // the new root has to live in page nroot, so the two nodes trade pages.
+        // Pages are shared through the pager's cache, so we swap their contents
+        // rather than their page numbers.
+        uint16_t page_size = bt->pager->page_size;
+        uint8_t swap[page_size];
+        MemPage *new_root_page = new_root_node->page;
+        MemPage *root_page = root_node->page;
+        ptrdiff_t new_root_cells = new_root_node->celloffset_array - new_root_page->data;
+        ptrdiff_t root_cells = root_node->celloffset_array - root_page->data;
+        memcpy(swap, new_root_page->data, page_size);
+        memcpy(new_root_page->data, root_page->data, page_size);
+        memcpy(root_page->data, swap, page_size);
+        new_root_node->page = root_page;
+        new_root_node->celloffset_array = root_page->data + new_root_cells;
+        root_node->page = new_root_page;
+        root_node->celloffset_array = new_root_page->data + root_cells;
+
+        // need to account for the fact that the first 100 bytes of page 1 is the file header.
+        if (nroot == 1)
+        {
+            uint16_t page_size = bt->pager->page_size;
+            uint8_t hold[page_size];
+            memcpy(hold, new_root_node->page->data, new_root_node->free_offset);
+            memcpy(new_root_node->page->data, root_node->page->data, 100);
+            memcpy(new_root_node->page->data + 100, hold, new_root_node->free_offset);
+            memcpy(hold, root_node->page->data + 100, root_node->free_offset - 100);
+            memcpy(root_node->page->data, hold, root_node->free_offset - 100);
+            new_root_node->free_offset += 100;
+            new_root_node->celloffset_array += 100;
+            root_node->free_offset -= 100;
+            root_node->celloffset_array -= 100;
+        }
+        int a1 = chidb_Btree_writeNode(bt, root_node);
+        if (a1 != CHIDB_OK)
+        {
+            return a1;
+        }
+        int a2 = chidb_Btree_writeNode(bt, new_root_node);
+        if (a2 != CHIDB_OK)
+        {
+            return a2;
+        }
+        chidb_Btree_freeMemNode(bt, new_root_node);
+    }
+    chidb_Btree_freeMemNode(bt, root_node);
+    return CHIDB_OK;
+}
+
+/* Insert a BTreeCell into a B-Tree
+ *
+ * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
+ * are responsible for inserting new entries into a B-Tree, although
+ * chidb_Btree_insertNonFull is the one that actually does the
+ * insertion. chidb_Btree_insert, however, first checks if the root
+ * has to be split (a splitting operation that is different from
+ * splitting any other node). If so, chidb_Btree_split is called
+ * before calling chidb_Btree_insertNonFull.
+ *
+ * If the data of a table entry does not fit in a cell, the part that
+ * does not fit is first written to overflow pages (see BTREE_MAX_LOCAL).
+ *
+ * The key of a text index cell can be up to BTREE_MAX_TEXTKEY bytes long.
+ * Text index B-Trees do not use append cursors. Inserting the key of a
+ * delete-marked text index entry reuses its cell.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ERANGE: The key of a text index cell is too long
+ * - CHIDB_EMISUSE: A text index cell in another kind of B-Tree, or vice versa
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    // the cell is copied, since its overflow page is set below
+    BTreeCell cell = *btc;
+    btc = &cell;
+    BTreeAppendCursor *ac = append_cursor(bt, nroot);
+    int rc;
+
+    if (is_text(btc->type))
+    {
+        // the key is searched for as a single byte string
+        uint8_t key[UINT8_MAX];
+        if (textkey_size(&btc->tkey) > BTREE_MAX_TEXTKEY(bt->pager->page_size))
+        {
+            return CHIDB_ERANGE;
+        }
+        if (btc->tkey.prefix_size > 0)
+        {
+            textkey_copy(&btc->tkey, 0, key);
+            btc->tkey.suffix = key;
+            btc->tkey.suffix_size = textkey_size(&btc->tkey);
+            btc->tkey.prefix_size = 0;
+        }
+        btc->deleted = false;
+        // a delete-marked entry with the same key is brought back in place
+        BTreeNode *btn;
+        ncell_t ncell;
+        rc = find_text_cell(bt, nroot, btc->tkey.suffix, btc->tkey.suffix_size, &btn, &ncell);
+        if (rc == CHIDB_OK)
+        {
+            BTreeCell found;
+            chidb_Btree_getCell(btn, ncell, &found);
+            rc = found.deleted ? mark_text_cell(bt, btn, ncell, false, btc->fields.indexLeaf.keyPk) : CHIDB_EDUPLICATE;
+            chidb_Btree_freeMemNode(bt, btn);
+            return rc;
+        }
+        else if (rc != CHIDB_ENOTFOUND)
+        {
+            return rc;
+        }
+    }
+    else
+    {
+        rc = insert_append(bt, ac, nroot, btc);
+        if (rc != CHIDB_ENOTFOUND)
+        {
+            return rc;
+        }
+
+        BTreeView view;
+        rc = chidb_Btree_findView(bt, nroot, btc->key, &view);
+        if (rc == CHIDB_OK)
+        {
+            chidb_Btree_releaseView(bt, &view);
+            return CHIDB_EDUPLICATE;
+        }
+        else if (rc != CHIDB_ENOTFOUND)
+        {
+            return rc;
+        }
+    }
+    if (btc->type == PGTYPE_TABLE_LEAF && (rc = write_overflow(bt, btc)) != CHIDB_OK)
+    {
+        return rc;
+    }
+    chilog(DEBUG, "Entering chidb_Btree_insert for key %d into page %d", btc->key, nroot);
+    /* Your code goes here */
+    npage_t nleaf;
+    do
+    {
+        if ((rc = split_root(bt, nroot, btc)) != CHIDB_OK)
+        {
+            return rc;
+        }
+        rc = insert_descend(bt, nroot, btc, &nleaf);
+    } while (rc == INSERT_RESTART);
+
+    if (rc == CHIDB_OK && nleaf != 0 && !is_text(btc->type))
+    {
+        ac->nroot = nroot;
+        ac->nleaf = nleaf;
+        ac->max_key = btc->key;
+        ac->generation = bt->pager->generation;
+    }
+    return rc;
+}
+
+/* Insert a BTreeCell into a non-full B-Tree node
+ *
+ * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
+ * assumed not to be full (i.e., does not require splitting). If the
+ * node is a leaf node, the cell is directly added in the appropriate
+ * position according to its key. If the node is an internal node, the
+ * function will determine what child node it must insert it in, and
+ * calls itself recursively on that child node. However, before doing so
+ * it will check if the child node is full or not. If it is, then it will
+ * have to be split first.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
 {
-    /* Your code goes here */
+    int rc;
+    do
+    {
+        rc = insert_descend(bt, npage, btc, NULL);
+    } while (rc == INSERT_RESTART);
+    return rc;
+}
+
+/* Split a B-Tree node
+ *
+ * Splits a B-Tree node N. This involves the following:
+ * - Find the median cell in N.
+ * - Create a new B-Tree node M.
+ * - Move the cells before the median cell to M (if the
+ *   cell is a table leaf cell, the median cell is moved too)
+ * - Add a cell to the parent (which, by definition, will be an
+ *   internal page) with the median key and the page number of M.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split
+ * - parent_ncell: Position in the parent where the new cell will
+ *                 be inserted.
+ * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+{
+    /* Your code goes here */
+    BTreeNode *child_node;
+    int try_get_child = chidb_Btree_getNodeByPage(bt, npage_child, &child_node);
+    if (try_get_child != CHIDB_OK)
+    {
+        return try_get_child;
+    }
+    BTreeNode *parent_node;
+    int try_get_parent = chidb_Btree_getNodeByPage(bt, npage_parent, &parent_node);
+    if (try_get_parent != CHIDB_OK)
+    {
+        return try_get_parent;
+    }
+    npage_t new_page_n;
+    int try_new_node = chidb_Btree_newNode(bt, &new_page_n, child_node->type);
+    if (try_new_node != CHIDB_OK)
+    {
+        return try_new_node;
+    }
+    chilog(INFO, "SPLIT PAGE %d containing %d cells WITH PARENT %d, NEW PAGE IS %d",
+           npage_child, child_node->n_cells, npage_parent, new_page_n);
+    BTreeNode *new_node;
+    int try_get_new_node = chidb_Btree_getNodeByPage(bt, new_page_n, &new_node);
+    if (try_get_new_node != CHIDB_OK)
+    {
+        return try_get_new_node;
+    }
+    ncell_t median_cell_n = (child_node->n_cells - 1) / 2;
+    BTreeCell median_cell;
+    uint8_t snapshot[bt->pager->page_size];
+    transfer_cells(bt, new_node, &child_node, median_cell_n + 1, &median_cell, snapshot);
+    BTreeCell insert_parent;
+    insert_parent.type = parent_node->type;
+    insert_parent.key = median_cell.key;
+    insert_parent.tkey = median_cell.tkey;
+    insert_parent.deleted = median_cell.deleted;
+    if (parent_node->type == PGTYPE_TABLE_INTERNAL)
+    {
+        insert_parent.fields.tableInternal.child_page = new_page_n;
+    }
+    else if (parent_node->type == PGTYPE_INDEX_INTERNAL || parent_node->type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+        insert_parent.fields.indexInternal.child_page = new_page_n;
+        insert_parent.fields.indexInternal.keyPk = median_cell.fields.indexInternal.keyPk;
+    }
+    chidb_Btree_insertCell(parent_node, parent_ncell, &insert_parent);
+    *npage_child2 = new_page_n;
+
+    chidb_Btree_writeNode(bt, parent_node);
+    chidb_Btree_writeNode(bt, new_node);
+    chidb_Btree_writeNode(bt, child_node);
+
+    chidb_Btree_freeMemNode(bt, parent_node);
+    chidb_Btree_freeMemNode(bt, new_node);
+    chidb_Btree_freeMemNode(bt, child_node);
+
+    return CHIDB_OK;
+}
+
+
+// number of bytes of a node in page npage that can hold cells (and their
+// entries in the cell offset array)
+static uint16_t usable_size(uint16_t page_size, npage_t npage, uint8_t type)
+{
+    uint16_t header_size = is_internal(type) ? INTPG_CELLSOFFSET_OFFSET : LEAFPG_CELLSOFFSET_OFFSET;
+    return page_size - (npage == 1 ? 100 : 0) - header_size;
+}
+
+// number of bytes taken up by the cells of a node (and their entries in
+// the cell offset array)
+static uint16_t used_size(BTreeNode *btn)
+{
+    uint16_t used = 0;
+    for (ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        BTreeCell cell;
+        chidb_Btree_getCell(btn, i, &cell);
+        used += cell_size(btn->page_size, &cell) + 2;
+    }
+    return used;
+}
+
+// a node is underfull if less than a third of it is used
+static bool node_underfull(BTreeNode *btn)
+{
+    return used_size(btn) * 3 < usable_size(btn->page_size, btn->page->npage, btn->type);
+}
+
+// frees a chain of overflow pages
+static int free_overflow(BTree *bt, npage_t npage)
+{
+    while (npage != 0)
+    {
+        MemPage *page;
+        int rc = chidb_Pager_readPage(bt->pager, npage, &page);
+        if (rc != CHIDB_OK)
+        {
+            return rc;
+        }
+        npage_t next = get4byte(page->data + OVERFLOWPG_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        if ((rc = chidb_Btree_freePage(bt, npage)) != CHIDB_OK)
+        {
+            return rc;
+        }
+        npage = next;
+    }
+    return CHIDB_OK;
+}
+
+// re-initializes the node in page npage, and fills it with cells[0..n)
+static int rebuild_node(BTree *bt, npage_t npage, uint8_t type, BTreeCell *cells, int n, npage_t right_page)
+{
+    BTreeNode *btn;
+    int rc = chidb_Btree_initEmptyNode(bt, npage, type);
+    if (rc != CHIDB_OK || (rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+    {
+        return rc;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        chidb_Btree_insertCell(btn, i, &cells[i]);
+    }
+    btn->right_page = right_page;
+    rc = chidb_Btree_writeNode(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+    return rc;
+}
+
+/* Balance two sibling nodes
+ *
+ * Takes the children in positions nleft and nleft + 1 of a parent node (one
+ * of which has become underfull) and, if all their cells fit in a single node,
+ * merges them into the right one, removing the parent's cell for the left one
+ * (whose page is freed). Otherwise, their cells are redistributed, so that
+ * each one holds about half of them, and the parent's cell for the left node
+ * is replaced with one holding the new separator key.
+ *
+ * In table leaves, the separator key is only a copy of the largest key in the
+ * left node. Everywhere else (internal nodes, and index leaves) the separator
+ * cell is moved down into the nodes, between the cells of the left node and
+ * the cells of the right node, and the cell in the middle is moved up.
+ *
+ * The parent node is modified in memory, but not written to disk.
+ */
+static int balance_siblings(BTree *bt, BTreeNode *parent, ncell_t nleft)
+{
+    npage_t npage_left = child_page(parent, nleft);
+    npage_t npage_right = child_page(parent, nleft + 1);
+    uint16_t page_size = bt->pager->page_size;
+    BTreeNode *left, *right;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage_left, &left)) != CHIDB_OK)
+    {
+        return rc;
+    }
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage_right, &right)) != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, left);
+        return rc;
+    }
+    if (left->type != right->type)
+    {
+        chidb_Btree_freeMemNode(bt, left);
+        chidb_Btree_freeMemNode(bt, right);
+        return CHIDB_ECORRUPT;
+    }
+
+    // the nodes are re-initialized in place, so their cells are read from copies of their pages
+    uint8_t type = left->type;
+    uint8_t left_data[page_size], right_data[page_size];
+    MemPage left_page, right_page;
+    BTreeNode left_copy, right_copy;
+    snapshot_node_copy(left, &left_copy, &left_page, left_data);
+    snapshot_node_copy(right, &right_copy, &right_page, right_data);
+    chidb_Btree_freeMemNode(bt, left);
+    chidb_Btree_freeMemNode(bt, right);
+
+    BTreeCell *cells = malloc((left_copy.n_cells + right_copy.n_cells + 1) * sizeof(BTreeCell));
+    if (cells == NULL)
+    {
+        return CHIDB_ENOMEM;
+    }
+    int n = 0;
+    for (ncell_t i = 0; i < left_copy.n_cells; i++)
+    {
+        chidb_Btree_getCell(&left_copy, i, &cells[n++]);
+    }
+    if (type != PGTYPE_TABLE_LEAF)
+    {
+        BTreeCell separator;
+        BTreeCell *cell = &cells[n++];
+        chidb_Btree_getCell(parent, nleft, &separator);
+        cell->type = type;
+        cell->key = separator.key;
+        if (type == PGTYPE_TABLE_INTERNAL)
+        {
+            cell->fields.tableInternal.child_page = left_copy.right_page;
+        }
+        else if (type == PGTYPE_INDEX_INTERNAL)
+        {
+            cell->fields.indexInternal.child_page = left_copy.right_page;
+            cell->fields.indexInternal.keyPk = separator.fields.indexInternal.keyPk;
+        }
+        else
+        {
+            cell->fields.indexLeaf.keyPk = separator.fields.indexInternal.keyPk;
+        }
+    }
+    for (ncell_t i = 0; i < right_copy.n_cells; i++)
+    {
+        chidb_Btree_getCell(&right_copy, i, &cells[n++]);
+    }
+
+    uint32_t total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        total += cell_size(page_size, &cells[i]) + 2;
+    }
+
+    if (total <= usable_size(page_size, npage_right, type))
+    {
+        chilog(INFO, "MERGE PAGE %d INTO PAGE %d (%d cells)", npage_left, npage_right, n);
+        rc = rebuild_node(bt, npage_right, type, cells, n, right_copy.right_page);
+        if (rc == CHIDB_OK)
+        {
+            chidb_Btree_removeCell(parent, nleft);
+            rc = chidb_Btree_freePage(bt, npage_left);
+        }
+        free(cells);
+        return rc;
+    }
+
+    // the left node gets the first cells, up to about half of the bytes
+    // (the right node must be left with at least one cell)
+    int last = type == PGTYPE_TABLE_LEAF ? n - 1 : n - 2;
+    int k = 0;
+    for (uint32_t acc = 0; k < last && acc + cell_size(page_size, &cells[k]) + 2 <= total / 2; k++)
+    {
+        acc += cell_size(page_size, &cells[k]) + 2;
+    }
+    if (k == 0)
+    {
+        k = 1;
+    }
+    chilog(INFO, "REDISTRIBUTE PAGES %d AND %d (%d and %d cells)", npage_left, npage_right, k, n - k);
+
+    BTreeCell separator;
+    separator.type = parent->type;
+    npage_t left_right_page = left_copy.right_page;
+    int right_start;
+    if (type == PGTYPE_TABLE_LEAF)
+    {
+        separator.key = cells[k - 1].key;
+        right_start = k;
+    }
+    else
+    {
+        separator.key = cells[k].key;
+        if (type == PGTYPE_TABLE_INTERNAL)
+        {
+            left_right_page = cells[k].fields.tableInternal.child_page;
+        }
+        else if (type == PGTYPE_INDEX_INTERNAL)
+        {
+            left_right_page = cells[k].fields.indexInternal.child_page;
+            separator.fields.indexInternal.keyPk = cells[k].fields.indexInternal.keyPk;
+        }
+        else
+        {
+            separator.fields.indexInternal.keyPk = cells[k].fields.indexLeaf.keyPk;
+        }
+        right_start = k + 1;
+    }
+    if (separator.type == PGTYPE_TABLE_INTERNAL)
+    {
+        separator.fields.tableInternal.child_page = npage_left;
+    }
+    else
+    {
+        separator.fields.indexInternal.child_page = npage_left;
+    }
+
+    rc = rebuild_node(bt, npage_left, type, cells, k, left_right_page);
+    if (rc == CHIDB_OK)
+    {
+        rc = rebuild_node(bt, npage_right, type, cells + right_start, n - right_start, right_copy.right_page);
+    }
+    if (rc == CHIDB_OK)
+    {
+        // both separator cells have the same size
+        chidb_Btree_removeCell(parent, nleft);
+        chidb_Btree_insertCell(parent, nleft, &separator);
+    }
+    free(cells);
+    return rc;
+}
+
+// while the root of a B-Tree is an internal node with no cells (and a single
+// child), moves the contents of its child into it, removing a level from the B-Tree
+static int collapse_root(BTree *bt, npage_t nroot)
+{
+    for (;;)
+    {
+        BTreeNode *root, *child;
+        int rc = chidb_Btree_getNodeByPage(bt, nroot, &root);
+        if (rc != CHIDB_OK)
+        {
+            return rc;
+        }
+        if (root->n_cells > 0 || root->type == PGTYPE_TABLE_LEAF || root->type == PGTYPE_INDEX_LEAF)
+        {
+            chidb_Btree_freeMemNode(bt, root);
+            return CHIDB_OK;
+        }
+        npage_t nchild = root->right_page;
+        chidb_Btree_freeMemNode(bt, root);
+        if ((rc = chidb_Btree_getNodeByPage(bt, nchild, &child)) != CHIDB_OK)
+        {
+            return rc;
+        }
+        // page 1 has less room for cells than any other page
+        if (used_size(child) > usable_size(child->page_size, nroot, child->type))
+        {
+            chidb_Btree_freeMemNode(bt, child);
+            return CHIDB_OK;
+        }
+
+        chilog(INFO, "COLLAPSE ROOT PAGE %d INTO PAGE %d", nchild, nroot);
+        BTreeCell *cells = malloc((child->n_cells + 1) * sizeof(BTreeCell));
+        if (cells == NULL)
+        {
+            chidb_Btree_freeMemNode(bt, child);
+            return CHIDB_ENOMEM;
+        }
+        for (ncell_t i = 0; i < child->n_cells; i++)
+        {
+            chidb_Btree_getCell(child, i, &cells[i]);
+        }
+        rc = rebuild_node(bt, nroot, child->type, cells, child->n_cells, child->right_page);
+        free(cells);
+        chidb_Btree_freeMemNode(bt, child);
+        if (rc != CHIDB_OK || (rc = chidb_Btree_freePage(bt, nchild)) != CHIDB_OK)
+        {
+            return rc;
+        }
+    }
+}
+
+/* Delete an entry from a B-Tree
+ *
+ * Removes the entry with a given key from a B-Tree. This involves the
+ * following:
+ * - Descend from the root to the node containing the key, remembering
+ *   the path taken.
+ * - If the entry is in a leaf, remove its cell (and free its overflow
+ *   pages, if any). If the entry is in an internal node (which can only
+ *   happen in an index B-Tree), replace its cell with the largest entry
+ *   in its left subtree (which is in a leaf), and remove that entry from
+ *   its leaf instead.
+ * - Going back up the path from the leaf, balance every node that is left
+ *   underfull (less than a third full) with one of its siblings: the two
+ *   nodes are merged if they fit in a single node, and their cells are
+ *   redistributed otherwise (see balance_siblings). Merging two nodes
+ *   removes a cell from their parent, which may become underfull in turn.
+ * - If the root is left with no cells (and a single child), the child is
+ *   moved into the root, so the B-Tree loses a level.
+ *
+ * Pages that are no longer used are added to the freelist. Entries cannot
+ * be deleted from text index B-Trees.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to delete
+ *          the entry from.
+ * - key: Entry key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EMISUSE: The B-Tree is a text index B-Tree
+ * - CHIDB_ECORRUPT: The B-Tree is not well-formed (or is too high)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    npage_t path[BTREE_MAX_DEPTH];
+    ncell_t pos[BTREE_MAX_DEPTH]; // position of the key (or of the child followed) in each node
+    npage_t npage = nroot;
+    npage_t overflow_page = 0;
     BTreeNode *btn;
-    int try_get_page = chidb_Btree_getNodeByPage(bt, npage, &btn);
-    if (try_get_page != CHIDB_OK)
+    int depth = 0, rc;
+
+    // descending iteratively down through the BTree, remembering the path
+    for (;; depth++)
     {
-        return try_get_page;
+        if (depth == BTREE_MAX_DEPTH)
+        {
+            return CHIDB_ECORRUPT;
+        }
+        if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        {
+            return rc;
+        }
+        if (is_text(btn->type))
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_EMISUSE;
+        }
+        bool found = chidb_Btree_searchNode(btn, key, &pos[depth]) == CHIDB_OK;
+        path[depth] = npage;
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+        {
+            if (!found)
+            {
+                chidb_Btree_freeMemNode(bt, btn);
+                return CHIDB_ENOTFOUND;
+            }
+            break;
+        }
+        else if (btn->type == PGTYPE_INDEX_INTERNAL && found)
+        {
+            break;
+        }
+        else if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_INDEX_INTERNAL)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_ECORRUPT;
+        }
+        npage = child_page(btn, pos[depth]);
+        chidb_Btree_freeMemNode(bt, btn);
     }
-    int j;
-    BTreeCell curr_cell;
-    for (j = 0; j < btn->n_cells; j++)
+
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
     {
-        chidb_Btree_getCell(btn, j, &curr_cell);
-        if (btc->key < curr_cell.key)
+        // the entry is replaced with its predecessor, the last entry in the
+        // rightmost leaf of its left subtree
+        int internal_depth = depth;
+        npage = child_page(btn, pos[depth]);
+        chidb_Btree_freeMemNode(bt, btn);
+        for (;;)
         {
-            break;
+            if (++depth == BTREE_MAX_DEPTH)
+            {
+                return CHIDB_ECORRUPT;
+            }
+            if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+            {
+                return rc;
+            }
+            path[depth] = npage;
+            pos[depth] = btn->n_cells;
+            if (btn->type == PGTYPE_INDEX_LEAF)
+            {
+                break;
+            }
+            bool internal = btn->type == PGTYPE_INDEX_INTERNAL;
+            npage = btn->right_page;
+            chidb_Btree_freeMemNode(bt, btn);
+            if (!internal)
+            {
+                return CHIDB_ECORRUPT;
+            }
         }
-        else if (btc->key == curr_cell.key)
+        if (btn->n_cells == 0)
         {
             chidb_Btree_freeMemNode(bt, btn);
-            return CHIDB_EDUPLICATE;
+            return CHIDB_ECORRUPT;
         }
+        pos[depth] = btn->n_cells - 1;
+
+        BTreeNode *internal;
+        BTreeCell predecessor, cell;
+        chidb_Btree_getCell(btn, pos[depth], &predecessor);
+        if ((rc = chidb_Btree_getNodeByPage(bt, path[internal_depth], &internal)) != CHIDB_OK)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return rc;
+        }
+        chidb_Btree_getCell(internal, pos[internal_depth], &cell);
+        cell.key = predecessor.key;
+        cell.fields.indexInternal.keyPk = predecessor.fields.indexLeaf.keyPk;
+        chidb_Btree_removeCell(internal, pos[internal_depth]);
+        chidb_Btree_insertCell(internal, pos[internal_depth], &cell);
+        rc = chidb_Btree_writeNode(bt, internal);
+        chidb_Btree_freeMemNode(bt, internal);
+        if (rc != CHIDB_OK)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return rc;
+        }
+    }
+    else if (btn->type == PGTYPE_TABLE_LEAF)
+    {
+        BTreeCell cell;
+        chidb_Btree_getCell(btn, pos[depth], &cell);
+        overflow_page = cell.fields.tableLeaf.overflow_page;
+    }
+
+    chidb_Btree_removeCell(btn, pos[depth]);
+    rc = chidb_Btree_writeNode(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+    if (rc != CHIDB_OK || (rc = free_overflow(bt, overflow_page)) != CHIDB_OK)
+    {
+        return rc;
+    }
+
+    // the rightmost leaf may be merged away
+    BTreeAppendCursor *ac = append_cursor(bt, nroot);
+    if (ac->nroot == nroot)
+    {
+        ac->nroot = 0;
     }
-    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+
+    // balancing the underfull nodes, bottom-up
+    for (; depth > 0; depth--)
     {
-        npage_t insertion_page;
-        if (j == btn->n_cells)
+        BTreeNode *parent;
+        if ((rc = chidb_Btree_getNodeByPage(bt, path[depth], &btn)) != CHIDB_OK)
         {
-            insertion_page = btn->right_page;
+            return rc;
         }
-        else
+        bool underfull = node_underfull(btn);
+        chidb_Btree_freeMemNode(bt, btn);
+        if (!underfull)
         {
-            insertion_page = btn->type == PGTYPE_TABLE_INTERNAL ? curr_cell.fields.tableInternal.child_page : curr_cell.fields.indexInternal.child_page;
+            break;
         }
-        BTreeNode *child_node;
-        chidb_Btree_getNodeByPage(bt, insertion_page, &child_node);
-        if (!node_has_space(child_node, btc))
+        if ((rc = chidb_Btree_getNodeByPage(bt, path[depth - 1], &parent)) != CHIDB_OK)
         {
-            npage_t new_child_n;
-            chidb_Btree_split(bt, npage, insertion_page, j, &new_child_n);
-            chidb_Btree_getNodeByPage(bt, npage, &btn);
-            BTreeCell new_cell_from_split;
-            chidb_Btree_getCell(btn, j, &new_cell_from_split);
-            if (btc->key <= new_cell_from_split.key)
+            return rc;
+        }
+        // a node whose parent has no cells has no siblings to balance it with
+        if (parent->n_cells > 0)
+        {
+            ncell_t nleft = pos[depth - 1] < parent->n_cells ? pos[depth - 1] : parent->n_cells - 1;
+            rc = balance_siblings(bt, parent, nleft);
+            if (rc == CHIDB_OK)
             {
-                insertion_page = btn->type == PGTYPE_TABLE_INTERNAL ? new_cell_from_split.fields.tableInternal.child_page : new_cell_from_split.fields.indexInternal.child_page;
-                chidb_Btree_freeMemNode(bt, btn);
-                return chidb_Btree_insertNonFull(bt, insertion_page, btc);
+                rc = chidb_Btree_writeNode(bt, parent);
             }
         }
-        chidb_Btree_freeMemNode(bt, btn);
-        return chidb_Btree_insertNonFull(bt, insertion_page, btc);
+        chidb_Btree_freeMemNode(bt, parent);
+        if (rc != CHIDB_OK)
+        {
+            return rc;
+        }
+    }
+
+    return collapse_root(bt, nroot);
+}
+
+
+/* Bulk loading
+ *
+ * A BTreeLoader builds a B-Tree bottom-up from a stream of cells sorted
+ * by key, instead of inserting them one at a time from the root. Cells
+ * are appended to the rightmost node of the leaf level until it reaches
+ * the fill factor; the node is then written out to a new page, and a
+ * cell pointing to it is appended to the level above (which is filled
+ * in the same way). No node is ever split, and every page is written
+ * once (the first time it is written, it is complete).
+ *
+ * Each level keeps the node being filled in a private page buffer, so
+ * the pages of a level are only allocated once they are complete. The
+ * last node of the topmost level becomes the root node.
+ *
+ * In table B-Trees, a full leaf is moved up with the largest key it
+ * contains. In index B-Trees (and in internal nodes) the cell that did
+ * not fit in a full node itself moves up, with the full node as its
+ * child. However, it is only moved up when the next cell arrives: if
+ * there is no next cell, the node would be left with no cells, so the
+ * pending cell is added to the full node instead (nodes are never
+ * filled so much that there is no room left for this cell).
+ */
+
+typedef struct BTreeLoaderLevel
+{
+    BTreeNode node;    /* Node being filled (its page is a private buffer) */
+    bool has_pending;  /* True if pending holds a cell */
+    BTreeCell pending; /* Cell that did not fit in the node */
+} BTreeLoaderLevel;
+
+struct BTreeLoader
+{
+    BTree *bt;
+    npage_t nroot;
+    uint8_t leaf_type;         /* PGTYPE_TABLE_LEAF or PGTYPE_INDEX_LEAF */
+    uint16_t fill_bytes;       /* Bytes of a node that are filled before it is considered full */
+    bool empty;                /* True if no cells have been appended */
+    chidb_key_t last_key;      /* Key of the last cell appended */
+    uint8_t nlevels;           /* Number of levels (level 0 is the leaf level) */
+    BTreeLoaderLevel *levels;
+};
+
+// initializes the node being filled at a level as an empty node
+static void bulk_reset_node(BTreeLoader *bl, BTreeNode *btn, uint8_t type)
+{
+    uint16_t header_size = is_internal(type) ? INTPG_CELLSOFFSET_OFFSET : LEAFPG_CELLSOFFSET_OFFSET;
+    btn->type = type;
+    btn->prefix_size = 0;
+    btn->free_offset = header_size;
+    btn->n_cells = 0;
+    btn->cells_offset = bl->bt->pager->page_size;
+    btn->right_page = 0;
+    btn->celloffset_array = btn->page->data + header_size;
+    btn->page_size = bl->bt->pager->page_size;
+}
+
+static int bulk_add_level(BTreeLoader *bl)
+{
+    BTreeLoaderLevel *levels = realloc(bl->levels, (bl->nlevels + 1) * sizeof(BTreeLoaderLevel));
+    if (levels == NULL)
+    {
+        return CHIDB_ENOMEM;
+    }
+    bl->levels = levels;
+
+    BTreeLoaderLevel *level = &bl->levels[bl->nlevels];
+    MemPage *buf = malloc(sizeof(MemPage));
+    uint8_t *data = calloc(1, bl->bt->pager->page_size);
+    if (buf == NULL || data == NULL)
+    {
+        free(buf);
+        free(data);
+        return CHIDB_ENOMEM;
+    }
+    buf->npage = 0;
+    buf->data = data;
+    level->node.page = buf;
+    level->has_pending = false;
+
+    uint8_t type = bl->leaf_type;
+    if (bl->nlevels > 0)
+    {
+        type = internal_type(bl->leaf_type);
     }
-    else if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+    bulk_reset_node(bl, &level->node, type);
+    bl->nlevels++;
+    return CHIDB_OK;
+}
+
+// returns true if a cell of the given size can be added to a node without going
+// over the fill factor. If keep_room is true, there must also be room left for
+// another cell of the same size.
+static bool bulk_fits(BTreeLoader *bl, BTreeNode *btn, uint16_t size, bool keep_room)
+{
+    uint32_t page_size = bl->bt->pager->page_size;
+    uint32_t used = btn->free_offset + (page_size - btn->cells_offset) + 2 + size;
+    uint32_t limit = bl->fill_bytes;
+    if (keep_room && limit > page_size - (size + 2))
+    {
+        limit = page_size - (size + 2);
+    }
+    return used <= limit;
+}
+
+// writes the node being filled at a level to page npage
+static int bulk_write_node(BTreeLoader *bl, BTreeNode *btn, npage_t npage)
+{
+    MemPage *buf = btn->page;
+    MemPage *page;
+    int rc = chidb_Pager_readPage(bl->bt->pager, npage, &page);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+    memcpy(page->data, buf->data, bl->bt->pager->page_size);
+    btn->page = page;
+    rc = chidb_Btree_writeNode(bl->bt, btn);
+    btn->page = buf;
+    chidb_Pager_releaseMemPage(bl->bt->pager, page);
+    return rc;
+}
+
+// writes the (complete) node being filled at a level to a new page, and
+// starts a new empty node in its place
+static int bulk_flush_node(BTreeLoader *bl, uint8_t nlevel, npage_t *npage)
+{
+    BTreeNode *btn = &bl->levels[nlevel].node;
+    int rc = chidb_Btree_allocatePage(bl->bt, npage);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+    rc = bulk_write_node(bl, btn, *npage);
+    if (rc != CHIDB_OK)
+    {
+        return rc;
+    }
+    bulk_reset_node(bl, btn, btn->type);
+    return CHIDB_OK;
+}
+
+// appends a cell to the node being filled at a level, moving the node up
+// to the next level if it is full
+static int bulk_append(BTreeLoader *bl, uint8_t nlevel, BTreeCell *cell)
+{
+    int rc;
+    if (nlevel == bl->nlevels && (rc = bulk_add_level(bl)) != CHIDB_OK)
     {
-        if (j == btn->n_cells)
+        return rc;
+    }
+    BTreeLoaderLevel *level = &bl->levels[nlevel];
+    BTreeNode *btn = &level->node;
+    uint16_t size = cell_size(btn->page_size, cell);
+
+    if (level->has_pending)
+    {
+        // the node is complete: the pending cell's child becomes its right page,
+        // and the pending cell moves up, with the node as its child
+        BTreeCell up;
+        level->has_pending = false;
+        up.key = level->pending.key;
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
         {
-            chilog(DEBUG, "Inserting cell into end of page %d at cell %d.", btn->page->npage, j);
-            chidb_Btree_insertCell(btn, btn->n_cells, btc);
-            int try_write = chidb_Btree_writeNode(bt, btn);
-            chidb_Btree_freeMemNode(bt, btn);
-            return try_write;
+            btn->right_page = level->pending.fields.tableInternal.child_page;
+            up.type = PGTYPE_TABLE_INTERNAL;
+            rc = bulk_flush_node(bl, nlevel, &up.fields.tableInternal.child_page);
         }
-        else if (j < btn->n_cells)
+        else
         {
-            chidb_Btree_insertCell(btn, j, btc);
-            int try_write = chidb_Btree_writeNode(bt, btn);
-            chidb_Btree_freeMemNode(bt, btn);
-            return try_write;
+            if (btn->type == PGTYPE_INDEX_INTERNAL)
+            {
+                btn->right_page = level->pending.fields.indexInternal.child_page;
+                up.fields.indexInternal.keyPk = level->pending.fields.indexInternal.keyPk;
+            }
+            else
+            {
+                up.fields.indexInternal.keyPk = level->pending.fields.indexLeaf.keyPk;
+            }
+            up.type = PGTYPE_INDEX_INTERNAL;
+            rc = bulk_flush_node(bl, nlevel, &up.fields.indexInternal.child_page);
+        }
+        if (rc != CHIDB_OK || (rc = bulk_append(bl, nlevel + 1, &up)) != CHIDB_OK)
+        {
+            return rc;
         }
+        // the levels may have been reallocated
+        level = &bl->levels[nlevel];
+        btn = &level->node;
     }
-    else
+
+    if (btn->type == PGTYPE_TABLE_LEAF)
     {
-        return CHIDB_ECORRUPT;
+        if (btn->n_cells > 0 && !bulk_fits(bl, btn, size, false))
+        {
+            // the leaf is complete, and moves up with its largest key
+            BTreeCell up;
+            up.type = PGTYPE_TABLE_INTERNAL;
+            up.key = cell_key(btn, btn->n_cells - 1);
+            rc = bulk_flush_node(bl, nlevel, &up.fields.tableInternal.child_page);
+            if (rc != CHIDB_OK || (rc = bulk_append(bl, nlevel + 1, &up)) != CHIDB_OK)
+            {
+                return rc;
+            }
+            btn = &bl->levels[nlevel].node;
+        }
+        if (!node_has_space(btn, cell))
+        {
+            // the cell does not fit even in an empty node
+            return CHIDB_EMISUSE;
+        }
     }
-    chilog(CRITICAL, "Invalid node type %d!", btn->type);
-    return CHIDB_ECORRUPT;
+    else if (btn->n_cells > 0 && !bulk_fits(bl, btn, size, true))
+    {
+        level->pending = *cell;
+        level->has_pending = true;
+        return CHIDB_OK;
+    }
+
+    return chidb_Btree_insertCell(btn, btn->n_cells, cell);
 }
 
-/* Split a B-Tree node
+static void bulk_free(BTreeLoader *bl)
+{
+    for (int i = 0; i < bl->nlevels; i++)
+    {
+        free(bl->levels[i].node.page->data);
+        free(bl->levels[i].node.page);
+    }
+    free(bl->levels);
+    free(bl);
+}
+
+/* Start bulk loading a B-Tree
  *
- * Splits a B-Tree node N. This involves the following:
- * - Find the median cell in N.
- * - Create a new B-Tree node M.
- * - Move the cells before the median cell to M (if the
- *   cell is a table leaf cell, the median cell is moved too)
- * - Add a cell to the parent (which, by definition, will be an
- *   internal page) with the median key and the page number of M.
+ * Creates a BTreeLoader that builds a B-Tree bottom-up from cells appended
+ * (in increasing key order) with chidb_Btree_bulkLoadAppend. This is much
+ * faster than inserting the cells one at a time, and produces a B-Tree
+ * whose nodes are all filled up to the requested fill factor. The
+ * B-Tree is complete once chidb_Btree_bulkLoadEnd is called.
+ *
+ * The B-Tree must be empty (i.e., its root must be an empty leaf node).
+ * Its root page must not be page 1. Text index B-Trees cannot be bulk
+ * loaded (their entries are inserted in order with chidb_Btree_insert,
+ * which splits the rightmost leaf asymmetrically, and so leaves its
+ * nodes almost full).
  *
  * Parameters
  * - bt: B-Tree file
- * - npage_parent: Page number of the parent node
- * - npage_child: Page number of the node to split
- * - parent_ncell: Position in the parent where the new cell will
- *                 be inserted.
- * - npage_child2: Out parameter. Used to return the page of the new child node.
+ * - nroot: Page number of the root node of the (empty) B-Tree to load
+ * - fill: Percentage of each node that is filled (1-100). Nodes are
+ *         never filled over this percentage, except to make room for
+ *         at least one cell.
+ * - bl: Out parameter. Used to return a pointer to the BTreeLoader
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is not empty, or fill is out of range
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+int chidb_Btree_bulkLoadBegin(BTree *bt, npage_t nroot, uint8_t fill, BTreeLoader **bl)
 {
-    /* Your code goes here */
-    BTreeNode *child_node;
-    int try_get_child = chidb_Btree_getNodeByPage(bt, npage_child, &child_node);
-    if (try_get_child != CHIDB_OK)
+    BTreeNode *root;
+    uint8_t type;
+    int rc;
+
+    if (nroot == 1 || fill == 0 || fill > 100)
     {
-        return try_get_child;
+        return CHIDB_EMISUSE;
     }
-    BTreeNode *parent_node;
-    int try_get_parent = chidb_Btree_getNodeByPage(bt, npage_parent, &parent_node);
-    if (try_get_parent != CHIDB_OK)
+    if ((rc = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
     {
-        return try_get_parent;
+        return rc;
     }
-    npage_t new_page_n;
-    int try_new_node = chidb_Btree_newNode(bt, &new_page_n, child_node->type);
-    if (try_new_node != CHIDB_OK)
+    type = root->type;
+    bool empty = root->n_cells == 0;
+    chidb_Btree_freeMemNode(bt, root);
+    if (!empty || (type != PGTYPE_TABLE_LEAF && type != PGTYPE_INDEX_LEAF))
     {
-        return try_new_node;
+        return CHIDB_EMISUSE;
     }
-    chilog(INFO, "SPLIT PAGE %d containing %d cells WITH PARENT %d, NEW PAGE IS %d",
-           npage_child, child_node->n_cells, npage_parent, new_page_n);
-    BTreeNode *new_node;
-    int try_get_new_node = chidb_Btree_getNodeByPage(bt, new_page_n, &new_node);
-    if (try_get_new_node != CHIDB_OK)
+
+    BTreeLoader *_bl = malloc(sizeof(BTreeLoader));
+    if (_bl == NULL)
     {
-        return try_get_new_node;
+        return CHIDB_ENOMEM;
     }
-    ncell_t median_cell_n = (child_node->n_cells - 1) / 2;
-    BTreeCell median_cell;
-    transfer_cells(bt, new_node, &child_node, median_cell_n + 1, &median_cell);
-    BTreeCell insert_parent;
-    insert_parent.type = parent_node->type;
-    insert_parent.key = median_cell.key;
-    if (parent_node->type == PGTYPE_TABLE_INTERNAL)
+    _bl->bt = bt;
+    _bl->nroot = nroot;
+    _bl->leaf_type = type;
+    _bl->fill_bytes = (uint32_t) bt->pager->page_size * fill / 100;
+    _bl->empty = true;
+    _bl->last_key = 0;
+    _bl->nlevels = 0;
+    _bl->levels = NULL;
+    if ((rc = bulk_add_level(_bl)) != CHIDB_OK)
     {
-        insert_parent.fields.tableInternal.child_page = new_page_n;
+        bulk_free(_bl);
+        return rc;
+    }
+    *bl = _bl;
+    return CHIDB_OK;
+}
+
+/* Append a cell to a B-Tree that is being bulk loaded
+ *
+ * Cells must be appended in strictly increasing key order, and must be
+ * leaf cells of the type of B-Tree being loaded (PGTYPE_TABLE_LEAF or
+ * PGTYPE_INDEX_LEAF). The cell is copied, so it can be reused once
+ * this function returns. Table data that does not fit in a cell is
+ * written to overflow pages, as in chidb_Btree_insert.
+ *
+ * Parameters
+ * - bl: BTreeLoader
+ * - btc: Cell to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The cell has the same key as the previous cell
+ * - CHIDB_EMISUSE: The cell is out of order, or has the wrong type
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bulkLoadAppend(BTreeLoader *bl, BTreeCell *btc)
+{
+    if (btc->type != bl->leaf_type)
+    {
+        return CHIDB_EMISUSE;
     }
-    else if (parent_node->type == PGTYPE_INDEX_INTERNAL)
+    if (!bl->empty && btc->key <= bl->last_key)
     {
-        insert_parent.fields.indexInternal.child_page = new_page_n;
-        insert_parent.fields.indexInternal.keyPk = median_cell.fields.indexInternal.keyPk;
+        return btc->key == bl->last_key ? CHIDB_EDUPLICATE : CHIDB_EMISUSE;
     }
-    chidb_Btree_insertCell(parent_node, parent_ncell, &insert_parent);
-    *npage_child2 = new_page_n;
 
-    chidb_Btree_writeNode(bt, parent_node);
-    chidb_Btree_writeNode(bt, new_node);
-    chidb_Btree_writeNode(bt, child_node);
+    BTreeCell cell = *btc;
+    int rc = cell.type == PGTYPE_TABLE_LEAF ? write_overflow(bl->bt, &cell) : CHIDB_OK;
+    if (rc == CHIDB_OK)
+    {
+        rc = bulk_append(bl, 0, &cell);
+    }
+    if (rc == CHIDB_OK)
+    {
+        bl->empty = false;
+        bl->last_key = btc->key;
+    }
+    return rc;
+}
 
-    chidb_Btree_freeMemNode(bt, parent_node);
-    chidb_Btree_freeMemNode(bt, new_node);
-    chidb_Btree_freeMemNode(bt, child_node);
+/* Finish bulk loading a B-Tree
+ *
+ * Writes out the nodes that are still being filled, turning the topmost
+ * one into the root node, and frees the BTreeLoader (which must not be
+ * used after calling this function, even if it fails).
+ *
+ * Parameters
+ * - bl: BTreeLoader
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bulkLoadEnd(BTreeLoader *bl)
+{
+    npage_t child = 0;
+    int rc = CHIDB_OK;
 
-    return CHIDB_OK;
+    // the nodes being filled are the rightmost nodes of each level,
+    // so each one is the right page of the one above it
+    for (uint8_t i = 0; i < bl->nlevels && rc == CHIDB_OK; i++)
+    {
+        BTreeLoaderLevel *level = &bl->levels[i];
+        BTreeNode *btn = &level->node;
+        if (level->has_pending)
+        {
+            // there is always room left for the pending cell (see bulk_fits)
+            rc = chidb_Btree_insertCell(btn, btn->n_cells, &level->pending);
+        }
+        if (i > 0)
+        {
+            btn->right_page = child;
+        }
+        if (rc != CHIDB_OK)
+        {
+            break;
+        }
+        if (i == bl->nlevels - 1)
+        {
+            rc = bulk_write_node(bl, btn, bl->nroot);
+        }
+        else
+        {
+            rc = bulk_flush_node(bl, i, &child);
+        }
+    }
+
+    // the leaves were not written through chidb_Btree_insert
+    BTreeAppendCursor *ac = append_cursor(bl->bt, bl->nroot);
+    if (ac->nroot == bl->nroot)
+    {
+        ac->nroot = 0;
+    }
+
+    bulk_free(bl);
+    return rc;
 }
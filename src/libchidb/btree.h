@@ -49,12 +49,21 @@
 #define PGTYPE_TABLE_LEAF (0x0D)
 #define PGTYPE_INDEX_INTERNAL (0x02)
 #define PGTYPE_INDEX_LEAF (0x0A)
+#define PGTYPE_TEXTINDEX_INTERNAL (0x03)
+#define PGTYPE_TEXTINDEX_LEAF (0x0B)
+
+/* File header offsets */
+
+#define HEADER_FREELIST_TRUNK_OFFSET (32)
+#define HEADER_FREELIST_COUNT_OFFSET (36)
+#define HEADER_SCHEMA_COOKIE_OFFSET (40)
 
 #define PGHEADER_PGTYPE_OFFSET (0)
 #define PGHEADER_FREE_OFFSET (1)
 #define PGHEADER_NCELLS_OFFSET (3)
 #define PGHEADER_CELL_OFFSET (5)
 #define PGHEADER_ZERO_OFFSET (7)
+#define PGHEADER_PREFIX_OFFSET (7)
 #define PGHEADER_RIGHTPG_OFFSET (8)
 
 #define LEAFPG_CELLSOFFSET_OFFSET (8)
@@ -83,6 +92,84 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Text index B-Trees
+ *
+ * Indexes on TEXT columns use their own page types. Their keys are byte
+ * strings of up to BTREE_MAX_TEXTKEY bytes, ordered with memcmp (a key
+ * that is a prefix of another key comes before it). An internal cell
+ * holds the child page, the size of the key, the primary key and the key.
+ *
+ * Leaves are prefix-compressed: the bytes that all the keys in a leaf start
+ * with are stored once, at the end of the page, and the byte at
+ * PGHEADER_PREFIX_OFFSET (which is 0 in every other type of node) holds
+ * their number. A leaf cell only holds the size of the rest of its key
+ * (its suffix), the primary key and the suffix. Inserting a key that does
+ * not start with the whole prefix shortens the prefix of the leaf (and
+ * rewrites the suffixes of its other cells). BTREE_MAX_TEXTKEY is chosen
+ * so that at least BTREE_MIN_TEXT_CELLS cells fit in any node.
+ *
+ * Entries are not removed from text index B-Trees. Instead, they are
+ * delete-marked, by setting the TEXTCELL_DELETED bit of the size field of
+ * their cell (see chidb_Btree_deleteFromTextIndex). A delete-marked entry
+ * keeps its place in the B-Tree, but it is not found anymore, and inserting
+ * its key again reuses its cell. */
+#define TEXTINTCELL_CHILD_OFFSET (0)
+#define TEXTINTCELL_SIZE_OFFSET (4)
+#define TEXTINTCELL_KEYPK_OFFSET (6)
+#define TEXTINTCELL_KEY_OFFSET (10)
+
+#define TEXTLEAFCELL_SIZE_OFFSET (0)
+#define TEXTLEAFCELL_KEYPK_OFFSET (2)
+#define TEXTLEAFCELL_KEY_OFFSET (6)
+
+#define TEXTCELL_DELETED (0x8000)
+
+#define TEXTINTCELL_SIZE_WITHOUTKEY (10)
+#define TEXTLEAFCELL_SIZE_WITHOUTKEY (6)
+
+#define BTREE_MIN_TEXT_CELLS (4)
+#define BTREE_MAX_TEXTKEY(page_size) \
+    ((((page_size) - INTPG_CELLSOFFSET_OFFSET) / BTREE_MIN_TEXT_CELLS \
+      - 2 - TEXTINTCELL_SIZE_WITHOUTKEY) < UINT8_MAX ? \
+     (((page_size) - INTPG_CELLSOFFSET_OFFSET) / BTREE_MIN_TEXT_CELLS \
+      - 2 - TEXTINTCELL_SIZE_WITHOUTKEY) : UINT8_MAX)
+
+/* Overflow pages
+ *
+ * A table leaf cell stores at most BTREE_MAX_LOCAL bytes of data. If an
+ * entry has more data than that, the cell only stores the first
+ * BTREE_MAX_LOCAL bytes, followed by the (4-byte) number of the first page
+ * in a chain of overflow pages holding the rest of the data. Each overflow
+ * page starts with the number of the next page in the chain (0 in the
+ * last page), followed by up to (page_size - OVERFLOWPG_DATA_OFFSET) bytes
+ * of data. BTREE_MAX_LOCAL is chosen so that at least BTREE_MIN_LEAF_CELLS
+ * cells fit in any leaf (including page 1, which also holds the file
+ * header), which keeps the fanout of leaves high. */
+#define OVERFLOWPG_NEXT_OFFSET (0)
+#define OVERFLOWPG_DATA_OFFSET (4)
+#define TABLELEAFCELL_OVERFLOW_SIZE (4)
+
+#define BTREE_MIN_LEAF_CELLS (4)
+#define BTREE_MAX_LOCAL(page_size) \
+    (((page_size) - 100 - LEAFPG_CELLSOFFSET_OFFSET) / BTREE_MIN_LEAF_CELLS \
+     - 2 - TABLELEAFCELL_SIZE_WITHOUTDATA - TABLELEAFCELL_OVERFLOW_SIZE)
+
+/* Freelist pages
+ *
+ * Pages that are no longer used by any B-Tree are kept in a freelist, so
+ * they can be reused before the file is grown. The file header holds the
+ * first freelist trunk page and the total number of free pages. Each trunk
+ * page holds the number of the next trunk page (0 in the last one), the
+ * number of leaf pages it lists, and the numbers of those leaf pages (which
+ * are free pages with no other content). */
+#define FREELISTPG_NEXT_OFFSET (0)
+#define FREELISTPG_NLEAVES_OFFSET (4)
+#define FREELISTPG_LEAVES_OFFSET (8)
+#define FREELISTPG_MAX_LEAVES(page_size) (((page_size) - FREELISTPG_LEAVES_OFFSET) / 4)
+
+/* Maximum height of a B-Tree that can be modified with chidb_Btree_delete */
+#define BTREE_MAX_DEPTH (32)
+
 #define SCHEMA_TYPE_TABLE (1)
 #define SCHMEA_TYPE_INDEX (2)
 
@@ -90,6 +177,21 @@
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
 
+/* Number of B-Trees for which an append cursor is kept */
+#define BTREE_APPEND_CURSORS (4)
+
+/* An append cursor remembers the rightmost leaf of a B-Tree after an entry
+ * is appended to it (i.e., inserted with a key larger than any other key in
+ * the B-Tree), so that the next append can go straight to that leaf without
+ * descending from the root (see chidb_Btree_insert in btree.c) */
+typedef struct BTreeAppendCursor
+{
+    npage_t nroot;         /* Root of the B-Tree (0 if the cursor is not valid) */
+    npage_t nleaf;         /* Rightmost leaf of the B-Tree */
+    chidb_key_t max_key;   /* Largest key in the B-Tree */
+    uint32_t generation;   /* Pager generation when the cursor was set */
+} BTreeAppendCursor;
+
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
  * use to access pages on the file */
@@ -97,6 +199,12 @@ typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    BTreeAppendCursor append[BTREE_APPEND_CURSORS]; /* Indexed by root page */
+    uint32_t shape;  /* Incremented whenever an internal node is written (see
+                      * chidb_Btree_writeNode), i.e., whenever the path from a
+                      * root to any of its leaves may have changed */
+    uint32_t writes; /* Incremented whenever any node is written, i.e., whenever
+                      * the contents of any cell may have changed */
 } Btree;
 
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
@@ -120,14 +228,30 @@ struct BTreeNode
     uint16_t cells_offset;     /* Byte offset of start of cells in page */
     npage_t right_page;        /* Right page (internal nodes only) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    uint16_t page_size;        /* Size of the page (determines how much data a cell can hold) */
+    uint8_t prefix_size;       /* Size of the common key prefix (text index leaves only) */
 };
 
+/* The key of a text index entry. A key read from a prefix-compressed leaf
+ * is split in two parts (the leaf's prefix and the cell's suffix), both
+ * pointing into the page. Any other key only has a suffix. */
+typedef struct BTreeTextKey
+{
+    uint8_t *prefix;      /* First bytes of the key */
+    uint16_t prefix_size;
+    uint8_t *suffix;      /* Rest of the key */
+    uint16_t suffix_size;
+} BTreeTextKey;
+
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
- * document for more details on the meaning of each field */
+ * document for more details on the meaning of each field. Text index cells
+ * keep their key in tkey, and use the fields of index cells for the rest. */
 struct BTreeCell
 {
     uint8_t type;    /* Type of page where this cell is contained */
     chidb_key_t key; /* Key */
+    BTreeTextKey tkey; /* Key (text index cells only) */
+    bool deleted;      /* Delete-marked entry (text index cells only) */
     union
     {
         struct
@@ -136,8 +260,10 @@ struct BTreeCell
         } tableInternal;
         struct
         {
-            uint32_t data_size; /* Number of bytes of data stored in this cell */
-            uint8_t *data;      /* Pointer to in-memory copy of data stored in this cell */
+            uint32_t data_size;     /* Number of bytes of data of this entry */
+            uint8_t *data;          /* Pointer to in-memory copy of data stored in this cell */
+            uint32_t local_size;    /* Number of bytes of data stored in the cell itself */
+            npage_t overflow_page;  /* First overflow page with the rest of the data (0 if none) */
         } tableLeaf;
         struct
         {
@@ -151,11 +277,40 @@ struct BTreeCell
     } fields;
 };
 
+/* A BTreeView is a view of the data of a table entry that points directly
+ * into the in-memory page that contains it, instead of into a copy of it.
+ * The page stays pinned in the pager's cache (and the view stays valid)
+ * until the view is released with chidb_Btree_releaseView. Entries whose
+ * data continues in overflow pages are not contiguous in any page, so
+ * their views point to a copy of the data instead. */
+typedef struct BTreeView
+{
+    MemPage *page;  /* Pinned page (NULL if the view does not pin a page) */
+    uint8_t *data;  /* Pointer to the entry's data in the page */
+    uint32_t size;  /* Number of bytes of data */
+    uint8_t *copy;  /* Copy of the data owned by the view (NULL if none) */
+} BTreeView;
+
+/* A BTreeLoader builds a B-Tree bottom-up from cells given in key order
+ * (see chidb_Btree_bulkLoadBegin in btree.c) */
+typedef struct BTreeLoader BTreeLoader;
+
+/* Default fill factor (percentage of each node that is filled) for bulk loads */
+#define BTREE_BULKLOAD_DEFAULT_FILL (90)
+
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
 int chidb_Btree_close(BTree *bt);
 
+int chidb_Btree_getSchemaCookie(BTree *bt, uint32_t *cookie);
+int chidb_Btree_setSchemaCookie(BTree *bt, uint32_t cookie);
+
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
+int chidb_Btree_getNodeByPageReadOnly(BTree *bt, npage_t npage, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
+int chidb_Btree_refreshNode(BTree *bt, BTreeNode *btn);
+
+int chidb_Btree_allocatePage(BTree *bt, npage_t *npage);
+int chidb_Btree_freePage(BTree *bt, npage_t npage);
 
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
@@ -163,13 +318,30 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+int chidb_Btree_removeCell(BTreeNode *btn, ncell_t ncell);
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell);
+int chidb_Btree_searchNodeText(BTreeNode *btn, const uint8_t *key, uint16_t size, ncell_t *ncell);
+int chidb_Btree_compareTextKey(BTreeTextKey *tkey, const uint8_t *key, uint16_t size);
 
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_findView(BTree *bt, npage_t nroot, chidb_key_t key, BTreeView *view);
+int chidb_Btree_releaseView(BTree *bt, BTreeView *view);
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *btc, uint32_t offset, uint32_t n, uint8_t *buf);
+int chidb_Btree_partition(BTree *bt, npage_t nroot, uint32_t nparts, chidb_key_t *bounds, uint32_t *nbounds);
 
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_Btree_insertInTextIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t keyPk);
+int chidb_Btree_findInTextIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size, chidb_key_t *keyPk);
+int chidb_Btree_deleteFromTextIndex(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
 
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key);
+
+int chidb_Btree_bulkLoadBegin(BTree *bt, npage_t nroot, uint8_t fill, BTreeLoader **bl);
+int chidb_Btree_bulkLoadAppend(BTreeLoader *bl, BTreeCell *btc);
+int chidb_Btree_bulkLoadEnd(BTreeLoader *bl);
+
 #endif /*BTREE_H_*/
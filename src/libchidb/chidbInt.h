@@ -47,6 +47,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 #include <chidb/chidb.h>
 
 // Private codes (shouldn't be used by API users)
@@ -62,6 +63,9 @@
 
 #define DEFAULT_PAGE_SIZE (1024)
 
+/* Default number of pages kept in the pager's page cache */
+#define DEFAULT_CACHE_SIZE (2000)
+
 #define MAX_STR_LEN (256)
 
 typedef uint16_t ncell_t;
@@ -85,6 +89,7 @@ struct ChidbSchema
   char *assoc_table_name;
   npage_t root_npage;
   char *sql;
+  int hash_next; /* Index of the next schema in the same hash bucket (-1 if none) */
 };
 
 /* code */
@@ -99,8 +104,40 @@ struct chidb
   BTree *bt;
   ChidbSchema *schema_list;
   int nSchema;
+
+  /* The schema is only reloaded when the schema cookie in the file
+   * header no longer matches the one it was loaded with */
+  bool schema_loaded;
+  uint32_t schema_cookie;
+  int *schema_hash; /* Buckets: index of first schema in schema_list (-1 if none) */
+  int nSchemaBuckets;
+
+  /* Database lock, only used if the database was opened with
+   * CHIDB_OPEN_THREADSAFE (see db_lock in api.c) */
+  bool threadsafe;
+  pthread_mutex_t lock_mutex; /* Protects the fields below */
+  pthread_cond_t lock_cond;   /* Signaled when the lock is released */
+  uint32_t n_readers;         /* Statements holding the lock to read */
+  bool writer;                /* Held by a statement (or transaction) that writes */
+  pthread_t writer_thread;    /* Thread running the writer */
+  uint32_t writer_depth;      /* Statements of writer_thread holding the lock */
+  uint32_t n_waiting;         /* Writers waiting for the readers to finish */
+  bool upgrading;             /* A thread holding read locks is waiting to write */
+  pthread_key_t reads_key;    /* Read locks held by each thread */
+  pthread_mutex_t schema_mutex; /* Serializes loading and using the cached schema */
 };
 
+/* How a statement holds the database lock */
+typedef enum chidb_lock
+{
+  CHIDB_LOCK_NONE = 0,
+  CHIDB_LOCK_READ,
+  CHIDB_LOCK_WRITE,
+  CHIDB_LOCK_NESTED /* Run by the thread that holds the writer lock */
+} chidb_lock_t;
+
 void schema_free(ChidbSchema *schema);
+int load_schema(chidb *db);
+void schema_invalidate(chidb *db);
 
 #endif /*CHIDBINT_H_*/
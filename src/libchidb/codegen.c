@@ -58,6 +58,10 @@ static int chidb_stmt_codegen_simple_create_table(chidb_stmt *stmt, chisql_state
 
 static int chidb_stmt_codegen_create_index(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
 
+static int chidb_stmt_codegen_delete(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
+
+static int chidb_stmt_codegen_transaction(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
+
 static int chidb_stmt_validate_schema_exists(chidb_stmt *stmt, char *schema_name, int *root_npage)
 {
   npage_t _root_npage = schema_root_page(stmt->db, schema_name);
@@ -180,25 +184,25 @@ static int chidb_stmt_validate_insert_cols(chidb_stmt *stmt, chisql_statement_t
   return CHIDB_OK;
 }
 
-static int chidb_stmt_validate_simple_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+// checks that a WHERE condition compares a column of the table to a value of the
+// same type (a parameter takes the type of the column).
+static int chidb_stmt_validate_simple_cond(chidb_stmt *stmt, char *table_name, Condition_t *cond)
 {
-  SRA_t *select = sql_stmt->stmt.select;
-  SRA_Project_t sra_project = select->project;
-  SRA_Select_t sra_select = sra_project.sra->select;
-  SRA_Table_t sra_table = sra_select.sra->table;
-  char *cmp_col_name = sra_select.cond->cond.comp.expr1->expr.term.ref->columnName;
-  enum data_type col_type = table_col_type(stmt->db, sra_table.ref->table_name, cmp_col_name);
-  enum data_type cmp_type = sra_select.cond->cond.comp.expr2->expr.term.val->t;
-  if (col_type != cmp_type)
+  char *cmp_col_name = cond->cond.comp.expr1->expr.term.ref->columnName;
+  enum data_type col_type = table_col_type(stmt->db, table_name, cmp_col_name);
+  Literal_t *cmp_val = cond->cond.comp.expr2->expr.term.val;
+  enum data_type cmp_type = cmp_val->t;
+  // a parameter takes the type of the column
+  if (col_type != cmp_type && cmp_type != TYPE_PARAM)
   {
     // support comparison of a string to a char
     if (cmp_type == TYPE_CHAR || col_type == TYPE_TEXT)
     {
-      select->project.sra->select.cond->cond.comp.expr2->expr.term.val->t = TYPE_TEXT;
+      cmp_val->t = TYPE_TEXT;
       char *str_from_char = malloc(2);
-      str_from_char[0] = select->project.sra->select.cond->cond.comp.expr2->expr.term.val->val.cval;
+      str_from_char[0] = cmp_val->val.cval;
       str_from_char[1] = '\0';
-      select->project.sra->select.cond->cond.comp.expr2->expr.term.val->val.strval = str_from_char;
+      cmp_val->val.strval = str_from_char;
     }
     else
     {
@@ -209,6 +213,15 @@ static int chidb_stmt_validate_simple_select(chidb_stmt *stmt, chisql_statement_
   return CHIDB_OK;
 }
 
+static int chidb_stmt_validate_simple_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+  SRA_t *select = sql_stmt->stmt.select;
+  SRA_Project_t sra_project = select->project;
+  SRA_Select_t sra_select = sra_project.sra->select;
+  SRA_Table_t sra_table = sra_select.sra->table;
+  return chidb_stmt_validate_simple_cond(stmt, sra_table.ref->table_name, sra_select.cond);
+}
+
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
   load_schema(stmt->db);
@@ -275,6 +288,14 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     chilog(DEBUG, "Creating index");
     return chidb_stmt_codegen_create_index(stmt, sql_stmt);
   }
+  else if (sql_stmt->type == STMT_DELETE)
+  {
+    return chidb_stmt_codegen_delete(stmt, sql_stmt);
+  }
+  else if (sql_stmt->type == STMT_BEGIN || sql_stmt->type == STMT_COMMIT || sql_stmt->type == STMT_ROLLBACK)
+  {
+    return chidb_stmt_codegen_transaction(stmt, sql_stmt);
+  }
   int opnum = 0;
   int nOps;
 
@@ -365,6 +386,108 @@ static int simple_col_codegen(chidb_stmt *stmt, int addr_start, int cursor, int
   return CHIDB_OK;
 }
 
+// sets the instruction in addr to load a parameter (? or :name) into register reg.
+// type is the type of the column the parameter is stored in or compared to.
+static int param_codegen(chidb_stmt *stmt, Literal_t *param, enum data_type type, int reg, int addr)
+{
+  uint32_t n;
+  if (chidb_stmt_add_param(stmt, param->val.strval, type, &n) != CHIDB_OK)
+  {
+    chilog(WARNING, "Parameter %s is used with more than one type", param->val.strval);
+    return CHIDB_EINVALIDSQL;
+  }
+  chidb_dbm_op_t op_variable = {Op_Variable, n, reg, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_variable, addr);
+  return CHIDB_OK;
+}
+
+// an index on more than one column, or with INCLUDE columns, is a record index: its entries
+// are kept in a text index B-Tree, with keys made by IdxKey from the values of several columns.
+static bool index_is_record(Index_t *index)
+{
+  return index->columns->next != NULL || index->include != NULL;
+}
+
+// number of values in the keys of a record index: its columns, the primary key (which makes
+// every key unique), and its INCLUDE columns, in this order. if names is not NULL, the names
+// of their columns are stored in it.
+static int record_index_cols(chidb_stmt *stmt, Index_t *index, char **names)
+{
+  int n = 0;
+  for (StrList_t *col = index->columns; col != NULL; col = col->next, n++)
+  {
+    if (names != NULL)
+    {
+      names[n] = col->str;
+    }
+  }
+  if (names != NULL)
+  {
+    ChidbSchema schema;
+    get_schema(stmt->db, index->table_name, &schema);
+    for (Column_t *col = schema.table->columns; col != NULL; col = col->next)
+    {
+      if (is_pkey(stmt->db, index->table_name, col->name))
+      {
+        names[n] = col->name;
+      }
+    }
+  }
+  n++;
+  for (StrList_t *col = index->include; col != NULL; col = col->next, n++)
+  {
+    if (names != NULL)
+    {
+      names[n] = col->str;
+    }
+  }
+  return n;
+}
+
+// number of values in the keys of a record index that are searched on: its columns and the
+// primary key. they must fit in a text index key (see BTREE_MAX_TEXTKEY), while the INCLUDE
+// values after them are left out of keys they do not fit in (see IdxInclude).
+static int record_index_search_cols(Index_t *index)
+{
+  int n = 1;
+  for (StrList_t *col = index->columns; col != NULL; col = col->next)
+  {
+    n++;
+  }
+  return n;
+}
+
+// the record indexes on a table. returns their number, and stores (up to max of) them in indexes.
+static int table_record_indexes(chidb_stmt *stmt, char *table_name, ChidbSchema **indexes, int max)
+{
+  int n = 0;
+  for (int i = 0; i < stmt->db->nSchema && n < max; i++)
+  {
+    ChidbSchema *schema = stmt->db->schema_list + i;
+    if (schema->type == CREATE_INDEX && strcmp(schema->assoc_table_name, table_name) == 0 &&
+        index_is_record(schema->index))
+    {
+      indexes[n++] = schema;
+    }
+  }
+  return n;
+}
+
+// sets the instruction in addr to load column col_name of the row cursor is at into register reg.
+static void table_col_codegen(chidb_stmt *stmt, char *table_name, char *col_name, int cursor, int reg, int addr)
+{
+  if (is_pkey(stmt->db, table_name, col_name))
+  {
+    chidb_dbm_op_t op_key = {Op_Key, cursor, reg, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_key, addr);
+  }
+  else
+  {
+    chidb_dbm_op_t op_column = {Op_Column, cursor, table_col_n(stmt->db, table_name, col_name), reg, NULL};
+    chidb_stmt_set_op(stmt, &op_column, addr);
+  }
+}
+
 static int chidb_stmt_codegen_simple_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, int nCols, int pkey_n, int root_npage)
 {
   SRA_t *select = sql_stmt->stmt.select;
@@ -436,41 +559,285 @@ static enum opcode simple_cmp_condtype_opcode(enum CondType condtype)
   }
 }
 
-static int chidb_stmt_codegen_range_query_indexed(chidb_stmt *stmt, chisql_statement_t *sql_stmt, int nCols)
+// the variant of comparison cmp (see FOREACH_TYPED_CMP_OP in dbm-types.h) for a column of
+// the given type: integer columns are compared with the integer in the instruction if imm
+// is true. comparisons of columns of other types are not specialized.
+#define TYPED_CMP_CASES(ARG, CMP, OPERATOR) \
+  case Op_##CMP:                            \
+    if (type == TYPE_TEXT)                  \
+      return Op_##CMP##Str;                 \
+    return imm ? Op_##CMP##Imm : Op_##CMP##Int;
+
+static enum opcode typed_cmp_opcode(enum opcode cmp, enum data_type type, bool imm)
+{
+  if (type != TYPE_INT && type != TYPE_TEXT)
+  {
+    return cmp;
+  }
+  switch (cmp)
+  {
+    FOREACH_CMP(TYPED_CMP_CASES, _)
+  default:
+    return cmp;
+  }
+}
+
+// sets the instruction in addr to load the value a WHERE condition compares a column to
+// into register 1.
+static int cond_value_codegen(chidb_stmt *stmt, char *table_name, Condition_t *cond, int addr)
 {
+  char *cmp_col_name = cond->cond.comp.expr1->expr.term.ref->columnName;
+  Literal_t *cmp_val = cond->cond.comp.expr2->expr.term.val;
+  if (cmp_val->t == TYPE_INT)
+  {
+    chidb_dbm_op_t op_int = {Op_Integer, cmp_val->val.ival, 1, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_int, addr);
+  }
+  else if (cmp_val->t == TYPE_TEXT)
+  {
+    chidb_dbm_op_t op_text = {Op_String, strlen(cmp_val->val.strval), 1, 0, cmp_val->val.strval};
+    chidb_stmt_set_op(stmt, &op_text, addr);
+  }
+  else if (cmp_val->t == TYPE_PARAM)
+  {
+    enum data_type col_type = table_col_type(stmt->db, table_name, cmp_col_name);
+    if (param_codegen(stmt, cmp_val, col_type, 1, addr) != CHIDB_OK)
+    {
+      return CHIDB_EINVALIDSQL;
+    }
+  }
+  return CHIDB_OK;
 }
 
-static int chidb_stmt_codegen_simple_select_where(chidb_stmt *stmt, chisql_statement_t *sql_stmt, int nCols, int pkey_n, int root_npage)
+// fills instructions addr_start thru addr_start + 2, which compare the column of the WHERE
+// condition cond of the row cursor is at (loaded into register 2) with register 1. jumps to
+// match_addr if the row satisfies the condition, and to nomatch_addr otherwise. the
+// comparison is the variant for the type of the column, and an integer literal is
+// compared directly (see typed_cmp_opcode).
+static void simple_cond_check_codegen(chidb_stmt *stmt, char *table_name, Condition_t *cond, int cursor, int addr_start, int match_addr, int nomatch_addr)
 {
-  SRA_t *select = sql_stmt->stmt.select;
-  SRA_Project_t sra_project = select->project;
-  SRA_Select_t sra_select = sra_project.sra->select;
-  SRA_Table_t sra_table = sra_select.sra->table;
-  // check the select where clause
-  char *cmp_col_name = sra_select.cond->cond.comp.expr1->expr.term.ref->columnName;
-  enum data_type cmp_type = sra_select.cond->cond.comp.expr2->expr.term.val->t;
-  if (is_pkey(stmt->db, sra_table.ref->table_name, cmp_col_name))
+  char *cmp_col_name = cond->cond.comp.expr1->expr.term.ref->columnName;
+  Literal_t *cmp_val = cond->cond.comp.expr2->expr.term.val;
+  if (is_pkey(stmt->db, table_name, cmp_col_name))
   {
-    chidb_dbm_op_t op_key = {Op_Key, 0, 2, 0, NULL};
-    chidb_stmt_set_op(stmt, &op_key, 4);
+    chidb_dbm_op_t op_key = {Op_Key, cursor, 2, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_key, addr_start);
   }
   else
   {
-    chidb_dbm_op_t op_column = {Op_Column, 0, table_col_n(stmt->db, sra_table.ref->table_name, cmp_col_name), 2, NULL};
-    chidb_stmt_set_op(stmt, &op_column, 4);
+    chidb_dbm_op_t op_column = {Op_Column, cursor, table_col_n(stmt->db, table_name, cmp_col_name), 2, NULL};
+    chidb_stmt_set_op(stmt, &op_column, addr_start);
+  }
+
+  enum data_type col_type = table_col_type(stmt->db, table_name, cmp_col_name);
+  bool imm = col_type == TYPE_INT && cmp_val->t == TYPE_INT;
+  chidb_dbm_op_t op_cmp = {typed_cmp_opcode(simple_cmp_condtype_opcode(cond->t), col_type, imm), imm ? cmp_val->val.ival : 1,
+                           match_addr, 2, NULL};
+  chidb_stmt_set_op(stmt, &op_cmp, addr_start + 1);
+  chidb_dbm_op_t op_unconditional_jump = {Op_Goto, 0, nomatch_addr, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_unconditional_jump, addr_start + 2);
+}
+
+// fills instructions addr_start thru addr_start + 3, which check the WHERE condition
+// cond on the row cursor is at: the value compared to goes in register 1, and the
+// column in register 2. jumps to match_addr if the row satisfies the condition, and
+// to nomatch_addr otherwise.
+static int simple_cond_codegen(chidb_stmt *stmt, char *table_name, Condition_t *cond, int cursor, int addr_start, int match_addr, int nomatch_addr)
+{
+  if (cond_value_codegen(stmt, table_name, cond, addr_start) != CHIDB_OK)
+  {
+    return CHIDB_EINVALIDSQL;
+  }
+  simple_cond_check_codegen(stmt, table_name, cond, cursor, addr_start + 1, match_addr, nomatch_addr);
+  return CHIDB_OK;
+}
+
+// position of a column in the keys of a record index (see record_index_cols), or -1
+static int record_index_col_pos(char **names, int nVals, char *col_name)
+{
+  for (int i = 0; i < nVals; i++)
+  {
+    if (strcmp(names[i], col_name) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// an index-only plan for a SELECT with a WHERE condition on the first column of a record index
+// that has every column the SELECT projects (a covering index). the scan starts at the first
+// entry that can satisfy the condition, and reads the columns from the index entries, so the
+// table B-Tree is not read. returns CHIDB_ENOTFOUND if there is no such index.
+//
+// if the index has INCLUDE columns, the table is also opened (in cursor 1), and the columns of
+// an entry whose INCLUDE values were left out of it (see IdxInclude) are read from its row.
+//
+// the value compared to goes in register 1, the key sought (and then the primary key of an
+// entry read from the table) in register 2, the first column of each entry in register 4,
+// and the projected columns from register 5 on.
+static int chidb_stmt_codegen_range_query_indexed(chidb_stmt *stmt, chisql_statement_t *sql_stmt, int nCols)
+{
+  SRA_Project_t sra_project = sql_stmt->stmt.select->project;
+  SRA_Select_t sra_select = sra_project.sra->select;
+  char *table_name = sra_select.sra->table.ref->table_name;
+  Condition_t *cond = sra_select.cond;
+  char *cmp_col_name = cond->cond.comp.expr1->expr.term.ref->columnName;
+  ChidbSchema *indexes[stmt->db->nSchema + 1];
+  int nIndexes = table_record_indexes(stmt, table_name, indexes, stmt->db->nSchema);
+
+  for (int k = 0; k < nIndexes; k++)
+  {
+    Index_t *index = indexes[k]->index;
+    int nVals = record_index_cols(stmt, index, NULL);
+    char *names[nVals];
+    int pos[nCols];
+    bool covering = true;
+    record_index_cols(stmt, index, names);
+    if (strcmp(names[0], cmp_col_name) != 0)
+    {
+      continue;
+    }
+    for (int i = 0; i < nCols && covering; i++)
+    {
+      pos[i] = record_index_col_pos(names, nVals, stmt->cols[i]);
+      covering = pos[i] != -1;
+    }
+    if (!covering)
+    {
+      continue;
+    }
+    chilog(DEBUG, "Index-only plan with index %s", index->name);
+
+    bool spill = index->include != NULL;
+    int first_addr = spill ? 4 : 2;
+    // a > condition skips the entries equal to the value (with a Next), and every other
+    // condition stops at the first entry that does not satisfy it
+    int loop_addr = first_addr + 4;
+    int nomatch_addr = loop_addr + 2;
+    int match_addr = nomatch_addr + (cond->t == RA_COND_GT ? 2 : 1);
+    int row_addr = match_addr + (spill ? 1 : 0) + nCols;
+    int end_addr = row_addr + 2;
+    int spill_addr = end_addr + 3;
+    chidb_dbm_op_t op_int = {Op_Integer, indexes[k]->root_npage, 0, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_int, 0);
+    chidb_dbm_op_t op_openRead = {Op_OpenRead, 0, 0, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_openRead, 1);
+    if (spill)
+    {
+      chidb_dbm_op_t op_int_table = {Op_Integer, schema_root_page(stmt->db, table_name), 0, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_int_table, 2);
+      chidb_dbm_op_t op_openReadTable = {Op_OpenRead, 1, 0, table_ncols(stmt->db, table_name), NULL};
+      chidb_stmt_set_op(stmt, &op_openReadTable, 3);
+    }
+    if (cond_value_codegen(stmt, table_name, cond, first_addr) != CHIDB_OK)
+    {
+      return CHIDB_EINVALIDSQL;
+    }
+    // the scan starts at the value, or (for < and <=) at the smallest value of the column's
+    // type, which comes after the NULLs
+    if (cond->t == RA_COND_LT || cond->t == RA_COND_LEQ)
+    {
+      if (table_col_type(stmt->db, table_name, cmp_col_name) == TYPE_TEXT)
+      {
+        chidb_dbm_op_t op_min = {Op_String, 0, 3, 0, ""};
+        chidb_stmt_set_op(stmt, &op_min, first_addr + 1);
+      }
+      else
+      {
+        chidb_dbm_op_t op_min = {Op_Integer, INT32_MIN, 3, 0, NULL};
+        chidb_stmt_set_op(stmt, &op_min, first_addr + 1);
+      }
+    }
+    else
+    {
+      chidb_dbm_op_t op_copy = {Op_SCopy, 1, 3, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_copy, first_addr + 1);
+    }
+    chidb_dbm_op_t op_idxKey = {Op_IdxKey, 3, 1, 2, NULL};
+    chidb_stmt_set_op(stmt, &op_idxKey, first_addr + 2);
+    chidb_dbm_op_t op_seek = {Op_SeekGe, 0, end_addr, 2, NULL};
+    chidb_stmt_set_op(stmt, &op_seek, first_addr + 3);
+
+    chidb_dbm_op_t op_firstCol = {Op_IdxColumn, 0, 0, 4, NULL};
+    chidb_stmt_set_op(stmt, &op_firstCol, loop_addr);
+    chidb_dbm_op_t op_cmp = {simple_cmp_condtype_opcode(cond->t), 1, match_addr, 4, NULL};
+    chidb_stmt_set_op(stmt, &op_cmp, loop_addr + 1);
+    if (cond->t == RA_COND_GT)
+    {
+      chidb_dbm_op_t op_skip = {Op_Next, 0, loop_addr, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_skip, nomatch_addr);
+    }
+    chidb_dbm_op_t op_stop = {Op_Goto, 0, end_addr, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_stop, match_addr - 1);
+
+    int addr = match_addr;
+    if (spill)
+    {
+      chidb_dbm_op_t op_spilled = {Op_IdxSpilled, 0, spill_addr, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_spilled, addr++);
+    }
+    for (int i = 0; i < nCols; i++)
+    {
+      chidb_dbm_op_t op_col = {Op_IdxColumn, 0, pos[i], 5 + i, NULL};
+      chidb_stmt_set_op(stmt, &op_col, addr++);
+    }
+    chidb_dbm_op_t op_resultRow = {Op_ResultRow, 5, nCols, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_resultRow, row_addr);
+    chidb_dbm_op_t op_next = {Op_Next, 0, loop_addr, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_next, row_addr + 1);
+    chidb_dbm_op_t op_close = {Op_Close, 0, 0, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_close, end_addr);
+    addr = end_addr + 1;
+    if (spill)
+    {
+      chidb_dbm_op_t op_closeTable = {Op_Close, 1, 0, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_closeTable, addr++);
+    }
+    chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_halt, addr);
+    if (spill)
+    {
+      // the row of the entry is sought by its primary key
+      chidb_dbm_op_t op_pkey = {Op_IdxPKey, 0, 2, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_pkey, spill_addr);
+      chidb_dbm_op_t op_seekRow = {Op_Seek, 1, row_addr + 1, 2, NULL};
+      chidb_stmt_set_op(stmt, &op_seekRow, spill_addr + 1);
+      for (int i = 0; i < nCols; i++)
+      {
+        table_col_codegen(stmt, table_name, stmt->cols[i], 1, 5 + i, spill_addr + 2 + i);
+      }
+      chidb_dbm_op_t op_row = {Op_Goto, 0, row_addr, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_row, spill_addr + 2 + nCols);
+    }
+    stmt->nCols = nCols;
+    stmt->nRR = nCols;
+    stmt->pc = 0;
+    return CHIDB_OK;
   }
+  return CHIDB_ENOTFOUND;
+}
 
-  if (cmp_type == TYPE_INT)
+static int chidb_stmt_codegen_simple_select_where(chidb_stmt *stmt, chisql_statement_t *sql_stmt, int nCols, int pkey_n, int root_npage)
+{
+  SRA_t *select = sql_stmt->stmt.select;
+  SRA_Project_t sra_project = select->project;
+  SRA_Select_t sra_select = sra_project.sra->select;
+  SRA_Table_t sra_table = sra_select.sra->table;
+  int rc = chidb_stmt_codegen_range_query_indexed(stmt, sql_stmt, nCols);
+  if (rc != CHIDB_ENOTFOUND)
   {
-    chidb_dbm_op_t op_int = {Op_Integer, sra_select.cond->cond.comp.expr2->expr.term.val->val.ival, 1, 0, NULL};
-    chidb_stmt_set_op(stmt, &op_int, 3);
+    return rc;
   }
-  else if (cmp_type == TYPE_TEXT)
+  // check the select where clause. the loop starts with a Filter, which skips the rows
+  // that do not satisfy it in batches, before the condition is checked on each row
+  if (cond_value_codegen(stmt, sra_table.ref->table_name, sra_select.cond, 3) != CHIDB_OK)
   {
-    char *strval = sra_select.cond->cond.comp.expr2->expr.term.val->val.strval;
-    chidb_dbm_op_t op_text = {Op_String, strlen(strval), 1, 0, strval};
-    chidb_stmt_set_op(stmt, &op_text, 3);
+    return CHIDB_EINVALIDSQL;
   }
+  chidb_dbm_op_t op_filter = {Op_Filter, 0, 8 + nCols + 2, 8 + nCols + 1, NULL};
+  chidb_stmt_set_op(stmt, &op_filter, 4);
+  simple_cond_check_codegen(stmt, sra_table.ref->table_name, sra_select.cond, 0, 5, 8, 8 + nCols + 1);
   chidb_dbm_op_t op_int = {Op_Integer, root_npage, 0, 0, NULL};
   chidb_stmt_set_op(stmt, &op_int, 0);
   ChidbSchema schema;
@@ -485,7 +852,7 @@ static int chidb_stmt_codegen_simple_select_where(chidb_stmt *stmt, chisql_state
     {
       cols_a[i] = i;
     }
-    simple_col_codegen(stmt, 7, 0, cols_a, nCols, 4, 3, pkey_n);
+    simple_col_codegen(stmt, 8, 0, cols_a, nCols, 4, 3, pkey_n);
   }
   else
   {
@@ -496,23 +863,19 @@ static int chidb_stmt_codegen_simple_select_where(chidb_stmt *stmt, chisql_state
     {
       cols_a[i] = table_col_exists(stmt->db, sra_table.ref->table_name, curr_col->expr.term.ref->columnName) - 1;
     }
-    simple_col_codegen(stmt, 7, 0, cols_a, nCols, 4, 3, pkey_n);
+    simple_col_codegen(stmt, 8, 0, cols_a, nCols, 4, 3, pkey_n);
   }
   stmt->nCols = nCols;
   stmt->nRR = nCols;
   chilog(DEBUG, "%d cols", nCols);
-  chidb_dbm_op_t op_cmp = {simple_cmp_condtype_opcode(sra_select.cond->t), 1, 7, 2, NULL};
-  chidb_stmt_set_op(stmt, &op_cmp, 5);
-  chidb_dbm_op_t op_unconditional_jump = {Op_Eq, 1, 7 + nCols + 1, 1, NULL};
-  chidb_stmt_set_op(stmt, &op_unconditional_jump, 6);
   chidb_dbm_op_t op_openRead = {Op_OpenRead, 0, 0, table_ncols(stmt->db, sra_table.ref->table_name), NULL};
   chidb_stmt_set_op(stmt, &op_openRead, 1);
-  chidb_dbm_op_t op_rewind = {Op_Rewind, 0, 7 + nCols + 2, 0, NULL};
+  chidb_dbm_op_t op_rewind = {Op_Rewind, 0, 8 + nCols + 2, 0, NULL};
   chidb_stmt_set_op(stmt, &op_rewind, 2);
   chidb_dbm_op_t op_close = {Op_Close, 0, 0, 0, NULL};
-  chidb_stmt_set_op(stmt, &op_close, 7 + nCols + 2);
+  chidb_stmt_set_op(stmt, &op_close, 8 + nCols + 2);
   chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
-  chidb_stmt_set_op(stmt, &op_halt, 7 + nCols + 3);
+  chidb_stmt_set_op(stmt, &op_halt, 8 + nCols + 3);
   stmt->pc = 0;
   return CHIDB_OK;
 }
@@ -532,9 +895,7 @@ static int insert_set_all_cols(Insert_t *insert, ChidbSchema *schema)
   StrList_t *insert_cols = insert->col_names;
   for (int i = 0; i < nCols; i++)
   {
-    char *s = malloc(strlen(cols->name));
-    strcpy(s, cols->name);
-    insert_cols->str = s;
+    insert_cols->str = strdup(cols->name);
     cols = cols->next;
     if (i < nCols - 1)
     {
@@ -561,7 +922,7 @@ static int verify_insert_value_types(enum data_type *types, int nCols, Literal_t
   while (curr_val != NULL)
   {
     chilog(DEBUG, "%d %d type compare", curr_val->t, types[_nValues % nCols]);
-    if (curr_val->t != types[_nValues % nCols])
+    if (curr_val->t != types[_nValues % nCols] && curr_val->t != TYPE_PARAM)
     {
       return CHIDB_EINVALIDSQL;
     }
@@ -577,12 +938,23 @@ static int verify_insert_value_types(enum data_type *types, int nCols, Literal_t
   return CHIDB_OK;
 }
 
-static int simple_insert_codegen_record(chidb_stmt *stmt, Literal_t *values, int addr_start, int nCols, int base_reg, int pkey_n)
+static int simple_insert_codegen_record(chidb_stmt *stmt, Literal_t *values, enum data_type *types, int addr_start, int nCols, int base_reg, int pkey_n)
 {
   Literal_t *curr_val = values;
   for (int i = 0, j = 0; i < nCols; i++, curr_val = curr_val->next)
   {
-    if (i == pkey_n)
+    if (i == pkey_n && curr_val->t == TYPE_PARAM)
+    {
+      if (param_codegen(stmt, curr_val, types[i], base_reg + nCols, addr_start + j) != CHIDB_OK)
+      {
+        return CHIDB_EINVALIDSQL;
+      }
+      j++;
+      chidb_dbm_op_t op_null = {Op_Null, 0, base_reg + i, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_null, addr_start + j);
+      j++;
+    }
+    else if (i == pkey_n)
     {
       chilog(DEBUG, "Address %d: (INTEGER %d %d %d %s) for primary key",
              addr_start + j, curr_val->val.ival, base_reg + nCols, 0, NULL);
@@ -611,6 +983,13 @@ static int simple_insert_codegen_record(chidb_stmt *stmt, Literal_t *values, int
         chidb_dbm_op_t op_int = {Op_Integer, curr_val->val.ival, base_reg + i, 0, NULL};
         chidb_stmt_set_op(stmt, &op_int, addr_start + j);
       }
+      else if (curr_val->t == TYPE_PARAM)
+      {
+        if (param_codegen(stmt, curr_val, types[i], base_reg + i, addr_start + j) != CHIDB_OK)
+        {
+          return CHIDB_EINVALIDSQL;
+        }
+      }
       j++;
     }
   }
@@ -625,16 +1004,125 @@ static int simple_insert_codegen_record(chidb_stmt *stmt, Literal_t *values, int
   return CHIDB_OK;
 }
 
-static int simple_insert_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt, int addr_start, int nCols, int nValues, int base_reg, int pkey_n)
+// number of instructions record_index_maintain_codegen sets for each of the indexes
+static int record_index_maintain_size(chidb_stmt *stmt, ChidbSchema **indexes, int nIndexes)
+{
+  int size = 0;
+  for (int k = 0; k < nIndexes; k++)
+  {
+    size += record_index_cols(stmt, indexes[k]->index, NULL) + (indexes[k]->index->include != NULL ? 3 : 2);
+  }
+  return size;
+}
+
+// fills instructions addr_start thru addr_start + record_index_maintain_size - 1, which insert
+// (if insert is not NULL) the entry of a new row into each of the record indexes of a table, or
+// delete the entry of the row cursor 0 is at. the index k is open in cursor k + 1, and the values
+// of the entries are copied (or read) into the registers from scratch_reg on.
+//
+// the values of a new row are in the registers from base_reg on (in the order of the columns of
+// the INSERT), and its primary key in register base_reg + nCols.
+static void record_index_maintain_codegen(chidb_stmt *stmt, Insert_t *insert, ChidbSchema **indexes, int nIndexes,
+                                          int addr_start, int nCols, int base_reg, int scratch_reg)
+{
+  int addr = addr_start;
+  for (int k = 0; k < nIndexes; k++)
+  {
+    Index_t *index = indexes[k]->index;
+    int nVals = record_index_cols(stmt, index, NULL);
+    char *names[nVals];
+    record_index_cols(stmt, index, names);
+    for (int i = 0; i < nVals; i++)
+    {
+      if (insert == NULL)
+      {
+        table_col_codegen(stmt, index->table_name, names[i], 0, scratch_reg + i, addr++);
+        continue;
+      }
+      int from_reg = -1;
+      if (is_pkey(stmt->db, index->table_name, names[i]))
+      {
+        from_reg = base_reg + nCols;
+      }
+      else
+      {
+        StrList_t *col = insert->col_names;
+        for (int j = 0; col != NULL; j++, col = col->next)
+        {
+          if (strcmp(col->str, names[i]) == 0)
+          {
+            from_reg = base_reg + j;
+          }
+        }
+      }
+      // a column missing from the INSERT is NULL
+      chidb_dbm_op_t op_copy = {Op_SCopy, from_reg, scratch_reg + i, 0, NULL};
+      chidb_dbm_op_t op_null = {Op_Null, 0, scratch_reg + i, 0, NULL};
+      chidb_stmt_set_op(stmt, from_reg != -1 ? &op_copy : &op_null, addr++);
+    }
+    int nSearch = record_index_search_cols(index);
+    chidb_dbm_op_t op_idxKey = {Op_IdxKey, scratch_reg, nSearch, scratch_reg + nVals, NULL};
+    chidb_stmt_set_op(stmt, &op_idxKey, addr++);
+    if (nSearch < nVals)
+    {
+      chidb_dbm_op_t op_idxInclude = {Op_IdxInclude, scratch_reg + nSearch, nVals - nSearch, scratch_reg + nVals, NULL};
+      chidb_stmt_set_op(stmt, &op_idxInclude, addr++);
+    }
+    if (insert != NULL)
+    {
+      chidb_dbm_op_t op_idxInsert = {Op_IdxInsert, k + 1, scratch_reg + nVals, base_reg + nCols, NULL};
+      chidb_stmt_set_op(stmt, &op_idxInsert, addr++);
+    }
+    else
+    {
+      chidb_dbm_op_t op_idxDelete = {Op_IdxDelete, k + 1, scratch_reg + nVals, 0, NULL};
+      chidb_stmt_set_op(stmt, &op_idxDelete, addr++);
+    }
+  }
+}
+
+// fills instructions addr_start thru addr_start + 2 * nIndexes - 1, which open the record
+// indexes of a table for writing (index k in cursor k + 1), using register reg.
+static void record_index_open_codegen(chidb_stmt *stmt, ChidbSchema **indexes, int nIndexes, int addr_start, int reg)
+{
+  for (int k = 0; k < nIndexes; k++)
+  {
+    chidb_dbm_op_t op_int = {Op_Integer, indexes[k]->root_npage, reg, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_int, addr_start + 2 * k);
+    chidb_dbm_op_t op_openWrite = {Op_OpenWrite, k + 1, reg, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_openWrite, addr_start + 2 * k + 1);
+  }
+}
+
+// fills the instructions that close the cursors of the record indexes, from addr_start on
+static void record_index_close_codegen(chidb_stmt *stmt, int nIndexes, int addr_start)
+{
+  for (int k = 0; k < nIndexes; k++)
+  {
+    chidb_dbm_op_t op_close = {Op_Close, k + 1, 0, 0, NULL};
+    chidb_stmt_set_op(stmt, &op_close, addr_start + k);
+  }
+}
+
+// each record takes nCols + 3 instructions, followed by the ones that insert its entries
+// into the record indexes of the table
+static int simple_insert_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt, enum data_type *types, int addr_start, int nCols, int nValues, int base_reg, int pkey_n,
+                                 ChidbSchema **indexes, int nIndexes)
 {
   Insert_t *insert = sql_stmt->stmt.insert;
   Literal_t *values = insert->values;
   Literal_t *curr_values = values;
   int nRecords = nValues / nCols;
-  for (int i = 0, curr_addr_start = addr_start; i < nRecords; i++, curr_addr_start += (nCols + 3))
+  int record_size = nCols + 3 + record_index_maintain_size(stmt, indexes, nIndexes);
+  for (int i = 0, curr_addr_start = addr_start; i < nRecords; i++, curr_addr_start += record_size)
   {
     chilog(DEBUG, "Generating code for record %d / %d, pkey at column %d", i + 1, nRecords, pkey_n);
-    simple_insert_codegen_record(stmt, curr_values, curr_addr_start, nCols, base_reg, pkey_n);
+    if (simple_insert_codegen_record(stmt, curr_values, types, curr_addr_start, nCols, base_reg, pkey_n) != CHIDB_OK)
+    {
+      return CHIDB_EINVALIDSQL;
+    }
+    record_index_maintain_codegen(stmt, insert, indexes, nIndexes, curr_addr_start + nCols + 3,
+                                  nCols, base_reg, base_reg + nCols + 2);
     for (int j = 0; j < nCols; j++)
     {
       curr_values = curr_values->next;
@@ -679,20 +1167,109 @@ static int chidb_stmt_codegen_simple_insert(chidb_stmt *stmt, chisql_statement_t
     return CHIDB_EINVALIDSQL;
   }
   col_names = insert->col_names;
+  ChidbSchema *indexes[stmt->db->nSchema + 1];
+  int nIndexes = table_record_indexes(stmt, insert->table_name, indexes, stmt->db->nSchema);
+  int addr_start = 3 + 2 * nIndexes;
   chidb_dbm_op_t op_int = {Op_Integer, root_npage, 0, 0, NULL};
   chidb_stmt_set_op(stmt, &op_int, 0);
   chidb_dbm_op_t op_openwrite = {Op_OpenWrite, 0, 0, table_ncols(stmt->db, insert->table_name), NULL};
   chidb_stmt_set_op(stmt, &op_openwrite, 1);
   chidb_dbm_op_t op_rewind = {Op_Rewind, 0, 3, 0, NULL};
   chidb_stmt_set_op(stmt, &op_rewind, 2);
-  simple_insert_codegen(stmt, sql_stmt, 3, nCols, nValues, 1, pkey_n);
+  record_index_open_codegen(stmt, indexes, nIndexes, 3, nCols + 3);
+  if (simple_insert_codegen(stmt, sql_stmt, types, addr_start, nCols, nValues, 1, pkey_n, indexes, nIndexes) != CHIDB_OK)
+  {
+    return CHIDB_EINVALIDSQL;
+  }
   int nRecords = nValues / nCols;
-  int end_addr = 3 + ((nCols + 3) * nRecords);
+  int record_size = nCols + 3 + record_index_maintain_size(stmt, indexes, nIndexes);
+  int end_addr = addr_start + record_size * nRecords;
   chidb_dbm_op_t op_close = {Op_Close, 0, 0, 0, NULL};
   chidb_stmt_set_op(stmt, &op_close, end_addr);
+  record_index_close_codegen(stmt, nIndexes, end_addr + 1);
   chilog(DEBUG, "Setting close / halt in addr %d", end_addr);
   chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
-  chidb_stmt_set_op(stmt, &op_halt, end_addr + 1);
+  chidb_stmt_set_op(stmt, &op_halt, end_addr + nIndexes + 1);
+  stmt->pc = 0;
+  return CHIDB_OK;
+}
+
+// a DELETE can only have a WHERE condition comparing a column to a value
+static int chidb_stmt_validate_delete(chidb_stmt *stmt, Delete_t *delete)
+{
+  Condition_t *cond = delete->where;
+  if (cond == NULL)
+  {
+    return CHIDB_OK;
+  }
+  if (cond->t != RA_COND_EQ && cond->t != RA_COND_LT && cond->t != RA_COND_GT &&
+      cond->t != RA_COND_LEQ && cond->t != RA_COND_GEQ)
+  {
+    chilog(WARNING, "Unsupported DELETE condition");
+    return CHIDB_EINVALIDSQL;
+  }
+  Expression_t *col = cond->cond.comp.expr1;
+  Expression_t *val = cond->cond.comp.expr2;
+  if (col->t != EXPR_TERM || col->expr.term.t != TERM_COLREF ||
+      val->t != EXPR_TERM || val->expr.term.t != TERM_LITERAL)
+  {
+    chilog(WARNING, "Unsupported DELETE condition");
+    return CHIDB_EINVALIDSQL;
+  }
+  if (!table_col_exists(stmt->db, delete->table_name, col->expr.term.ref->columnName))
+  {
+    chilog(WARNING, "Column %s does not exist", col->expr.term.ref->columnName);
+    return CHIDB_EINVALIDSQL;
+  }
+  return chidb_stmt_validate_simple_cond(stmt, delete->table_name, cond);
+}
+
+// deletes every row of the table (that satisfies the WHERE condition, if there is one),
+// and its entries in the record indexes of the table.
+// chidb_Cursor_delete leaves the cursor at the row after the deleted one, and the Next
+// after a Delete does not skip it.
+static int chidb_stmt_codegen_delete(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+  Delete_t *delete = sql_stmt->stmt.delete;
+  int root_npage;
+  if (chidb_stmt_validate_schema_exists(stmt, delete->table_name, &root_npage) != CHIDB_OK)
+  {
+    return CHIDB_EINVALIDSQL;
+  }
+  if (chidb_stmt_validate_delete(stmt, delete) != CHIDB_OK)
+  {
+    return CHIDB_EINVALIDSQL;
+  }
+  // the record indexes are opened after the table, the loop has the condition check
+  // (4 instructions, if any), the deletes from the indexes, the Delete and the Next
+  ChidbSchema *indexes[stmt->db->nSchema + 1];
+  int nIndexes = table_record_indexes(stmt, delete->table_name, indexes, stmt->db->nSchema);
+  int loop_addr = 3 + 2 * nIndexes;
+  int index_addr = delete->where != NULL ? loop_addr + 4 : loop_addr;
+  int delete_addr = index_addr + record_index_maintain_size(stmt, indexes, nIndexes);
+  int end_addr = delete_addr + 2;
+  if (delete->where != NULL &&
+      simple_cond_codegen(stmt, delete->table_name, delete->where, 0, loop_addr, index_addr, delete_addr + 1) != CHIDB_OK)
+  {
+    return CHIDB_EINVALIDSQL;
+  }
+  chidb_dbm_op_t op_int = {Op_Integer, root_npage, 0, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_int, 0);
+  chidb_dbm_op_t op_openwrite = {Op_OpenWrite, 0, 0, table_ncols(stmt->db, delete->table_name), NULL};
+  chidb_stmt_set_op(stmt, &op_openwrite, 1);
+  record_index_open_codegen(stmt, indexes, nIndexes, 2, 3);
+  chidb_dbm_op_t op_rewind = {Op_Rewind, 0, end_addr, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_rewind, loop_addr - 1);
+  record_index_maintain_codegen(stmt, NULL, indexes, nIndexes, index_addr, 0, 0, 3);
+  chidb_dbm_op_t op_delete = {Op_Delete, 0, 0, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_delete, delete_addr);
+  chidb_dbm_op_t op_next = {Op_Next, 0, loop_addr, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_next, delete_addr + 1);
+  chidb_dbm_op_t op_close = {Op_Close, 0, 0, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_close, end_addr);
+  record_index_close_codegen(stmt, nIndexes, end_addr + 1);
+  chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_halt, end_addr + nIndexes + 1);
   stmt->pc = 0;
   return CHIDB_OK;
 }
@@ -771,6 +1348,17 @@ static int chidb_stmt_codegen_simple_create_table(chidb_stmt *stmt, chisql_state
   return CHIDB_OK;
 }
 
+// builds the index, and then adds its row to the schema table (with cursor 2).
+//
+// an index on a single column keeps the values of the column as its keys (in an index
+// B-Tree, or a text index B-Tree for a text column). a record index (see index_is_record)
+// keeps keys made by IdxKey from the values of its columns and the primary key, followed by
+// its INCLUDE columns, so the INCLUDE values are stored in the leaf cells of the index. the
+// INCLUDE values of a row that do not fit in the key are left in the table (see IdxInclude),
+// but the values of the columns of the index must fit, or the row cannot be inserted.
+//
+// the table root page goes in register 0, the index root page in register 1, the values
+// of each row from register 2 on, followed by the key of the entry and the primary key.
 static int chidb_stmt_codegen_create_index(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
   Index_t *index = sql_stmt->stmt.create->index;
@@ -784,45 +1372,124 @@ static int chidb_stmt_codegen_create_index(chidb_stmt *stmt, chisql_statement_t
   }
   ChidbSchema table_schema;
   get_schema(stmt->db, index->table_name, &table_schema);
-  int col_n = table_col_n(stmt->db, index->table_name, index->column_name);
-  if (col_n == -1)
+  bool record = index_is_record(index);
+  int nVals = record ? record_index_cols(stmt, index, NULL) : 1;
+  char *names[nVals];
+  if (record)
   {
-    return CHIDB_EINVALIDSQL;
+    record_index_cols(stmt, index, names);
   }
-  int j = table_col_type(stmt->db, index->table_name, index->column_name);
-  if (j != TYPE_INT)
+  else
   {
-    chilog(CRITICAL, "Column %s of table %s is of type %d, but indices can only be created on integer columns!",
-           index->column_name, index->table_name, j);
-    return CHIDB_EINVALIDSQL;
+    names[0] = index->column_name;
   }
-  chilog(DEBUG, "Codegen for create index %s on %s %s, col type %d and col number %d",
-         index->name, index->table_name, index->column_name, j, col_n);
+  for (int i = 0; i < nVals; i++)
+  {
+    if (table_col_n(stmt->db, index->table_name, names[i]) == -1)
+    {
+      return CHIDB_EINVALIDSQL;
+    }
+    int j = table_col_type(stmt->db, index->table_name, names[i]);
+    if (j != TYPE_INT && j != TYPE_TEXT)
+    {
+      chilog(CRITICAL, "Column %s of table %s is of type %d, but indices can only be created on integer and text columns!",
+             names[i], index->table_name, j);
+      return CHIDB_EINVALIDSQL;
+    }
+  }
+  chilog(DEBUG, "Codegen for create index %s on %s %s, %d values per entry",
+         index->name, index->table_name, index->column_name, nVals);
+
+  int key_reg = record ? 2 + nVals : 2;
+  int pkey_reg = 3 + nVals;
+  int loop_addr = 5;
+  int nSearch = record ? record_index_search_cols(index) : nVals;
+  int build_addr = loop_addr + nVals + (record ? 1 : 0) + (nSearch < nVals ? 1 : 0) + 3;
+  int schema_reg = pkey_reg + 1;
   chidb_dbm_op_t op_int = {Op_Integer, table_schema.root_npage, 0, 0, NULL};
   chidb_dbm_op_t op_openReadTable = {Op_OpenRead, 0, 0, table_ncols(stmt->db, index->table_name), NULL};
-  chidb_dbm_op_t op_createIndex = {Op_CreateIndex, 1, 0, 0, NULL};
+  // text columns and record indexes get a text index B-Tree
+  bool text = record || table_col_type(stmt->db, index->table_name, index->column_name) == TYPE_TEXT;
+  chidb_dbm_op_t op_createIndex = {Op_CreateIndex, 1, text, 0, NULL};
   chidb_dbm_op_t op_openWriteIndex = {Op_OpenWrite, 1, 1, 0, NULL};
-  chidb_dbm_op_t op_rewindTable = {Op_Rewind, 0, 9, 0, NULL};
-  chidb_dbm_op_t op_key = {Op_Key, 0, 3, 0, NULL};
-  chidb_dbm_op_t op_col = {Op_Column, 0, col_n, 2, NULL};
-  chidb_dbm_op_t op_insertIndex = {Op_IdxInsert, 1, 2, 3, NULL};
-  chidb_dbm_op_t op_next = {Op_Next, 0, 5, 0, NULL};
+  chidb_dbm_op_t op_rewindTable = {Op_Rewind, 0, build_addr, 0, NULL};
+  chidb_dbm_op_t op_idxKey = {Op_IdxKey, 2, nSearch, key_reg, NULL};
+  chidb_dbm_op_t op_idxInclude = {Op_IdxInclude, 2 + nSearch, nVals - nSearch, key_reg, NULL};
+  chidb_dbm_op_t op_key = {Op_Key, 0, pkey_reg, 0, NULL};
+  // the entries are collected while scanning the table, and the index is then built bottom-up
+  chidb_dbm_op_t op_appendIndex = {Op_IdxAppend, 1, key_reg, pkey_reg, NULL};
+  chidb_dbm_op_t op_next = {Op_Next, 0, loop_addr, 0, NULL};
+  chidb_dbm_op_t op_buildIndex = {Op_IdxBuild, 1, 0, 0, NULL};
   chidb_dbm_op_t op_close0 = {Op_Close, 0, 0, 0, NULL};
   chidb_dbm_op_t op_close1 = {Op_Close, 1, 0, 0, NULL};
-  chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
 
   chidb_stmt_set_op(stmt, &op_int, 0);
   chidb_stmt_set_op(stmt, &op_openReadTable, 1);
   chidb_stmt_set_op(stmt, &op_createIndex, 2);
   chidb_stmt_set_op(stmt, &op_openWriteIndex, 3);
   chidb_stmt_set_op(stmt, &op_rewindTable, 4);
-  chidb_stmt_set_op(stmt, &op_key, 5);
-  chidb_stmt_set_op(stmt, &op_col, 6);
-  chidb_stmt_set_op(stmt, &op_insertIndex, 7);
-  chidb_stmt_set_op(stmt, &op_next, 8);
-  chidb_stmt_set_op(stmt, &op_close0, 9);
-  chidb_stmt_set_op(stmt, &op_close1, 10);
-  chidb_stmt_set_op(stmt, &op_halt, 11);
+  int addr = loop_addr;
+  for (int i = 0; i < nVals; i++)
+  {
+    table_col_codegen(stmt, index->table_name, names[i], 0, 2 + i, addr++);
+  }
+  if (record)
+  {
+    chidb_stmt_set_op(stmt, &op_idxKey, addr++);
+  }
+  if (nSearch < nVals)
+  {
+    chidb_stmt_set_op(stmt, &op_idxInclude, addr++);
+  }
+  chidb_stmt_set_op(stmt, &op_key, addr++);
+  chidb_stmt_set_op(stmt, &op_appendIndex, addr++);
+  chidb_stmt_set_op(stmt, &op_next, addr++);
+  chidb_stmt_set_op(stmt, &op_buildIndex, addr++);
+  chidb_stmt_set_op(stmt, &op_close0, addr++);
+  chidb_stmt_set_op(stmt, &op_close1, addr++);
+
+  chidb_dbm_op_t op_int_schema = {Op_Integer, 1, schema_reg, 0, NULL};
+  chidb_dbm_op_t op_openWriteSchema = {Op_OpenWrite, 2, schema_reg, 5, NULL};
+  chidb_dbm_op_t op_string_schematype = {Op_String, 5, schema_reg + 1, 0, "index"};
+  chidb_dbm_op_t op_string_schemaname = {Op_String, strlen(index->name), schema_reg + 2, 0, index->name};
+  chidb_dbm_op_t op_string_associatedname = {Op_String, strlen(index->table_name), schema_reg + 3, 0, index->table_name};
+  chidb_dbm_op_t op_copy_root = {Op_SCopy, 1, schema_reg + 4, 0, NULL};
+  chidb_dbm_op_t op_string_sql = {Op_String, strlen(sql_stmt->text), schema_reg + 5, 0, sql_stmt->text};
+  chidb_dbm_op_t op_record = {Op_MakeRecord, schema_reg + 1, 5, schema_reg + 6, NULL};
+  chidb_dbm_op_t op_int_key = {Op_Integer, stmt->db->nSchema + 1, schema_reg + 7, 0, NULL};
+  chidb_dbm_op_t op_insert = {Op_Insert, 2, schema_reg + 6, schema_reg + 7, NULL};
+  chidb_dbm_op_t op_close2 = {Op_Close, 2, 0, 0, NULL};
+  chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
+  chidb_stmt_set_op(stmt, &op_int_schema, addr++);
+  chidb_stmt_set_op(stmt, &op_openWriteSchema, addr++);
+  chidb_stmt_set_op(stmt, &op_string_schematype, addr++);
+  chidb_stmt_set_op(stmt, &op_string_schemaname, addr++);
+  chidb_stmt_set_op(stmt, &op_string_associatedname, addr++);
+  chidb_stmt_set_op(stmt, &op_copy_root, addr++);
+  chidb_stmt_set_op(stmt, &op_string_sql, addr++);
+  chidb_stmt_set_op(stmt, &op_record, addr++);
+  chidb_stmt_set_op(stmt, &op_int_key, addr++);
+  chidb_stmt_set_op(stmt, &op_insert, addr++);
+  chidb_stmt_set_op(stmt, &op_close2, addr++);
+  chidb_stmt_set_op(stmt, &op_halt, addr);
+  stmt->pc = 0;
+  return CHIDB_OK;
+}
+
+static int chidb_stmt_codegen_transaction(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+  opcode_t opcode;
+  if (sql_stmt->type == STMT_BEGIN)
+    opcode = Op_Begin;
+  else if (sql_stmt->type == STMT_COMMIT)
+    opcode = Op_Commit;
+  else
+    opcode = Op_Rollback;
+  chidb_dbm_op_t op_txn = {opcode, 0, 0, 0, NULL};
+  chidb_dbm_op_t op_halt = {Op_Halt, 0, 0, 0, NULL};
+
+  chidb_stmt_set_op(stmt, &op_txn, 0);
+  chidb_stmt_set_op(stmt, &op_halt, 1);
   stmt->pc = 0;
   return CHIDB_OK;
 }
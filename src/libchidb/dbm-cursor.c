@@ -38,6 +38,7 @@
  */
 
 #include "dbm-cursor.h"
+#include "util.h"
 
 int chidb_Cursor_open(chidb_dbm_cursor_t **cursor, chidb_dbm_cursor_type_t type, BTree *bt, npage_t npage, uint32_t col_n)
 {
@@ -47,8 +48,19 @@ int chidb_Cursor_open(chidb_dbm_cursor_t **cursor, chidb_dbm_cursor_type_t type,
   _cursor->root_page_n = npage;
   _cursor->col_n = col_n;
   _cursor->nNodes = 1;
+  _cursor->nNodesAlloc = 1;
+  _cursor->idx_entries = NULL;
+  _cursor->nIdxEntries = 0;
+  _cursor->idxEntriesSize = 0;
+  _cursor->skip_next = false;
+  _cursor->scan_bounded = false;
+  _cursor->row_valid = false;
+  _cursor->row_alloc = 0;
+  _cursor->row_types = NULL;
+  _cursor->row_offsets = NULL;
+  memset(&_cursor->batch, 0, sizeof(cursor_batch));
   _cursor->node_entries = malloc(sizeof(cursor_node_entry));
-  chidb_Btree_getNodeByPage(bt, npage, &((_cursor->node_entries)[0].node));
+  chidb_Btree_getNodeByPageReadOnly(bt, npage, &((_cursor->node_entries)[0].node));
   if ((_cursor->node_entries)[0].node->type == PGTYPE_INDEX_INTERNAL ||
       (_cursor->node_entries)[0].node->type == PGTYPE_INDEX_LEAF)
   {
@@ -59,21 +71,58 @@ int chidb_Cursor_open(chidb_dbm_cursor_t **cursor, chidb_dbm_cursor_type_t type,
   {
     _cursor->tree_type = TABLE_CURSOR;
   }
+  else if ((_cursor->node_entries)[0].node->type == PGTYPE_TEXTINDEX_INTERNAL ||
+           (_cursor->node_entries)[0].node->type == PGTYPE_TEXTINDEX_LEAF)
+  {
+    _cursor->tree_type = TEXT_INDEX_CURSOR;
+  }
   chidb_Cursor_rewind(_cursor);
   *cursor = _cursor;
   return CHIDB_OK;
 }
 
+// free the entries added with chidb_Cursor_appendIdxEntry (or chidb_Cursor_appendTextIdxEntry)
+static void chidb_Cursor_freeIdxEntries(chidb_dbm_cursor_t *cursor)
+{
+  for (uint32_t i = 0; i < cursor->nIdxEntries; i++)
+  {
+    free(cursor->idx_entries[i].text);
+  }
+  free(cursor->idx_entries);
+  cursor->idx_entries = NULL;
+  cursor->nIdxEntries = 0;
+  cursor->idxEntriesSize = 0;
+}
+
 int chidb_Cursor_freeCursor(chidb_dbm_cursor_t *cursor)
 {
-  for (int i = 0; i < cursor->nNodes; i++)
+  for (int i = 0; i < cursor->nNodesAlloc; i++)
   {
-    chidb_Btree_freeMemNode(cursor->bt, cursor->node_entries[i].node);
+    if (cursor->node_entries[i].node != NULL)
+    {
+      chidb_Btree_freeMemNode(cursor->bt, cursor->node_entries[i].node);
+    }
   }
+  free(cursor->node_entries);
+  cursor->node_entries = NULL;
+  cursor->nNodes = 0;
+  cursor->nNodesAlloc = 0;
+  chidb_Cursor_freeIdxEntries(cursor);
+  free(cursor->row_types);
+  free(cursor->row_offsets);
+  cursor->row_types = NULL;
+  cursor->row_offsets = NULL;
+  cursor->row_alloc = 0;
+  cursor->row_valid = false;
+  free(cursor->batch.values);
+  free(cursor->batch.known);
+  free(cursor->batch.match);
+  memset(&cursor->batch, 0, sizeof(cursor_batch));
   return CHIDB_OK;
 }
 
 // set the ith entry of the node entries array in the cursor to have the node rooted at page npage, at the ncell entry.
+// the node that was in the entry (if any) is freed.
 int chidb_Cursor_setPathNode(chidb_dbm_cursor_t *cursor, npage_t npage, ncell_t ncell, uint32_t i)
 {
   if (cursor->nNodes <= i)
@@ -81,7 +130,11 @@ int chidb_Cursor_setPathNode(chidb_dbm_cursor_t *cursor, npage_t npage, ncell_t
     realloc_nodes(cursor, i + 1);
   }
   BTreeNode *ptr;
-  chidb_Btree_getNodeByPage(cursor->bt, npage, &ptr);
+  chidb_Btree_getNodeByPageReadOnly(cursor->bt, npage, &ptr);
+  if (cursor->node_entries[i].node != NULL)
+  {
+    chidb_Btree_freeMemNode(cursor->bt, cursor->node_entries[i].node);
+  }
   cursor->node_entries[i].node = ptr;
   cursor->node_entries[i].ncell = ncell;
   if (ncell == ptr->n_cells)
@@ -94,9 +147,18 @@ int chidb_Cursor_setPathNode(chidb_dbm_cursor_t *cursor, npage_t npage, ncell_t
   return CHIDB_OK;
 }
 
+// set the number of nodes in the path of the cursor, making room for them in the array of nodes.
 int realloc_nodes(chidb_dbm_cursor_t *cursor, uint32_t size)
 {
-  cursor->node_entries = realloc(cursor->node_entries, sizeof(cursor_node_entry) * size);
+  if (cursor->nNodesAlloc < size)
+  {
+    cursor->node_entries = realloc(cursor->node_entries, sizeof(cursor_node_entry) * size);
+    for (uint32_t i = cursor->nNodesAlloc; i < size; i++)
+    {
+      cursor->node_entries[i].node = NULL;
+    }
+    cursor->nNodesAlloc = size;
+  }
   cursor->nNodes = size;
   return CHIDB_OK;
 }
@@ -105,8 +167,8 @@ int chidb_Cursor_rewindNode(chidb_dbm_cursor_t *cursor, npage_t npage, int index
 {
   BTreeNode *btn;
   BTreeCell curr_cell;
-  chidb_Btree_getNodeByPage(cursor->bt, npage, &btn);
   chidb_Cursor_setPathNode(cursor, npage, 0, index);
+  btn = cursor->node_entries[index].node;
   cursor->nNodes = index + 1;
   if (btn->n_cells == 0)
   {
@@ -114,7 +176,7 @@ int chidb_Cursor_rewindNode(chidb_dbm_cursor_t *cursor, npage_t npage, int index
     return CHIDB_CURSOR_EMPTY_BTREE;
   }
   chidb_Btree_getCell(btn, 0, &curr_cell);
-  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TEXTINDEX_LEAF)
   {
     cursor->curr_key = curr_cell.key;
     return CHIDB_OK;
@@ -123,7 +185,7 @@ int chidb_Cursor_rewindNode(chidb_dbm_cursor_t *cursor, npage_t npage, int index
   {
     return chidb_Cursor_rewindNode(cursor, curr_cell.fields.tableInternal.child_page, index + 1);
   }
-  else if (btn->type == PGTYPE_INDEX_INTERNAL)
+  else if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TEXTINDEX_INTERNAL)
   {
     return chidb_Cursor_rewindNode(cursor, curr_cell.fields.indexInternal.child_page, index + 1);
   }
@@ -134,53 +196,245 @@ int chidb_Cursor_rewindNodeEnd(chidb_dbm_cursor_t *cursor, npage_t npage, int in
 {
   BTreeNode *btn;
   BTreeCell curr_cell;
-  chidb_Btree_getNodeByPage(cursor->bt, npage, &btn);
+  chidb_Cursor_setPathNode(cursor, npage, 0, index);
+  btn = cursor->node_entries[index].node;
   cursor->nNodes = index + 1;
-  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TEXTINDEX_LEAF)
   {
     chidb_Btree_getCell(btn, btn->n_cells - 1, &curr_cell);
-    chidb_Cursor_setPathNode(cursor, npage, btn->n_cells - 1, index);
+    cursor->node_entries[index].ncell = btn->n_cells - 1;
+    cursor->node_entries[index].key = curr_cell.key;
     cursor->curr_key = curr_cell.key;
     return CHIDB_OK;
   }
-  else if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+  else if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL ||
+           btn->type == PGTYPE_TEXTINDEX_INTERNAL)
   {
-    chidb_Cursor_setPathNode(cursor, npage, btn->n_cells, index);
+    cursor->node_entries[index].ncell = btn->n_cells;
     return chidb_Cursor_rewindNodeEnd(cursor, btn->right_page, index + 1);
   }
   return CHIDB_OK;
 }
 
+// true if the cursor is at a delete-marked entry of a text index (see chidb_Btree_deleteFromTextIndex),
+// which the cursor must skip over
+static bool chidb_Cursor_atDeleted(chidb_dbm_cursor_t *cursor)
+{
+  BTreeCell cell;
+  if (cursor->tree_type != TEXT_INDEX_CURSOR)
+  {
+    return false;
+  }
+  return chidb_Cursor_get(cursor, &cell) == CHIDB_OK && cell.deleted;
+}
+
 int chidb_Cursor_rewind(chidb_dbm_cursor_t *cursor)
 {
-  chidb_Cursor_rewindNode(cursor, cursor->root_page_n, 0);
+  cursor->skip_next = false;
+  cursor->row_valid = false;
+  cursor->shape = cursor->bt->shape;
+  cursor->generation = cursor->bt->pager->generation;
+  int rc = chidb_Cursor_rewindNode(cursor, cursor->root_page_n, 0);
+  if (rc == CHIDB_OK && chidb_Cursor_atDeleted(cursor))
+  {
+    // an index whose entries are all delete-marked is empty
+    rc = chidb_Cursor_next(cursor);
+    return rc == CHIDB_CURSOR_LAST_ENTRY ? CHIDB_CURSOR_EMPTY_BTREE : rc;
+  }
+  return rc;
 }
 
 int chidb_Cursor_get(chidb_dbm_cursor_t *cursor, BTreeCell *cell)
 {
-  BTreeCell _cell;
-  chidb_key_t key = cursor->curr_key;
+  cursor_node_entry *entry = cursor->node_entries + (cursor->nNodes - 1);
+  ncell_t ncell;
+  if (cursor->tree_type == TEXT_INDEX_CURSOR)
+  {
+    // text keys are not kept in the cursor, so the entry is found by its position
+    return chidb_Btree_getCell(entry->node, entry->ncell, cell);
+  }
+  if (chidb_Btree_searchNode(entry->node, cursor->curr_key, &ncell) != CHIDB_OK)
+  {
+    return CHIDB_ENOTFOUND;
+  }
+  return chidb_Btree_getCell(entry->node, ncell, cell);
+}
+
+// out parameters type, and offset (relative to the record's data), of column ncol of the record in
+// cell, which must be the entry of the table the cursor is at (see chidb_Cursor_get). the header of
+// the record is only decoded the first time one of its columns is read, and the types and offsets of
+// all its columns are kept in the cursor until it moves. a column past the end of the record is NULL.
+int chidb_Cursor_getColumn(chidb_dbm_cursor_t *cursor, BTreeCell *cell, uint32_t ncol, uint32_t *type, uint32_t *offset)
+{
+  if (!cursor->row_valid || cursor->row_writes != cursor->bt->writes ||
+      cursor->row_generation != cursor->bt->pager->generation)
+  {
+    uint8_t *data = cell->fields.tableLeaf.data;
+    uint8_t header[UINT8_MAX + 1];
+    int rc;
+
+    // the header can have at most one column per byte
+    if (cursor->row_alloc < UINT8_MAX)
+    {
+      uint32_t *types = realloc(cursor->row_types, UINT8_MAX * sizeof(uint32_t));
+      if (types == NULL)
+      {
+        return CHIDB_ENOMEM;
+      }
+      cursor->row_types = types;
+      uint32_t *offsets = realloc(cursor->row_offsets, UINT8_MAX * sizeof(uint32_t));
+      if (offsets == NULL)
+      {
+        return CHIDB_ENOMEM;
+      }
+      cursor->row_offsets = offsets;
+      cursor->row_alloc = UINT8_MAX;
+    }
+    // large records continue in overflow pages: the header is only read from them if
+    // it is not in the part stored in the cell
+    if (data[0] > cell->fields.tableLeaf.local_size)
+    {
+      if ((rc = chidb_Btree_readPayload(cursor->bt, cell, 0, data[0], header)) != CHIDB_OK)
+      {
+        return rc;
+      }
+      data = header;
+    }
+    cursor->row_ncols = getRecordCols(data, cursor->row_alloc, cursor->row_types, cursor->row_offsets);
+    cursor->row_writes = cursor->bt->writes;
+    cursor->row_generation = cursor->bt->pager->generation;
+    cursor->row_valid = true;
+  }
+  if (ncol >= cursor->row_ncols)
+  {
+    *type = 0;
+    *offset = 0;
+    return CHIDB_OK;
+  }
+  *type = cursor->row_types[ncol];
+  *offset = cursor->row_offsets[ncol];
+  return CHIDB_OK;
+}
+
+// read column ncol (or the key, if ncol is -1) of the rows in the leaf of a table the cursor is at, from
+// the row the cursor is at to the last one, into the cursor's batch. the values of a column that is not
+// an integer, or that is not stored in the cell of its row, are not read (they are not known).
+int chidb_Cursor_readBatch(chidb_dbm_cursor_t *cursor, int ncol)
+{
   cursor_node_entry *entry = cursor->node_entries + (cursor->nNodes - 1);
   BTreeNode *btn = entry->node;
-  for (int i = 0; i < btn->n_cells; i++)
+  cursor_batch *batch = &cursor->batch;
+  uint32_t n = btn->n_cells - entry->ncell;
+
+  batch->npage = 0;
+  if (btn->type != PGTYPE_TABLE_LEAF || btn->n_cells == 0)
+  {
+    return CHIDB_EMISMATCH;
+  }
+  if (batch->alloc < n)
   {
-    chidb_Btree_getCell(btn, i, &_cell);
-    if (_cell.key == cursor->curr_key)
+    int32_t *values = realloc(batch->values, n * sizeof(int32_t));
+    if (values == NULL)
+    {
+      return CHIDB_ENOMEM;
+    }
+    batch->values = values;
+    uint8_t *known = realloc(batch->known, n);
+    if (known == NULL)
     {
-      break;
+      return CHIDB_ENOMEM;
     }
+    batch->known = known;
+    int32_t *match = realloc(batch->match, n * sizeof(int32_t));
+    if (match == NULL)
+    {
+      return CHIDB_ENOMEM;
+    }
+    batch->match = match;
+    batch->alloc = n;
   }
-  *cell = _cell;
+
+  for (uint32_t i = 0; i < n; i++)
+  {
+    BTreeCell cell;
+    uint32_t type, offset;
+    chidb_Btree_getCell(btn, entry->ncell + i, &cell);
+    uint8_t *data = cell.fields.tableLeaf.data;
+    uint32_t local = cell.fields.tableLeaf.local_size;
+
+    batch->known[i] = 1;
+    if (ncol < 0)
+    {
+      batch->values[i] = (int32_t) cell.key;
+      continue;
+    }
+    batch->known[i] = 0;
+    batch->values[i] = 0;
+    if (data[0] > local)
+    {
+      continue;
+    }
+    // the values are decoded as the Column instruction does
+    getRecordCol(data, ncol, &type, &offset);
+    if (type == 1 && offset + 1 <= local)
+    {
+      batch->values[i] = data[offset];
+      batch->known[i] = 1;
+    }
+    else if (type == 2 && offset + 2 <= local)
+    {
+      batch->values[i] = get2byte(data + offset);
+      batch->known[i] = 1;
+    }
+    else if (type == 4 && offset + 4 <= local)
+    {
+      batch->values[i] = get4byte(data + offset);
+      batch->known[i] = 1;
+    }
+  }
+  batch->npage = btn->page->npage;
+  batch->first = entry->ncell;
+  batch->n = n;
+  batch->writes = cursor->bt->writes;
+  batch->generation = cursor->bt->pager->generation;
+  return CHIDB_OK;
+}
+
+// move the cursor to cell ncell of the leaf it is at
+int chidb_Cursor_skipTo(chidb_dbm_cursor_t *cursor, ncell_t ncell)
+{
+  cursor_node_entry *entry = cursor->node_entries + (cursor->nNodes - 1);
+  BTreeCell cell;
+  if (ncell >= entry->node->n_cells || chidb_Btree_getCell(entry->node, ncell, &cell) != CHIDB_OK)
+  {
+    return CHIDB_ECELLNO;
+  }
+  cursor->skip_next = false;
+  cursor->row_valid = false;
+  entry->ncell = ncell;
+  entry->key = cell.key;
+  cursor->curr_key = cell.key;
   return CHIDB_OK;
 }
 
+// move the cursor to the first entry of the leaf after the one it is at
+int chidb_Cursor_nextLeaf(chidb_dbm_cursor_t *cursor)
+{
+  cursor_node_entry *entry = cursor->node_entries + (cursor->nNodes - 1);
+  if (entry->node->n_cells > 0)
+  {
+    entry->ncell = entry->node->n_cells - 1;
+  }
+  return chidb_Cursor_next(cursor);
+}
+
 int chidb_Cursor_tableNextHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
 {
   cursor_node_entry *entry = cursor->node_entries + cursor_node_n;
   BTreeNode *btn = entry->node;
   BTreeCell cell;
   chilog(DEBUG, "%d cells, page %d, entry ncell %d", btn->n_cells, btn->page->npage, entry->ncell);
-  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TEXTINDEX_LEAF)
   {
     if (entry->ncell == btn->n_cells - 1 || btn->n_cells == 0 && cursor_node_n == 0)
     {
@@ -222,7 +476,7 @@ int chidb_Cursor_tableNextHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
       return chidb_Cursor_rewindNode(cursor, cell.fields.tableInternal.child_page, cursor_node_n + 1);
     }
   }
-  else if (btn->type == PGTYPE_INDEX_INTERNAL)
+  else if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TEXTINDEX_INTERNAL)
   {
     if (entry->ncell == btn->n_cells)
     {
@@ -232,27 +486,26 @@ int chidb_Cursor_tableNextHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
       }
       return chidb_Cursor_tableNextHelper(cursor, cursor_node_n - 1);
     }
+    else if (cursor_node_n < cursor->nNodes - 1)
+    {
+      // coming back up from the child of the cell, so the cell is the next entry
+      cursor->curr_key = entry->key;
+      cursor->nNodes = cursor_node_n + 1;
+      return CHIDB_OK;
+    }
     else
     {
-      if (entry->key > cursor->curr_key)
+      // the cursor is at the cell, so the next entry is the first one after it
+      entry->ncell += 1;
+      if (entry->ncell == btn->n_cells)
       {
-        cursor->curr_key = entry->key;
-        cursor->nNodes = cursor_node_n + 1;
-        return CHIDB_OK;
+        return chidb_Cursor_rewindNode(cursor, btn->right_page, cursor_node_n + 1);
       }
-      else if (entry->key == cursor->curr_key)
+      else
       {
-        entry->ncell += 1;
-        if (entry->ncell == btn->n_cells)
-        {
-          return chidb_Cursor_rewindNode(cursor, btn->right_page, cursor_node_n + 1);
-        }
-        else
-        {
-          chidb_Btree_getCell(btn, entry->ncell, &cell);
-          entry->key = cell.key;
-          return chidb_Cursor_rewindNode(cursor, cell.fields.indexInternal.child_page, cursor_node_n + 1);
-        }
+        chidb_Btree_getCell(btn, entry->ncell, &cell);
+        entry->key = cell.key;
+        return chidb_Cursor_rewindNode(cursor, cell.fields.indexInternal.child_page, cursor_node_n + 1);
       }
     }
   }
@@ -261,7 +514,18 @@ int chidb_Cursor_tableNextHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
 
 int chidb_Cursor_next(chidb_dbm_cursor_t *cursor)
 {
-  return chidb_Cursor_tableNextHelper(cursor, cursor->nNodes - 1);
+  if (cursor->skip_next)
+  {
+    cursor->skip_next = false;
+    return cursor->skip_rc;
+  }
+  cursor->row_valid = false;
+  int rc;
+  do
+  {
+    rc = chidb_Cursor_tableNextHelper(cursor, cursor->nNodes - 1);
+  } while (rc == CHIDB_OK && chidb_Cursor_atDeleted(cursor));
+  return rc;
 }
 
 int chidb_Cursor_tablePrevHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
@@ -269,7 +533,7 @@ int chidb_Cursor_tablePrevHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
   cursor_node_entry *entry = cursor->node_entries + cursor_node_n;
   BTreeNode *btn = entry->node;
   BTreeCell cell;
-  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+  if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TEXTINDEX_LEAF)
   {
     if (entry->ncell == 0)
     {
@@ -306,9 +570,15 @@ int chidb_Cursor_tablePrevHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
       return chidb_Cursor_rewindNodeEnd(cursor, cell.fields.tableInternal.child_page, cursor_node_n + 1);
     }
   }
-  else if (btn->type == PGTYPE_INDEX_INTERNAL)
+  else if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TEXTINDEX_INTERNAL)
   {
-    if (entry->ncell == 0)
+    if (cursor_node_n == cursor->nNodes - 1)
+    {
+      // the cursor is at the cell, so the previous entry is the last one in its child
+      chidb_Btree_getCell(btn, entry->ncell, &cell);
+      return chidb_Cursor_rewindNodeEnd(cursor, cell.fields.indexInternal.child_page, cursor_node_n + 1);
+    }
+    else if (entry->ncell == 0)
     {
       if (cursor_node_n == 0)
       {
@@ -316,30 +586,14 @@ int chidb_Cursor_tablePrevHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
       }
       return chidb_Cursor_tablePrevHelper(cursor, cursor_node_n - 1);
     }
-    else if (entry->ncell == btn->n_cells)
+    else
     {
-      entry->ncell = btn->n_cells - 1;
-      chidb_Btree_getCell(btn, btn->n_cells - 1, &cell);
+      // coming back up from a child, so the previous entry is the cell before it
+      entry->ncell -= 1;
+      chidb_Btree_getCell(btn, entry->ncell, &cell);
       entry->key = cell.key;
       cursor->curr_key = cell.key;
       cursor->nNodes = cursor_node_n + 1;
-      return CHIDB_OK;
-    }
-    else
-    {
-      if (entry->key == cursor->curr_key)
-      {
-        chidb_Btree_getCell(btn, entry->ncell, &cell);
-        return chidb_Cursor_rewindNodeEnd(cursor, cell.fields.indexInternal.child_page, cursor_node_n + 1);
-      }
-      else
-      {
-        entry->ncell -= 1;
-        chidb_Btree_getCell(btn, entry->ncell, &cell);
-        entry->key = cell.key;
-        cursor->curr_key = cell.key;
-        cursor->nNodes = cursor_node_n + 1;
-      }
     }
   }
   return CHIDB_OK;
@@ -347,163 +601,178 @@ int chidb_Cursor_tablePrevHelper(chidb_dbm_cursor_t *cursor, int cursor_node_n)
 
 int chidb_Cursor_prev(chidb_dbm_cursor_t *cursor)
 {
-  return chidb_Cursor_tablePrevHelper(cursor, cursor->nNodes - 1);
+  cursor->skip_next = false;
+  cursor->row_valid = false;
+  int rc;
+  do
+  {
+    rc = chidb_Cursor_tablePrevHelper(cursor, cursor->nNodes - 1);
+  } while (rc == CHIDB_OK && chidb_Cursor_atDeleted(cursor));
+  return rc;
 }
 
-// this function assumes that the key exists somewhere in the tree rooted at
-// the indexth entry of the node entries of the cursor.
-int chidb_Cursor_setKey(chidb_dbm_cursor_t *cursor, chidb_key_t key, int index)
+// Go to the position in the btree that key would be at, starting at the indexth
+// entry of the node entries of the cursor, and descending iteratively from there.
+// If the key exists in the btree, then the position will be at the key. If the key
+// doesn't exist in the btree, then the position will be one of two possibilities:
+// first, there exists a key greater than the given key in the leaf node that is
+// navigated to. In this case, the cursor is at the insertion position of the key
+// if it were to be inserted into the btree. Second is that the given key is
+// greater than all of the keys in the leaf node. Then the cursor will be set to
+// the last cell of the leaf node. In a text index, the key is given by tkey and
+// tsize instead of key.
+static int chidb_Cursor_descend(chidb_dbm_cursor_t *cursor, chidb_key_t key, const uint8_t *tkey, uint16_t tsize, int index)
 {
-  cursor_node_entry *entry = cursor->node_entries + index;
-  BTreeNode *btn = entry->node;
-  if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+  cursor->skip_next = false;
+  cursor->row_valid = false;
+  for (;; index++)
   {
-    for (int i = 0; i < btn->n_cells; i++)
+    cursor_node_entry *entry = cursor->node_entries + index;
+    BTreeNode *btn = entry->node;
+    BTreeCell curr_cell;
+    ncell_t ncell;
+    int found;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+      found = chidb_Btree_searchNodeText(btn, tkey, tsize, &ncell) == CHIDB_OK;
+    }
+    else
+    {
+      found = chidb_Btree_searchNode(btn, key, &ncell) == CHIDB_OK;
+    }
+    if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TEXTINDEX_LEAF)
     {
-      BTreeCell curr_cell;
-      chidb_Btree_getCell(btn, i, &curr_cell);
-      if (key <= curr_cell.key)
+      cursor->nNodes = index + 1;
+      if (btn->n_cells == 0)
+      {
+        return CHIDB_CURSOR_EMPTY_BTREE;
+      }
+      if (ncell == btn->n_cells)
       {
-        entry->ncell = i;
-        entry->key = curr_cell.key;
-        if (btn->type == PGTYPE_TABLE_INTERNAL)
-        {
-          chidb_Cursor_setPathNode(cursor, curr_cell.fields.tableInternal.child_page, 0, index + 1);
-        }
-        else if (btn->type == PGTYPE_INDEX_INTERNAL)
-        {
-          if (key == curr_cell.key)
-          {
-            cursor->curr_key = key;
-            cursor->nNodes = index + 1;
-            return CHIDB_OK;
-          }
-          chidb_Cursor_setPathNode(cursor, curr_cell.fields.indexInternal.child_page, 0, index + 1);
-        }
-        return chidb_Cursor_setKey(cursor, key, index + 1);
+        ncell--;
       }
+      chidb_Btree_getCell(btn, ncell, &curr_cell);
+      entry->key = curr_cell.key;
+      entry->ncell = ncell;
+      cursor->curr_key = curr_cell.key;
+      return found ? CHIDB_OK : CHIDB_ENOTFOUND;
     }
-    entry->ncell = btn->n_cells;
-    chidb_Cursor_setPathNode(cursor, btn->right_page, 0, index + 1);
-    return chidb_Cursor_setKey(cursor, key, index + 1);
-  }
-  else if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
-  {
-    for (int i = 0; i < btn->n_cells; i++)
+    entry->ncell = ncell;
+    if (ncell == btn->n_cells)
+    {
+      chidb_Cursor_setPathNode(cursor, btn->right_page, 0, index + 1);
+      continue;
+    }
+    chidb_Btree_getCell(btn, ncell, &curr_cell);
+    entry->key = curr_cell.key;
+    if (btn->type == PGTYPE_TABLE_INTERNAL)
     {
-      BTreeCell curr_cell;
-      chidb_Btree_getCell(btn, i, &curr_cell);
-      if (key == curr_cell.key)
+      chidb_Cursor_setPathNode(cursor, curr_cell.fields.tableInternal.child_page, 0, index + 1);
+    }
+    else if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+      // index entries in internal nodes are entries too
+      if (found)
       {
-        entry->key = key;
-        entry->ncell = i;
-        cursor->curr_key = key;
+        cursor->curr_key = curr_cell.key;
         cursor->nNodes = index + 1;
         return CHIDB_OK;
       }
+      chidb_Cursor_setPathNode(cursor, curr_cell.fields.indexInternal.child_page, 0, index + 1);
     }
   }
 }
 
-int chidb_Cursor_seekHelper(chidb_dbm_cursor_t *cursor, chidb_key_t key, int index)
+// compare the key of a cell with a key (in a text index, tkey and tsize). the result is
+// negative, zero or positive if the cell's key is smaller than, equal to, or larger than it.
+static int chidb_Cursor_compareCell(chidb_dbm_cursor_t *cursor, BTreeCell *cell, chidb_key_t key, const uint8_t *tkey, uint16_t tsize)
 {
-  cursor_node_entry *entry = cursor->node_entries + index;
-  uint8_t *data;
-  uint8_t size;
-  int try_find = chidb_Btree_find(cursor->bt, entry->node->page->npage, key, &data, &size);
-  if (try_find == CHIDB_ENOTFOUND)
+  if (cursor->tree_type == TEXT_INDEX_CURSOR)
   {
-    if (index == 0)
-    {
-      return CHIDB_ENOTFOUND;
-    }
-    else
-    {
-      return chidb_Cursor_seekHelper(cursor, key, index - 1);
-    }
+    return chidb_Btree_compareTextKey(&cell->tkey, tkey, tsize);
   }
-  else if (try_find == CHIDB_OK)
-  {
-    chidb_Cursor_setKey(cursor, key, index);
-    return CHIDB_OK;
-  }
-  return CHIDB_OK;
+  return (cell->key > key) - (cell->key < key);
 }
 
-int chidb_Cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key)
+// the deepest node in the path of the cursor whose subtree holds the position of the key
+// (in a text index, tkey and tsize), which a seek can descend from instead of the root. as
+// long as the B-Tree has not changed shape, the nodes in the path are still the ones on the
+// way to the cursor's entry (only their headers need to be reloaded, from the pages they
+// already hold), so a key in the same leaf as the cursor, or in a nearby one, is found
+// without reading the pages above it. otherwise, the path is reloaded from the root.
+static int chidb_Cursor_climb(chidb_dbm_cursor_t *cursor, chidb_key_t key, const uint8_t *tkey, uint16_t tsize)
 {
-  return chidb_Cursor_seekHelper(cursor, key, cursor->nNodes - 1);
-}
-
-// Go to the position in the btree that key would be at, regardless of whether
-// it is actually in the btree. If the key exists in the btree, then the position
-// will be at the key. If the key doesn't exist in the btree, then the position will be
-// one of two possibilities: first, there exists a key greater than the given key in the
-// leaf node that is navigated to. In this case, the cursor is at the insertion position
-// of the key if it were to be inserted into the btree. Second is that the given key is
-// greater than all of the keys in the leaf node. Then the cursor will be set to the last
-// cell of the leaf node.
-int chidb_Cursor_goToPositionHelper(chidb_dbm_cursor_t *cursor, chidb_key_t key, int index)
-{
-  cursor_node_entry *entry = cursor->node_entries + index;
-  BTreeNode *btn = entry->node;
-  if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+  if (cursor->shape != cursor->bt->shape || cursor->generation != cursor->bt->pager->generation)
+  {
+    chidb_Cursor_setPathNode(cursor, cursor->root_page_n, 0, 0);
+    cursor->nNodes = 1;
+    cursor->shape = cursor->bt->shape;
+    cursor->generation = cursor->bt->pager->generation;
+    return 0;
+  }
+  chidb_Btree_refreshNode(cursor->bt, cursor->node_entries[0].node);
+  for (int i = 0; i < (int)cursor->nNodes - 1; i++)
   {
-    for (int i = 0; i < btn->n_cells; i++)
+    // the child in the path holds the keys between the cells before and at ncell
+    // (up to and including the cell at ncell, in a table)
+    cursor_node_entry *entry = cursor->node_entries + i;
+    BTreeNode *btn = entry->node;
+    BTreeCell cell;
+    if (entry->ncell > 0)
     {
-      BTreeCell curr_cell;
-      chidb_Btree_getCell(btn, i, &curr_cell);
-      if (key <= curr_cell.key)
+      chidb_Btree_getCell(btn, entry->ncell - 1, &cell);
+      if (chidb_Cursor_compareCell(cursor, &cell, key, tkey, tsize) >= 0)
       {
-        entry->ncell = i;
-        entry->key = curr_cell.key;
-        if (btn->type == PGTYPE_TABLE_INTERNAL)
-        {
-          chidb_Cursor_setPathNode(cursor, curr_cell.fields.tableInternal.child_page, 0, index + 1);
-        }
-        else if (btn->type == PGTYPE_INDEX_INTERNAL)
-        {
-          if (key == curr_cell.key)
-          {
-            cursor->curr_key = key;
-            cursor->nNodes = index + 1;
-            return CHIDB_OK;
-          }
-          chidb_Cursor_setPathNode(cursor, curr_cell.fields.indexInternal.child_page, 0, index + 1);
-        }
-        return chidb_Cursor_goToPositionHelper(cursor, key, index + 1);
+        return i;
       }
     }
-    entry->ncell = btn->n_cells;
-    chidb_Cursor_setPathNode(cursor, btn->right_page, 0, index + 1);
-    return chidb_Cursor_goToPositionHelper(cursor, key, index + 1);
-  }
-  else if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
-  {
-    for (int i = 0; i < btn->n_cells; i++)
+    if (entry->ncell < btn->n_cells)
     {
-      BTreeCell curr_cell;
-      chidb_Btree_getCell(btn, i, &curr_cell);
-      if (key <= curr_cell.key || i == btn->n_cells - 1)
+      chidb_Btree_getCell(btn, entry->ncell, &cell);
+      int cmp = chidb_Cursor_compareCell(cursor, &cell, key, tkey, tsize);
+      if (cmp < 0 || (cmp == 0 && btn->type != PGTYPE_TABLE_INTERNAL))
       {
-        entry->key = curr_cell.key;
-        entry->ncell = i;
-        cursor->curr_key = curr_cell.key;
-        cursor->nNodes = index + 1;
-        return CHIDB_OK;
+        return i;
       }
     }
+    chidb_Btree_refreshNode(cursor->bt, cursor->node_entries[i + 1].node);
   }
+  return cursor->nNodes - 1;
+}
+
+// go to the position of a key (see chidb_Cursor_descend), starting from the path of the cursor.
+static int chidb_Cursor_find(chidb_dbm_cursor_t *cursor, chidb_key_t key, const uint8_t *tkey, uint16_t tsize)
+{
+  return chidb_Cursor_descend(cursor, key, tkey, tsize, chidb_Cursor_climb(cursor, key, tkey, tsize));
+}
+
+// set the cursor to the entry with the given key, searching the tree rooted at
+// the indexth entry of the node entries of the cursor.
+int chidb_Cursor_setKey(chidb_dbm_cursor_t *cursor, chidb_key_t key, int index)
+{
+  return chidb_Cursor_descend(cursor, key, NULL, 0, index);
+}
+
+int chidb_Cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key)
+{
+  return chidb_Cursor_find(cursor, key, NULL, 0) == CHIDB_OK ? CHIDB_OK : CHIDB_ENOTFOUND;
 }
 
 int chidb_Cursor_goToPosition(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 {
-  return chidb_Cursor_goToPositionHelper(cursor, key, 0);
+  int rc = chidb_Cursor_find(cursor, key, NULL, 0);
+  return rc == CHIDB_ENOTFOUND ? CHIDB_OK : rc;
 }
 
+// the seeks below go to the position of the key (see chidb_Cursor_descend), and then move the
+// cursor at most one entry, depending on how the key of the entry there compares to the given key.
+// (in a text index, the move also skips any delete-marked entries)
 int chidb_Cursor_seekGt(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 {
-  chidb_Cursor_goToPosition(cursor, key);
+  if (chidb_Cursor_goToPosition(cursor, key) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_LAST_ENTRY;
+  }
   if (key >= cursor->curr_key)
   {
     int try_next = chidb_Cursor_next(cursor);
@@ -517,7 +786,10 @@ int chidb_Cursor_seekGt(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 
 int chidb_Cursor_seekGte(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 {
-  chidb_Cursor_goToPosition(cursor, key);
+  if (chidb_Cursor_goToPosition(cursor, key) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_LAST_ENTRY;
+  }
   if (key > cursor->curr_key)
   {
     int try_next = chidb_Cursor_next(cursor);
@@ -531,7 +803,10 @@ int chidb_Cursor_seekGte(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 
 int chidb_Cursor_seekLt(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 {
-  chidb_Cursor_goToPosition(cursor, key);
+  if (chidb_Cursor_goToPosition(cursor, key) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_FIRST_ENTRY;
+  }
   if (key <= cursor->curr_key)
   {
     int try_prev = chidb_Cursor_prev(cursor);
@@ -545,7 +820,10 @@ int chidb_Cursor_seekLt(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 
 int chidb_Cursor_seekLte(chidb_dbm_cursor_t *cursor, chidb_key_t key)
 {
-  chidb_Cursor_goToPosition(cursor, key);
+  if (chidb_Cursor_goToPosition(cursor, key) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_FIRST_ENTRY;
+  }
   if (key < cursor->curr_key)
   {
     int try_prev = chidb_Cursor_prev(cursor);
@@ -556,3 +834,233 @@ int chidb_Cursor_seekLte(chidb_dbm_cursor_t *cursor, chidb_key_t key)
     return CHIDB_OK;
   }
 }
+
+// compare the key of the entry a text index cursor is at with the given key. the result is
+// negative, zero or positive if the entry's key is smaller than, equal to, or larger than it.
+int chidb_Cursor_compareText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  BTreeCell cell;
+  chidb_Cursor_get(cursor, &cell);
+  return chidb_Btree_compareTextKey(&cell.tkey, key, size);
+}
+
+// go to the position of a text key. returns CHIDB_CURSOR_EMPTY_BTREE if the index is empty.
+static int chidb_Cursor_goToPositionText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  int rc = chidb_Cursor_find(cursor, 0, key, size);
+  return rc == CHIDB_ENOTFOUND ? CHIDB_OK : rc;
+}
+
+int chidb_Cursor_seekText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  if (chidb_Cursor_find(cursor, 0, key, size) != CHIDB_OK || chidb_Cursor_atDeleted(cursor))
+  {
+    return CHIDB_ENOTFOUND;
+  }
+  return CHIDB_OK;
+}
+
+int chidb_Cursor_seekGtText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  if (chidb_Cursor_goToPositionText(cursor, key, size) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_LAST_ENTRY;
+  }
+  if (chidb_Cursor_compareText(cursor, key, size) <= 0 || chidb_Cursor_atDeleted(cursor))
+  {
+    return chidb_Cursor_next(cursor);
+  }
+  return CHIDB_OK;
+}
+
+int chidb_Cursor_seekGteText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  if (chidb_Cursor_goToPositionText(cursor, key, size) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_LAST_ENTRY;
+  }
+  if (chidb_Cursor_compareText(cursor, key, size) < 0 || chidb_Cursor_atDeleted(cursor))
+  {
+    return chidb_Cursor_next(cursor);
+  }
+  return CHIDB_OK;
+}
+
+int chidb_Cursor_seekLtText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  if (chidb_Cursor_goToPositionText(cursor, key, size) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_FIRST_ENTRY;
+  }
+  if (chidb_Cursor_compareText(cursor, key, size) >= 0 || chidb_Cursor_atDeleted(cursor))
+  {
+    return chidb_Cursor_prev(cursor);
+  }
+  return CHIDB_OK;
+}
+
+int chidb_Cursor_seekLteText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size)
+{
+  if (chidb_Cursor_goToPositionText(cursor, key, size) == CHIDB_CURSOR_EMPTY_BTREE)
+  {
+    return CHIDB_CURSOR_FIRST_ENTRY;
+  }
+  if (chidb_Cursor_compareText(cursor, key, size) > 0 || chidb_Cursor_atDeleted(cursor))
+  {
+    return chidb_Cursor_prev(cursor);
+  }
+  return CHIDB_OK;
+}
+
+// add an entry to the entries that chidb_Cursor_buildIndex loads into the cursor's index B-Tree.
+int chidb_Cursor_appendIdxEntry(chidb_dbm_cursor_t *cursor, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+  if (cursor->nIdxEntries == cursor->idxEntriesSize)
+  {
+    uint32_t size = cursor->idxEntriesSize ? cursor->idxEntriesSize * 2 : 1024;
+    cursor_idx_entry *entries = realloc(cursor->idx_entries, size * sizeof(cursor_idx_entry));
+    if (entries == NULL)
+    {
+      return CHIDB_ENOMEM;
+    }
+    cursor->idx_entries = entries;
+    cursor->idxEntriesSize = size;
+  }
+  cursor->idx_entries[cursor->nIdxEntries].keyIdx = keyIdx;
+  cursor->idx_entries[cursor->nIdxEntries].text = NULL;
+  cursor->idx_entries[cursor->nIdxEntries].keyPk = keyPk;
+  cursor->nIdxEntries++;
+  return CHIDB_OK;
+}
+
+// add an entry with a text key (a string, or any other byte string) to the entries that
+// chidb_Cursor_buildIndex inserts into the cursor's text index B-Tree. the key is copied.
+int chidb_Cursor_appendTextIdxEntry(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size, chidb_key_t keyPk)
+{
+  uint8_t *text = malloc(size ? size : 1);
+  if (text == NULL)
+  {
+    return CHIDB_ENOMEM;
+  }
+  memcpy(text, key, size);
+  int rc = chidb_Cursor_appendIdxEntry(cursor, 0, keyPk);
+  if (rc != CHIDB_OK)
+  {
+    free(text);
+    return rc;
+  }
+  cursor->idx_entries[cursor->nIdxEntries - 1].text = text;
+  cursor->idx_entries[cursor->nIdxEntries - 1].text_size = size;
+  return CHIDB_OK;
+}
+
+static int compare_idx_entries(const void *a, const void *b)
+{
+  const cursor_idx_entry *ea = a, *eb = b;
+  if (ea->keyIdx != eb->keyIdx)
+  {
+    return ea->keyIdx < eb->keyIdx ? -1 : 1;
+  }
+  if (ea->keyPk != eb->keyPk)
+  {
+    return ea->keyPk < eb->keyPk ? -1 : 1;
+  }
+  return 0;
+}
+
+static int compare_text_idx_entries(const void *a, const void *b)
+{
+  const cursor_idx_entry *ea = a, *eb = b;
+  // (in the order of chidb_Btree_compareTextKey)
+  int cmp = memcmp(ea->text, eb->text, ea->text_size < eb->text_size ? ea->text_size : eb->text_size);
+  if (cmp != 0)
+  {
+    return cmp;
+  }
+  if (ea->text_size != eb->text_size)
+  {
+    return ea->text_size < eb->text_size ? -1 : 1;
+  }
+  if (ea->keyPk != eb->keyPk)
+  {
+    return ea->keyPk < eb->keyPk ? -1 : 1;
+  }
+  return 0;
+}
+
+// text index B-Trees cannot be bulk loaded (see chidb_Btree_bulkLoadBegin), so the sorted
+// entries are inserted one at a time. since every key is larger than the ones before it,
+// every insertion is an append to the rightmost leaf, which leaves the leaves almost full.
+static int chidb_Cursor_buildTextIndex(chidb_dbm_cursor_t *cursor)
+{
+  int rc = CHIDB_OK;
+  qsort(cursor->idx_entries, cursor->nIdxEntries, sizeof(cursor_idx_entry), compare_text_idx_entries);
+  for (uint32_t i = 0; i < cursor->nIdxEntries && rc == CHIDB_OK; i++)
+  {
+    cursor_idx_entry *entry = cursor->idx_entries + i;
+    rc = chidb_Btree_insertInTextIndex(cursor->bt, cursor->root_page_n, entry->text, entry->text_size,
+                                       entry->keyPk);
+  }
+  return rc;
+}
+
+// sort the entries added with chidb_Cursor_appendIdxEntry, and bulk load them into the cursor's
+// (empty) index B-Tree. the cursor is rewound afterwards.
+int chidb_Cursor_buildIndex(chidb_dbm_cursor_t *cursor)
+{
+  BTreeLoader *bl;
+  BTreeCell cell;
+  int rc, rc_end;
+  if (cursor->tree_type == TEXT_INDEX_CURSOR)
+  {
+    rc = chidb_Cursor_buildTextIndex(cursor);
+    rc_end = CHIDB_OK;
+  }
+  else
+  {
+    rc = chidb_Btree_bulkLoadBegin(cursor->bt, cursor->root_page_n, BTREE_BULKLOAD_DEFAULT_FILL, &bl);
+    if (rc != CHIDB_OK)
+    {
+      chidb_Cursor_freeIdxEntries(cursor);
+      return rc;
+    }
+    qsort(cursor->idx_entries, cursor->nIdxEntries, sizeof(cursor_idx_entry), compare_idx_entries);
+    cell.type = PGTYPE_INDEX_LEAF;
+    for (uint32_t i = 0; i < cursor->nIdxEntries && rc == CHIDB_OK; i++)
+    {
+      cell.key = cursor->idx_entries[i].keyIdx;
+      cell.fields.indexLeaf.keyPk = cursor->idx_entries[i].keyPk;
+      rc = chidb_Btree_bulkLoadAppend(bl, &cell);
+    }
+    rc_end = chidb_Btree_bulkLoadEnd(bl);
+  }
+
+  chidb_Cursor_freeIdxEntries(cursor);
+  if (rc != CHIDB_OK || rc_end != CHIDB_OK)
+  {
+    return rc != CHIDB_OK ? rc : rc_end;
+  }
+
+  // the cursor's path still holds the (empty) root node as it was before the load
+  chidb_Cursor_rewind(cursor);
+  return CHIDB_OK;
+}
+
+// delete the entry the cursor is at from its B-Tree. the cursor is left at the entry after
+// the deleted one, so that the next call to chidb_Cursor_next (which would otherwise skip it)
+// does not move the cursor, and only reports whether there is such an entry.
+int chidb_Cursor_delete(chidb_dbm_cursor_t *cursor)
+{
+  chidb_key_t key = cursor->curr_key;
+  int rc = chidb_Btree_delete(cursor->bt, cursor->root_page_n, key);
+  if (rc != CHIDB_OK)
+  {
+    return rc;
+  }
+
+  // if the deletion changed the shape of the B-Tree, the seek descends from the root again
+  int try_seek = chidb_Cursor_seekGt(cursor, key);
+  cursor->skip_next = true;
+  cursor->skip_rc = try_seek == CHIDB_OK ? CHIDB_OK : CHIDB_CURSOR_LAST_ENTRY;
+  return CHIDB_OK;
+}
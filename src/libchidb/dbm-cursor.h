@@ -59,7 +59,8 @@ typedef enum chidb_dbm_cursor_type
 typedef enum chidb_dbm_cursor_tree_type
 {
     TABLE_CURSOR,
-    INDEX_CURSOR
+    INDEX_CURSOR,
+    TEXT_INDEX_CURSOR
 } chidb_dbm_cursor_tree_type;
 
 typedef struct chidbm_dbm_cursor_node_entry
@@ -75,6 +76,32 @@ typedef struct chidbm_dbm_cursor_node_entry
     ncell_t ncell;
 } cursor_node_entry;
 
+/* An index entry waiting to be loaded into an index B-Tree (see chidb_Cursor_buildIndex) */
+typedef struct cursor_idx_entry
+{
+    chidb_key_t keyIdx;
+    uint8_t *text; // key of an entry of a text index (owned by the cursor), NULL otherwise
+    uint16_t text_size;
+    chidb_key_t keyPk;
+} cursor_idx_entry;
+
+/* A column of the rows of a leaf, read all at once to be filtered in a batch (see chidb_Cursor_readBatch) */
+typedef struct cursor_batch
+{
+    npage_t npage;      // leaf the rows are in (0 if there is no batch)
+    ncell_t first;      // cell of the first row
+    uint32_t n;         // number of rows
+    int32_t *values;    // value of the column in each row
+    uint8_t *known;     // 0 if the column of a row is not an integer stored in its cell
+    int32_t *match;     // set by whoever filters the batch (see chidb_dbm_op_Filter)
+    uint32_t alloc;     // number of entries allocated in values, known and match
+    // what the batch was filtered with, and the writes counter and generation when it was read
+    uint32_t pc;
+    int32_t value;
+    uint32_t writes;
+    uint32_t generation;
+} cursor_batch;
+
 typedef struct chidb_dbm_cursor
 {
     chidb_dbm_cursor_type_t type; //
@@ -85,6 +112,35 @@ typedef struct chidb_dbm_cursor
     uint32_t col_n;
     uint32_t curr_key;
     uint32_t nNodes; // equal to number of nodes in the array of nodes.
+    uint32_t nNodesAlloc; // number of entries allocated in the array of nodes (the ones past nNodes may hold nodes too)
+    // the shape of the B-Tree file, and the generation of the pager, when the path of the cursor was
+    // loaded from the root. while they are unchanged, a seek can start from the nodes in the path
+    // (see chidb_Cursor_climb) instead of descending from the root again.
+    uint32_t shape;
+    uint32_t generation;
+    cursor_idx_entry *idx_entries; // entries added with chidb_Cursor_appendIdxEntry
+    uint32_t nIdxEntries;
+    uint32_t idxEntriesSize;
+    // set by chidb_Cursor_delete, which leaves the cursor on the entry after the deleted one.
+    // the next call to chidb_Cursor_next then stays there, and returns skip_rc.
+    bool skip_next;
+    int skip_rc;
+    // set by the Rewind instruction when the statement scans a range of keys (see chidb_scan_range).
+    // the Next instruction then stops after the last entry with a key <= scan_max.
+    bool scan_bounded;
+    chidb_key_t scan_max;
+    // types and offsets of the columns of the record the cursor is at, decoded from the record header
+    // the first time one of its columns is read (see chidb_Cursor_getColumn). row_valid is cleared
+    // whenever the cursor moves, and the cache is also not used if any node of the B-Tree file was
+    // written, or the pager's pages changed, since the header was decoded.
+    bool row_valid;
+    uint32_t row_writes;
+    uint32_t row_generation;
+    uint32_t row_ncols;  // number of columns decoded
+    uint32_t row_alloc;  // number of entries allocated in row_types and row_offsets
+    uint32_t *row_types;
+    uint32_t *row_offsets;
+    cursor_batch batch;
     /* Your code goes here */
 
 } chidb_dbm_cursor_t;
@@ -103,6 +159,14 @@ int chidb_Cursor_rewind(chidb_dbm_cursor_t *cursor);
 
 int chidb_Cursor_get(chidb_dbm_cursor_t *cursor, BTreeCell *cell);
 
+int chidb_Cursor_readBatch(chidb_dbm_cursor_t *cursor, int ncol);
+
+int chidb_Cursor_skipTo(chidb_dbm_cursor_t *cursor, ncell_t ncell);
+
+int chidb_Cursor_nextLeaf(chidb_dbm_cursor_t *cursor);
+
+int chidb_Cursor_getColumn(chidb_dbm_cursor_t *cursor, BTreeCell *cell, uint32_t ncol, uint32_t *type, uint32_t *offset);
+
 int chidb_Cursor_next(chidb_dbm_cursor_t *cursor);
 
 int chidb_Cursor_prev(chidb_dbm_cursor_t *cursor);
@@ -119,4 +183,24 @@ int chidb_Cursor_seekLt(chidb_dbm_cursor_t *cursor, chidb_key_t key);
 
 int chidb_Cursor_seekLte(chidb_dbm_cursor_t *cursor, chidb_key_t key);
 
+int chidb_Cursor_compareText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size);
+
+int chidb_Cursor_seekText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size);
+
+int chidb_Cursor_seekGtText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size);
+
+int chidb_Cursor_seekGteText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size);
+
+int chidb_Cursor_seekLtText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size);
+
+int chidb_Cursor_seekLteText(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size);
+
+int chidb_Cursor_appendIdxEntry(chidb_dbm_cursor_t *cursor, chidb_key_t keyIdx, chidb_key_t keyPk);
+
+int chidb_Cursor_appendTextIdxEntry(chidb_dbm_cursor_t *cursor, const uint8_t *key, uint16_t size, chidb_key_t keyPk);
+
+int chidb_Cursor_buildIndex(chidb_dbm_cursor_t *cursor);
+
+int chidb_Cursor_delete(chidb_dbm_cursor_t *cursor);
+
 #endif /* DBM_CURSOR_H_ */
\ No newline at end of file
@@ -76,6 +76,7 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
 
 /* Implemented in optimizer.c */
 int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
+int chidb_stmt_peephole(chidb_stmt *stmt);
 
 
 int __chidb_dbm_file_read_line(FILE *f, char* line)
@@ -290,6 +291,7 @@ int __chidb_dbm_file_parse_register(char *line, chidb_dbm_file_register_t *reg)
         if(ntokens == 3)
         {
             reg->reg.value.s = strdup(tokens[2]);
+            reg->reg.len = strlen(tokens[2]);
             reg->has_value = true;
         }
     }
@@ -458,6 +460,13 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
         	    {
         	        return rc;
         	    }
+
+        	    rc = chidb_stmt_peephole(&dbmf->stmt);
+
+        	    if(rc != CHIDB_OK)
+        	    {
+        	        return rc;
+        	    }
         	}
             break;
         case QUERY_RESULT:
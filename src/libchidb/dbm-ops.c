@@ -37,6 +37,7 @@
  *
  */
 
+#include <assert.h>
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
@@ -118,13 +119,29 @@ int chidb_dbm_op_Close(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
 
-    return chidb_Cursor_freeCursor(stmt->cursors + op->p1);
+    int rc = chidb_Cursor_freeCursor(stmt->cursors + op->p1);
+    stmt->cursors[op->p1].type = CURSOR_UNSPECIFIED;
+    return rc;
 }
 
 int chidb_dbm_op_Rewind(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    if (stmt->ranged && cursor->tree_type == TABLE_CURSOR)
+    {
+        /* Only the keys in the statement's range are scanned */
+        int try_seek = chidb_Cursor_seekGte(cursor, stmt->range_min);
+        cursor->scan_bounded = true;
+        cursor->scan_max = stmt->range_max;
+        if (try_seek == CHIDB_CURSOR_LAST_ENTRY ||
+            (try_seek == CHIDB_OK && cursor->curr_key > stmt->range_max))
+        {
+            stmt->pc = op->p2;
+            return CHIDB_OK;
+        }
+        return try_seek;
+    }
     int try_rewind = chidb_Cursor_rewind(cursor);
     if (try_rewind == CHIDB_OK)
     {
@@ -141,12 +158,19 @@ int chidb_dbm_op_Rewind(chidb_stmt *stmt, chidb_dbm_op_t *op)
     }
 }
 
-int chidb_dbm_op_Next(chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* The handlers of the instructions that run in every iteration of a loop
+ * (Next, Column, Key, ...) look up their registers and cursor, and then
+ * call a function like op_next below, which is also called by the
+ * threaded interpreter with the registers and cursor it decoded (see
+ * chidb_stmt_exec_threaded). */
+
+static inline int op_next(chidb_stmt *stmt, chidb_dbm_op_t *op, chidb_dbm_cursor_t *cursor)
 {
-    /* Your code goes here */
-    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    /* The values read from the previous row are no longer needed */
+    chidb_Arena_reset(&stmt->row_arena);
     int try_next = chidb_Cursor_next(cursor);
-    if (try_next == CHIDB_CURSOR_LAST_ENTRY)
+    if (try_next == CHIDB_CURSOR_LAST_ENTRY ||
+        (cursor->scan_bounded && cursor->curr_key > cursor->scan_max))
     {
         chilog(INFO, "Cursor %d at end, doing nothing", op->p1);
     }
@@ -157,10 +181,17 @@ int chidb_dbm_op_Next(chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+int chidb_dbm_op_Next(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    /* Your code goes here */
+    return op_next(stmt, op, stmt->cursors + op->p1);
+}
+
 int chidb_dbm_op_Prev(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    chidb_Arena_reset(&stmt->row_arena);
     int try_prev = chidb_Cursor_prev(cursor);
     if (try_prev == CHIDB_CURSOR_FIRST_ENTRY)
     {
@@ -172,11 +203,40 @@ int chidb_dbm_op_Prev(chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Text index cursors are keyed by the string in a register (or by the
+ * bytes of a key made by IdxKey), instead of by the integer in it. Sets
+ * *key and *size to the string, or returns CHIDB_EMISMATCH if the
+ * register does not hold one. */
+static int text_key(chidb_dbm_register_t *reg, const uint8_t **key, uint16_t *size)
+{
+    if (reg->type == REG_BINARY)
+    {
+        *key = reg->value.bin.bytes;
+        *size = reg->value.bin.nbytes;
+        return CHIDB_OK;
+    }
+    if (reg->type != REG_STRING)
+        return CHIDB_EMISMATCH;
+    *key = (const uint8_t *) reg->value.s;
+    *size = strlen(reg->value.s);
+    return CHIDB_OK;
+}
+
 int chidb_dbm_op_Seek(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    int try_seek = chidb_Cursor_seek(cursor, stmt->reg[op->p3].value.i);
+    int try_seek;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        try_seek = chidb_Cursor_seekText(cursor, key, size);
+    }
+    else
+        try_seek = chidb_Cursor_seek(cursor, stmt->reg[op->p3].value.i);
     if (try_seek == CHIDB_ENOTFOUND)
     {
         chilog(DEBUG, "Seek failed, jumping to %d.", op->p2);
@@ -189,7 +249,17 @@ int chidb_dbm_op_SeekGt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    int try_seek = chidb_Cursor_seekGt(cursor, stmt->reg[op->p3].value.i);
+    int try_seek;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        try_seek = chidb_Cursor_seekGtText(cursor, key, size);
+    }
+    else
+        try_seek = chidb_Cursor_seekGt(cursor, stmt->reg[op->p3].value.i);
     if (try_seek == CHIDB_CURSOR_LAST_ENTRY)
     {
         stmt->pc = op->p2;
@@ -202,7 +272,17 @@ int chidb_dbm_op_SeekGe(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    int try_seek = chidb_Cursor_seekGte(cursor, stmt->reg[op->p3].value.i);
+    int try_seek;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        try_seek = chidb_Cursor_seekGteText(cursor, key, size);
+    }
+    else
+        try_seek = chidb_Cursor_seekGte(cursor, stmt->reg[op->p3].value.i);
     if (try_seek == CHIDB_CURSOR_LAST_ENTRY)
     {
         stmt->pc = op->p2;
@@ -215,7 +295,17 @@ int chidb_dbm_op_SeekLt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    int try_seek = chidb_Cursor_seekLt(cursor, stmt->reg[op->p3].value.i);
+    int try_seek;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        try_seek = chidb_Cursor_seekLtText(cursor, key, size);
+    }
+    else
+        try_seek = chidb_Cursor_seekLt(cursor, stmt->reg[op->p3].value.i);
     if (try_seek == CHIDB_CURSOR_FIRST_ENTRY)
     {
         stmt->pc = op->p2;
@@ -227,7 +317,17 @@ int chidb_dbm_op_SeekLt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 int chidb_dbm_op_SeekLe(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    int try_seek = chidb_Cursor_seekLte(cursor, stmt->reg[op->p3].value.i);
+    int try_seek;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        try_seek = chidb_Cursor_seekLteText(cursor, key, size);
+    }
+    else
+        try_seek = chidb_Cursor_seekLte(cursor, stmt->reg[op->p3].value.i);
     if (try_seek == CHIDB_CURSOR_FIRST_ENTRY)
     {
         stmt->pc = op->p2;
@@ -260,14 +360,8 @@ static int col_size(int col_type)
     }
 }
 
-int chidb_dbm_op_Column(chidb_stmt *stmt, chidb_dbm_op_t *op)
+static inline int op_column(chidb_stmt *stmt, chidb_dbm_op_t *op, chidb_dbm_cursor_t *cursor, chidb_dbm_register_t *reg)
 {
-    /* Your code goes here */
-    if (op->p3 >= stmt->nReg)
-    {
-        realloc_reg(stmt, op->p3 + 1);
-    }
-    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
     if (cursor->col_n <= op->p2)
     {
         chilog(WARNING, "col_n %d col # %d", cursor->col_n, op->p2);
@@ -276,12 +370,26 @@ int chidb_dbm_op_Column(chidb_stmt *stmt, chidb_dbm_op_t *op)
     BTreeCell cell;
     chidb_Cursor_get(cursor, &cell);
     uint8_t *data = cell.fields.tableLeaf.data;
-    uint8_t *ptr = data;
+    uint32_t local = cell.fields.tableLeaf.local_size;
+    uint8_t value[4];
+    uint8_t *ptr;
     uint32_t type;
-    uint32_t offset_to_col = 0;
-    getRecordCol(data, op->p2, &type, &offset_to_col);
-    ptr += offset_to_col;
-    chidb_dbm_register_t *reg = stmt->reg + op->p3;
+    uint32_t offset_to_col;
+    int rc;
+
+    // the record header is decoded once per row, by the first Column that reads it
+    if ((rc = chidb_Cursor_getColumn(cursor, &cell, op->p2, &type, &offset_to_col)) != CHIDB_OK)
+        return rc;
+    // large records continue in overflow pages: the column is only read
+    // from them if it is not in the part stored in the cell
+    bool in_cell = offset_to_col + col_size(type) <= local;
+    ptr = data + offset_to_col;
+    if (!in_cell && (type == 1 || type == 2 || type == 4))
+    {
+        if ((rc = chidb_Btree_readPayload(cursor->bt, &cell, offset_to_col, col_size(type), value)) != CHIDB_OK)
+            return rc;
+        ptr = value;
+    }
     if (type == 0)
     {
         reg->type = REG_NULL;
@@ -305,24 +413,35 @@ int chidb_dbm_op_Column(chidb_stmt *stmt, chidb_dbm_op_t *op)
     }
     else
     {
-        reg->type = REG_STRING;
         int str_size = col_size(type);
-        reg->value.s = malloc(str_size + 1);
-        memcpy(reg->value.s, ptr, str_size);
-        reg->value.s[str_size] = '\0';
+        char *s = chidb_Arena_alloc(&stmt->row_arena, str_size + 1);
+        if (s == NULL)
+            return CHIDB_ENOMEM;
+        if (in_cell)
+            memcpy(s, ptr, str_size);
+        else if ((rc = chidb_Btree_readPayload(cursor->bt, &cell, offset_to_col, str_size, (uint8_t *) s)) != CHIDB_OK)
+            return rc;
+        s[str_size] = '\0';
+        reg->type = REG_STRING;
+        reg->value.s = s;
+        reg->len = str_size;
         chilog(DEBUG, "setting col %s, in reg %d", reg->value.s, op->p3);
     }
     return CHIDB_OK;
 }
 
-int chidb_dbm_op_Key(chidb_stmt *stmt, chidb_dbm_op_t *op)
+int chidb_dbm_op_Column(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
-    if (op->p2 >= stmt->nReg)
+    if (op->p3 >= stmt->nReg)
     {
-        realloc_reg(stmt, op->p2 + 1);
+        realloc_reg(stmt, op->p3 + 1);
     }
-    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    return op_column(stmt, op, stmt->cursors + op->p1, stmt->reg + op->p3);
+}
+
+static inline int op_key(chidb_stmt *stmt, chidb_dbm_op_t *op, chidb_dbm_cursor_t *cursor, chidb_dbm_register_t *reg)
+{
     cursor_node_entry *entry = cursor->node_entries + (cursor->nNodes - 1);
     BTreeNode *btn = entry->node;
     BTreeCell cell;
@@ -335,12 +454,21 @@ int chidb_dbm_op_Key(chidb_stmt *stmt, chidb_dbm_op_t *op)
             break;
         }
     }
-    chidb_dbm_register_t *reg = stmt->reg + op->p2;
     reg->type = REG_INT32;
     reg->value.i = cell.key;
     return CHIDB_OK;
 }
 
+int chidb_dbm_op_Key(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    /* Your code goes here */
+    if (op->p2 >= stmt->nReg)
+    {
+        realloc_reg(stmt, op->p2 + 1);
+    }
+    return op_key(stmt, op, stmt->cursors + op->p1, stmt->reg + op->p2);
+}
+
 int chidb_dbm_op_Integer(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -360,10 +488,12 @@ int chidb_dbm_op_String(chidb_stmt *stmt, chidb_dbm_op_t *op)
     {
         realloc_reg(stmt, op->p2 + 1);
     }
+    char *s = chidb_Arena_strndup(&stmt->arena, op->p4, op->p1);
+    if (s == NULL)
+        return CHIDB_ENOMEM;
     stmt->reg[op->p2].type = REG_STRING;
-    stmt->reg[op->p2].value.s = malloc(op->p1 + 1);
-    memcpy(stmt->reg[op->p2].value.s, op->p4, op->p1);
-    stmt->reg[op->p2].value.s[op->p1] = '\0';
+    stmt->reg[op->p2].value.s = s;
+    stmt->reg[op->p2].len = strlen(s);
     return CHIDB_OK;
 }
 
@@ -378,6 +508,41 @@ int chidb_dbm_op_Null(chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Variable * * * *
+ *
+ * Copy the value of parameter p1 (see chidb_bind_*) into register p2.
+ * A parameter that has not been bound is NULL.
+ */
+int chidb_dbm_op_Variable(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p1 < 1 || op->p1 > stmt->nParams)
+        return CHIDB_EMISUSE;
+    if (op->p2 >= stmt->nReg)
+    {
+        realloc_reg(stmt, op->p2 + 1);
+    }
+    chidb_dbm_register_t *value = &stmt->params[op->p1 - 1].value;
+    chidb_dbm_register_t *reg = &stmt->reg[op->p2];
+    switch (value->type)
+    {
+    case REG_INT32:
+        reg->type = REG_INT32;
+        reg->value.i = value->value.i;
+        break;
+    case REG_STRING:
+        reg->value.s = chidb_Arena_strndup(&stmt->arena, value->value.s, value->len);
+        if (reg->value.s == NULL)
+            return CHIDB_ENOMEM;
+        reg->type = REG_STRING;
+        reg->len = value->len;
+        break;
+    default:
+        reg->type = REG_NULL;
+        break;
+    }
+    return CHIDB_OK;
+}
+
 // function for debugging
 static void logreg(chidb_stmt *stmt, int n)
 {
@@ -403,7 +568,6 @@ int chidb_dbm_op_ResultRow(chidb_stmt *stmt, chidb_dbm_op_t *op)
     stmt->startRR = op->p1;
     stmt->nRR = op->p2;
     stmt->nCols = op->p2;
-    stmt->cols = malloc(op->p2 * sizeof(char *));
     return CHIDB_ROW;
 }
 
@@ -445,7 +609,9 @@ int chidb_dbm_op_MakeRecord(chidb_stmt *stmt, chidb_dbm_op_t *op)
         header_size += header_field_size;
         record_size += (header_field_size + data_size);
     }
-    uint8_t *data = malloc(record_size);
+    uint8_t *data = chidb_Arena_alloc(&stmt->arena, record_size);
+    if (data == NULL)
+        return CHIDB_ENOMEM;
     uint8_t *header_ptr = data;
     uint8_t *data_ptr = data + header_size;
     *header_ptr = header_size;
@@ -491,6 +657,8 @@ int chidb_dbm_op_Insert(chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_key_t key = cursor->curr_key;
     chidb_dbm_register_t *r1 = stmt->reg + op->p2;
     chidb_dbm_register_t *r2 = stmt->reg + op->p3;
+    if (r2->type != REG_INT32)
+        return CHIDB_EMISMATCH;
     chilog(DEBUG, "Trying to insert key %d in root page %d, from data in reg %d.", r2->value.i, cursor->root_page_n, op->p2);
     int try_insert = chidb_Btree_insertInTable(cursor->bt, cursor->root_page_n, r2->value.i, r1->value.bin.bytes, r1->value.bin.nbytes);
     if (try_insert != CHIDB_OK)
@@ -498,11 +666,32 @@ int chidb_dbm_op_Insert(chidb_stmt *stmt, chidb_dbm_op_t *op)
         chilog(DEBUG, "Insertion failed.");
         return try_insert;
     }
-    chidb_Cursor_rewind(cursor);
-    chidb_Cursor_setKey(cursor, key, 0);
+    /* Back to the entry the cursor was at, which is usually still in the
+     * same leaf (see chidb_Cursor_climb) */
+    chidb_Cursor_seek(cursor, key);
     return CHIDB_OK;
 }
 
+/* Delete p1 * * *
+ *
+ * p1: cursor
+ *
+ * delete the entry pointed at by the cursor at p1 from its BTree. The
+ * cursor is left pointing at the entry after the deleted one, and the
+ * next Next on it will not move it (so a Rewind/Delete/Next loop visits
+ * every entry).
+ */
+int chidb_dbm_op_Delete(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    int rc = chidb_Cursor_delete(cursor);
+    if (rc != CHIDB_OK)
+    {
+        chilog(WARNING, "Btree delete returned with code %d", rc);
+    }
+    return rc;
+}
+
 int chidb_dbm_op_Eq(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -709,6 +898,264 @@ int chidb_dbm_op_Ge(chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Goto * p2 * *
+ *
+ * p2: jump addr
+ *
+ * jump to p2
+ */
+int chidb_dbm_op_Goto(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    stmt->pc = op->p2;
+    return CHIDB_OK;
+}
+
+/* Compares two strings like strcmp, but with their lengths instead of
+ * the null characters at their ends */
+static inline int reg_strcmp(const chidb_dbm_register_t *r1, const chidb_dbm_register_t *r2)
+{
+    int cmp = memcmp(r1->value.s, r2->value.s, r1->len < r2->len ? r1->len : r2->len);
+    if (cmp != 0)
+        return cmp;
+    return (r1->len > r2->len) - (r1->len < r2->len);
+}
+
+/* EqInt, EqImm, EqStr, NeInt, ... p1 p2 p3 *
+ *
+ * p1: register containing value r1 (Int, Str), or the integer r1 (Imm)
+ * p2: jump addr
+ * p3: register containing value r2
+ *
+ * if r2 OP r1, jump, where OP is the comparison (Eq, Ne, ...) the
+ * instruction is a variant of. The variants do not look at the types of
+ * the registers to decide how to compare them: Int and Imm compare
+ * integers, and Str compares strings (see reg_strcmp). A NULL register
+ * (e.g., a NULL column, or a parameter that was not bound) satisfies no
+ * comparison.
+ *
+ * They are all generated from the template below (see FOREACH_CMP).
+ */
+#define TYPED_CMP_HANDLERS(ARG, CMP, OPERATOR)                                                  \
+    static inline bool cmp_##CMP##Int(const chidb_dbm_register_t *r1,                           \
+                                      const chidb_dbm_register_t *r2)                           \
+    {                                                                                           \
+        return r1->type == REG_INT32 && r2->type == REG_INT32 &&                                \
+               r2->value.i OPERATOR r1->value.i;                                                \
+    }                                                                                           \
+                                                                                                \
+    static inline bool cmp_##CMP##Imm(int32_t x, const chidb_dbm_register_t *r2)                \
+    {                                                                                           \
+        return r2->type == REG_INT32 && r2->value.i OPERATOR x;                                 \
+    }                                                                                           \
+                                                                                                \
+    static inline bool cmp_##CMP##Str(const chidb_dbm_register_t *r1,                           \
+                                      const chidb_dbm_register_t *r2)                           \
+    {                                                                                           \
+        return r1->type == REG_STRING && r2->type == REG_STRING &&                              \
+               reg_strcmp(r2, r1) OPERATOR 0;                                                   \
+    }                                                                                           \
+                                                                                                \
+    int chidb_dbm_op_##CMP##Int(chidb_stmt *stmt, chidb_dbm_op_t *op)                           \
+    {                                                                                           \
+        if (cmp_##CMP##Int(stmt->reg + op->p1, stmt->reg + op->p3))                             \
+            stmt->pc = op->p2;                                                                  \
+        return CHIDB_OK;                                                                        \
+    }                                                                                           \
+                                                                                                \
+    int chidb_dbm_op_##CMP##Imm(chidb_stmt *stmt, chidb_dbm_op_t *op)                           \
+    {                                                                                           \
+        if (cmp_##CMP##Imm(op->p1, stmt->reg + op->p3))                                         \
+            stmt->pc = op->p2;                                                                  \
+        return CHIDB_OK;                                                                        \
+    }                                                                                           \
+                                                                                                \
+    int chidb_dbm_op_##CMP##Str(chidb_stmt *stmt, chidb_dbm_op_t *op)                           \
+    {                                                                                           \
+        if (cmp_##CMP##Str(stmt->reg + op->p1, stmt->reg + op->p3))                             \
+            stmt->pc = op->p2;                                                                  \
+        return CHIDB_OK;                                                                        \
+    }
+
+FOREACH_CMP(TYPED_CMP_HANDLERS, _)
+
+/* The comparison (Eq, Ne, ...) that an instruction that compares integers
+ * does (i.e., the comparison itself, or its Int or Imm variant), or -1.
+ * *imm is set to true if the instruction is an Imm variant. */
+#define INT_CMP_CASES(ARG, CMP, OPERATOR) \
+    case Op_##CMP:                        \
+    case Op_##CMP##Int:                   \
+        return Op_##CMP;                  \
+    case Op_##CMP##Imm:                   \
+        *imm = true;                      \
+        return Op_##CMP;
+
+static int int_cmp_opcode(opcode_t opcode, bool *imm)
+{
+    *imm = false;
+    switch (opcode)
+    {
+        FOREACH_CMP(INT_CMP_CASES, _)
+    default:
+        return -1;
+    }
+}
+
+#ifdef __GNUC__
+/* filter_values compares four values at a time, with the vector extensions
+ * of gcc (and clang), which are compiled to SIMD instructions (e.g., SSE2
+ * on x86-64, NEON on ARM) or, where there are none, to scalar ones */
+typedef int32_t filter_vector_t __attribute__((vector_size(16)));
+
+#define FILTER_LOOP(CMP)                                  \
+    do                                                    \
+    {                                                     \
+        filter_vector_t xs = {x, x, x, x};                \
+        uint32_t i = 0;                                   \
+        for (; i + 4 <= n; i += 4)                        \
+        {                                                 \
+            filter_vector_t v;                            \
+            memcpy(&v, values + i, sizeof(v));            \
+            v = -(v CMP xs);                              \
+            memcpy(match + i, &v, sizeof(v));             \
+        }                                                 \
+        for (; i < n; i++)                                \
+            match[i] = values[i] CMP x;                   \
+    } while (0)
+#else
+#define FILTER_LOOP(CMP)                                  \
+    do                                                    \
+    {                                                     \
+        for (uint32_t i = 0; i < n; i++)                  \
+            match[i] = values[i] CMP x;                   \
+    } while (0)
+#endif
+
+/* Sets match[i] to 1 if values[i] satisfies the comparison cmp (Eq, Ne, Lt,
+ * Le, Gt or Ge) with x, as the comparison instructions do, and to 0
+ * otherwise. */
+static void filter_values(opcode_t cmp, const int32_t *values, uint32_t n, int32_t x, int32_t *match)
+{
+    switch (cmp)
+    {
+    case Op_Eq:
+        FILTER_LOOP(==);
+        break;
+    case Op_Ne:
+        FILTER_LOOP(!=);
+        break;
+    case Op_Lt:
+        FILTER_LOOP(<);
+        break;
+    case Op_Le:
+        FILTER_LOOP(<=);
+        break;
+    case Op_Gt:
+        FILTER_LOOP(>);
+        break;
+    default:
+        FILTER_LOOP(>=);
+        break;
+    }
+}
+
+/* Filter p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump addr
+ * p3: addr that the rows that do not satisfy the condition go to
+ *
+ * Skips the rows of the table that cursor p1 is at that do not satisfy
+ * the condition checked by the two instructions after Filter: a Column
+ * (or ColumnCmp, or Key) of cursor p1 into a register, and a comparison
+ * (Eq, Ne, Lt, Le, Gt or Ge, or their Int or Imm variants) of that
+ * register with an integer. If the comparison
+ * jumps to p3, the rows that satisfy the condition are the ones for
+ * which it does not jump.
+ *
+ * The column is read from all the rows left in the leaf the cursor is at
+ * at once, and the condition is checked on all of them in a batch. The
+ * cursor is then moved to the first row that satisfies it, moving on to
+ * the next leaves if there is none in this one, and the Column and the
+ * comparison after Filter check that row as usual. If no rows left
+ * satisfy the condition, jump to p2.
+ *
+ * Rows are only skipped if their column is an integer stored in the cell
+ * of the row, so whatever is not known to not satisfy the condition is
+ * left to the Column and the comparison. If the instructions after
+ * Filter are not a condition that can be checked in batches, Filter does
+ * nothing.
+ */
+int chidb_dbm_op_Filter(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    uint32_t addr = op - stmt->ops;
+    chidb_dbm_op_t *load = op + 1;
+    chidb_dbm_op_t *cmp = op + 2;
+    cursor_batch *batch = &cursor->batch;
+    int rc;
+
+    if (addr + 2 >= stmt->endOp || cursor->tree_type != TABLE_CURSOR || cursor->skip_next)
+        return CHIDB_OK;
+    bool column = load->opcode == Op_Column || load->opcode == Op_ColumnCmp;
+    if (!((column && load->p1 == op->p1) || (load->opcode == Op_Key && load->p1 == op->p1)))
+        return CHIDB_OK;
+    uint32_t reg = column ? load->p3 : load->p2;
+    bool imm;
+    int cmp_opcode = int_cmp_opcode(cmp->opcode, &imm);
+    if (cmp_opcode < 0 || cmp->p3 != reg ||
+        (!imm && (cmp->p1 >= stmt->nReg || stmt->reg[cmp->p1].type != REG_INT32)))
+        return CHIDB_OK;
+    int ncol = column ? load->p2 : -1;
+    int32_t x = imm ? cmp->p1 : stmt->reg[cmp->p1].value.i;
+    int32_t skip_matches = cmp->p2 == op->p3;
+
+    for (;;)
+    {
+        cursor_node_entry *entry = cursor->node_entries + (cursor->nNodes - 1);
+
+        /* The batch of this leaf is reused by the rows after the first one */
+        if (batch->npage != entry->node->page->npage || entry->ncell < batch->first ||
+            batch->pc != addr || batch->value != x ||
+            batch->writes != cursor->bt->writes || batch->generation != cursor->bt->pager->generation)
+        {
+            if ((rc = chidb_Cursor_readBatch(cursor, ncol)) == CHIDB_EMISMATCH)
+                return CHIDB_OK;
+            else if (rc != CHIDB_OK)
+                return rc;
+            filter_values(cmp_opcode, batch->values, batch->n, x, batch->match);
+            for (uint32_t i = 0; i < batch->n; i++)
+                batch->match[i] = (batch->match[i] ^ skip_matches) | !batch->known[i];
+            batch->pc = addr;
+            batch->value = x;
+        }
+
+        uint32_t i = entry->ncell - batch->first;
+        while (i < batch->n && !batch->match[i])
+            i++;
+        if (i < batch->n)
+        {
+            if (batch->first + i != entry->ncell && (rc = chidb_Cursor_skipTo(cursor, batch->first + i)) != CHIDB_OK)
+                return rc;
+            break;
+        }
+
+        rc = chidb_Cursor_nextLeaf(cursor);
+        if (rc == CHIDB_CURSOR_LAST_ENTRY)
+        {
+            stmt->pc = op->p2;
+            return CHIDB_OK;
+        }
+        else if (rc != CHIDB_OK)
+            return rc;
+        if (cursor->scan_bounded && cursor->curr_key > cursor->scan_max)
+            break;
+    }
+
+    if (cursor->scan_bounded && cursor->curr_key > cursor->scan_max)
+        stmt->pc = op->p2;
+    return CHIDB_OK;
+}
+
 /* IdxGt p1 p2 p3 *
  *
  * p1: cursor
@@ -720,7 +1167,18 @@ int chidb_dbm_op_Ge(chidb_stmt *stmt, chidb_dbm_op_t *op)
 int chidb_dbm_op_IdxGt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    if (cursor->curr_key > stmt->reg[op->p3].value.i)
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        if (chidb_Cursor_compareText(cursor, key, size) > 0)
+        {
+            stmt->pc = op->p2;
+        }
+    }
+    else if (cursor->curr_key > stmt->reg[op->p3].value.i)
     {
         stmt->pc = op->p2;
     }
@@ -740,7 +1198,18 @@ int chidb_dbm_op_IdxGt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 int chidb_dbm_op_IdxGe(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    if (cursor->curr_key >= stmt->reg[op->p3].value.i)
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        if (chidb_Cursor_compareText(cursor, key, size) >= 0)
+        {
+            stmt->pc = op->p2;
+        }
+    }
+    else if (cursor->curr_key >= stmt->reg[op->p3].value.i)
     {
         stmt->pc = op->p2;
     }
@@ -758,7 +1227,18 @@ int chidb_dbm_op_IdxGe(chidb_stmt *stmt, chidb_dbm_op_t *op)
 int chidb_dbm_op_IdxLt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    if (cursor->curr_key < stmt->reg[op->p3].value.i)
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        if (chidb_Cursor_compareText(cursor, key, size) < 0)
+        {
+            stmt->pc = op->p2;
+        }
+    }
+    else if (cursor->curr_key < stmt->reg[op->p3].value.i)
     {
         stmt->pc = op->p2;
     }
@@ -776,7 +1256,18 @@ int chidb_dbm_op_IdxLt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 int chidb_dbm_op_IdxLe(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
-    if (cursor->curr_key <= stmt->reg[op->p3].value.i)
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p3, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        if (chidb_Cursor_compareText(cursor, key, size) <= 0)
+        {
+            stmt->pc = op->p2;
+        }
+    }
+    else if (cursor->curr_key <= stmt->reg[op->p3].value.i)
     {
         stmt->pc = op->p2;
     }
@@ -803,11 +1294,11 @@ int chidb_dbm_op_IdxPKey(chidb_stmt *stmt, chidb_dbm_op_t *op)
     cursor_node_entry *entry = cursor->node_entries + cursor->nNodes - 1;
     BTreeCell cell;
     chidb_Btree_getCell(entry->node, entry->ncell, &cell);
-    if (cell.type == PGTYPE_INDEX_INTERNAL)
+    if (cell.type == PGTYPE_INDEX_INTERNAL || cell.type == PGTYPE_TEXTINDEX_INTERNAL)
     {
         reg->value.i = cell.fields.indexInternal.keyPk;
     }
-    else if (cell.type == PGTYPE_INDEX_LEAF)
+    else if (cell.type == PGTYPE_INDEX_LEAF || cell.type == PGTYPE_TEXTINDEX_LEAF)
     {
         reg->value.i = cell.fields.indexLeaf.keyPk;
     }
@@ -822,9 +1313,11 @@ int chidb_dbm_op_IdxPKey(chidb_stmt *stmt, chidb_dbm_op_t *op)
  *
  * p1: cursor
  * p2: register containing IdxKey
- * p2: register containing PKey
+ * p3: register containing PKey
  *
- * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
+ * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1.
+ * In a text index, IdxKey is a string or a binary (see IdxKey), and the
+ * cursor is rewound.
  */
 int chidb_dbm_op_IdxInsert(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
@@ -832,22 +1325,380 @@ int chidb_dbm_op_IdxInsert(chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_key_t key = cursor->curr_key;
     chidb_key_t idxKey = stmt->reg[op->p2].value.i;
     chidb_key_t pKey = stmt->reg[op->p3].value.i;
+    int try_insert;
 
-    int try_insert = chidb_Btree_insertInIndex(cursor->bt, cursor->root_page_n, idxKey, pKey);
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *tkey;
+        uint16_t size;
+        if (text_key(stmt->reg + op->p2, &tkey, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        try_insert = chidb_Btree_insertInTextIndex(cursor->bt, cursor->root_page_n, tkey, size, pKey);
+    }
+    else
+        try_insert = chidb_Btree_insertInIndex(cursor->bt, cursor->root_page_n, idxKey, pKey);
     if (try_insert != CHIDB_OK)
     {
         chilog(WARNING, "Btree index insert returned with code %d", try_insert);
         return try_insert;
     }
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+        chidb_Cursor_rewind(cursor);
+    else
+        chidb_Cursor_seek(cursor, key);
+    return CHIDB_OK;
+}
+
+/* IdxAppend p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: register containing IdxKey
+ * p3: register containing PKey
+ *
+ * add new (IdxKey,PKey) entry to the entries that IdxBuild will load into
+ * the index BTree pointed at by cursor at p1. The entries can be added in
+ * any order. In a text index, IdxKey is a string (or a key made by IdxKey),
+ * and entries with a NULL IdxKey are left out of the index.
+ */
+int chidb_dbm_op_IdxAppend(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    if (cursor->tree_type == TEXT_INDEX_CURSOR)
+    {
+        const uint8_t *key;
+        uint16_t size;
+        if (stmt->reg[op->p2].type == REG_NULL)
+            return CHIDB_OK;
+        if (text_key(stmt->reg + op->p2, &key, &size) != CHIDB_OK)
+            return CHIDB_EMISMATCH;
+        return chidb_Cursor_appendTextIdxEntry(cursor, key, size, stmt->reg[op->p3].value.i);
+    }
+    return chidb_Cursor_appendIdxEntry(cursor, stmt->reg[op->p2].value.i, stmt->reg[op->p3].value.i);
+}
+
+/* IdxBuild p1 * * *
+ *
+ * p1: cursor
+ *
+ * sort the entries added with IdxAppend, and build the (empty) index BTree
+ * pointed at by cursor at p1 from them, bottom-up.
+ */
+int chidb_dbm_op_IdxBuild(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    int rc = chidb_Cursor_buildIndex(cursor);
+    if (rc != CHIDB_OK)
+    {
+        chilog(WARNING, "Btree index build returned with code %d", rc);
+    }
+    return rc;
+}
+
+/* Record index keys
+ *
+ * An index on several columns (or with INCLUDE columns) is kept in a text
+ * index B-Tree, whose keys are made by IdxKey from the values of several
+ * registers. Each value is a tag byte followed by its bytes: a NULL is just
+ * IDXKEY_NULL, an integer is IDXKEY_INT and its four big-endian bytes (with
+ * the sign bit flipped, so negative numbers come first), and a string is
+ * IDXKEY_TEXT, its bytes and a 0 byte. Comparing two keys with memcmp then
+ * compares their values one by one, the same way Lt, Gt, etc. would.
+ *
+ * The INCLUDE values are appended to a key by IdxInclude, after the values
+ * that are searched on (which end with the primary key, so they are unique).
+ * If they do not fit in a text index key, a single IDXKEY_SPILLED byte is
+ * appended instead, and the values are only in the table row.
+ */
+#define IDXKEY_NULL (0x00)
+#define IDXKEY_INT (0x01)
+#define IDXKEY_TEXT (0x02)
+#define IDXKEY_SPILLED (0x03)
+
+/* Size of the record index key values of registers first to first + n - 1
+ * (or -1 if one of them cannot be in a key) */
+static int32_t idxkey_size(chidb_stmt *stmt, int32_t first, int32_t n)
+{
+    int32_t size = 0;
+    for (int i = 0; i < n; i++)
+    {
+        chidb_dbm_register_t *reg = stmt->reg + first + i;
+        if (reg->type == REG_INT32)
+            size += 5;
+        else if (reg->type == REG_STRING)
+            size += strlen(reg->value.s) + 2;
+        else if (reg->type == REG_NULL)
+            size += 1;
+        else
+            return -1;
+        if (size > UINT16_MAX)
+            return UINT16_MAX + 1;
+    }
+    return size;
+}
+
+/* Writes the record index key values of registers first to first + n - 1
+ * to ptr */
+static void idxkey_put(chidb_stmt *stmt, int32_t first, int32_t n, uint8_t *ptr)
+{
+    for (int i = 0; i < n; i++)
+    {
+        chidb_dbm_register_t *reg = stmt->reg + first + i;
+        if (reg->type == REG_INT32)
+        {
+            *ptr++ = IDXKEY_INT;
+            put4byte(ptr, (uint32_t) reg->value.i ^ 0x80000000);
+            ptr += 4;
+        }
+        else if (reg->type == REG_STRING)
+        {
+            uint32_t len = strlen(reg->value.s);
+            *ptr++ = IDXKEY_TEXT;
+            memcpy(ptr, reg->value.s, len);
+            ptr += len;
+            *ptr++ = 0;
+        }
+        else
+        {
+            *ptr++ = IDXKEY_NULL;
+        }
+    }
+}
+
+/* Position of the value after the one at pos in a record index key */
+static uint16_t idxkey_next(const uint8_t *key, uint16_t size, uint16_t pos)
+{
+    if (key[pos] == IDXKEY_INT)
+        return pos + 5;
+    if (key[pos] == IDXKEY_TEXT)
+        return pos + strnlen((const char *) key + pos + 1, size - pos - 1) + 2;
+    return pos + 1;
+}
+
+/* Copies the key of the entry at a text index cursor to key (which has
+ * room for any text index key) */
+static int idxkey_get(chidb_dbm_cursor_t *cursor, uint8_t *key, uint16_t *size)
+{
+    BTreeCell cell;
+
+    if (cursor->tree_type != TEXT_INDEX_CURSOR)
+        return CHIDB_EMISMATCH;
+    if (chidb_Cursor_get(cursor, &cell) != CHIDB_OK)
+        return CHIDB_ECORRUPT;
+    *size = cell.tkey.prefix_size + cell.tkey.suffix_size;
+    memcpy(key, cell.tkey.prefix, cell.tkey.prefix_size);
+    memcpy(key + cell.tkey.prefix_size, cell.tkey.suffix, cell.tkey.suffix_size);
+    return CHIDB_OK;
+}
+
+/* Stores a key in (register at r) */
+static void set_binary(chidb_stmt *stmt, int32_t r, uint8_t *bytes, uint32_t nbytes)
+{
+    if (r >= stmt->nReg)
+    {
+        realloc_reg(stmt, r + 1);
+    }
+    chidb_dbm_register_t *reg = stmt->reg + r;
+    reg->type = REG_BINARY;
+    reg->value.bin.bytes = bytes;
+    reg->value.bin.nbytes = nbytes;
+}
+
+/* IdxKey p1 p2 p3 *
+ *
+ * p1: first register
+ * p2: number of registers
+ * p3: register
+ *
+ * make a record index key from the values in registers p1 to p1 + p2 - 1,
+ * and store it in (register at p3)
+ */
+int chidb_dbm_op_IdxKey(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int32_t size = idxkey_size(stmt, op->p1, op->p2);
+    if (size < 0)
+        return CHIDB_EMISMATCH;
+    if (size > UINT16_MAX)
+        return CHIDB_ERANGE;
+
+    uint8_t *key = chidb_Arena_alloc(&stmt->arena, size ? size : 1);
+    if (key == NULL)
+        return CHIDB_ENOMEM;
+    idxkey_put(stmt, op->p1, op->p2, key);
+    set_binary(stmt, op->p3, key, size);
+    return CHIDB_OK;
+}
+
+/* IdxInclude p1 p2 p3 *
+ *
+ * p1: first register
+ * p2: number of registers
+ * p3: register containing IdxKey
+ *
+ * append the values in registers p1 to p1 + p2 - 1 (the INCLUDE columns of
+ * a record index) to the key in (register at p3). If the key would then be
+ * too long for a text index B-Tree, IDXKEY_SPILLED is appended instead, so
+ * a long INCLUDE value never keeps a row out of the index.
+ */
+int chidb_dbm_op_IdxInclude(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    const uint8_t *prev;
+    uint16_t prev_size;
+
+    if (text_key(stmt->reg + op->p3, &prev, &prev_size) != CHIDB_OK)
+        return CHIDB_EMISMATCH;
+    int32_t size = idxkey_size(stmt, op->p1, op->p2);
+    if (size < 0)
+        return CHIDB_EMISMATCH;
+    bool spilled = prev_size + size > BTREE_MAX_TEXTKEY(stmt->db->bt->pager->page_size);
+    if (spilled)
+        size = 1;
+
+    uint8_t *key = chidb_Arena_alloc(&stmt->arena, prev_size + size);
+    if (key == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(key, prev, prev_size);
+    if (spilled)
+        key[prev_size] = IDXKEY_SPILLED;
+    else
+        idxkey_put(stmt, op->p1, op->p2, key + prev_size);
+    set_binary(stmt, op->p3, key, prev_size + size);
+    return CHIDB_OK;
+}
+
+/* IdxSpilled p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump address
+ *
+ * if the INCLUDE values of the record index entry at cursor p1 are not in
+ * its key (see IdxInclude), jump to addr p2
+ */
+int chidb_dbm_op_IdxSpilled(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint8_t key[UINT8_MAX * 2];
+    uint16_t size;
+    int rc = idxkey_get(stmt->cursors + op->p1, key, &size);
+    if (rc != CHIDB_OK)
+        return rc;
+    for (uint16_t pos = 0; pos < size; pos = idxkey_next(key, size, pos))
+    {
+        if (key[pos] == IDXKEY_SPILLED)
+        {
+            stmt->pc = op->p2;
+            break;
+        }
+    }
+    return CHIDB_OK;
+}
+
+/* IdxColumn p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column number
+ * p3: register
+ *
+ * store the p2-th value of the record index key (see IdxKey) of the entry
+ * at cursor p1 in (register at p3). Index-only plans read every column they
+ * need this way, without going to the table (unless IdxSpilled jumps).
+ */
+int chidb_dbm_op_IdxColumn(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint8_t key[UINT8_MAX * 2];
+    uint16_t size;
+    int rc = idxkey_get(stmt->cursors + op->p1, key, &size);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    // skip the values before column p2
+    uint16_t pos = 0;
+    for (int i = 0; i < op->p2 && pos < size; i++)
+    {
+        pos = idxkey_next(key, size, pos);
+    }
+    if (pos >= size)
+        return CHIDB_ECORRUPT;
+
+    if (op->p3 >= stmt->nReg)
+    {
+        realloc_reg(stmt, op->p3 + 1);
+    }
+    chidb_dbm_register_t *reg = stmt->reg + op->p3;
+    if (key[pos] == IDXKEY_INT && pos + 5 <= size)
+    {
+        reg->type = REG_INT32;
+        reg->value.i = (int32_t) (get4byte(key + pos + 1) ^ 0x80000000);
+    }
+    else if (key[pos] == IDXKEY_TEXT)
+    {
+        size_t len = strnlen((char *) key + pos + 1, size - pos - 1);
+        char *s = chidb_Arena_strndup(&stmt->row_arena, (char *) key + pos + 1, len);
+        if (s == NULL)
+            return CHIDB_ENOMEM;
+        reg->type = REG_STRING;
+        reg->value.s = s;
+        reg->len = len;
+    }
+    else if (key[pos] == IDXKEY_NULL)
+    {
+        reg->type = REG_NULL;
+    }
+    else if (key[pos] == IDXKEY_SPILLED)
+    {
+        // the value is only in the table row
+        return CHIDB_EMISMATCH;
+    }
+    else
+    {
+        return CHIDB_ECORRUPT;
+    }
+    return CHIDB_OK;
+}
+
+/* IdxDelete p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register containing IdxKey
+ *
+ * delete the entry with key IdxKey from the text index BTree pointed at by
+ * cursor at p1 (see chidb_Btree_deleteFromTextIndex). It is not an error
+ * if there is no such entry. The cursor is rewound.
+ */
+int chidb_dbm_op_IdxDelete(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    const uint8_t *key;
+    uint16_t size;
+
+    if (cursor->tree_type != TEXT_INDEX_CURSOR || text_key(stmt->reg + op->p2, &key, &size) != CHIDB_OK)
+        return CHIDB_EMISMATCH;
+    int rc = chidb_Btree_deleteFromTextIndex(cursor->bt, cursor->root_page_n, key, size);
+    if (rc != CHIDB_OK && rc != CHIDB_ENOTFOUND)
+    {
+        chilog(WARNING, "Btree index delete returned with code %d", rc);
+        return rc;
+    }
     chidb_Cursor_rewind(cursor);
-    chidb_Cursor_setKey(cursor, key, 0);
     return CHIDB_OK;
 }
 
+/* Every change to the schema increments the schema cookie, so other
+ * statements (and connections) know they must reload the schema */
+static int bump_schema_cookie(chidb_stmt *stmt)
+{
+    uint32_t cookie;
+    int rc = chidb_Btree_getSchemaCookie(stmt->db->bt, &cookie);
+    if (rc != CHIDB_OK)
+        return rc;
+    return chidb_Btree_setSchemaCookie(stmt->db->bt, cookie + 1);
+}
+
 int chidb_dbm_op_CreateTable(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     npage_t new_npage;
+    int rc = bump_schema_cookie(stmt);
+    if (rc != CHIDB_OK)
+        return rc;
     chidb_Btree_newNode(stmt->db->bt, &new_npage, PGTYPE_TABLE_LEAF);
     if (stmt->nReg <= op->p1)
     {
@@ -859,11 +1710,21 @@ int chidb_dbm_op_CreateTable(chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* CreateIndex p1 p2 * *
+ *
+ * p1: register
+ * p2: 0 for an index on an integer column, 1 for an index on a text column
+ *
+ * create a new (empty) index BTree, and store its root page in (register at p1)
+ */
 int chidb_dbm_op_CreateIndex(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
     npage_t new_npage;
-    chidb_Btree_newNode(stmt->db->bt, &new_npage, PGTYPE_INDEX_LEAF);
+    int rc = bump_schema_cookie(stmt);
+    if (rc != CHIDB_OK)
+        return rc;
+    chidb_Btree_newNode(stmt->db->bt, &new_npage, op->p2 ? PGTYPE_TEXTINDEX_LEAF : PGTYPE_INDEX_LEAF);
     if (stmt->nReg <= op->p1)
     {
         realloc_reg(stmt, op->p1 + 1);
@@ -874,20 +1735,205 @@ int chidb_dbm_op_CreateIndex(chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Copy p1 p2 * *
+ *
+ * p1: register
+ * p2: register
+ *
+ * copy the value in (register at p1) to (register at p2). A string (or
+ * binary) value is duplicated, so the copy is still valid once the
+ * cursors move to another row.
+ */
 int chidb_dbm_op_Copy(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
-
+    if (op->p2 >= stmt->nReg)
+    {
+        realloc_reg(stmt, op->p2 + 1);
+    }
+    chidb_dbm_register_t *from = stmt->reg + op->p1;
+    chidb_dbm_register_t *to = stmt->reg + op->p2;
+    *to = *from;
+    if (from->type == REG_STRING)
+    {
+        to->value.s = chidb_Arena_strndup(&stmt->arena, from->value.s, from->len);
+        if (to->value.s == NULL)
+            return CHIDB_ENOMEM;
+    }
+    else if (from->type == REG_BINARY)
+    {
+        to->value.bin.bytes = chidb_Arena_alloc(&stmt->arena, from->value.bin.nbytes ? from->value.bin.nbytes : 1);
+        if (to->value.bin.bytes == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(to->value.bin.bytes, from->value.bin.bytes, from->value.bin.nbytes);
+    }
     return CHIDB_OK;
 }
 
+/* SCopy p1 p2 * *
+ *
+ * p1: register
+ * p2: register
+ *
+ * make (register at p2) a shallow copy of (register at p1): a string (or
+ * binary) value is shared by both registers, so p2 must not be used after
+ * p1 is changed.
+ */
 int chidb_dbm_op_SCopy(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    if (op->p2 >= stmt->nReg)
+    {
+        realloc_reg(stmt, op->p2 + 1);
+    }
+    stmt->reg[op->p2] = stmt->reg[op->p1];
+    return CHIDB_OK;
+}
+
+/* Begin * * * *
+ *
+ * Start a transaction. Until it ends, changes are kept in memory
+ * (see chidb_Pager_begin) and, with a write-ahead log, all statements
+ * read from the same snapshot of the database.
+ */
+int chidb_dbm_op_Begin(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    Pager *pager = stmt->db->bt->pager;
 
+    int rc = chidb_Pager_begin(pager);
+    if (rc != CHIDB_OK)
+    {
+        chilog(WARNING, "Cannot start a transaction within a transaction");
+        return rc;
+    }
+    return chidb_Pager_beginRead(pager);
+}
+
+/* Commit * * * *
+ *
+ * Write all the changes made in the current transaction
+ */
+int chidb_dbm_op_Commit(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    Pager *pager = stmt->db->bt->pager;
+
+    if (!pager->in_txn)
+    {
+        chilog(WARNING, "Cannot commit: no transaction is active");
+        return CHIDB_EMISUSE;
+    }
+    int rc = chidb_Pager_commit(pager);
+    if (rc == CHIDB_OK)
+        chidb_Pager_endRead(pager);
+    return rc;
+}
+
+/* Rollback * * * *
+ *
+ * Discard all the changes made in the current transaction
+ */
+int chidb_dbm_op_Rollback(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    Pager *pager = stmt->db->bt->pager;
+
+    int rc = chidb_Pager_rollback(pager);
+    if (rc == CHIDB_EMISUSE)
+    {
+        chilog(WARNING, "Cannot roll back: no transaction is active");
+        return rc;
+    }
+    chidb_Pager_endRead(pager);
+    /* The schema cookie goes back to its old value, but the schema
+     * may have been reloaded with the changes we just discarded */
+    schema_invalidate(stmt->db);
+    return rc;
+}
+
+/* Runs a comparison instruction (Eq, Ne, ..., or one of their variants) */
+#define CMP_HANDLER_CASES(ARG, CMP, OPERATOR)         \
+    case Op_##CMP:                                    \
+        return chidb_dbm_op_##CMP(stmt, op);          \
+    case Op_##CMP##Int:                               \
+        return chidb_dbm_op_##CMP##Int(stmt, op);     \
+    case Op_##CMP##Imm:                               \
+        return chidb_dbm_op_##CMP##Imm(stmt, op);     \
+    case Op_##CMP##Str:                               \
+        return chidb_dbm_op_##CMP##Str(stmt, op);
+
+static inline int cmp_handle(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    switch (op->opcode)
+    {
+        FOREACH_CMP(CMP_HANDLER_CASES, _)
+    default:
+        return chidb_dbm_op_handle(stmt, op);
+    }
+}
+
+/* ColumnCmp p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column number
+ * p3: register
+ *
+ * Does what the three instructions starting at ColumnCmp do, without
+ * going back to the interpreter in between: a Column p1 p2 p3, the
+ * comparison after it (which must not jump to the instruction after
+ * itself), and the Goto after the comparison, which is where the rows
+ * for which the comparison does not jump go.
+ *
+ * ColumnCmp is a superinstruction: it is not generated by codegen, but
+ * by the peephole pass (see chidb_stmt_peephole in optimizer.c), which
+ * leaves the comparison and the Goto in the program. They are read from
+ * there, and still run on their own if something jumps to them.
+ */
+int chidb_dbm_op_ColumnCmp(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t addr = op - stmt->ops;
+    int rc;
+
+    if ((rc = chidb_dbm_op_Column(stmt, op)) != CHIDB_OK)
+        return rc;
+    stmt->pc = addr + 2;
+    if ((rc = cmp_handle(stmt, op + 1)) != CHIDB_OK)
+        return rc;
+    if (stmt->pc == addr + 2)
+        stmt->pc = op[2].p2;
     return CHIDB_OK;
 }
 
+/* NextColumn p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * Does what a Next p1 p2 does and, if it jumps, what the instruction at
+ * p2 (a Column, ColumnCmp or Key, which reads the row the cursor moved
+ * to) does too, without going back to the interpreter in between. p2
+ * must come before NextColumn.
+ *
+ * Like ColumnCmp, NextColumn is a superinstruction generated by the
+ * peephole pass.
+ */
+int chidb_dbm_op_NextColumn(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc = chidb_dbm_op_Next(stmt, op);
+    if (rc != CHIDB_OK || stmt->pc != op->p2)
+        return rc;
+
+    chidb_dbm_op_t *load = stmt->ops + op->p2;
+    stmt->pc++;
+    switch (load->opcode)
+    {
+    case Op_Column:
+        return chidb_dbm_op_Column(stmt, load);
+    case Op_ColumnCmp:
+        return chidb_dbm_op_ColumnCmp(stmt, load);
+    case Op_Key:
+        return chidb_dbm_op_Key(stmt, load);
+    default:
+        return chidb_dbm_op_handle(stmt, load);
+    }
+}
+
 int chidb_dbm_op_Halt(chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -898,3 +1944,281 @@ int chidb_dbm_op_Halt(chidb_stmt *stmt, chidb_dbm_op_t *op)
     stmt->pc = stmt->nOps;
     return CHIDB_OK;
 }
+
+/*** THREADED INTERPRETER ***/
+
+#ifdef CHIDB_DBM_THREADED
+
+/* Operands of an instruction that name registers or a cursor */
+#define OPND_R1 (1 << 0)     /* p1 is a register */
+#define OPND_R2 (1 << 1)     /* p2 is a register */
+#define OPND_R3 (1 << 2)     /* p3 is a register */
+#define OPND_CURSOR (1 << 3) /* p1 is a cursor */
+#define OPND_RANGE (1 << 4)  /* p1 is the first of p2 registers */
+
+#define REG_CMP_OPERANDS(ARG, CMP, OPERATOR) case Op_##CMP: case Op_##CMP##Int: case Op_##CMP##Str:
+#define IMM_CMP_OPERANDS(ARG, CMP, OPERATOR) case Op_##CMP##Imm:
+
+/* Which operands of an instruction name registers or a cursor (a
+ * combination of the OPND_* flags above) */
+static int op_operands(opcode_t opcode)
+{
+    switch (opcode)
+    {
+    case Op_OpenRead:
+    case Op_OpenWrite:
+    case Op_Key:
+    case Op_IdxPKey:
+    case Op_IdxDelete:
+        return OPND_CURSOR | OPND_R2;
+    case Op_Close:
+    case Op_Rewind:
+    case Op_Next:
+    case Op_Prev:
+    case Op_Delete:
+    case Op_Filter:
+    case Op_IdxBuild:
+    case Op_IdxSpilled:
+    case Op_NextColumn:
+        return OPND_CURSOR;
+    case Op_Seek:
+    case Op_SeekGt:
+    case Op_SeekGe:
+    case Op_SeekLt:
+    case Op_SeekLe:
+    case Op_Column:
+    case Op_ColumnCmp:
+    case Op_IdxGt:
+    case Op_IdxGe:
+    case Op_IdxLt:
+    case Op_IdxLe:
+    case Op_IdxColumn:
+        return OPND_CURSOR | OPND_R3;
+    case Op_Insert:
+    case Op_IdxInsert:
+    case Op_IdxAppend:
+        return OPND_CURSOR | OPND_R2 | OPND_R3;
+    case Op_Integer:
+    case Op_String:
+    case Op_Null:
+    case Op_Variable:
+        return OPND_R2;
+    case Op_Copy:
+    case Op_SCopy:
+        return OPND_R1 | OPND_R2;
+    case Op_CreateTable:
+    case Op_CreateIndex:
+        return OPND_R1;
+    case Op_ResultRow:
+        return OPND_RANGE;
+    case Op_MakeRecord:
+    case Op_IdxKey:
+    case Op_IdxInclude:
+        return OPND_RANGE | OPND_R3;
+        FOREACH_CMP(REG_CMP_OPERANDS, _)
+        return OPND_R1 | OPND_R3;
+        FOREACH_CMP(IMM_CMP_OPERANDS, _)
+        return OPND_R3;
+    default:
+        return 0;
+    }
+}
+
+/* Number of registers (or cursors) there must be for index i to be one
+ * of them, if there must be at least n */
+static inline uint32_t index_bound(uint32_t n, int32_t i)
+{
+    return i >= 0 && (uint32_t) i >= n ? (uint32_t) i + 1 : n;
+}
+
+/* Decodes the program of a DBM into stmt->code
+ *
+ * The registers and cursors that the instructions name are allocated
+ * first, so that the instructions do not reallocate them (and leave the
+ * decoded program pointing to the old arrays) while the program runs.
+ *
+ * Parameters
+ * - stmt: DBM
+ * - labels: Address of the code that runs each instruction
+ * - fast_labels: Address of the code that runs each of the instructions
+ *                that the threaded interpreter runs without calling
+ *                their handler, or NULL
+ *
+ * Returns
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int decode_program(chidb_stmt *stmt, void *const *labels, void *const *fast_labels)
+{
+    uint32_t nReg = stmt->nReg, nCursors = stmt->nCursors;
+    int rc;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        int operands = op_operands(op->opcode);
+
+        if (operands & OPND_R1)
+            nReg = index_bound(nReg, op->p1);
+        if (operands & OPND_R2)
+            nReg = index_bound(nReg, op->p2);
+        if (operands & OPND_R3)
+            nReg = index_bound(nReg, op->p3);
+        if ((operands & OPND_RANGE) && op->p2 > 0)
+            nReg = index_bound(nReg, op->p1 + op->p2 - 1);
+        if (operands & OPND_CURSOR)
+            nCursors = index_bound(nCursors, op->p1);
+    }
+    if (nReg > stmt->nReg && (rc = realloc_reg(stmt, nReg)) != CHIDB_OK)
+        return rc;
+    if (nCursors > stmt->nCursors && (rc = realloc_cur(stmt, nCursors)) != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_decoded_op_t *code = malloc(sizeof(chidb_dbm_decoded_op_t) * (stmt->endOp + 1));
+    if (code == NULL)
+        return CHIDB_ENOMEM;
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        chidb_dbm_decoded_op_t *d = &code[i];
+        int operands = op_operands(op->opcode);
+        bool reg_p1 = (operands & OPND_R1) || ((operands & OPND_RANGE) && op->p2 > 0);
+
+        d->code = fast_labels[op->opcode] != NULL ? fast_labels[op->opcode] : labels[op->opcode];
+        d->op = op;
+        d->r1 = reg_p1 && op->p1 >= 0 ? stmt->reg + op->p1 : NULL;
+        d->r2 = (operands & OPND_R2) && op->p2 >= 0 ? stmt->reg + op->p2 : NULL;
+        d->r3 = (operands & OPND_R3) && op->p3 >= 0 ? stmt->reg + op->p3 : NULL;
+        d->cursor = (operands & OPND_CURSOR) && op->p1 >= 0 ? stmt->cursors + op->p1 : NULL;
+    }
+    stmt->code = code;
+
+    return CHIDB_OK;
+}
+
+/* Run the DBM with a direct-threaded interpreter
+ *
+ * Runs the program like chidb_stmt_exec_table (see dbm.c) but, instead
+ * of returning to a single loop that dispatches every instruction
+ * through the table of handlers, the code of each instruction jumps
+ * straight to the code of the next one (with a computed goto). Each of
+ * these jumps is predicted separately by the processor, which learns
+ * the sequences in the program's loops (e.g., a Next is followed by a
+ * Column).
+ *
+ * The program is decoded when it first runs (see decode_program), and
+ * the instructions that run for every row (Next, Column, Key, the typed
+ * comparisons, ...) then use the registers and cursors their operands
+ * were decoded to, instead of calling their handler. Every other
+ * instruction calls its handler directly. If a handler reallocates the
+ * registers or cursors anyway, the program is decoded again.
+ *
+ * The superinstructions made by the peephole pass (see optimizer.c) run
+ * like the instruction they start with: ColumnCmp like Column, and
+ * NextColumn like Next. The instructions they fuse are still in the
+ * program, and are reached without going back to a dispatch loop.
+ *
+ * Parameters
+ * - stmt: DBM to run.
+ *
+ * Returns
+ * - Same as chidb_stmt_exec
+ */
+int chidb_stmt_exec_threaded(chidb_stmt *stmt)
+{
+#define THREADED_LABEL(OP) [Op_##OP] = &&do_##OP,
+#define THREADED_CMP_LABELS(ARG, CMP, OPERATOR) \
+    [Op_##CMP##Int] = &&fast_##CMP##Int,        \
+    [Op_##CMP##Imm] = &&fast_##CMP##Imm,        \
+    [Op_##CMP##Str] = &&fast_##CMP##Str,
+    static void *const labels[] = {FOREACH_OP(THREADED_LABEL)};
+    static void *const fast_labels[Op_Halt + 1] = {
+        [Op_Next] = &&fast_Next,
+        [Op_NextColumn] = &&fast_Next,
+        [Op_Column] = &&fast_Column,
+        [Op_ColumnCmp] = &&fast_Column,
+        [Op_Key] = &&fast_Key,
+        [Op_Integer] = &&fast_Integer,
+        [Op_Null] = &&fast_Null,
+        [Op_SCopy] = &&fast_SCopy,
+        [Op_Goto] = &&fast_Goto,
+        FOREACH_CMP(THREADED_CMP_LABELS, _)};
+    chidb_dbm_decoded_op_t *code, *d;
+    int rc = CHIDB_OK;
+
+#define DISPATCH()                   \
+    do                               \
+    {                                \
+        if (stmt->pc >= stmt->endOp) \
+            goto done;               \
+        d = code + stmt->pc++;       \
+        goto *d->code;               \
+    } while (0)
+
+#define THREADED_HANDLER(OP)                 \
+    do_##OP:                                 \
+        rc = chidb_dbm_op_##OP(stmt, d->op); \
+        if (rc != CHIDB_OK)                  \
+            goto done;                       \
+        if (stmt->code != code)              \
+            goto decode;                     \
+        DISPATCH();
+
+#define THREADED_CMP(ARG, CMP, OPERATOR)             \
+    fast_##CMP##Int:                                 \
+        if (cmp_##CMP##Int(d->r1, d->r3))            \
+            stmt->pc = d->op->p2;                    \
+        DISPATCH();                                  \
+    fast_##CMP##Imm:                                 \
+        if (cmp_##CMP##Imm(d->op->p1, d->r3))        \
+            stmt->pc = d->op->p2;                    \
+        DISPATCH();                                  \
+    fast_##CMP##Str:                                 \
+        if (cmp_##CMP##Str(d->r1, d->r3))            \
+            stmt->pc = d->op->p2;                    \
+        DISPATCH();
+
+decode:
+    if (stmt->code == NULL && (rc = decode_program(stmt, labels, fast_labels)) != CHIDB_OK)
+        return rc;
+    code = stmt->code;
+    DISPATCH();
+
+    FOREACH_OP(THREADED_HANDLER)
+    FOREACH_CMP(THREADED_CMP, _)
+
+fast_Next:
+    if ((rc = op_next(stmt, d->op, d->cursor)) != CHIDB_OK)
+        goto done;
+    DISPATCH();
+fast_Column:
+    if ((rc = op_column(stmt, d->op, d->cursor, d->r3)) != CHIDB_OK)
+        goto done;
+    DISPATCH();
+fast_Key:
+    if ((rc = op_key(stmt, d->op, d->cursor, d->r2)) != CHIDB_OK)
+        goto done;
+    DISPATCH();
+fast_Integer:
+    d->r2->type = REG_INT32;
+    d->r2->value.i = d->op->p1;
+    DISPATCH();
+fast_Null:
+    d->r2->type = REG_NULL;
+    DISPATCH();
+fast_SCopy:
+    *d->r2 = *d->r1;
+    DISPATCH();
+fast_Goto:
+    stmt->pc = d->op->p2;
+    DISPATCH();
+
+done:
+    assert(stmt->nRR == stmt->nCols);
+
+    if (rc == CHIDB_OK || rc == CHIDB_DONE)
+        rc = CHIDB_DONE;
+
+    return rc;
+}
+#endif
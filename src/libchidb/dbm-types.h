@@ -45,11 +45,32 @@
 #include <chidb/chisql.h>
 #include "chidbInt.h"
 #include "dbm-cursor.h"
+#include "arena.h"
 
 #define DEFAULT_OPS_SIZE (50)
 #define DEFAULT_REG_SIZE (10)
 #define DEFAULT_CUR_SIZE (10)
 
+/* The comparisons, and the C operator each one checks. Like FOREACH_OP,
+ * this generates code by calling X(ARG, comparison, operator) for each
+ * comparison. */
+#define FOREACH_CMP(X, ARG)     \
+        X(ARG, Eq, ==)          \
+        X(ARG, Ne, !=)          \
+        X(ARG, Lt, <)           \
+        X(ARG, Le, <=)          \
+        X(ARG, Gt, >)           \
+        X(ARG, Ge, >=)
+
+/* Besides the comparisons that look at the types of the registers they
+ * compare (Eq, Ne, ...), there is a variant of each comparison for each
+ * type of values, which codegen uses when the types are known from the
+ * schema: Int compares two integer registers, Imm compares an integer
+ * register with the integer in p1, and Str compares two string registers.
+ * This generates OP(EqInt) OP(EqImm) OP(EqStr) OP(NeInt) ... */
+#define TYPED_CMP_OPS(OP, CMP, OPERATOR) OP(CMP ## Int) OP(CMP ## Imm) OP(CMP ## Str)
+#define FOREACH_TYPED_CMP_OP(OP) FOREACH_CMP(TYPED_CMP_OPS, OP)
+
 /* We define a "for each" macro to generate the various portions
  * of code that relate to opcodes. This is based on the solution
  * shown at http://stackoverflow.com/questions/9907160/how-to-convert-enum-names-to-string-in-c
@@ -73,25 +94,42 @@
         OP(Integer)     \
         OP(String)      \
         OP(Null)        \
+        OP(Variable)    \
         OP(ResultRow)   \
         OP(MakeRecord)  \
         OP(Insert)      \
+        OP(Delete)      \
         OP(Eq)          \
         OP(Ne)          \
         OP(Lt)          \
         OP(Le)          \
         OP(Gt)          \
         OP(Ge)          \
+        OP(Goto)        \
+        OP(Filter)      \
+        FOREACH_TYPED_CMP_OP(OP) \
         OP(IdxGt)       \
         OP(IdxGe)       \
         OP(IdxLt)       \
         OP(IdxLe)       \
         OP(IdxPKey)     \
         OP(IdxInsert)   \
+        OP(IdxAppend)   \
+        OP(IdxBuild)    \
+        OP(IdxKey)      \
+        OP(IdxInclude)  \
+        OP(IdxSpilled)  \
+        OP(IdxColumn)   \
+        OP(IdxDelete)   \
         OP(CreateTable) \
         OP(CreateIndex) \
         OP(Copy)        \
         OP(SCopy)       \
+        OP(Begin)       \
+        OP(Commit)      \
+        OP(Rollback)    \
+        OP(ColumnCmp)   \
+        OP(NextColumn)  \
         OP(Halt)
 
 /* The following generates an enum type for the opcode. It expands to:
@@ -205,8 +243,38 @@ typedef struct chidb_dbm_register
         } bin;
     } value;
 
+    /* Length of a string (not counting the null character at its end),
+     * so that strings can be compared without looking for it */
+    uint32_t len;
+
 } chidb_dbm_register_t;
 
+/* A DBM instruction decoded for the threaded interpreter (see
+ * chidb_stmt_exec_threaded in dbm-ops.c). The registers and the cursor
+ * that the operands name are looked up once, when the program is
+ * decoded, and are NULL for the operands that are something else. */
+typedef struct chidb_dbm_decoded_op
+{
+    void *code;                 /* Address of the code that runs the instruction */
+    chidb_dbm_op_t *op;
+    chidb_dbm_register_t *r1;   /* Register p1 */
+    chidb_dbm_register_t *r2;   /* Register p2 */
+    chidb_dbm_register_t *r3;   /* Register p3 */
+    chidb_dbm_cursor_t *cursor; /* Cursor p1 */
+} chidb_dbm_decoded_op_t;
+
+/* A statement parameter (a ? or :name placeholder in the SQL statement).
+ * Parameters are numbered from 1, in the order in which they first appear
+ * in the statement, and their values are set with the chidb_bind_*
+ * functions. The Variable instruction copies a parameter's value into
+ * a register. */
+typedef struct chidb_dbm_param
+{
+    char *name;                 /* Parameter name, or NULL if anonymous (?) */
+    enum data_type type;        /* Type of the column the parameter is stored in or compared to */
+    chidb_dbm_register_t value; /* Bound value (REG_UNSPECIFIED if not bound) */
+} chidb_dbm_param_t;
+
 /*  This is the struct that represents a single DBM program.
  *
  *  Notice how a single DBM program has its own registers and cursors;
@@ -259,6 +327,36 @@ struct chidb_stmt
      * per operation */
     bool explain;
 
+    /* Parameters */
+    /* Stored in a dynamically allocated array; parameter i is params[i-1] */
+    chidb_dbm_param_t *params;
+    uint32_t nParams;
+
+    /* How the statement holds the database lock while it runs
+     * (only in thread-safe mode, see CHIDB_OPEN_THREADSAFE) */
+    chidb_lock_t lock;
+
+    /* Range of keys the statement's table scans are restricted to
+     * (see chidb_scan_range) */
+    bool ranged;
+    chidb_key_t range_min;
+    chidb_key_t range_max;
+
+    /* Decoded program, for the threaded interpreter (see
+     * chidb_stmt_exec_threaded in dbm-ops.c). It points into ops, reg and
+     * cursors, so it is dropped (set to NULL) whenever one of them is
+     * reallocated or the program changes, and decoded again on the
+     * next run. */
+    chidb_dbm_decoded_op_t *code;
+
+    /* Memory for the strings and records made by the program. Values
+     * read from the current row (e.g., by Column) go in row_arena,
+     * which is reset when a cursor moves to another row (Next or Prev),
+     * and everything else goes in arena, which is reset when the
+     * statement is reset. */
+    Arena arena;
+    Arena row_arena;
+
     /* Additional fields go here */
 };
 
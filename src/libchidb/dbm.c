@@ -84,6 +84,9 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->ops = NULL;
     stmt->nOps = 0;
     stmt->endOp = 0;
+    stmt->code = NULL;
+    chidb_Arena_init(&stmt->arena, ARENA_BLOCK_SIZE);
+    chidb_Arena_init(&stmt->row_arena, ARENA_BLOCK_SIZE);
     rc = realloc_ops(stmt, DEFAULT_OPS_SIZE);
     if (rc != CHIDB_OK)
         return rc;
@@ -108,6 +111,15 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->cols = NULL;
     stmt->nCols = 0;
 
+    /* The statement has no parameters until the code generator adds them */
+    stmt->params = NULL;
+    stmt->nParams = 0;
+
+    stmt->lock = CHIDB_LOCK_NONE;
+
+    /* Table scans visit the whole table */
+    stmt->ranged = false;
+
     return CHIDB_OK;
 }
 
@@ -123,12 +135,103 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
  */
 int chidb_stmt_free(chidb_stmt *stmt)
 {
+    for (int i = 0; i < stmt->nParams; i++)
+    {
+        free(stmt->params[i].name);
+        if (stmt->params[i].value.type == REG_STRING)
+            free(stmt->params[i].value.value.s);
+    }
+    free(stmt->params);
     free(stmt->ops);
+    free(stmt->code);
+    chidb_Arena_free(&stmt->arena);
+    chidb_Arena_free(&stmt->row_arena);
     free(stmt->reg);
     free(stmt->cursors);
     return CHIDB_OK;
 }
 
+/* Reset a DBM
+ *
+ * Closes any cursors the program left open, frees the values made by
+ * the program, and sets the program counter back to the first
+ * instruction, so the program can be run again. Parameter values are
+ * not modified.
+ *
+ * Parameters
+ * - stmt: DBM to reset
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_reset(chidb_stmt *stmt)
+{
+    for (int i = 0; i < stmt->nCursors; i++)
+    {
+        if (stmt->cursors[i].type != CURSOR_UNSPECIFIED)
+        {
+            chidb_Cursor_freeCursor(&stmt->cursors[i]);
+            stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        }
+    }
+
+    stmt->pc = 0;
+
+    /* The values made by the previous run are no longer needed */
+    chidb_Arena_reset(&stmt->arena);
+    chidb_Arena_reset(&stmt->row_arena);
+
+    return CHIDB_OK;
+}
+
+/* Add a parameter to a DBM
+ *
+ * Named parameters that appear more than once in a statement are
+ * a single parameter, so if the DBM already has a parameter called
+ * "name", that parameter is returned instead.
+ *
+ * Parameters
+ * - stmt: DBM
+ * - name: Parameter name, or NULL for an anonymous parameter
+ * - type: Type of the values that can be bound to the parameter
+ * - n: Out parameter. Number of the parameter (numbered from 1)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The parameter already exists, with another type
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_add_param(chidb_stmt *stmt, const char *name, enum data_type type, uint32_t *n)
+{
+    if (name != NULL)
+    {
+        for (int i = 0; i < stmt->nParams; i++)
+        {
+            if (stmt->params[i].name != NULL && strcmp(stmt->params[i].name, name) == 0)
+            {
+                if (stmt->params[i].type != type)
+                    return CHIDB_EMISMATCH;
+                *n = i + 1;
+                return CHIDB_OK;
+            }
+        }
+    }
+
+    chidb_dbm_param_t *params = realloc(stmt->params, sizeof(chidb_dbm_param_t) * (stmt->nParams + 1));
+    if (params == NULL)
+        return CHIDB_ENOMEM;
+    stmt->params = params;
+
+    chidb_dbm_param_t *param = &stmt->params[stmt->nParams];
+    param->name = name == NULL ? NULL : strdup(name);
+    param->type = type;
+    param->value.type = REG_UNSPECIFIED;
+
+    *n = ++stmt->nParams;
+
+    return CHIDB_OK;
+}
+
 /* Set the value of a specific instruction
  *
  * Given an instruction (of type chidb_dbm_op_t, which includes
@@ -167,6 +270,10 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
     if (pos >= stmt->endOp)
         stmt->endOp = pos + 1;
 
+    /* The program has to be decoded again */
+    free(stmt->code);
+    stmt->code = NULL;
+
     return CHIDB_OK;
 }
 
@@ -186,6 +293,10 @@ int chidb_dbm_op_handle(chidb_stmt *stmt, chidb_dbm_op_t *op);
  *    or CHIDB_ROW. The program stops executing and and the return
  *    value of the instruction handler is returned.
  *
+ * The program is run by chidb_stmt_exec_threaded (see dbm-ops.c) if
+ * the DBM was built with the threaded interpreter (see dbm.h), and by
+ * chidb_stmt_exec_table otherwise.
+ *
  * Parameters
  * - stmt: DBM to run.
  *
@@ -195,6 +306,24 @@ int chidb_dbm_op_handle(chidb_stmt *stmt, chidb_dbm_op_t *op);
  * - Any error code returned by an individual instruction handler.
  */
 int chidb_stmt_exec(chidb_stmt *stmt)
+{
+#ifdef CHIDB_DBM_THREADED
+    return chidb_stmt_exec_threaded(stmt);
+#else
+    return chidb_stmt_exec_table(stmt);
+#endif
+}
+
+/* Run the DBM, dispatching each instruction through the table of
+ * instruction handlers (see chidb_dbm_op_handle in dbm-ops.c)
+ *
+ * Parameters
+ * - stmt: DBM to run.
+ *
+ * Returns
+ * - Same as chidb_stmt_exec
+ */
+int chidb_stmt_exec_table(chidb_stmt *stmt)
 {
     int rc = CHIDB_OK;
 
@@ -380,6 +509,10 @@ int realloc_ops(chidb_stmt *stmt, uint32_t size)
  * to be "size" registers. All new registers are set to type REG_UNSPECIFIED */
 int realloc_reg(chidb_stmt *stmt, uint32_t size)
 {
+    /* The decoded program points to the registers */
+    free(stmt->code);
+    stmt->code = NULL;
+
     stmt->reg = realloc(stmt->reg, sizeof(chidb_dbm_register_t) * size);
     if (stmt->reg == NULL)
         return CHIDB_ENOMEM;
@@ -398,6 +531,10 @@ int realloc_reg(chidb_stmt *stmt, uint32_t size)
  * to be "size" cursors. All new cursors are set to type CURSOR_UNSPECIFIED */
 int realloc_cur(chidb_stmt *stmt, uint32_t size)
 {
+    /* The decoded program points to the cursors */
+    free(stmt->code);
+    stmt->code = NULL;
+
     stmt->cursors = realloc(stmt->cursors, sizeof(chidb_dbm_cursor_t) * size);
     if (stmt->cursors == NULL)
         return CHIDB_ENOMEM;
@@ -43,11 +43,24 @@
 #include "chidbInt.h"
 #include "dbm-types.h"
 
+/* DBM programs are run by a direct-threaded interpreter (which needs the
+ * "labels as values" extension of GCC and Clang), unless the library
+ * is built with CHIDB_DBM_DISPATCH_TABLE defined (see the
+ * --disable-threaded-dbm option of configure) */
+#if defined(__GNUC__) && !defined(CHIDB_DBM_DISPATCH_TABLE)
+#define CHIDB_DBM_THREADED
+#endif
 
 int chidb_stmt_init(chidb_stmt *stmt, chidb *db);
 int chidb_stmt_free(chidb_stmt *stmt);
+int chidb_stmt_reset(chidb_stmt *stmt);
+int chidb_stmt_add_param(chidb_stmt *stmt, const char *name, enum data_type type, uint32_t *n);
 int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos);
 int chidb_stmt_exec(chidb_stmt *stmt);
+int chidb_stmt_exec_table(chidb_stmt *stmt);
+#ifdef CHIDB_DBM_THREADED
+int chidb_stmt_exec_threaded(chidb_stmt *stmt);
+#endif
 char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep);
 int chidb_stmt_rr_print(chidb_stmt *stmt, char sep);
 int chidb_stmt_print(chidb_stmt *stmt);
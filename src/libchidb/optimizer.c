@@ -52,3 +52,369 @@ int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statemen
     return CHIDB_OK;
 }
 
+
+/*** PEEPHOLE OPTIMIZER ***/
+
+/* The peephole pass looks at the DBM program that codegen made for a
+ * statement (see chidb_stmt_peephole below), and rewrites it so that
+ * fewer instructions run for each row the program reads. */
+
+#define IMM_CMP_CASES(ARG, CMP, OPERATOR) case Op_##CMP##Imm:
+#define REG_CMP_CASES(ARG, CMP, OPERATOR) case Op_##CMP: case Op_##CMP##Int: case Op_##CMP##Str:
+
+/* Is the instruction a load of a value that does not change while the
+ * program runs into register p2? */
+static bool is_const_load(const chidb_dbm_op_t *op)
+{
+    return op->opcode == Op_Integer || op->opcode == Op_String ||
+           op->opcode == Op_Null || op->opcode == Op_Variable;
+}
+
+static bool is_cmp(opcode_t opcode)
+{
+    switch (opcode)
+    {
+        FOREACH_CMP(IMM_CMP_CASES, _)
+        FOREACH_CMP(REG_CMP_CASES, _)
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Can the instruction read register r? (true for the instructions the pass
+ * does not know about) */
+static bool op_reads_reg(const chidb_dbm_op_t *op, int32_t r)
+{
+    switch (op->opcode)
+    {
+    case Op_OpenRead:
+    case Op_OpenWrite:
+    case Op_IdxDelete:
+        return r == op->p2;
+    case Op_Seek:
+    case Op_SeekGt:
+    case Op_SeekGe:
+    case Op_SeekLt:
+    case Op_SeekLe:
+    case Op_IdxGt:
+    case Op_IdxGe:
+    case Op_IdxLt:
+    case Op_IdxLe:
+        FOREACH_CMP(IMM_CMP_CASES, _)
+        return r == op->p3;
+        FOREACH_CMP(REG_CMP_CASES, _)
+        return r == op->p1 || r == op->p3;
+    case Op_Insert:
+    case Op_IdxInsert:
+    case Op_IdxAppend:
+        return r == op->p2 || r == op->p3;
+    case Op_Copy:
+    case Op_SCopy:
+        return r == op->p1;
+    case Op_ResultRow:
+    case Op_MakeRecord:
+    case Op_IdxKey:
+        return r >= op->p1 && r < op->p1 + op->p2;
+    case Op_IdxInclude:
+        return (r >= op->p1 && r < op->p1 + op->p2) || r == op->p3;
+    case Op_Noop:
+    case Op_Close:
+    case Op_Rewind:
+    case Op_Next:
+    case Op_Prev:
+    case Op_Column:
+    case Op_ColumnCmp:
+    case Op_Key:
+    case Op_Integer:
+    case Op_String:
+    case Op_Null:
+    case Op_Variable:
+    case Op_Delete:
+    case Op_Goto:
+    case Op_Filter:
+    case Op_IdxPKey:
+    case Op_IdxBuild:
+    case Op_IdxSpilled:
+    case Op_IdxColumn:
+    case Op_CreateTable:
+    case Op_CreateIndex:
+    case Op_Begin:
+    case Op_Commit:
+    case Op_Rollback:
+    case Op_Halt:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Can the instruction write register r? (true for the instructions the
+ * pass does not know about) */
+static bool op_writes_reg(const chidb_dbm_op_t *op, int32_t r)
+{
+    switch (op->opcode)
+    {
+    case Op_Column:
+    case Op_ColumnCmp:
+    case Op_MakeRecord:
+    case Op_IdxKey:
+    case Op_IdxInclude:
+    case Op_IdxColumn:
+        return r == op->p3;
+    case Op_Key:
+    case Op_Integer:
+    case Op_String:
+    case Op_Null:
+    case Op_Variable:
+    case Op_IdxPKey:
+    case Op_Copy:
+    case Op_SCopy:
+        return r == op->p2;
+    case Op_CreateTable:
+    case Op_CreateIndex:
+        return r == op->p1;
+    case Op_Noop:
+    case Op_OpenRead:
+    case Op_OpenWrite:
+    case Op_Close:
+    case Op_Rewind:
+    case Op_Next:
+    case Op_Prev:
+    case Op_Seek:
+    case Op_SeekGt:
+    case Op_SeekGe:
+    case Op_SeekLt:
+    case Op_SeekLe:
+    case Op_ResultRow:
+    case Op_Insert:
+    case Op_Delete:
+    case Op_Goto:
+    case Op_Filter:
+    case Op_IdxGt:
+    case Op_IdxGe:
+    case Op_IdxLt:
+    case Op_IdxLe:
+    case Op_IdxInsert:
+    case Op_IdxAppend:
+    case Op_IdxBuild:
+    case Op_IdxSpilled:
+    case Op_IdxDelete:
+    case Op_Begin:
+    case Op_Commit:
+    case Op_Rollback:
+    case Op_Halt:
+        FOREACH_CMP(IMM_CMP_CASES, _)
+        FOREACH_CMP(REG_CMP_CASES, _)
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Stores pointers to the jump addresses of an instruction in addrs, and
+ * returns how many there are */
+static int op_jump_addrs(chidb_dbm_op_t *op, int32_t *addrs[2])
+{
+    switch (op->opcode)
+    {
+    case Op_Filter:
+        addrs[0] = &op->p2;
+        addrs[1] = &op->p3;
+        return 2;
+    case Op_Rewind:
+    case Op_Next:
+    case Op_Prev:
+    case Op_NextColumn:
+    case Op_Seek:
+    case Op_SeekGt:
+    case Op_SeekGe:
+    case Op_SeekLt:
+    case Op_SeekLe:
+    case Op_Goto:
+    case Op_IdxGt:
+    case Op_IdxGe:
+    case Op_IdxLt:
+    case Op_IdxLe:
+    case Op_IdxSpilled:
+        FOREACH_CMP(IMM_CMP_CASES, _)
+        FOREACH_CMP(REG_CMP_CASES, _)
+        addrs[0] = &op->p2;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Can the instruction at start, the first one of the loop that ends with
+ * a jump back to it at end, be run only once, before the loop? It can if
+ * it loads a constant into a register that no other instruction in the
+ * loop writes, and the loop is always entered through start. */
+static bool loop_invariant(chidb_stmt *stmt, uint32_t start, uint32_t end)
+{
+    chidb_dbm_op_t *load = stmt->ops + start;
+
+    if (!is_const_load(load))
+        return false;
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = stmt->ops + i;
+        int32_t *addrs[2];
+        if (i > start && i <= end)
+        {
+            if (op_writes_reg(op, load->p2))
+                return false;
+        }
+        else if (i != start)
+        {
+            for (int k = op_jump_addrs(op, addrs) - 1; k >= 0; k--)
+                if (*addrs[k] > (int32_t) start && *addrs[k] <= (int32_t) end)
+                    return false;
+        }
+    }
+    return true;
+}
+
+/* Moves the constant loads at the start of scan loops out of them, by
+ * making the jumps back to the start of each loop skip them */
+static void hoist_loads(chidb_stmt *stmt)
+{
+    for (uint32_t end = 0; end < stmt->endOp; end++)
+    {
+        chidb_dbm_op_t *op = stmt->ops + end;
+        if ((op->opcode != Op_Next && op->opcode != Op_Prev) || op->p2 < 0 || op->p2 >= end)
+            continue;
+        for (uint32_t start = op->p2; start < end && loop_invariant(stmt, start, end); start++)
+        {
+            for (uint32_t i = start; i <= end; i++)
+            {
+                int32_t *addrs[2];
+                for (int k = op_jump_addrs(stmt->ops + i, addrs) - 1; k >= 0; k--)
+                    if (*addrs[k] == start)
+                        *addrs[k] = start + 1;
+            }
+        }
+    }
+}
+
+/* Replaces the constant loads into registers that no instruction reads
+ * with Noops */
+static void remove_dead_loads(chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *load = stmt->ops + i;
+        bool read = false;
+        if (!is_const_load(load))
+            continue;
+        for (uint32_t j = 0; j < stmt->endOp && !read; j++)
+            read = op_reads_reg(stmt->ops + j, load->p2);
+        if (!read)
+        {
+            free(load->p4);
+            load->opcode = Op_Noop;
+            load->p4 = NULL;
+        }
+    }
+}
+
+/* Removes the Noops from the program, and moves the jump addresses of the
+ * other instructions accordingly */
+static int remove_noops(chidb_stmt *stmt)
+{
+    uint32_t *addr = malloc(sizeof(uint32_t) * (stmt->endOp + 1));
+    uint32_t n = 0;
+
+    if (addr == NULL)
+        return CHIDB_ENOMEM;
+    /* A jump to a Noop goes to the instruction after it */
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        addr[i] = n;
+        if (stmt->ops[i].opcode != Op_Noop)
+            n++;
+    }
+    addr[stmt->endOp] = n;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = stmt->ops + i;
+        int32_t *addrs[2];
+        if (op->opcode == Op_Noop)
+            continue;
+        for (int k = op_jump_addrs(op, addrs) - 1; k >= 0; k--)
+            if (*addrs[k] >= 0 && *addrs[k] <= stmt->endOp)
+                *addrs[k] = addr[*addrs[k]];
+        stmt->ops[addr[i]] = *op;
+    }
+    for (uint32_t i = n; i < stmt->endOp; i++)
+    {
+        stmt->ops[i].opcode = Op_Noop;
+        stmt->ops[i].p4 = NULL;
+    }
+    stmt->endOp = n;
+
+    free(addr);
+    return CHIDB_OK;
+}
+
+/* Fuses a Column, a comparison and a Goto into a ColumnCmp, and a Next
+ * that jumps back to a Column, ColumnCmp or Key into a NextColumn (see
+ * dbm-ops.c) */
+static void fuse_superinstructions(chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i + 2 < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = stmt->ops + i;
+        if (op->opcode == Op_Column && is_cmp(op[1].opcode) && op[1].p2 != i + 2 && op[2].opcode == Op_Goto)
+            op->opcode = Op_ColumnCmp;
+    }
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = stmt->ops + i;
+        if (op->opcode != Op_Next || op->p2 < 0 || op->p2 >= i)
+            continue;
+        opcode_t load = stmt->ops[op->p2].opcode;
+        if (load == Op_Column || load == Op_ColumnCmp || load == Op_Key)
+            op->opcode = Op_NextColumn;
+    }
+}
+
+/* Optimize a DBM program
+ *
+ * Rewrites the program generated for a statement by chidb_stmt_codegen
+ * so that it runs fewer instructions for each row:
+ *
+ *  - The loads of constants (Integer, String, Null, Variable) at the start
+ *    of a scan loop are run once, before the loop.
+ *  - The loads of constants into registers that are never read (e.g., the
+ *    value compared to by an Imm comparison) are removed.
+ *  - The instructions that check a row (Column, comparison, Goto), and the
+ *    Next at the end of a loop with the Column at its start, are fused
+ *    into superinstructions (ColumnCmp and NextColumn).
+ *
+ * Programs written by hand (e.g., in .dbmf files) are run as they are.
+ *
+ * Parameters
+ * - stmt: DBM
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_peephole(chidb_stmt *stmt)
+{
+    int rc;
+
+    hoist_loads(stmt);
+    remove_dead_loads(stmt);
+    if ((rc = remove_noops(stmt)) != CHIDB_OK)
+        return rc;
+    fuse_superinstructions(stmt);
+
+    /* The program has to be decoded again */
+    free(stmt->code);
+    stmt->code = NULL;
+
+    return CHIDB_OK;
+}
@@ -9,12 +9,59 @@
  * modify the page returned by the pager and instruct the pager to
  * write it back to disk.
  *
- * The default pager is very simple and always creates an in-memory copy
- * of any page that is read (even if that page has already been read before).
- * More specifically, pages are read into a MemPage structure, which must
- * be freed (using the releaseMemPage function) once they are not needed.
- * In a real database, the pager component typically does some caching
- * of pages to reduce the number of disk accesses.
+ * Pages are read into a MemPage structure, which must be released
+ * (using the releaseMemPage function) once they are not needed.
+ * The file is accessed through a raw file descriptor with positional
+ * reads and writes (pread/pwrite), so no file position is shared between
+ * callers, and pages are not copied through a stdio buffer.
+ *
+ * The pager keeps a bounded cache of pages. Reading a page that is
+ * already in memory returns the same MemPage (and the same data buffer)
+ * instead of reading it again from the file, so every module sees the
+ * same in-memory copy of a page. Each readPage "pins" the page, and
+ * releaseMemPage "unpins" it; only pages with no pins can be evicted.
+ * If every page in the cache is pinned, the cache is allowed to grow
+ * past its configured size until some pages are released.
+ *
+ * The replacement policy is 2Q (Johnson and Shasha, 1994), which
+ * keeps a full-table scan from flushing frequently used pages
+ * (such as the top levels of a B-Tree) out of the cache:
+ *
+ *  - A1in: FIFO queue of pages that have been read only once.
+ *  - Am: LRU queue of pages that have been read again while in
+ *        memory, or shortly after being evicted from A1in.
+ *  - A1out: FIFO queue of "ghost" entries (page numbers, without
+ *           data) of pages recently evicted from A1in.
+ *
+ * A page is promoted to Am only if it is referenced again after
+ * leaving A1in, so pages touched once by a scan flow through A1in
+ * and never displace the pages in Am.
+ *
+ * Optionally (see chidb_Pager_enableMmap), the pager can map the whole
+ * file into memory. In that case, the data of a MemPage read with
+ * chidb_Pager_readPageReadOnly points straight into the mapping instead
+ * of into a heap copy of the page. The mapping is shared and read-only:
+ * it always shows what is in the file, and pages are only modified (and
+ * written back with chidb_Pager_writePage) through heap copies, which
+ * chidb_Pager_readPage makes before a page can be modified.
+ *
+ * Also optionally (see chidb_Pager_enableWal), the pager can use a
+ * write-ahead log (see wal.c). In that case, chidb_Pager_writePage does
+ * not write anything to the file: it adds the page to the set of dirty
+ * pages (which stay pinned in the cache), and chidb_Pager_commit appends
+ * all the dirty pages to the log as a single transaction.
+ *
+ * The same dirty page set is used for explicit transactions (see
+ * chidb_Pager_begin). Inside a transaction, a page is written at most
+ * once, when the transaction commits, no matter how many times it was
+ * passed to writePage, and chidb_Pager_rollback restores every dirty
+ * page to its last committed version.
+ *
+ * Finally (see chidb_Pager_enableThreads), the page cache can be shared
+ * by several threads. Pages that are not in the cache are read without
+ * holding the cache's mutex, so a thread that misses the cache does not
+ * hold up threads that hit it; a page that is being read is "latched",
+ * and other threads that need it wait until it has been loaded.
  *
  */
 
@@ -56,6 +103,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 
 #include <chidb/log.h>
@@ -63,6 +114,360 @@
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "wal.h"
+
+
+/* Alignment of the buffers used to hold pages that are read from the file */
+#define PAGER_BUFFER_ALIGN (4096)
+
+/* Size of the A1in queue, as a fraction (1/PGCACHE_KIN_DIV) of the cache size */
+#define PGCACHE_KIN_DIV (4)
+/* Size of the A1out queue, as a fraction (1/PGCACHE_KOUT_DIV) of the cache size */
+#define PGCACHE_KOUT_DIV (2)
+
+static void pager_lock(Pager *pager)
+{
+    if (pager->shared)
+        pthread_mutex_lock(&pager->mutex);
+}
+
+static void pager_unlock(Pager *pager)
+{
+    if (pager->shared)
+        pthread_mutex_unlock(&pager->mutex);
+}
+
+static void pgqueue_push(PageQueue *q, MemPage *page, pgcache_queue_t which)
+{
+    page->prev = NULL;
+    page->next = q->head;
+    if (q->head != NULL)
+        q->head->prev = page;
+    q->head = page;
+    if (q->tail == NULL)
+        q->tail = page;
+    q->n++;
+    page->queue = which;
+}
+
+static void pgqueue_remove(PageQueue *q, MemPage *page)
+{
+    if (page->prev != NULL)
+        page->prev->next = page->next;
+    else
+        q->head = page->next;
+    if (page->next != NULL)
+        page->next->prev = page->prev;
+    else
+        q->tail = page->prev;
+    page->prev = page->next = NULL;
+    page->queue = PGCACHE_NONE;
+    q->n--;
+}
+
+static PageQueue *pgcache_queue(Pager *pager, pgcache_queue_t which)
+{
+    switch (which)
+    {
+    case PGCACHE_A1IN:
+        return &pager->a1in;
+    case PGCACHE_AM:
+        return &pager->am;
+    case PGCACHE_A1OUT:
+        return &pager->a1out;
+    default:
+        return NULL;
+    }
+}
+
+static uint32_t pgcache_bucket(Pager *pager, npage_t npage)
+{
+    return (npage * 2654435761u) & (pager->n_buckets - 1);
+}
+
+static MemPage *pgcache_lookup(Pager *pager, npage_t npage)
+{
+    MemPage *page = pager->hash[pgcache_bucket(pager, npage)];
+    while (page != NULL && page->npage != npage)
+        page = page->hash_next;
+    return page;
+}
+
+static void pgcache_hash_insert(Pager *pager, MemPage *page)
+{
+    uint32_t b = pgcache_bucket(pager, page->npage);
+    page->hash_next = pager->hash[b];
+    pager->hash[b] = page;
+}
+
+static void pgcache_hash_remove(Pager *pager, MemPage *page)
+{
+    MemPage **p = &pager->hash[pgcache_bucket(pager, page->npage)];
+    while (*p != page)
+        p = &(*p)->hash_next;
+    *p = page->hash_next;
+    page->hash_next = NULL;
+}
+
+/* (Re)allocates the hash table so that it has at least as many buckets
+ * as pages that can be tracked by the cache (resident + ghost). */
+static int pgcache_resize_hash(Pager *pager, uint32_t npages)
+{
+    uint32_t n_buckets = 16;
+    while (n_buckets < npages)
+        n_buckets <<= 1;
+    if (n_buckets == pager->n_buckets)
+        return CHIDB_OK;
+
+    MemPage **hash = calloc(n_buckets, sizeof(MemPage *));
+    if (hash == NULL)
+        return CHIDB_ENOMEM;
+
+    MemPage **old_hash = pager->hash;
+    uint32_t old_n_buckets = pager->n_buckets;
+    pager->hash = hash;
+    pager->n_buckets = n_buckets;
+    for (uint32_t i = 0; i < old_n_buckets; i++)
+    {
+        MemPage *page = old_hash[i];
+        while (page != NULL)
+        {
+            MemPage *next = page->hash_next;
+            pgcache_hash_insert(pager, page);
+            page = next;
+        }
+    }
+    free(old_hash);
+
+    return CHIDB_OK;
+}
+
+/* Drops a page from the cache entirely (it must not be pinned) */
+static void pgcache_forget(Pager *pager, MemPage *page)
+{
+    PageQueue *q = pgcache_queue(pager, page->queue);
+    if (q != NULL)
+        pgqueue_remove(q, page);
+    pgcache_hash_remove(pager, page);
+    if (page->data != NULL)
+    {
+        if (!page->mapped)
+            free(page->data);
+        pager->n_resident--;
+    }
+    free(page);
+}
+
+/* Trims the ghost queue down to its maximum size */
+static void pgcache_trim_ghosts(Pager *pager)
+{
+    uint32_t kout = pager->cache_size / PGCACHE_KOUT_DIV;
+    while (pager->a1out.n > kout)
+        pgcache_forget(pager, pager->a1out.tail);
+}
+
+/* Returns the least recently used unpinned page in a queue, or NULL */
+static MemPage *pgcache_victim_in(PageQueue *q)
+{
+    MemPage *page = q->tail;
+    while (page != NULL && page->refs > 0)
+        page = page->prev;
+    return page;
+}
+
+/* Evicts one unpinned resident page, following the 2Q policy.
+ *
+ * Pages are evicted from A1in while it is over its target size
+ * (and remembered in A1out); otherwise, the LRU page in Am is evicted.
+ *
+ * Return
+ * - CHIDB_OK: A page was evicted
+ * - CHIDB_ENOTFOUND: All resident pages are pinned
+ */
+static int pgcache_evict(Pager *pager)
+{
+    uint32_t kin = pager->cache_size / PGCACHE_KIN_DIV;
+    MemPage *victim = NULL;
+
+    if (pager->a1in.n > (kin > 0 ? kin : 1) || pager->am.n == 0)
+        victim = pgcache_victim_in(&pager->a1in);
+    if (victim == NULL)
+        victim = pgcache_victim_in(&pager->am);
+    if (victim == NULL)
+        victim = pgcache_victim_in(&pager->a1in);
+    if (victim == NULL)
+        return CHIDB_ENOTFOUND;
+
+    chilog(TRACE, "Evicting page %i from the page cache", victim->npage);
+    if (victim->queue == PGCACHE_A1IN && pager->cache_size / PGCACHE_KOUT_DIV > 0)
+    {
+        /* Keep a ghost entry, so we can tell if the page is referenced again soon */
+        pgqueue_remove(&pager->a1in, victim);
+        if (!victim->mapped)
+            free(victim->data);
+        victim->data = NULL;
+        victim->mapped = 0;
+        pager->n_resident--;
+        pgqueue_push(&pager->a1out, victim, PGCACHE_A1OUT);
+        pgcache_trim_ghosts(pager);
+    }
+    else
+    {
+        pgcache_forget(pager, victim);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Evicts unpinned pages until the cache is no larger than its configured size */
+static void pgcache_shrink(Pager *pager)
+{
+    while (pager->n_resident > pager->cache_size)
+        if (pgcache_evict(pager) != CHIDB_OK)
+            break;
+}
+
+/* Drops every page from the cache */
+static void pgcache_clear(Pager *pager)
+{
+    for (uint32_t i = 0; i < pager->n_buckets; i++)
+    {
+        MemPage *page = pager->hash[i];
+        while (page != NULL)
+        {
+            MemPage *next = page->hash_next;
+            if (page->refs > 0)
+                chilog(WARNING, "Page %i still pinned (%i) when clearing page cache", page->npage, page->refs);
+            if (!page->mapped)
+                free(page->data);
+            free(page);
+            page = next;
+        }
+        pager->hash[i] = NULL;
+    }
+    pager->a1in = pager->am = pager->a1out = (PageQueue){NULL, NULL, 0};
+    pager->n_resident = 0;
+}
+
+/* Makes sure the mapping covers the first "size" bytes of the file.
+ *
+ * The file is mapped with some room to spare (the mapping doubles in
+ * size when it has to grow), so that pages appended to the file can
+ * usually be accessed without remapping. Accessing the part of the
+ * mapping past the end of the file is not allowed, so pager->file_size
+ * keeps track of how much of it can be used.
+ *
+ * Since the mappings are shared, the older ones (which pinned pages may
+ * still point into) show the same bytes as the file, like the new one.
+ */
+static int pager_map(Pager *pager, off_t size)
+{
+    pager->file_size = size;
+    if (pager->map != NULL && (off_t) pager->map->size >= size)
+        return CHIDB_OK;
+    if (size == 0)
+        return CHIDB_OK;
+
+    off_t map_size = pager->map != NULL ? (off_t) pager->map->size : (off_t) DEFAULT_PAGE_SIZE * 64;
+    while (map_size < size)
+        map_size *= 2;
+    /* The whole file must fit in the address space */
+    if ((uint64_t) map_size > SIZE_MAX)
+        return CHIDB_EIO;
+
+    PagerMapping *mapping = malloc(sizeof(PagerMapping));
+    if (mapping == NULL)
+        return CHIDB_ENOMEM;
+    mapping->addr = mmap(NULL, map_size, PROT_READ, MAP_SHARED, pager->fd, 0);
+    if (mapping->addr == MAP_FAILED)
+    {
+        free(mapping);
+        return CHIDB_EIO;
+    }
+    chilog(TRACE, "Mapped %lld bytes of the database file (file size %lld)", (long long) map_size, (long long) size);
+    mapping->size = map_size;
+    mapping->next = pager->map;
+    pager->map = mapping;
+
+    return CHIDB_OK;
+}
+
+/* Called after writing page npage, which may have extended the file */
+static int pager_extended(Pager *pager, npage_t npage)
+{
+    off_t size = (off_t) npage * pager->page_size;
+    if (pager->use_mmap && size > pager->file_size)
+        return pager_map(pager, size);
+    return CHIDB_OK;
+}
+
+static void pager_unmap(Pager *pager)
+{
+    while (pager->map != NULL)
+    {
+        PagerMapping *next = pager->map->next;
+        munmap(pager->map->addr, pager->map->size);
+        free(pager->map);
+        pager->map = next;
+    }
+    pager->file_size = 0;
+}
+
+/* Reads the latest version of a page (from the log, if there is a
+ * copy of the page in it, or from the database file otherwise) */
+static int pager_read(Pager *pager, npage_t npage, uint8_t *data)
+{
+    uint32_t frame;
+    ssize_t n;
+
+    if (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage, &frame) == CHIDB_OK)
+        return chidb_Wal_readFrame(pager->wal, frame, data);
+
+    /* Pages that have been allocated, but not yet written,
+     * are past the end of the file, and read as zeroes */
+    memset(data, 0, pager->page_size);
+    n = pread(pager->fd, data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    if (n < 0)
+        return CHIDB_EIO;
+    chilog(TRACE, "Read %i bytes from page %i into memory [data: %x]", (int) n, npage, data);
+
+    return CHIDB_OK;
+}
+
+/* Unpins a page that could not be read, and drops it from the cache
+ * once nobody else has it pinned */
+static int pgcache_unpin_failed(Pager *pager, MemPage *page)
+{
+    if (--page->refs == 0)
+        pgcache_forget(pager, page);
+    return CHIDB_EIO;
+}
+
+/* Called when another connection has modified a page. If the page is
+ * in the cache, it is dropped or, if it is pinned, re-read in place. */
+static void pgcache_invalidate(Pager *pager, MemPage *page)
+{
+    if (page->data == NULL)
+        return;
+    if (page->refs == 0)
+        pgcache_forget(pager, page);
+    else
+        pager_read(pager, page->npage, page->data);
+}
+
+static void pgcache_invalidate_all(Pager *pager)
+{
+    for (uint32_t i = 0; i < pager->n_buckets; i++)
+    {
+        MemPage *page = pager->hash[i];
+        while (page != NULL)
+        {
+            MemPage *next = page->hash_next;
+            pgcache_invalidate(pager, page);
+            page = next;
+        }
+    }
+}
 
 /* Open a file
  *
@@ -80,18 +485,26 @@
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
-    *pager = malloc(sizeof(Pager));
+    *pager = calloc(1, sizeof(Pager));
     if (*pager == NULL)
         return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
+    (*pager)->fd = open(filename, O_RDWR | O_CREAT, 0644);
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
-
-    if ((*pager)->f == NULL)
+    if ((*pager)->fd < 0)
+    {
+        free(*pager);
         return CHIDB_EIO;
-    else
-        return CHIDB_OK;
+    }
+
+    (*pager)->cache_size = DEFAULT_CACHE_SIZE;
+    if (pgcache_resize_hash(*pager, DEFAULT_CACHE_SIZE + DEFAULT_CACHE_SIZE / PGCACHE_KOUT_DIV) != CHIDB_OK)
+    {
+        close((*pager)->fd);
+        free(*pager);
+        return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
 }
 
 
@@ -101,6 +514,7 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  * This function must be called before operating on pages.
  * It will not verify if the page size makes size. If an incorrect
  * page size is provided, this will result in unexpected behaviour.
+ * Any pages in the page cache are discarded.
  *
  * Parameters
  * - pager: A Pager.
@@ -111,6 +525,7 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  */
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
 {
+    pgcache_clear(pager);
     pager->page_size = pagesize;
     chidb_Pager_getRealDBSize(pager, &pager->n_pages);
 
@@ -118,6 +533,581 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
 }
 
 
+/* Set the size of the page cache
+ *
+ * The page cache will try to keep at most this many pages in memory.
+ * If more pages than that are pinned at the same time, the cache
+ * will temporarily grow beyond this size. A size of zero means that
+ * pages are discarded as soon as they are released.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Maximum number of unpinned pages to keep in memory.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t npages)
+{
+    int rc = pgcache_resize_hash(pager, npages + npages / PGCACHE_KOUT_DIV);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    pager->cache_size = npages;
+    pgcache_shrink(pager);
+    pgcache_trim_ghosts(pager);
+
+    return CHIDB_OK;
+}
+
+
+/* Read pages through a memory mapping of the file
+ *
+ * After calling this function, readPageReadOnly returns pages whose data
+ * points directly into a (shared, read-only) memory mapping of the
+ * database file, instead of reading them into memory allocated by the
+ * pager. This saves a copy and an allocation every time a page is
+ * brought into the cache. readPage still returns pages that can be
+ * modified, copying them from the mapping if needed.
+ * The mapping is extended when new pages are allocated.
+ *
+ * Any unpinned pages in the page cache are discarded.
+ *
+ * Parameters
+ * - pager: A Pager. The page size must have already been set.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: The file could not be mapped
+ */
+int chidb_Pager_enableMmap(Pager *pager)
+{
+    struct stat buf;
+
+    if (pager->use_mmap)
+        return CHIDB_OK;
+
+    if (fstat(pager->fd, &buf) != 0)
+        return CHIDB_EIO;
+
+    int rc = pager_map(pager, buf.st_size);
+    if (rc != CHIDB_OK)
+        return rc;
+    pager->use_mmap = 1;
+
+    uint32_t cache_size = pager->cache_size;
+    pager->cache_size = 0;
+    pgcache_shrink(pager);
+    pager->cache_size = cache_size;
+
+    return CHIDB_OK;
+}
+
+
+/* Use a write-ahead log
+ *
+ * After calling this function, modified pages are written to a
+ * write-ahead log (see wal.c) when chidb_Pager_commit is called,
+ * instead of being written to the database file by writePage.
+ *
+ * Parameters
+ * - pager: A Pager. The page size must have already been set.
+ * - filename: Log file (might not exist)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ * - CHIDB_ECORRUPT: The log was written with a different page size
+ */
+int chidb_Pager_enableWal(Pager *pager, const char *filename)
+{
+    if (pager->wal != NULL)
+        return CHIDB_OK;
+
+    int rc = chidb_Wal_open(&pager->wal, filename, pager->fd, pager->page_size);
+    if (rc != CHIDB_OK)
+    {
+        pager->wal = NULL;
+        return rc;
+    }
+
+    /* The log may contain newer versions of pages we already read */
+    pgcache_invalidate_all(pager);
+    if (pager->wal->db_size > pager->n_pages)
+        pager->n_pages = pager->wal->db_size;
+
+    return CHIDB_OK;
+}
+
+
+/* Set how many commits share an fsync of the write-ahead log
+ *
+ * With a value of 1 (the default), every commit is durable when
+ * chidb_Pager_commit returns. With a value of n, the log is fsync'd
+ * once every n commits (and when the pager is closed), so a crash may
+ * lose up to the last n-1 commits, but the database is never corrupted.
+ *
+ * Parameters
+ * - pager: A Pager, with the write-ahead log enabled.
+ * - ncommits: Number of commits per fsync.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The write-ahead log is not enabled
+ */
+int chidb_Pager_setGroupCommit(Pager *pager, uint32_t ncommits)
+{
+    if (pager->wal == NULL)
+        return CHIDB_EMISUSE;
+    pager->wal->group_commit = ncommits > 0 ? ncommits : 1;
+
+    return CHIDB_OK;
+}
+
+
+/* Allow several threads to read pages at the same time
+ *
+ * After calling this function, the page cache is protected by a mutex,
+ * so readPage and releaseMemPage can be called by several threads at
+ * once. A page that is not in the cache is read from the file without
+ * holding the mutex: threads that need the same page wait until it has
+ * been loaded, and threads that need other pages are not held up.
+ *
+ * Only reads are concurrent. Writing pages, and beginning or ending
+ * transactions, must not happen while other threads are reading pages
+ * (chidb_open_v2 does this with a database-level lock), although other
+ * threads may release the pages they still have pinned in the meantime.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_enableThreads(Pager *pager)
+{
+    if (pager->shared)
+        return CHIDB_OK;
+
+    if (pthread_mutex_init(&pager->mutex, NULL) != 0)
+        return CHIDB_ENOMEM;
+    if (pthread_cond_init(&pager->loaded, NULL) != 0)
+    {
+        pthread_mutex_destroy(&pager->mutex);
+        return CHIDB_ENOMEM;
+    }
+    pager->shared = 1;
+
+    return CHIDB_OK;
+}
+
+
+/* Begin a read transaction
+ *
+ * When the write-ahead log is enabled, this takes a snapshot of the
+ * database: pages read until chidb_Pager_endRead is called reflect
+ * the transactions committed up to this point (plus the changes made
+ * by this connection), even if other connections commit in the meantime.
+ * Pages in the cache that were changed by other connections since the
+ * last snapshot are discarded.
+ *
+ * Without the write-ahead log, this function does nothing.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The log is not well formed
+ */
+int chidb_Pager_beginRead(Pager *pager)
+{
+    bool reset;
+    uint32_t first_new;
+    Wal *wal = pager->wal;
+
+    if (wal == NULL)
+        return CHIDB_OK;
+
+    pager_lock(pager);
+    int rc = chidb_Wal_beginRead(wal, &reset, &first_new);
+    if (rc != CHIDB_OK)
+    {
+        chidb_Wal_endRead(wal);
+        pager_unlock(pager);
+        return rc;
+    }
+
+    if (reset)
+    {
+        /* The log was checkpointed by someone else, so we don't know
+         * which pages changed */
+        if (pager->use_mmap)
+        {
+            struct stat buf;
+            fstat(pager->fd, &buf);
+            pager_map(pager, buf.st_size);
+        }
+        pgcache_invalidate_all(pager);
+    }
+    else
+    {
+        for (uint32_t frame = first_new; frame <= wal->n_frames; frame++)
+        {
+            MemPage *page = pgcache_lookup(pager, wal->frame_page[frame]);
+            if (page != NULL)
+                pgcache_invalidate(pager, page);
+        }
+    }
+
+    if (reset || first_new <= wal->n_frames)
+    {
+        pager->generation++;
+        chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+        if (wal->db_size > pager->n_pages)
+            pager->n_pages = wal->db_size;
+    }
+    pager_unlock(pager);
+
+    return CHIDB_OK;
+}
+
+
+/* End a read transaction
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_endRead(Pager *pager)
+{
+    if (pager->wal == NULL)
+        return CHIDB_OK;
+
+    pager_lock(pager);
+    int rc = chidb_Wal_endRead(pager->wal);
+    pager_unlock(pager);
+    return rc;
+}
+
+
+/* Begin a write transaction
+ *
+ * When the write-ahead log is enabled, this takes the writer lock
+ * (writePage also does this, but calling this function first lets
+ * the caller find out that the database is busy before modifying
+ * any pages). The lock is released by chidb_Pager_commit.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another connection is writing to the database, or
+ *                has committed changes since our read transaction began.
+ */
+int chidb_Pager_beginWrite(Pager *pager)
+{
+    if (pager->wal == NULL)
+        return CHIDB_OK;
+
+    return chidb_Wal_beginWrite(pager->wal);
+}
+
+/* Checkpoints the log while holding the writer lock */
+static int pager_checkpoint(Pager *pager)
+{
+    int rc = chidb_Wal_checkpoint(pager->wal);
+    if (rc == CHIDB_OK && pager->use_mmap)
+    {
+        struct stat buf;
+        fstat(pager->fd, &buf);
+        rc = pager_map(pager, buf.st_size);
+    }
+    return rc;
+}
+
+
+static int compare_npage(const void *a, const void *b)
+{
+    npage_t na = (*(MemPage * const *) a)->npage;
+    npage_t nb = (*(MemPage * const *) b)->npage;
+    return (na > nb) - (na < nb);
+}
+
+/* Writes pages to the database file, sorted by page number, with one
+ * pwritev call for each run of adjacent pages */
+static int pager_write_pages(Pager *pager, MemPage **pages, uint32_t npages)
+{
+    struct iovec iov[IOV_MAX];
+
+    qsort(pages, npages, sizeof(MemPage *), compare_npage);
+
+    uint32_t i = 0;
+    while (i < npages)
+    {
+        /* Gather the run of adjacent pages starting at pages[i] */
+        uint32_t run = 0;
+        while (i + run < npages && run < IOV_MAX
+               && pages[i + run]->npage == pages[i]->npage + run)
+        {
+            iov[run].iov_base = pages[i + run]->data;
+            iov[run].iov_len = pager->page_size;
+            run++;
+        }
+
+        ssize_t n = pwritev(pager->fd, iov, run, (off_t) (pages[i]->npage - 1) * pager->page_size);
+        chilog(TRACE, "Wrote %i bytes to pages %i-%i", (int) n, pages[i]->npage, pages[i]->npage + run - 1);
+        if (n != (ssize_t) run * pager->page_size)
+            return CHIDB_EIO;
+
+        i += run;
+        /* Skip duplicates of the last page in the run */
+        while (i < npages && pages[i]->npage == pages[i - 1]->npage)
+            i++;
+    }
+
+    return npages > 0 ? pager_extended(pager, pages[npages - 1]->npage) : CHIDB_OK;
+}
+
+/* Unpins every page in the dirty set, and empties it */
+static void pager_clear_dirty(Pager *pager)
+{
+    MemPage *page = pager->dirty;
+    while (page != NULL)
+    {
+        MemPage *next = page->dirty_next;
+        page->dirty = 0;
+        page->dirty_next = NULL;
+        page->refs--;
+        page = next;
+    }
+    pager->dirty = NULL;
+    pager->n_dirty = 0;
+}
+
+/* Appends the dirty pages to the write-ahead log */
+static int pager_commit_wal(Pager *pager)
+{
+    int rc = CHIDB_OK;
+    npage_t *npages = malloc(pager->n_dirty * sizeof(npage_t));
+    uint8_t **data = malloc(pager->n_dirty * sizeof(uint8_t *));
+    if (npages == NULL || data == NULL)
+        rc = CHIDB_ENOMEM;
+
+    uint32_t i = 0;
+    for (MemPage *page = pager->dirty; page != NULL && rc == CHIDB_OK; page = page->dirty_next, i++)
+    {
+        npages[i] = page->npage;
+        data[i] = page->data;
+    }
+    if (rc == CHIDB_OK)
+        rc = chidb_Wal_appendFrames(pager->wal, npages, data, pager->n_dirty, pager->n_pages);
+    free(npages);
+    free(data);
+
+    return rc;
+}
+
+/* Writes the dirty pages to the database file */
+static int pager_commit_file(Pager *pager)
+{
+    MemPage **pages = malloc(pager->n_dirty * sizeof(MemPage *));
+    if (pages == NULL)
+        return CHIDB_ENOMEM;
+
+    uint32_t i = 0;
+    for (MemPage *page = pager->dirty; page != NULL; page = page->dirty_next)
+        pages[i++] = page;
+    int rc = pager_write_pages(pager, pages, pager->n_dirty);
+    free(pages);
+
+    return rc;
+}
+
+
+/* Begin a transaction
+ *
+ * Until the transaction ends (with chidb_Pager_commit or
+ * chidb_Pager_rollback), writePage does not write anything to the file:
+ * it only adds the page to the set of dirty pages, which stay pinned in
+ * memory. So, a page that is modified many times in a transaction is
+ * only written once.
+ *
+ * When the write-ahead log is enabled, pages are always kept in the
+ * dirty set until chidb_Pager_commit is called, but the pages allocated
+ * since this function was called are also discarded on a rollback.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A transaction is already active
+ */
+int chidb_Pager_begin(Pager *pager)
+{
+    if (pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    pager->in_txn = 1;
+    pager->txn_n_pages = pager->n_pages;
+
+    return CHIDB_OK;
+}
+
+
+/* Commit a transaction
+ *
+ * Writes all the dirty pages, and unpins them. When the write-ahead log
+ * is enabled, they are appended to the log as a single transaction and,
+ * if the log has grown past WAL_AUTOCHECKPOINT frames, this also tries
+ * to checkpoint it. Otherwise, they are written to the database file, in
+ * page order, with as few system calls as possible.
+ *
+ * Without the write-ahead log, and outside of a transaction, pages are
+ * written to the file by writePage, and this function does nothing.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_commit(Pager *pager)
+{
+    Wal *wal = pager->wal;
+    int rc = CHIDB_OK;
+
+    pager_lock(pager);
+    if (pager->n_dirty > 0)
+    {
+        rc = wal != NULL ? pager_commit_wal(pager) : pager_commit_file(pager);
+        if (rc != CHIDB_OK)
+        {
+            pager_unlock(pager);
+            return rc;
+        }
+        pager_clear_dirty(pager);
+
+        if (wal != NULL && wal->n_frames >= WAL_AUTOCHECKPOINT)
+            pager_checkpoint(pager);
+        pgcache_shrink(pager);
+    }
+    pager->in_txn = 0;
+    if (wal != NULL)
+        chidb_Wal_endWrite(wal);
+    pager_unlock(pager);
+
+    return rc;
+}
+
+
+/* Roll back a transaction
+ *
+ * Discards the set of dirty pages: the contents of every dirty page are
+ * restored to their last committed version, and the pages allocated
+ * during the transaction are deallocated.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No transaction is active
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_rollback(Pager *pager)
+{
+    int rc = CHIDB_OK;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    pager_lock(pager);
+    MemPage *page = pager->dirty;
+    while (page != NULL)
+    {
+        MemPage *next = page->dirty_next;
+        page->dirty = 0;
+        page->dirty_next = NULL;
+        page->refs--;
+        if (page->npage > pager->txn_n_pages && page->refs == 0)
+            pgcache_forget(pager, page);
+        else
+            pager_read(pager, page->npage, page->data);
+        page = next;
+    }
+    pager->dirty = NULL;
+    pager->n_dirty = 0;
+    pager->generation++;
+
+    pager->n_pages = pager->txn_n_pages;
+    off_t size = (off_t) pager->n_pages * pager->page_size;
+    if (pager->use_mmap && pager->file_size > size)
+    {
+        /* allocatePage extended the file */
+        if (ftruncate(pager->fd, size) != 0)
+            rc = CHIDB_EIO;
+        else
+            pager->file_size = size;
+    }
+    pgcache_shrink(pager);
+
+    pager->in_txn = 0;
+    if (pager->wal != NULL)
+        chidb_Wal_endWrite(pager->wal);
+    pager_unlock(pager);
+
+    return rc;
+}
+
+
+/* Checkpoint the write-ahead log
+ *
+ * Copies all the pages in the log back into the database file, and
+ * resets the log. There must be no uncommitted changes.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or the log is not enabled)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EBUSY: Another connection is using the log
+ * - CHIDB_EMISUSE: There are uncommitted changes
+ */
+int chidb_Pager_checkpoint(Pager *pager)
+{
+    Wal *wal = pager->wal;
+
+    if (wal == NULL)
+        return CHIDB_OK;
+    if (pager->n_dirty > 0)
+        return CHIDB_EMISUSE;
+
+    int rc = chidb_Wal_beginWrite(wal);
+    if (rc != CHIDB_OK)
+        return rc;
+    pager_lock(pager);
+    rc = pager_checkpoint(pager);
+    pager_unlock(pager);
+    chidb_Wal_endWrite(wal);
+
+    return rc;
+}
+
+
 /* Read the chidb file header
  *
  * This function reads in the header of a chidb file and returns it
@@ -135,9 +1125,7 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
  */
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
+    ssize_t count = pread(pager->fd, header, 100, 0);
     if (count != 100)
         return CHIDB_NOHEADER;
     else
@@ -157,27 +1145,178 @@ int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
  */
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
 {
+    int rc = CHIDB_OK;
+
     /* We simply increment the page number counter. readPage
      * and writePage take care of the rest. */
+    pager_lock(pager);
     *npage = ++pager->n_pages;
 
+    if (pager->use_mmap)
+    {
+        /* Extend the file, so the new page can be accessed
+         * through the mapping. */
+        off_t size = (off_t) pager->n_pages * pager->page_size;
+        if (size > pager->file_size)
+        {
+            if (ftruncate(pager->fd, size) != 0)
+                rc = CHIDB_EIO;
+            else
+                rc = pager_map(pager, size);
+        }
+    }
+    pager_unlock(pager);
+
+    return rc;
+}
+
+
+/* Reads a page (see chidb_Pager_readPage). If writable is false, the page
+ * may be returned in the mapping of the file (see chidb_Pager_enableMmap).
+ * Otherwise, a page in the mapping is first copied to the heap. */
+static int pager_read_page(Pager *pager, npage_t npage, MemPage **page, bool writable)
+{
+    if (npage > pager->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+
+    pager_lock(pager);
+    MemPage *_page = pgcache_lookup(pager, npage);
+    if (_page != NULL && _page->data != NULL)
+    {
+        /* Cache hit. Pages in A1in stay where they are (a page read
+         * several times in a short span is not necessarily "hot");
+         * pages in Am are moved to the front of the LRU queue. */
+        if (_page->queue == PGCACHE_AM)
+        {
+            pgqueue_remove(&pager->am, _page);
+            pgqueue_push(&pager->am, _page, PGCACHE_AM);
+        }
+        _page->refs++;
+        /* Another thread may still be reading the page from the file */
+        while (_page->loading)
+            pthread_cond_wait(&pager->loaded, &pager->mutex);
+        if (_page->failed)
+        {
+            int rc = pgcache_unpin_failed(pager, _page);
+            pager_unlock(pager);
+            return rc;
+        }
+        if (writable && _page->mapped)
+        {
+            /* Whoever else has the page pinned keeps reading the same
+             * bytes (the mapping shows the file) until it is modified */
+            uint8_t *data;
+            if (posix_memalign((void **) &data, PAGER_BUFFER_ALIGN, pager->page_size) != 0)
+            {
+                _page->refs--;
+                pager_unlock(pager);
+                return CHIDB_ENOMEM;
+            }
+            memcpy(data, _page->data, pager->page_size);
+            _page->data = data;
+            _page->mapped = 0;
+        }
+        pager_unlock(pager);
+        *page = _page;
+        chilog(TRACE, "Page %i found in page cache [%x data: %x]", npage, _page, _page->data);
+        return CHIDB_OK;
+    }
+
+    /* Cache miss. Make room for the page before reading it (this
+     * may drop the page's own ghost entry, so we look it up again) */
+    if (pager->n_resident >= pager->cache_size)
+    {
+        pgcache_evict(pager);
+        _page = pgcache_lookup(pager, npage);
+    }
+
+    off_t offset = (off_t) (npage - 1) * pager->page_size;
+    uint32_t frame;
+    uint8_t mapped = !writable && pager->use_mmap && offset + pager->page_size <= pager->file_size
+                     && (pager->wal == NULL || chidb_Wal_findFrame(pager->wal, npage, &frame) != CHIDB_OK);
+    uint8_t *data;
+    if (mapped)
+    {
+        data = pager->map->addr + offset;
+        chilog(TRACE, "Page %i is mapped [data: %x]", npage, data);
+    }
+    else if (posix_memalign((void **) &data, PAGER_BUFFER_ALIGN, pager->page_size) != 0)
+    {
+        pager_unlock(pager);
+        return CHIDB_ENOMEM;
+    }
+
+    pgcache_queue_t queue;
+    if (_page != NULL)
+    {
+        /* Ghost hit: the page was read recently, so it goes to Am */
+        pgqueue_remove(&pager->a1out, _page);
+        queue = PGCACHE_AM;
+    }
+    else
+    {
+        _page = calloc(1, sizeof(MemPage));
+        if (_page == NULL)
+        {
+            if (!mapped)
+                free(data);
+            pager_unlock(pager);
+            return CHIDB_ENOMEM;
+        }
+        _page->npage = npage;
+        pgcache_hash_insert(pager, _page);
+        queue = PGCACHE_A1IN;
+    }
+
+    _page->data = data;
+    _page->mapped = mapped;
+    _page->refs = 1;
+    pager->n_resident++;
+    pgqueue_push(pgcache_queue(pager, queue), _page, queue);
+
+    if (!mapped)
+    {
+        /* The page is latched while it is read, so that other
+         * threads can use the cache in the meantime */
+        _page->loading = 1;
+        pager_unlock(pager);
+        int rc = pager_read(pager, npage, data);
+        pager_lock(pager);
+        _page->loading = 0;
+        if (pager->shared)
+            pthread_cond_broadcast(&pager->loaded);
+        if (rc != CHIDB_OK)
+        {
+            _page->failed = 1;
+            pgcache_unpin_failed(pager, _page);
+            pager_unlock(pager);
+            return rc;
+        }
+    }
+    pager_unlock(pager);
+    *page = _page;
+
     return CHIDB_OK;
 }
 
 
 /* Read a page from file
  *
- * This page reads a page from the file, and creates an in-memory copy
- * in a MemPage struct (see header file for more details on this struct).
- * Always use chidb_Pager_releaseMemPage to free the memory allocated for
- * a MemPage created by this function.
- * Any changes done to a MemPage will not be effective until you call
- * chidb_Pager_writePage with that MemPage.
+ * This page reads a page from the file, and returns the in-memory copy
+ * of the page in a MemPage struct (see header file for more details on
+ * this struct). If the page is already in the page cache, no I/O is
+ * done, and the same MemPage is returned to every caller. The page is
+ * pinned in memory until chidb_Pager_releaseMemPage is called on it,
+ * so every call to this function must be matched by a call to
+ * chidb_Pager_releaseMemPage.
+ * Any changes done to a MemPage will not be effective in the file until
+ * you call chidb_Pager_writePage with that MemPage (but they are visible
+ * to anyone else who reads the same page).
  *
  * Parameters
  * - pager: A Pager.
  * - npage: Page number of page to read.
- * - page: Out parameter. Used to return a pointer to newly created MemPage
+ * - page: Out parameter. Used to return a pointer to the MemPage
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -186,22 +1325,32 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  */
 int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    return pager_read_page(pager, npage, page, true);
+}
 
-    *page = malloc(sizeof(MemPage));
-    if (*page == NULL)
-        return CHIDB_ENOMEM;
-    (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
-    if ((*page)->data == NULL)
-        return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
 
-    return CHIDB_OK;
+/* Read a page from file, for reading only
+ *
+ * Like chidb_Pager_readPage, but the data of the page must not be
+ * modified. If the mmap backend is enabled (see chidb_Pager_enableMmap),
+ * the data of the page may point into the mapping of the file, which
+ * is read-only. If someone calls chidb_Pager_readPage on the page while
+ * it is pinned, the data of the page is moved to the heap, and pointers
+ * into the old data keep showing what is in the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to the MemPage
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readPageReadOnly(Pager *pager, npage_t npage, MemPage **page)
+{
+    return pager_read_page(pager, npage, page, false);
 }
 
 
@@ -210,6 +1359,10 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
  * This page writes the in-memory copy of a page (stored in a MemPage
  * struct) back to disk.
  *
+ * If the write-ahead log is enabled, or a transaction is active (see
+ * chidb_Pager_begin), the page is only added to the set of dirty pages
+ * (and stays pinned in memory); it will be written by chidb_Pager_commit.
+ *
  * Parameters
  * - pager: A Pager.
  * - page: In-memory copy of page to write
@@ -218,24 +1371,92 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
  * - CHIDB_OK: Operation successful
  * - CHIDB_EPAGENO: The page has an incorrect page number
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EBUSY: Another connection is writing to the database (WAL only)
  */
 int	chidb_Pager_writePage(Pager *pager, MemPage *page)
 {
+    int rc = CHIDB_OK;
+
     if (page->npage > pager->n_pages)
         return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
-    return CHIDB_OK;
+
+    pager_lock(pager);
+    if (pager->wal != NULL || pager->in_txn)
+    {
+        if (!page->dirty && pager->wal != NULL)
+            rc = chidb_Wal_beginWrite(pager->wal);
+        if (!page->dirty && rc == CHIDB_OK)
+        {
+            page->dirty = 1;
+            page->refs++;
+            page->dirty_next = pager->dirty;
+            pager->dirty = page;
+            pager->n_dirty++;
+        }
+        pager_unlock(pager);
+        return rc;
+    }
+
+    ssize_t n = pwrite(pager->fd, page->data, pager->page_size, (off_t) (page->npage - 1) * pager->page_size);
+    chilog(TRACE, "Wrote %i bytes to page %i", (int) n, page->npage);
+    rc = n == pager->page_size ? pager_extended(pager, page->npage) : CHIDB_EIO;
+    pager_unlock(pager);
+
+    return rc;
+}
+
+
+/* Write several pages to file
+ *
+ * Writes a set of pages back to disk. Runs of pages that are adjacent
+ * in the file are written with a single system call.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - pages: Array of in-memory copies of the pages to write (in any order).
+ *          The array is sorted by page number.
+ * - npages: Number of pages in the array.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: One of the pages has an incorrect page number
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EBUSY: Another connection is writing to the database (WAL only)
+ */
+int chidb_Pager_writePages(Pager *pager, MemPage **pages, uint32_t npages)
+{
+    for (uint32_t i = 0; i < npages; i++)
+        if (pages[i]->npage > pager->n_pages)
+            return CHIDB_EPAGENO;
+
+    if (pager->wal != NULL || pager->in_txn)
+    {
+        for (uint32_t i = 0; i < npages; i++)
+        {
+            int rc = chidb_Pager_writePage(pager, pages[i]);
+            if (rc != CHIDB_OK)
+                return rc;
+        }
+        return CHIDB_OK;
+    }
+
+    pager_lock(pager);
+    int rc = pager_write_pages(pager, pages, npages);
+    pager_unlock(pager);
+
+    return rc;
 }
 
 
 /* Release an in-memory copy of a page
+ *
+ * Unpins a page returned by chidb_Pager_readPage. The page stays
+ * in the page cache, but may be evicted once nobody has it pinned.
+ * The MemPage must not be used after releasing it.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - page: In-memory copy of page to release
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -247,8 +1468,12 @@ int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
         return CHIDB_EPAGENO;
 
     chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
-    free(page->data);
-    free(page);
+    pager_lock(pager);
+    if (page->refs > 0)
+        page->refs--;
+    if (page->refs == 0 && pager->n_resident > pager->cache_size)
+        pgcache_shrink(pager);
+    pager_unlock(pager);
 
     return CHIDB_OK;
 }
@@ -266,7 +1491,7 @@ int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
 {
     struct stat buf;
-    fstat(fileno(pager->f), &buf);
+    fstat(pager->fd, &buf);
     *npages = buf.st_size / pager->page_size;
 
     return CHIDB_OK;
@@ -284,7 +1509,24 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
  */
 int chidb_Pager_close(Pager *pager)
 {
-    fclose(pager->f);
+    /* An unfinished transaction is rolled back */
+    if (pager->in_txn)
+        chidb_Pager_rollback(pager);
+    if (pager->wal != NULL)
+    {
+        chidb_Pager_commit(pager);
+        chidb_Pager_checkpoint(pager);
+        chidb_Wal_close(pager->wal);
+    }
+    pgcache_clear(pager);
+    free(pager->hash);
+    pager_unmap(pager);
+    close(pager->fd);
+    if (pager->shared)
+    {
+        pthread_mutex_destroy(&pager->mutex);
+        pthread_cond_destroy(&pager->loaded);
+    }
     free(pager);
 
     return CHIDB_OK;
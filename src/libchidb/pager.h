@@ -41,30 +41,121 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
 #include "chidbInt.h"
 
+/* Queues used by the page cache (see pager.c for a description
+ * of the replacement policy) */
+typedef enum pgcache_queue
+{
+    PGCACHE_NONE  = 0,  /* Not in any queue */
+    PGCACHE_A1IN  = 1,  /* Resident, referenced once */
+    PGCACHE_AM    = 2,  /* Resident, referenced more than once */
+    PGCACHE_A1OUT = 3   /* Not resident ("ghost" entry) */
+} pgcache_queue_t;
+
 struct MemPage
 {
     npage_t npage;
     uint8_t *data;
+
+    /* The following fields are used by the pager's page cache,
+     * and must not be modified outside of pager.c */
+    uint32_t refs;              /* Number of pins (readPage calls not yet released) */
+    pgcache_queue_t queue;      /* Queue this page is currently in */
+    struct MemPage *prev;       /* Previous page in queue (towards the head) */
+    struct MemPage *next;       /* Next page in queue (towards the tail) */
+    struct MemPage *hash_next;  /* Next page in the same hash bucket */
+    uint8_t mapped;             /* 1 if data points into the file mapping (not owned by the page) */
+    uint8_t dirty;              /* 1 if the page has been written, but not committed */
+    struct MemPage *dirty_next; /* Next page in the set of dirty pages */
+    uint8_t loading;            /* 1 while the page is being read by another thread */
+    uint8_t failed;             /* 1 if the page could not be read (it is dropped once unpinned) */
 };
 typedef struct MemPage MemPage;
 
+/* A doubly-linked list of pages. Pages are added at the head
+ * and removed from the tail. */
+typedef struct PageQueue
+{
+    MemPage *head;
+    MemPage *tail;
+    uint32_t n;
+} PageQueue;
+
+/* A memory mapping of the database file. Mappings that are replaced
+ * when the file grows are kept around until the pager is closed,
+ * since pinned pages may still be pointing into them. */
+typedef struct PagerMapping
+{
+    uint8_t *addr;
+    size_t size;
+    struct PagerMapping *next;
+} PagerMapping;
+
 struct Pager
 {
-    FILE *f;
+    int fd;
     npage_t n_pages;
     uint16_t page_size;
+
+    /* Page cache */
+    uint32_t cache_size;   /* Number of resident pages the cache tries to stay under */
+    uint32_t n_resident;   /* Number of pages currently in memory */
+    MemPage **hash;        /* Hash table of pages (resident and ghost), by page number */
+    uint32_t n_buckets;
+    PageQueue a1in;
+    PageQueue am;
+    PageQueue a1out;
+
+    /* mmap backend (only used if enabled with chidb_Pager_enableMmap) */
+    uint8_t use_mmap;
+    PagerMapping *map;     /* Current mapping (older mappings follow in the list) */
+    off_t file_size;       /* Bytes of the mapping backed by the file */
+
+    /* Write-ahead log (only used if enabled with chidb_Pager_enableWal) */
+    struct Wal *wal;
+
+    /* Transactions */
+    uint8_t in_txn;        /* 1 if a transaction was started with chidb_Pager_begin */
+    npage_t txn_n_pages;   /* Number of pages when the transaction began */
+    MemPage *dirty;        /* Pages written since the last commit */
+    uint32_t n_dirty;
+
+    /* Incremented whenever cached pages are reverted or changed by someone
+     * else, so that the layers above can tell when what they remember about
+     * the contents of pages may be stale */
+    uint32_t generation;
+
+    /* Threads (only used if enabled with chidb_Pager_enableThreads) */
+    uint8_t shared;
+    pthread_mutex_t mutex; /* Protects the page cache and the dirty page set */
+    pthread_cond_t loaded; /* Signaled when a page has been read */
 };
 typedef struct Pager Pager;
 
 int chidb_Pager_open(Pager **pager, const char *filename);
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t npages);
+int chidb_Pager_enableMmap(Pager *pager);
+int chidb_Pager_enableWal(Pager *pager, const char *filename);
+int chidb_Pager_setGroupCommit(Pager *pager, uint32_t ncommits);
+int chidb_Pager_enableThreads(Pager *pager);
+int chidb_Pager_beginRead(Pager *pager);
+int chidb_Pager_endRead(Pager *pager);
+int chidb_Pager_beginWrite(Pager *pager);
+int chidb_Pager_begin(Pager *pager);
+int chidb_Pager_commit(Pager *pager);
+int chidb_Pager_rollback(Pager *pager);
+int chidb_Pager_checkpoint(Pager *pager);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_readPageReadOnly(Pager *pager, npage_t page_num, MemPage **page);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+int chidb_Pager_writePages(Pager *pager, MemPage **pages, uint32_t npages);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
 int chidb_Pager_close(Pager *pager);
 
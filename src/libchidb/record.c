@@ -99,6 +99,7 @@ int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields)
     dbrb->header_size = 1;
 
     dbrb->dbr->nfields = nfields;
+    dbrb->dbr->borrowed = false;
     dbrb->dbr->types = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
     dbrb->dbr->offsets = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
     dbrb->dbr->data = malloc(dbrb->buf_size);
@@ -270,23 +271,16 @@ int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
 }
 
 
-/* Create a DBRecord from a raw binary database record
- *
- * Parameters
- * - dbr: Out paremeter used to return a pointer to a DBRecord.
- * - raw: Pointer to first byte of raw binary database record
- *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ENOMEM: Could not allocate memory
- */
-int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
+// unpacks the header of a raw record, and either copies its data or
+// (if borrow is true) points the DBRecord directly at it
+static int unpack_record(DBRecord **dbr, uint8_t *raw, bool borrow)
 {
     *dbr = malloc(sizeof(DBRecord));
     if (*dbr == NULL)
         return CHIDB_ENOMEM;
 
     (*dbr)->nfields = 0;
+    (*dbr)->borrowed = borrow;
 
     uint8_t header_size = raw[0];
     uint8_t header_pos = 1;
@@ -334,6 +328,11 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
 
     (*dbr)->data_len = offset;
     (*dbr)->packed_len = header_size + offset;
+    if (borrow)
+    {
+        (*dbr)->data = raw + header_size;
+        return CHIDB_OK;
+    }
     (*dbr)->data = malloc(offset);
     if ((*dbr)->data == NULL)
         return CHIDB_ENOMEM;
@@ -343,6 +342,41 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
 }
 
 
+/* Create a DBRecord from a raw binary database record
+ *
+ * Parameters
+ * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
+{
+    return unpack_record(dbr, raw, false);
+}
+
+
+/* Create a DBRecord that reads its values directly from a raw binary
+ * database record (e.g., a BTreeView into a cached page), instead of
+ * from a copy of it. The raw record must stay valid, and unmodified,
+ * for as long as the DBRecord is used.
+ *
+ * Parameters
+ * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_unpackView(DBRecord **dbr, uint8_t *raw)
+{
+    return unpack_record(dbr, raw, true);
+}
+
+
 /* Create a raw binary database record from a DBRecord
  *
  * Parameters
@@ -646,7 +680,8 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
  */
 int chidb_DBRecord_destroy(DBRecord *dbr)
 {
-    free(dbr->data);
+    if (!dbr->borrowed)
+        free(dbr->data);
     free(dbr->types);
     free(dbr->offsets);
     free(dbr);
@@ -350,14 +350,59 @@ int getRecordCol(uint8_t *data, int ncol, uint32_t *type, uint32_t *offset)
     return CHIDB_OK;
 }
 
+// decode the whole header of a record at once: out parameters types, and offsets (relative
+// to data pointer), of its first ncols columns. returns the number of columns decoded, which
+// is less than ncols if the record has fewer columns.
+int getRecordCols(uint8_t *data, int ncols, uint32_t *types, uint32_t *offsets)
+{
+    uint8_t *ptr = data + 1;
+    uint8_t *end = data + *data;
+    uint32_t offset_to_col = *data;
+    int i;
+    for (i = 0; i < ncols && ptr < end; i++)
+    {
+        uint32_t col_size;
+        if (*ptr >= 128)
+        {
+            getVarint32(ptr, types + i);
+            col_size = (types[i] - 13) / 2;
+            ptr += 4;
+        }
+        else
+        {
+            types[i] = *ptr;
+            col_size = *ptr;
+            ptr += 1;
+        }
+        offsets[i] = offset_to_col;
+        offset_to_col += col_size;
+    }
+    return i;
+}
+
+uint32_t schema_hash(const char *name)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++)
+        h = (h ^ (uint8_t) *c) * 16777619u;
+    return h;
+}
+
 int schema_exists(chidb *db, char *name)
 {
-    for (int i = 0; i < db->nSchema; i++)
+    if (db->nSchemaBuckets == 0)
+    {
+        return 0;
+    }
+    int i = db->schema_hash[schema_hash(name) & (db->nSchemaBuckets - 1)];
+    while (i != -1)
     {
         if (strcmp(name, db->schema_list[i].name) == 0)
         {
             return i + 1;
         }
+        i = db->schema_list[i].hash_next;
     }
     return 0;
 }
@@ -76,6 +76,9 @@ void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc);
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc);
 
 int getRecordCol(uint8_t *data, int ncol, uint32_t *type, uint32_t *offset);
+int getRecordCols(uint8_t *data, int ncols, uint32_t *types, uint32_t *offsets);
+
+uint32_t schema_hash(const char *name);
 
 int schema_exists(chidb *db, char *name);
 
@@ -0,0 +1,778 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements a write-ahead log (WAL) for the pager.
+ *
+ * When the WAL is enabled, modified pages are not written back to the
+ * database file. Instead, when a transaction commits, the pager appends
+ * a copy of every page it modified (a "frame") to the end of the log.
+ * The last frame of a transaction is marked as a commit frame, and
+ * records the size of the database after the transaction.
+ *
+ * To read a page, the pager first looks for the most recent copy of
+ * that page in the log, and only reads it from the database file if
+ * there is none. The WAL index is an in-memory map from page numbers
+ * to the frames holding them. Each connection builds its own index by
+ * reading the log; frames that do not belong to a committed transaction
+ * (e.g., because the writer crashed halfway through a commit) are never
+ * added to it.
+ *
+ * Readers work on a snapshot: when a read transaction begins, the
+ * reader records the last committed frame, and ignores any frames
+ * that are appended after that. So, a writer can keep on appending
+ * to the log while other connections are reading from it.
+ *
+ * Durability comes from an fsync of the log, which is done once per
+ * "group" of commits (by default, a group is one commit; see
+ * chidb_Pager_setGroupCommit). Committing a transaction is thus a
+ * sequential append plus, at most, one fsync.
+ *
+ * Checkpointing copies the latest version of every page in the log
+ * back into the database file, and then resets the log. A checkpoint
+ * cannot run while other connections are reading from the log, since
+ * they might need older versions of those pages.
+ *
+ * Concurrency control uses flock() locks:
+ *
+ *  - Readers hold a shared lock on the log while a read transaction
+ *    is active. A checkpoint needs an exclusive lock on the log.
+ *  - A single writer is allowed at a time. The writer holds an
+ *    exclusive lock on the database file.
+ *
+ * Log format (all integers are 4-byte big-endian):
+ *
+ *  - Header: magic number, page size, salt. The salt changes every time
+ *    the log is reset, so frames from an older log are never mistaken
+ *    for new ones.
+ *  - Frames: page number, database size (commit frames only, 0 in
+ *    other frames), salt, checksum, followed by the page itself. The
+ *    checksum covers the first 8 bytes of the frame header and the page,
+ *    and is seeded with the checksum of the previous frame (the salt
+ *    for the first frame), so a torn write at the end of the log
+ *    is detected.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <chidb/log.h>
+#include "wal.h"
+#include "util.h"
+
+
+static off_t frame_offset(Wal *wal, uint32_t frame)
+{
+    return WAL_HEADER_SIZE + (off_t) (frame - 1) * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+}
+
+static uint32_t wal_checksum(uint32_t seed, const uint8_t *data, size_t n)
+{
+    /* FNV-1a */
+    uint32_t sum = seed ^ 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        sum = (sum ^ data[i]) * 16777619u;
+    return sum;
+}
+
+static uint32_t frame_checksum(uint32_t seed, const uint8_t *header, const uint8_t *data, uint16_t page_size)
+{
+    return wal_checksum(wal_checksum(seed, header, WALFRAME_SALT_OFFSET), data, page_size);
+}
+
+/* Adds a frame to the WAL index */
+static int wal_index_add(Wal *wal, uint32_t frame, npage_t npage)
+{
+    if (frame >= wal->n_alloc)
+    {
+        uint32_t n_alloc = wal->n_alloc > 0 ? wal->n_alloc * 2 : 256;
+        while (n_alloc <= frame)
+            n_alloc *= 2;
+        npage_t *frame_page = realloc(wal->frame_page, n_alloc * sizeof(npage_t));
+        if (frame_page == NULL)
+            return CHIDB_ENOMEM;
+        wal->frame_page = frame_page;
+        uint32_t *frame_prev = realloc(wal->frame_prev, n_alloc * sizeof(uint32_t));
+        if (frame_prev == NULL)
+            return CHIDB_ENOMEM;
+        wal->frame_prev = frame_prev;
+        wal->n_alloc = n_alloc;
+    }
+    if (npage >= wal->n_page_frame)
+    {
+        npage_t n = wal->n_page_frame > 0 ? wal->n_page_frame * 2 : 256;
+        while (n <= npage)
+            n *= 2;
+        uint32_t *page_frame = realloc(wal->page_frame, n * sizeof(uint32_t));
+        if (page_frame == NULL)
+            return CHIDB_ENOMEM;
+        memset(page_frame + wal->n_page_frame, 0, (n - wal->n_page_frame) * sizeof(uint32_t));
+        wal->page_frame = page_frame;
+        wal->n_page_frame = n;
+    }
+
+    wal->frame_page[frame] = npage;
+    wal->frame_prev[frame] = wal->page_frame[npage];
+    wal->page_frame[npage] = frame;
+
+    return CHIDB_OK;
+}
+
+/* Removes all frames after frame n from the WAL index */
+static void wal_index_truncate(Wal *wal, uint32_t n, uint32_t last)
+{
+    for (uint32_t frame = last; frame > n; frame--)
+        wal->page_frame[wal->frame_page[frame]] = wal->frame_prev[frame];
+}
+
+static void wal_index_clear(Wal *wal)
+{
+    if (wal->page_frame != NULL)
+        memset(wal->page_frame, 0, wal->n_page_frame * sizeof(uint32_t));
+    wal->n_frames = 0;
+    wal->snapshot = 0;
+    wal->checksum = wal->salt;
+}
+
+/* Reads the log header
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The log has no header (it has never been written to)
+ * - CHIDB_ECORRUPT: The log was written with a different page size
+ */
+static int wal_read_header(Wal *wal, uint32_t *salt)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+
+    if (pread(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE
+        || get4byte(header + WALHEADER_MAGIC_OFFSET) != WAL_MAGIC)
+        return CHIDB_EEMPTY;
+    if (get4byte(header + WALHEADER_PAGESIZE_OFFSET) != wal->page_size)
+        return CHIDB_ECORRUPT;
+    *salt = get4byte(header + WALHEADER_SALT_OFFSET);
+
+    return CHIDB_OK;
+}
+
+/* Reads the frames that follow the last committed frame in the index
+ *
+ * Frames are only valid if they have the right salt and checksum. If
+ * update is true, every committed frame is added to the WAL index.
+ * Otherwise, the index is left untouched, and the scan stops at the
+ * first commit frame.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - update: Update the WAL index?
+ * - committed: Out parameter. Set to true if at least one new
+ *              transaction was found in the log.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int wal_scan(Wal *wal, bool update, bool *committed)
+{
+    uint8_t frame_header[WAL_FRAME_HEADER_SIZE];
+    uint8_t *data;
+    int rc = CHIDB_OK;
+
+    *committed = false;
+    data = malloc(wal->page_size);
+    if (data == NULL)
+        return CHIDB_ENOMEM;
+
+    /* Frames are added to the index as they are read, and the ones after
+     * the last commit frame are removed at the end. */
+    uint32_t frame = wal->n_frames + 1;
+    uint32_t checksum = wal->checksum;
+    for (;; frame++)
+    {
+        off_t offset = frame_offset(wal, frame);
+        if (pread(wal->fd, frame_header, WAL_FRAME_HEADER_SIZE, offset) != WAL_FRAME_HEADER_SIZE
+            || pread(wal->fd, data, wal->page_size, offset + WAL_FRAME_HEADER_SIZE) != wal->page_size)
+            break;
+        if (get4byte(frame_header + WALFRAME_SALT_OFFSET) != wal->salt)
+            break;
+        checksum = frame_checksum(checksum, frame_header, data, wal->page_size);
+        if (get4byte(frame_header + WALFRAME_CHECKSUM_OFFSET) != checksum)
+            break;
+
+        npage_t db_size = get4byte(frame_header + WALFRAME_DBSIZE_OFFSET);
+        if (!update)
+        {
+            if (db_size != 0)
+            {
+                *committed = true;
+                break;
+            }
+            continue;
+        }
+
+        rc = wal_index_add(wal, frame, get4byte(frame_header + WALFRAME_NPAGE_OFFSET));
+        if (rc != CHIDB_OK)
+            break;
+        if (db_size != 0)
+        {
+            *committed = true;
+            wal->n_frames = frame;
+            wal->db_size = db_size;
+            wal->checksum = checksum;
+        }
+    }
+    if (update)
+        wal_index_truncate(wal, wal->n_frames, frame - 1);
+    free(data);
+
+    return rc;
+}
+
+/* Brings the WAL index up to date with the log file
+ *
+ * Reads any committed frames that other connections have appended
+ * to the log since the last time the index was updated.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - reset: Out parameter. Set to true if the log was reset since the
+ *          last update (so any page might have changed).
+ * - first_new: Out parameter. First frame that was added to the index
+ *              (frames first_new to wal->n_frames are new).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The log was written with a different page size
+ */
+static int wal_refresh(Wal *wal, bool *reset, uint32_t *first_new)
+{
+    uint32_t salt;
+    bool committed;
+
+    *reset = false;
+    int rc = wal_read_header(wal, &salt);
+    if (rc == CHIDB_EEMPTY)
+    {
+        /* Empty log */
+        if (wal->n_frames > 0)
+        {
+            *reset = true;
+            wal_index_clear(wal);
+        }
+        *first_new = wal->n_frames + 1;
+        return CHIDB_OK;
+    }
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (salt != wal->salt)
+    {
+        /* The log was checkpointed, so the database file itself
+         * may have changed (even if our index was empty) */
+        *reset = true;
+        wal->salt = salt;
+        wal_index_clear(wal);
+    }
+    *first_new = wal->n_frames + 1;
+
+    rc = wal_scan(wal, true, &committed);
+    if (committed)
+        chilog(TRACE, "WAL: read frames %i to %i from the log", *first_new, wal->n_frames);
+
+    return rc;
+}
+
+/* Checks whether other connections have changed the database since
+ * the WAL index was last updated, without updating it */
+static int wal_changed(Wal *wal, bool *changed)
+{
+    uint32_t salt;
+
+    int rc = wal_read_header(wal, &salt);
+    if (rc == CHIDB_EEMPTY)
+    {
+        *changed = wal->n_frames > 0;
+        return CHIDB_OK;
+    }
+    if (rc != CHIDB_OK)
+        return rc;
+    if (salt != wal->salt)
+    {
+        *changed = true;
+        return CHIDB_OK;
+    }
+
+    return wal_scan(wal, false, changed);
+}
+
+
+/* Open a write-ahead log
+ *
+ * Opens (or creates) the log file, and builds the WAL index
+ * from any committed frames in it.
+ *
+ * Parameters
+ * - wal: Out parameter. Used to return a pointer to the new Wal.
+ * - filename: Log file (might not exist)
+ * - db_fd: File descriptor of the database file
+ * - page_size: Page size of the database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_ECORRUPT: The log was written with a different page size
+ */
+int chidb_Wal_open(Wal **wal, const char *filename, int db_fd, uint16_t page_size)
+{
+    bool reset;
+    uint32_t first_new;
+
+    *wal = calloc(1, sizeof(Wal));
+    if (*wal == NULL)
+        return CHIDB_ENOMEM;
+
+    (*wal)->fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if ((*wal)->fd < 0)
+    {
+        free(*wal);
+        return CHIDB_EIO;
+    }
+    (*wal)->db_fd = db_fd;
+    (*wal)->page_size = page_size;
+    (*wal)->group_commit = 1;
+    (*wal)->salt = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+    (*wal)->checksum = (*wal)->salt;
+
+    flock((*wal)->fd, LOCK_SH);
+    int rc = wal_refresh(*wal, &reset, &first_new);
+    flock((*wal)->fd, LOCK_UN);
+    if (rc != CHIDB_OK)
+    {
+        chidb_Wal_close(*wal);
+        return rc;
+    }
+    (*wal)->snapshot = (*wal)->n_frames;
+
+    return CHIDB_OK;
+}
+
+
+/* Close a write-ahead log
+ *
+ * Any commits that have not been fsync'd yet are fsync'd.
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Wal_close(Wal *wal)
+{
+    chidb_Wal_sync(wal);
+    if (wal->writing)
+        chidb_Wal_endWrite(wal);
+    close(wal->fd);
+    free(wal->frame_page);
+    free(wal->frame_prev);
+    free(wal->page_frame);
+    free(wal);
+
+    return CHIDB_OK;
+}
+
+
+/* Begin a read transaction
+ *
+ * Brings the WAL index up to date, and takes a snapshot of the log:
+ * until the read transaction ends, frames appended by other connections
+ * are ignored, and the log cannot be checkpointed. Read transactions
+ * can be nested (only the outermost one takes a new snapshot).
+ *
+ * Parameters
+ * - wal: A Wal
+ * - reset: Out parameter. Set to true if the log was reset since
+ *          the last snapshot (so any page might have changed).
+ * - first_new: Out parameter. Frames first_new to wal->n_frames
+ *              were not part of the last snapshot.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The log was written with a different page size
+ */
+int chidb_Wal_beginRead(Wal *wal, bool *reset, uint32_t *first_new)
+{
+    *reset = false;
+    *first_new = wal->n_frames + 1;
+    if (wal->n_readers++ > 0)
+        return CHIDB_OK;
+
+    flock(wal->fd, LOCK_SH);
+    /* While we hold the writer lock, nobody else can modify the log */
+    if (wal->writing)
+        return CHIDB_OK;
+
+    int rc = wal_refresh(wal, reset, first_new);
+    wal->snapshot = wal->n_frames;
+
+    return rc;
+}
+
+
+/* End a read transaction
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No read transaction is active
+ */
+int chidb_Wal_endRead(Wal *wal)
+{
+    if (wal->n_readers == 0)
+        return CHIDB_EMISUSE;
+    if (--wal->n_readers == 0)
+        flock(wal->fd, LOCK_UN);
+
+    return CHIDB_OK;
+}
+
+
+/* Find the most recent version of a page in the log
+ *
+ * Only frames that are part of the current snapshot are considered.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - npage: Page number
+ * - frame: Out parameter. Frame containing the page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The page is not in the log
+ */
+int chidb_Wal_findFrame(Wal *wal, npage_t npage, uint32_t *frame)
+{
+    uint32_t f = npage < wal->n_page_frame ? wal->page_frame[npage] : 0;
+    while (f > wal->snapshot)
+        f = wal->frame_prev[f];
+    *frame = f;
+
+    return f != 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
+}
+
+
+/* Read the page stored in a frame
+ *
+ * Parameters
+ * - wal: A Wal
+ * - frame: Frame number
+ * - data: Buffer with enough space for a page
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data)
+{
+    ssize_t n = pread(wal->fd, data, wal->page_size, frame_offset(wal, frame) + WAL_FRAME_HEADER_SIZE);
+    chilog(TRACE, "WAL: read page %i from frame %i", wal->frame_page[frame], frame);
+
+    return n == wal->page_size ? CHIDB_OK : CHIDB_EIO;
+}
+
+
+/* Begin a write transaction
+ *
+ * Takes the writer lock. Only one connection can write at a time, and
+ * only if it is working on the latest version of the database (if
+ * another connection has committed since our last snapshot, our
+ * in-memory pages are stale, and we must start over with a new
+ * read transaction).
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another connection is writing, or our snapshot is
+ *                not the latest version of the database.
+ */
+int chidb_Wal_beginWrite(Wal *wal)
+{
+    bool changed;
+
+    if (wal->writing)
+        return CHIDB_OK;
+    if (flock(wal->db_fd, LOCK_EX | LOCK_NB) != 0)
+        return CHIDB_EBUSY;
+
+    /* The index is not updated here: the pager finds out which pages
+     * are stale when its next read transaction begins */
+    if (wal->n_readers == 0)
+        flock(wal->fd, LOCK_SH);
+    int rc = wal_changed(wal, &changed);
+    if (wal->n_readers == 0)
+        flock(wal->fd, LOCK_UN);
+    if (rc == CHIDB_OK && changed)
+        rc = CHIDB_EBUSY;
+    if (rc != CHIDB_OK)
+    {
+        flock(wal->db_fd, LOCK_UN);
+        return rc;
+    }
+    wal->writing = 1;
+
+    return CHIDB_OK;
+}
+
+
+/* End a write transaction (releases the writer lock)
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Wal_endWrite(Wal *wal)
+{
+    if (wal->writing)
+    {
+        flock(wal->db_fd, LOCK_UN);
+        wal->writing = 0;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Commit a transaction
+ *
+ * Appends a frame for each page to the log (with as few system calls as
+ * possible), the last of which is marked as the commit frame. The log is
+ * fsync'd if this completes a group of commits (see wal->group_commit).
+ * The writer lock must be held.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - npages: Page numbers of the pages to append
+ * - data: Contents of the pages to append
+ * - n: Number of pages
+ * - db_size: Size of the database (in pages) after this transaction
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EMISUSE: The writer lock is not held
+ */
+int chidb_Wal_appendFrames(Wal *wal, npage_t *npages, uint8_t **data, uint32_t n, npage_t db_size)
+{
+    struct iovec iov[IOV_MAX];
+    uint32_t frames_per_write = IOV_MAX / 2;
+    int rc = CHIDB_OK;
+
+    if (!wal->writing)
+        return CHIDB_EMISUSE;
+    if (n == 0)
+        return CHIDB_OK;
+
+    if (wal->n_frames == 0)
+    {
+        /* First transaction in the log: (re)write the header */
+        uint8_t header[WAL_HEADER_SIZE] = {0};
+        put4byte(header + WALHEADER_MAGIC_OFFSET, WAL_MAGIC);
+        put4byte(header + WALHEADER_PAGESIZE_OFFSET, wal->page_size);
+        put4byte(header + WALHEADER_SALT_OFFSET, wal->salt);
+        if (pwrite(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE)
+            return CHIDB_EIO;
+        wal->checksum = wal->salt;
+    }
+
+    uint8_t *headers = malloc((size_t) n * WAL_FRAME_HEADER_SIZE);
+    if (headers == NULL)
+        return CHIDB_ENOMEM;
+
+    uint32_t checksum = wal->checksum;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint8_t *header = headers + (size_t) i * WAL_FRAME_HEADER_SIZE;
+        put4byte(header + WALFRAME_NPAGE_OFFSET, npages[i]);
+        put4byte(header + WALFRAME_DBSIZE_OFFSET, i == n - 1 ? db_size : 0);
+        put4byte(header + WALFRAME_SALT_OFFSET, wal->salt);
+        checksum = frame_checksum(checksum, header, data[i], wal->page_size);
+        put4byte(header + WALFRAME_CHECKSUM_OFFSET, checksum);
+    }
+
+    for (uint32_t i = 0; i < n; i += frames_per_write)
+    {
+        uint32_t nframes = n - i < frames_per_write ? n - i : frames_per_write;
+        for (uint32_t j = 0; j < nframes; j++)
+        {
+            iov[2 * j].iov_base = headers + (size_t) (i + j) * WAL_FRAME_HEADER_SIZE;
+            iov[2 * j].iov_len = WAL_FRAME_HEADER_SIZE;
+            iov[2 * j + 1].iov_base = data[i + j];
+            iov[2 * j + 1].iov_len = wal->page_size;
+        }
+        ssize_t expected = (ssize_t) nframes * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+        if (pwritev(wal->fd, iov, 2 * nframes, frame_offset(wal, wal->n_frames + i + 1)) != expected)
+        {
+            free(headers);
+            return CHIDB_EIO;
+        }
+    }
+    free(headers);
+    chilog(TRACE, "WAL: appended frames %i to %i", wal->n_frames + 1, wal->n_frames + n);
+
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i++)
+        rc = wal_index_add(wal, wal->n_frames + i + 1, npages[i]);
+    if (rc != CHIDB_OK)
+        return rc;
+    wal->n_frames += n;
+    wal->snapshot = wal->n_frames;
+    wal->db_size = db_size;
+    wal->checksum = checksum;
+
+    if (++wal->n_unsynced >= wal->group_commit)
+        rc = chidb_Wal_sync(wal);
+
+    return rc;
+}
+
+
+/* Make all commits durable
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_sync(Wal *wal)
+{
+    if (wal->n_unsynced == 0)
+        return CHIDB_OK;
+    if (fdatasync(wal->fd) != 0)
+        return CHIDB_EIO;
+    chilog(TRACE, "WAL: synced %i commits", wal->n_unsynced);
+    wal->n_unsynced = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Checkpoint the log
+ *
+ * Copies the most recent version of every page in the log back into
+ * the database file, and resets the log. The writer lock must be held.
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EBUSY: Other connections are reading from the log
+ * - CHIDB_EMISUSE: The writer lock is not held
+ */
+int chidb_Wal_checkpoint(Wal *wal)
+{
+    int rc;
+
+    if (!wal->writing)
+        return CHIDB_EMISUSE;
+    if (wal->n_frames == 0)
+        return CHIDB_OK;
+
+    rc = chidb_Wal_sync(wal);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (flock(wal->fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        /* Converting our own shared lock may have released it */
+        if (wal->n_readers > 0)
+            flock(wal->fd, LOCK_SH);
+        return CHIDB_EBUSY;
+    }
+
+    uint8_t *data = malloc(wal->page_size);
+    if (data == NULL)
+        rc = CHIDB_ENOMEM;
+    for (npage_t npage = 1; npage < wal->n_page_frame && rc == CHIDB_OK; npage++)
+    {
+        uint32_t frame = wal->page_frame[npage];
+        if (frame == 0)
+            continue;
+        rc = chidb_Wal_readFrame(wal, frame, data);
+        if (rc == CHIDB_OK && pwrite(wal->db_fd, data, wal->page_size, (off_t) (npage - 1) * wal->page_size) != wal->page_size)
+            rc = CHIDB_EIO;
+    }
+    free(data);
+    if (rc == CHIDB_OK && fsync(wal->db_fd) != 0)
+        rc = CHIDB_EIO;
+
+    if (rc == CHIDB_OK)
+    {
+        chilog(TRACE, "WAL: checkpointed %i frames", wal->n_frames);
+        /* Reset the log. The new salt invalidates the old frames */
+        wal->salt++;
+        wal_index_clear(wal);
+        uint8_t header[WAL_HEADER_SIZE] = {0};
+        put4byte(header + WALHEADER_MAGIC_OFFSET, WAL_MAGIC);
+        put4byte(header + WALHEADER_PAGESIZE_OFFSET, wal->page_size);
+        put4byte(header + WALHEADER_SALT_OFFSET, wal->salt);
+        if (pwrite(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE
+            || ftruncate(wal->fd, WAL_HEADER_SIZE) != 0 || fdatasync(wal->fd) != 0)
+            rc = CHIDB_EIO;
+    }
+
+    flock(wal->fd, wal->n_readers > 0 ? LOCK_SH : LOCK_UN);
+
+    return rc;
+}
@@ -0,0 +1,107 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Write-ahead log header. See wal.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <sys/types.h>
+#include "chidbInt.h"
+
+#define WAL_MAGIC (0x63574c31)      /* "cWL1" */
+#define WAL_HEADER_SIZE (16)
+#define WAL_FRAME_HEADER_SIZE (16)
+
+/* WAL header offsets */
+#define WALHEADER_MAGIC_OFFSET (0)
+#define WALHEADER_PAGESIZE_OFFSET (4)
+#define WALHEADER_SALT_OFFSET (8)
+
+/* Frame header offsets */
+#define WALFRAME_NPAGE_OFFSET (0)
+#define WALFRAME_DBSIZE_OFFSET (4)      /* Non-zero only in the last frame of a transaction */
+#define WALFRAME_SALT_OFFSET (8)
+#define WALFRAME_CHECKSUM_OFFSET (12)
+
+/* Default number of committed frames after which the pager tries
+ * to checkpoint the log */
+#define WAL_AUTOCHECKPOINT (1000)
+
+/* The Wal struct represents an open write-ahead log.
+ *
+ * The WAL index (frame_page, frame_prev, and page_frame) is an in-memory
+ * map from page numbers to the frames that contain them. Frames are
+ * numbered from 1. Only frames up to n_frames (the last commit frame
+ * known to this connection) are ever added to the index. */
+typedef struct Wal
+{
+    int fd;                 /* WAL file */
+    int db_fd;              /* Database file (for locking and checkpoints) */
+    uint16_t page_size;
+    uint32_t salt;          /* Changes every time the log is reset */
+    uint32_t checksum;      /* Checksum of the last committed frame */
+
+    uint32_t n_frames;      /* Number of committed frames */
+    npage_t db_size;        /* Size of the database (in pages) as of the last commit */
+    uint32_t snapshot;      /* Last frame visible to the current reader */
+
+    npage_t *frame_page;    /* Page stored in each frame */
+    uint32_t *frame_prev;   /* Previous frame holding the same page (or 0) */
+    uint32_t n_alloc;       /* Allocated entries in frame_page/frame_prev */
+    uint32_t *page_frame;   /* Last frame holding each page (or 0) */
+    npage_t n_page_frame;   /* Allocated entries in page_frame */
+
+    uint32_t group_commit;  /* Number of commits per fsync */
+    uint32_t n_unsynced;    /* Commits not yet fsync'd */
+    uint32_t n_readers;     /* Nesting level of read transactions */
+    uint8_t writing;        /* 1 if this connection holds the writer lock */
+} Wal;
+
+int chidb_Wal_open(Wal **wal, const char *filename, int db_fd, uint16_t page_size);
+int chidb_Wal_close(Wal *wal);
+int chidb_Wal_beginRead(Wal *wal, bool *reset, uint32_t *first_new);
+int chidb_Wal_endRead(Wal *wal);
+int chidb_Wal_findFrame(Wal *wal, npage_t npage, uint32_t *frame);
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data);
+int chidb_Wal_beginWrite(Wal *wal);
+int chidb_Wal_endWrite(Wal *wal);
+int chidb_Wal_appendFrames(Wal *wal, npage_t *npages, uint8_t **data, uint32_t n, npage_t db_size);
+int chidb_Wal_sync(Wal *wal);
+int chidb_Wal_checkpoint(Wal *wal);
+
+#endif /*WAL_H_*/
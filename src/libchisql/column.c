@@ -113,6 +113,9 @@ size_t Column_getSize(Column_t *col)
         return sizeof(int);
     case TYPE_TEXT:
         return 250; /* default text length */
+    case TYPE_PARAM:
+        /* Only literals are parameters; a column never has this type */
+        break;
     }
 
     return 0;
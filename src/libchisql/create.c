@@ -139,12 +139,13 @@ TableReference_t *TableReference_make(char *table_name, char *alias)
     return ref;
 }
 
-Index_t *Index_make(char *name, char *table_name, char *column_name)
+Index_t *Index_make(char *name, char *table_name, StrList_t *columns)
 {
     Index_t *idx = (Index_t *)calloc(1, sizeof(Index_t));
     idx->name = name;
     idx->table_name = table_name;
-    idx->column_name = column_name;
+    idx->column_name = strdup(columns->str);
+    idx->columns = columns;
     return idx;
 }
 
@@ -154,11 +155,22 @@ Index_t *Index_makeUnique(Index_t *idx)
     return idx;
 }
 
+Index_t *Index_addInclude(Index_t *idx, StrList_t *include)
+{
+    idx->include = include;
+    return idx;
+}
+
 void Index_print(Index_t *idx)
 {
-    printf("Index '%s' on %s (%s)", idx->column_name,
-           idx->table_name,
-           idx->column_name);
+    printf("Index '%s' on %s ", idx->name,
+           idx->table_name);
+    StrList_print(idx->columns);
+    if (idx->include)
+    {
+        printf(" include ");
+        StrList_print(idx->include);
+    }
     if (idx->unique) printf(", unique");
     puts("");
 }
@@ -168,6 +180,8 @@ void Index_free(Index_t *idx)
     free(idx->name);
     free(idx->column_name);
     free(idx->table_name);
+    StrList_free(idx->columns);
+    StrList_free(idx->include);
     free(idx);
 }
 
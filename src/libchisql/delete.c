@@ -17,8 +17,12 @@ void deleteDelete(Delete_t *del)
 
 void Delete_print(Delete_t *del)
 {
-    printf("Delete from %s where ", del->table_name);
-    Condition_print(del->where);
+    printf("Delete from %s", del->table_name);
+    if (del->where)
+    {
+        printf(" where ");
+        Condition_print(del->where);
+    }
     puts("");
 }
 
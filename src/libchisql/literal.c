@@ -33,6 +33,16 @@ Literal_t *litText(char *str)
     return lval;
 }
 
+/* A statement parameter. name is the parameter name (including the
+ * leading ':'), or NULL for an anonymous (?) parameter */
+Literal_t *litParam(char *name)
+{
+    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    lval->t = TYPE_PARAM;
+    lval->val.strval = name;
+    return lval;
+}
+
 void Literal_print(Literal_t *val)
 {
     char buf[100];
@@ -51,6 +61,9 @@ void Literal_print(Literal_t *val)
     case TYPE_TEXT:
         printf("\"%s\"", val->val.strval);
         break;
+    case TYPE_PARAM:
+        printf("%s", val->val.strval ? val->val.strval : "?");
+        break;
     default:
         printf("(unknown type)");
     }
@@ -84,7 +97,7 @@ Literal_t *Literal_append(Literal_t *lit1, Literal_t *lit2)
 
 void Literal_free(Literal_t *lval)
 {
-    if (lval->t == TYPE_TEXT)
+    if (lval->t == TYPE_TEXT || lval->t == TYPE_PARAM)
         free(lval->val.strval);
     free(lval);
 }
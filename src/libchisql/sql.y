@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "sql-lexer.h"
@@ -52,17 +53,20 @@ chisql_statement_t *__stmt;
 %token VALUES AUTO_INCREMENT ASC DESC UNIQUE IN ON
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
-%token INDEX EXPLAIN
+%token INDEX EXPLAIN INCLUDE
+%token TOKEN_BEGIN COMMIT ROLLBACK TRANSACTION
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
+%token <strval> PARAMETER
 %token <dval> DOUBLE_LITERAL
 %token <ival> INT_LITERAL
 
 %type <ival> column_type bool_op comp_op select_combo
 %type <ival> function_name opt_distinct join opt_unique
+%type <ival> transaction
 %type <strval> column_name table_name opt_alias 
 %type <strval> index_name column_name_or_star
-%type <slist> column_names_list opt_column_names
+%type <slist> column_names_list opt_column_names opt_include
 %type <constr> opt_constraints constraints constraint
 %type <lval> literal_value values_list in_statement
 %type <fkeyref> references_stmt
@@ -100,6 +104,18 @@ sql_line
 	| select 		{ __stmt->stmt.select = $1; __stmt->type = STMT_SELECT; }
 	| insert_into 	{ __stmt->stmt.insert = $1; __stmt->type = STMT_INSERT; }
 	| delete_from 	{ __stmt->stmt.delete = $1; __stmt->type = STMT_DELETE; }
+	| transaction 	{ __stmt->type = $1; }
+	| /* empty */
+	;
+
+transaction
+	: TOKEN_BEGIN opt_transaction 	{ $$ = STMT_BEGIN; }
+	| COMMIT opt_transaction 	{ $$ = STMT_COMMIT; }
+	| ROLLBACK opt_transaction 	{ $$ = STMT_ROLLBACK; }
+	;
+
+opt_transaction
+	: TRANSACTION
 	| /* empty */
 	;
 
@@ -109,13 +125,19 @@ create
 	;
 
 create_index
-        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')'
+        : CREATE opt_unique INDEX index_name ON table_name '(' column_names_list ')' opt_include
 		{ 
 			$$ = Index_make($4, $6, $8); 
 		  	if ($2 == UNIQUE) $$ = Index_makeUnique($$); 
+			if ($10) $$ = Index_addInclude($$, $10);
 		}
 	;
 
+opt_include
+	: INCLUDE '(' column_names_list ')' { $$ = $3; }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_unique
 	: UNIQUE { $$ = UNIQUE; }
 	| /* empty */ { $$ = 0; }
@@ -475,10 +497,11 @@ literal_value
 			else
 				$$ = litText($1);
 		}
+	| PARAMETER { $$ = litParam($1); }
 	;
 
 delete_from
-	: DELETE FROM table_name where_condition
+	: DELETE FROM table_name opt_where_condition
 		{
 			$$ = Delete_make($3, $4);
 		}
@@ -506,6 +529,15 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_BEGIN:
+        printf("BEGIN TRANSACTION\n");
+        break;
+    case STMT_COMMIT:
+        printf("COMMIT\n");
+        break;
+    case STMT_ROLLBACK:
+        printf("ROLLBACK\n");
+        break;
     }
 
     return 0;
@@ -524,24 +556,32 @@ char *__sql_semicolon(const char *sql)
   return t;
 }
 
+/* The parser and the lexer keep their state in globals, so only one
+   statement can be parsed at a time */
+static pthread_mutex_t __parser_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 int chisql_parser(const char *sql, chisql_statement_t **stmt)
 {
   int rc;
+  chisql_statement_t *parsed;
   
-  __stmt = malloc(sizeof(chisql_statement_t));
   char *tsql = __sql_semicolon(sql);
-    
+
+  pthread_mutex_lock(&__parser_mutex);
+  __stmt = malloc(sizeof(chisql_statement_t));
   YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql);
   rc = yyparse();
   yy_delete_buffer (my_string_buffer);
+  parsed = __stmt;
+  pthread_mutex_unlock(&__parser_mutex);
   
   if (rc == 0) {
-    __stmt->text = tsql; /* strdup(sql); */
-    *stmt = __stmt;
+    parsed->text = tsql; /* strdup(sql); */
+    *stmt = parsed;
     return CHIDB_OK;
   } else {
     fprintf(stderr,"invalid sql: \"%s\"\n", tsql);
-    free(__stmt);
+    free(parsed);
     return CHIDB_EINVALIDSQL;
   }
 
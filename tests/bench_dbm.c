@@ -0,0 +1,146 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  DBM interpreter benchmark.
+ *
+ *  Runs a few queries over a table, many times, with the interpreter
+ *  that dispatches every instruction through the table of handlers and
+ *  with the direct-threaded interpreter (if the library was built with
+ *  it, see dbm.h), and compares how long they take.
+ *
+ *  Usage: bench_dbm [FILE [NROWS [NRUNS]]]
+ *
+ *  The file is deleted when the benchmark finishes.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <chidb/chidb.h>
+#include <chidb/log.h>
+#include "libchidb/dbm.h"
+
+#define DEFAULT_FILE "bench-dbm.cdb"
+#define DEFAULT_NROWS (20000)
+#define DEFAULT_NRUNS (20)
+
+static const char *queries[] = {
+    "SELECT * FROM t;",
+    "SELECT id FROM t WHERE n = 3;",
+    "SELECT name, n FROM t WHERE id > 100;",
+};
+
+typedef int (*exec_function)(chidb_stmt *stmt);
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Runs a statement nruns times with an interpreter, and returns the
+ * time it took (or a negative number if the statement failed) */
+static double run(chidb_stmt *stmt, exec_function exec, int nruns, long *nrows)
+{
+    double t = now();
+    int rc;
+
+    *nrows = 0;
+    for (int i = 0; i < nruns; i++)
+    {
+        while ((rc = exec(stmt)) == CHIDB_ROW)
+            (*nrows)++;
+        chidb_stmt_reset(stmt);
+        if (rc != CHIDB_DONE)
+            return -1;
+    }
+    return now() - t;
+}
+
+static int exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    if (chidb_prepare(db, sql, &stmt) != CHIDB_OK)
+        return 0;
+    int ok = chidb_step(stmt) == CHIDB_DONE;
+    chidb_finalize(stmt);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = argc > 1 ? argv[1] : DEFAULT_FILE;
+    int nrows = argc > 2 ? atoi(argv[2]) : DEFAULT_NROWS;
+    int nruns = argc > 3 ? atoi(argv[3]) : DEFAULT_NRUNS;
+    chidb *db;
+    chidb_stmt *stmt;
+    char name[32];
+    int ok = 1;
+
+    remove(fname);
+    if (chidb_open(fname, &db) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not create %s\n", fname);
+        return EXIT_FAILURE;
+    }
+    /* Opening the database sets the log level */
+    chilog_setloglevel(CRITICAL);
+
+    /* Build */
+    ok = exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);") &&
+         exec_sql(db, "BEGIN;") &&
+         chidb_prepare(db, "INSERT INTO t VALUES(?, ?, ?);", &stmt) == CHIDB_OK;
+    for (int i = 1; i <= nrows && ok; i++)
+    {
+        sprintf(name, "row-%d", i);
+        chidb_bind_int(stmt, 1, i);
+        chidb_bind_text(stmt, 2, name);
+        chidb_bind_int(stmt, 3, i % 10);
+        ok = chidb_step(stmt) == CHIDB_DONE && chidb_reset(stmt) == CHIDB_OK;
+    }
+    ok = ok && chidb_finalize(stmt) == CHIDB_OK && exec_sql(db, "COMMIT;");
+    if (!ok)
+    {
+        fprintf(stderr, "Could not build the table\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int q = 0; q < sizeof(queries) / sizeof(queries[0]) && ok; q++)
+    {
+        long nrows_table, nrows_threaded;
+        double t_table, t_threaded;
+
+        if (chidb_prepare(db, queries[q], &stmt) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not prepare %s\n", queries[q]);
+            return EXIT_FAILURE;
+        }
+        printf("%s\n", queries[q]);
+
+        /* Warm up the page cache */
+        run(stmt, chidb_stmt_exec_table, 1, &nrows_table);
+
+        t_table = run(stmt, chidb_stmt_exec_table, nruns, &nrows_table);
+        printf("  table:    %ld rows in %.3f s (%.0f rows/s)\n", nrows_table, t_table, nrows_table / t_table);
+#ifdef CHIDB_DBM_THREADED
+        t_threaded = run(stmt, chidb_stmt_exec_threaded, nruns, &nrows_threaded);
+        printf("  threaded: %ld rows in %.3f s (%.0f rows/s, %.2fx)\n", nrows_threaded, t_threaded,
+               nrows_threaded / t_threaded, t_table / t_threaded);
+        ok = t_table >= 0 && t_threaded >= 0 && nrows_table == nrows_threaded;
+#else
+        printf("  threaded: not built (see --disable-threaded-dbm)\n");
+        ok = t_table >= 0;
+#endif
+        chidb_finalize(stmt);
+    }
+
+    chidb_close(db);
+    remove(fname);
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
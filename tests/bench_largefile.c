@@ -0,0 +1,180 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Large file stress benchmark.
+ *
+ *  Builds a table B-Tree that is larger than 4 GB (by default), and then
+ *  checks that lookups and a full scan return the right data, with
+ *  special attention to the rows stored at the far end of the file.
+ *
+ *  Usage: bench_largefile [FILE [SIZE_MB]]
+ *
+ *  The file is deleted when the benchmark finishes.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <chidb/log.h>
+#include "libchidb/btree.h"
+
+#define DEFAULT_FILE "bench-largefile.cdb"
+#define DEFAULT_SIZE_MB (5120)
+#define ROW_SIZE (400)
+#define NLOOKUPS (100000)
+#define CACHE_SIZE (4096)
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void make_row(chidb_key_t key, uint8_t *row)
+{
+    for (int i = 0; i < ROW_SIZE; i++)
+        row[i] = (uint8_t) (key * 31 + i);
+}
+
+static int check_row(chidb_key_t key, uint8_t *data, uint16_t size)
+{
+    uint8_t row[ROW_SIZE];
+    make_row(key, row);
+    return size == ROW_SIZE && memcmp(row, data, ROW_SIZE) == 0;
+}
+
+/* Scans the tree rooted at npage in key order, checking that keys
+ * are consecutive and that every row has the expected contents */
+static int scan(BTree *bt, npage_t npage, chidb_key_t *next_key)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+
+    if (chidb_Btree_getNodeByPage(bt, npage, &btn) != CHIDB_OK)
+        return 0;
+
+    for (int i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            if (!scan(bt, cell.fields.tableInternal.child_page, next_key))
+                goto fail;
+        }
+        else if (cell.key != *next_key || !check_row(cell.key, cell.fields.tableLeaf.data, cell.fields.tableLeaf.data_size))
+        {
+            fprintf(stderr, "Scan: bad row at page %u (key %u, expected %u)\n", npage, cell.key, *next_key);
+            goto fail;
+        }
+        else
+        {
+            (*next_key)++;
+        }
+    }
+    if (btn->type == PGTYPE_TABLE_INTERNAL && !scan(bt, btn->right_page, next_key))
+        goto fail;
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return 1;
+
+fail:
+    chidb_Btree_freeMemNode(bt, btn);
+    return 0;
+}
+
+static int lookup(BTree *bt, chidb_key_t key)
+{
+    BTreeView view;
+    int ok;
+
+    if (chidb_Btree_findView(bt, 1, key, &view) != CHIDB_OK)
+    {
+        fprintf(stderr, "Lookup: key %u not found\n", key);
+        return 0;
+    }
+    ok = check_row(key, view.data, view.size);
+    if (!ok)
+        fprintf(stderr, "Lookup: bad row for key %u\n", key);
+    chidb_Btree_releaseView(bt, &view);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = argc > 1 ? argv[1] : DEFAULT_FILE;
+    off_t target = (off_t) (argc > 2 ? atol(argv[2]) : DEFAULT_SIZE_MB) * 1024 * 1024;
+    chidb *db = malloc(sizeof(chidb));
+    BTree *bt;
+    uint8_t row[ROW_SIZE];
+    struct stat st;
+    chidb_key_t nrows = 0, next_key = 1;
+    double t;
+    int ok = 1;
+
+    chilog_setloglevel(CRITICAL);
+    remove(fname);
+    if (chidb_Btree_open(fname, db, &bt) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not create %s\n", fname);
+        return EXIT_FAILURE;
+    }
+    chidb_Pager_setCacheSize(bt->pager, CACHE_SIZE);
+
+    /* Build */
+    t = now();
+    do
+    {
+        for (int i = 0; i < 10000; i++)
+        {
+            nrows++;
+            make_row(nrows, row);
+            if (chidb_Btree_insertInTable(bt, 1, nrows, row, ROW_SIZE) != CHIDB_OK)
+            {
+                fprintf(stderr, "Insert of key %u failed\n", nrows);
+                return EXIT_FAILURE;
+            }
+        }
+        fstat(bt->pager->fd, &st);
+    } while (st.st_size < target);
+    t = now() - t;
+    printf("build:  %u rows, %u pages, %.1f MB in %.2f s (%.0f rows/s)\n", nrows, bt->pager->n_pages,
+           st.st_size / (1024.0 * 1024.0), t, nrows / t);
+
+    /* Reopen, so nothing is served from the cache of the build phase */
+    chidb_Btree_close(bt);
+    chidb_Btree_open(fname, db, &bt);
+    chidb_Pager_setCacheSize(bt->pager, CACHE_SIZE);
+
+    /* Lookups at the far end of the file */
+    chidb_key_t ntail = nrows < NLOOKUPS ? nrows : NLOOKUPS;
+    t = now();
+    for (chidb_key_t key = nrows; key > nrows - ntail && ok; key--)
+        ok = lookup(bt, key);
+    t = now() - t;
+    printf("tail:   %u lookups in %.2f s (%.0f lookups/s)\n", ntail, t, ntail / t);
+
+    /* Random lookups over the whole file */
+    t = now();
+    srand(42);
+    for (int i = 0; i < NLOOKUPS && ok; i++)
+        ok = lookup(bt, 1 + ((chidb_key_t) rand() * 2654435761u) % nrows);
+    t = now() - t;
+    printf("random: %u lookups in %.2f s (%.0f lookups/s)\n", NLOOKUPS, t, NLOOKUPS / t);
+
+    /* Full scan */
+    t = now();
+    ok = ok && scan(bt, 1, &next_key) && next_key == nrows + 1;
+    t = now() - t;
+    printf("scan:   %u rows in %.2f s (%.0f rows/s)\n", next_key - 1, t, (next_key - 1) / t);
+
+    chidb_Btree_close(bt);
+    free(db);
+    remove(fname);
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
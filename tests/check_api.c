@@ -0,0 +1,829 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include "check_common.h"
+
+#define NROWS (50)
+
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+static void row_name(int i, char *name)
+{
+    sprintf(name, "row-%03d", i);
+}
+
+/* Inserts NROWS rows with a single prepared statement */
+static void insert_rows(chidb *db)
+{
+    chidb_stmt *stmt;
+    char name[16];
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(?, :name, ?);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_parameter_count(stmt) == 3);
+    ck_assert(chidb_bind_parameter_index(stmt, ":name") == 2);
+    ck_assert(chidb_bind_parameter_index(stmt, ":nope") == 0);
+
+    for (int i = 1; i <= NROWS; i++)
+    {
+        row_name(i, name);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, name) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, i * 10) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        /* A finished statement does not run again until it is reset */
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+/* A file that cannot be opened, or that is not a chidb file, is an error,
+ * and leaves nothing open */
+START_TEST (test_open_errors)
+{
+    chidb *db;
+    FILE *f;
+
+    ck_assert(chidb_open(GENERATED_DIR "no-such-dir/db.cdb", &db) != CHIDB_OK);
+    ck_assert(db == NULL);
+
+    char *fname = create_tmp_file();
+    f = fopen(fname, "w");
+    ck_assert(f != NULL);
+    for (int i = 0; i < 1024; i++)
+        fputc('x', f);
+    fclose(f);
+    ck_assert(chidb_open(fname, &db) != CHIDB_OK);
+    ck_assert(db == NULL);
+    ck_assert(chidb_open_v2(fname, &db, CHIDB_OPEN_MMAP | CHIDB_OPEN_THREADSAFE, 16) != CHIDB_OK);
+    ck_assert(db == NULL);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_bind)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char name[16];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+
+    ck_assert(chidb_prepare(db, "SELECT name, n FROM t WHERE id = :id;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_parameter_count(stmt) == 1);
+    for (int i = NROWS; i >= 1; i--)
+    {
+        row_name(i, name);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_str_eq(chidb_column_text(stmt, 0), name);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), i * 10);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+
+    /* Parameters that have not been bound are NULL, and match nothing */
+    ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE name = ?;", &stmt) == CHIDB_OK);
+    row_name(17, name);
+    ck_assert(chidb_bind_text(stmt, 1, name) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 17);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_bind_errors)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+
+    /* A named parameter cannot be compared to columns of different types */
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(:x, 'abc', :x);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(:x, :x, 1);", &stmt) != CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE id > ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 0, 1) == CHIDB_ERANGE);
+    ck_assert(chidb_bind_int(stmt, 2, 1) == CHIDB_ERANGE);
+    ck_assert(chidb_bind_text(stmt, 1, "abc") == CHIDB_EMISMATCH);
+    ck_assert(chidb_bind_int(stmt, 1, NROWS - 2) == CHIDB_OK);
+
+    /* Parameters cannot be changed while the statement is running */
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), NROWS - 1);
+    ck_assert(chidb_bind_int(stmt, 1, 0) == CHIDB_EMISUSE);
+    ck_assert(chidb_clear_bindings(stmt) == CHIDB_EMISUSE);
+
+    /* ...but a statement can be reset before it is done */
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, NROWS - 1) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), NROWS);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Rows (and schema entries) that do not fit in a B-Tree cell */
+START_TEST (test_overflow)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *text = malloc(4001);
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE long_rows(id INTEGER PRIMARY KEY, a_rather_long_column_name TEXT, "
+                 "another_rather_long_column_name TEXT, yet_another_rather_long_column_name INTEGER, "
+                 "the_last_of_the_rather_long_column_names INTEGER);");
+
+    ck_assert(chidb_prepare(db, "INSERT INTO long_rows VALUES(?, ?, 'short', ?, ?);", &stmt) == CHIDB_OK);
+    for (int i = 1; i <= NROWS; i++)
+    {
+        int len = (i * 97) % 4000;
+        memset(text, 'a' + i % 26, len);
+        text[len] = '\0';
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, text) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, i * 10) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 4, len) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    /* The schema is loaded from the file again */
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT * FROM long_rows;", &stmt) == CHIDB_OK);
+    for (int i = 1; i <= NROWS; i++)
+    {
+        int len = (i * 97) % 4000;
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), i);
+        ck_assert_int_eq(strlen(chidb_column_text(stmt, 1)), len);
+        ck_assert(len == 0 || chidb_column_text(stmt, 1)[len - 1] == 'a' + i % 26);
+        ck_assert_str_eq(chidb_column_text(stmt, 2), "short");
+        ck_assert_int_eq(chidb_column_int(stmt, 3), i * 10);
+        ck_assert_int_eq(chidb_column_int(stmt, 4), len);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+    free(text);
+}
+END_TEST
+
+
+#define NCOLS (40)
+
+/* Columns of the wide table: even ones are integers, odd ones are text */
+static void wide_value(int row, int col, char *text, int *n)
+{
+    *n = row * 100 + col;
+    sprintf(text, "r%d-c%d", row, col);
+}
+
+START_TEST (test_wide_rows)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[2048], text[32];
+    int n;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    strcpy(sql, "CREATE TABLE wide(c0 INTEGER PRIMARY KEY");
+    for (int c = 1; c < NCOLS; c++)
+        sprintf(sql + strlen(sql), ", c%d %s", c, c % 2 ? "TEXT" : "INTEGER");
+    strcat(sql, ");");
+    exec_sql(db, sql);
+
+    strcpy(sql, "INSERT INTO wide VALUES(?");
+    for (int c = 1; c < NCOLS; c++)
+        strcat(sql, ", ?");
+    strcat(sql, ");");
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    for (int i = 1; i <= NROWS; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        for (int c = 1; c < NCOLS; c++)
+        {
+            wide_value(i, c, text, &n);
+            if (c % 2)
+                ck_assert(chidb_bind_text(stmt, c + 1, text) == CHIDB_OK);
+            else
+                ck_assert(chidb_bind_int(stmt, c + 1, n) == CHIDB_OK);
+        }
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The columns are read in any order, and some more than once */
+    ck_assert(chidb_prepare(db, "SELECT c39, c2, c38, c1, c20, c39 FROM wide WHERE c10 > 1000;", &stmt) == CHIDB_OK);
+    for (int i = 10; i <= NROWS; i++)
+    {
+        int cols[] = {39, 2, 38, 1, 20, 39};
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        for (int j = 0; j < 6; j++)
+        {
+            wide_value(i, cols[j], text, &n);
+            if (cols[j] % 2)
+                ck_assert_str_eq(chidb_column_text(stmt, j), text);
+            else
+                ck_assert_int_eq(chidb_column_int(stmt, j), n);
+        }
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Deleting rows while the table is scanned */
+    exec_sql(db, "DELETE FROM wide WHERE c11 = 'r7-c11';");
+    ck_assert(chidb_prepare(db, "SELECT * FROM wide;", &stmt) == CHIDB_OK);
+    for (int i = 1; i <= NROWS; i++)
+    {
+        if (i == 7)
+            continue;
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), i);
+        wide_value(i, NCOLS - 1, text, &n);
+        ck_assert_str_eq(chidb_column_text(stmt, NCOLS - 1), text);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Counts the rows returned by a query */
+static int count_rows(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int n = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    while (chidb_step(stmt) == CHIDB_ROW)
+        n++;
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    return n;
+}
+
+START_TEST (test_delete)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+
+    exec_sql(db, "DELETE FROM t WHERE id > 40;");
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 40);
+    exec_sql(db, "DELETE FROM t WHERE n <= 100;");
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 30);
+    exec_sql(db, "DELETE FROM t WHERE name = 'row-025';");
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 29);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t WHERE id = 25;"), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t WHERE id = 26;"), 1);
+
+    /* Parameters can be used in the condition */
+    ck_assert(chidb_prepare(db, "DELETE FROM t WHERE id = ?;", &stmt) == CHIDB_OK);
+    for (int i = 11; i <= 40; i += 2)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 15);
+
+    ck_assert(chidb_prepare(db, "DELETE FROM nope;", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "DELETE FROM t WHERE nope = 1;", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "DELETE FROM t WHERE id = 'abc';", &stmt) != CHIDB_OK);
+
+    exec_sql(db, "DELETE FROM t;");
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 0);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    /* The table can be filled again after it is reopened */
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "INSERT INTO t VALUES(7, 'seven', 70);");
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 1);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_create_index)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+
+    /* Indexes can be created on integer and text columns */
+    exec_sql(db, "CREATE INDEX idx_n ON t(n);");
+    exec_sql(db, "CREATE INDEX idx_name ON t(name);");
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx_nope ON t(nope);", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx_n ON t(name);", &stmt) != CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), NROWS);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t WHERE name = 'row-025';"), 1);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Checks that a query is run without reading the table (except for the
+ * entries whose INCLUDE values are not in the index, after IdxSpilled) */
+static void check_index_only(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int nIdxColumn = 0;
+    int spill_addr = -1;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    while (chidb_step(stmt) == CHIDB_ROW)
+    {
+        const char *opcode = chidb_column_text(stmt, 1);
+        if (strcmp(opcode, "IdxSpilled") == 0)
+            spill_addr = chidb_column_int(stmt, 3);
+        if (strcmp(opcode, "Column") == 0 || strcmp(opcode, "Key") == 0)
+            ck_assert(spill_addr != -1 && chidb_column_int(stmt, 0) >= spill_addr);
+        if (strcmp(opcode, "IdxColumn") == 0)
+            nIdxColumn++;
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(nIdxColumn > 0);
+}
+
+START_TEST (test_covering_index)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char name[16];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+
+    exec_sql(db, "CREATE INDEX idx_n ON t(n) INCLUDE (name);");
+    exec_sql(db, "CREATE INDEX idx_name_n ON t(name, n);");
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx_n ON t(id);", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx_bad ON t(n) INCLUDE (nope);", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx_bad ON t(n, nope);", &stmt) != CHIDB_OK);
+
+    check_index_only(db, "EXPLAIN SELECT name FROM t WHERE n > 100;");
+    check_index_only(db, "EXPLAIN SELECT * FROM t WHERE n = 100;");
+    check_index_only(db, "EXPLAIN SELECT id, n FROM t WHERE name <= 'row-010';");
+
+    /* The rows come in the order of the index */
+    ck_assert(chidb_prepare(db, "SELECT name, id FROM t WHERE n >= 200;", &stmt) == CHIDB_OK);
+    for (int i = 20; i <= NROWS; i++)
+    {
+        row_name(i, name);
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_str_eq(chidb_column_text(stmt, 0), name);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), i);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 250;"), 1);
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 255;"), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n > 250;"), NROWS - 25);
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n < 250;"), 24);
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n <= 250;"), 25);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t WHERE name >= 'row-040';"), NROWS - 39);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE name < 'row';"), 0);
+
+    ck_assert(chidb_prepare(db, "SELECT id, n FROM t WHERE name = ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, "row-025") == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 25);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 250);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The indexes are kept up to date by INSERT and DELETE */
+    exec_sql(db, "INSERT INTO t VALUES(100, 'extra', 255);");
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 255;"), 1);
+    ck_assert_int_eq(count_rows(db, "SELECT n FROM t WHERE name = 'extra';"), 1);
+    exec_sql(db, "DELETE FROM t WHERE id > 40;");
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n > 0;"), 40);
+    ck_assert_int_eq(count_rows(db, "SELECT n FROM t WHERE name > 'a';"), 40);
+    exec_sql(db, "DELETE FROM t WHERE name = 'row-005';");
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 50;"), 0);
+    exec_sql(db, "INSERT INTO t VALUES(5, 'row-005', 50);");
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 50;"), 1);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    /* The indexes are in the schema */
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n <= 400;"), 40);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t WHERE name = 'row-040';"), 1);
+    check_index_only(db, "EXPLAIN SELECT name FROM t WHERE n > 100;");
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_covering_index_long_text)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *text = malloc(1001);
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+    exec_sql(db, "CREATE INDEX idx_n ON t(n) INCLUDE (name);");
+
+    /* Text values too long for an index key are left in the table, and
+     * read from it by the index-only plan */
+    memset(text, 'x', 1000);
+    text[1000] = '\0';
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(?, ?, ?);", &stmt) == CHIDB_OK);
+    for (int i = 1; i <= 3; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, NROWS + i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, text + i * 100) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, 255) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    check_index_only(db, "EXPLAIN SELECT name FROM t WHERE n = 255;");
+    ck_assert(chidb_prepare(db, "SELECT name, id FROM t WHERE n >= 250;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "row-025");
+    for (int i = 1; i <= 3; i++)
+    {
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_str_eq(chidb_column_text(stmt, 0), text + i * 100);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), NROWS + i);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "row-026");
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* An index built over long values, and the deletion of their entries */
+    exec_sql(db, "CREATE INDEX idx_n_id ON t(n, id) INCLUDE (name);");
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 255;"), 3);
+    exec_sql(db, "DELETE FROM t WHERE id = 52;");
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t WHERE n = 255;"), 2);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE n > 0;"), NROWS + 2);
+
+    /* The values of the indexed columns themselves must fit in a key */
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx_name_n ON t(name, n);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ERANGE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    exec_sql(db, "DELETE FROM t WHERE id > 50;");
+    exec_sql(db, "CREATE INDEX idx_name_n ON t(name, n);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(60, ?, 1);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, text) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ERANGE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+    free(text);
+}
+END_TEST
+
+
+/* Returns the address of the first instruction with the given opcode in
+ * the program of an EXPLAIN statement (and its p2 in *p2), or -1 */
+static int find_op(chidb *db, const char *sql, const char *opcode, int *p2)
+{
+    chidb_stmt *stmt;
+    int addr = -1;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    while (chidb_step(stmt) == CHIDB_ROW)
+    {
+        if (addr == -1 && strcmp(chidb_column_text(stmt, 1), opcode) == 0)
+        {
+            addr = chidb_column_int(stmt, 0);
+            if (p2 != NULL)
+                *p2 = chidb_column_int(stmt, 3);
+        }
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    return addr;
+}
+
+START_TEST (test_peephole)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    int loop_addr, addr;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    insert_rows(db);
+
+    /* The row is checked by a ColumnCmp, and the value compared to is in
+     * the comparison, so it is not loaded into a register */
+    ck_assert(find_op(db, "EXPLAIN SELECT id FROM t WHERE n = 300;", "ColumnCmp", NULL) >= 0);
+    ck_assert(find_op(db, "EXPLAIN SELECT id FROM t WHERE n = 300;", "Eq", NULL) == -1);
+    ck_assert(find_op(db, "EXPLAIN SELECT id FROM t WHERE n = 300;", "Noop", NULL) == -1);
+    ck_assert_int_eq(find_op(db, "EXPLAIN SELECT id FROM t WHERE n = 300;", "Integer", NULL), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE n = 300;"), 1);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE n > 300;"), NROWS - 30);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE name <= 'row-010';"), 10);
+
+    /* The loop of a scan starts with a Column, which the Next at its end runs */
+    ck_assert(find_op(db, "EXPLAIN SELECT * FROM t;", "NextColumn", &loop_addr) >= 0);
+    ck_assert_int_eq(count_rows(db, "SELECT name FROM t;"), NROWS);
+
+    /* The value compared to is loaded once, before the loop */
+    addr = find_op(db, "EXPLAIN DELETE FROM t WHERE name = 'row-025';", "String", NULL);
+    ck_assert(find_op(db, "EXPLAIN DELETE FROM t WHERE name = 'row-025';", "NextColumn", &loop_addr) >= 0);
+    ck_assert(addr >= 0 && addr < loop_addr);
+    exec_sql(db, "DELETE FROM t WHERE name = 'row-025';");
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), NROWS - 1);
+
+    ck_assert(chidb_prepare(db, "DELETE FROM t WHERE n >= ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 410) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), 39);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+#define NREADERS (4)
+#define NBATCHES (5)
+
+/* Counts the rows in t over and over, while the writer adds them in
+ * batches of 10 (each in its own transaction) */
+static void *count_rows_thread(void *arg)
+{
+    chidb *db = arg;
+    int last = NROWS;
+
+    for (int i = 0; i < 50; i++)
+    {
+        int n = count_rows(db, "SELECT * FROM t;");
+        /* A batch is seen in full or not at all */
+        ck_assert_int_eq(n % 10, 0);
+        ck_assert(n >= last && n <= NROWS + NBATCHES * 10);
+        last = n;
+    }
+    return NULL;
+}
+
+START_TEST (test_threads)
+{
+    chidb *db;
+    pthread_t readers[NREADERS];
+    char sql[64];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open_v2(fname, &db, CHIDB_OPEN_THREADSAFE, 16) == CHIDB_OK);
+    insert_rows(db);
+
+    for (int i = 0; i < NREADERS; i++)
+        ck_assert(pthread_create(&readers[i], NULL, count_rows_thread, db) == 0);
+
+    for (int b = 0; b < NBATCHES; b++)
+    {
+        exec_sql(db, "BEGIN;");
+        for (int i = 1; i <= 10; i++)
+        {
+            sprintf(sql, "INSERT INTO t VALUES(%d, 'new', 0);", NROWS + b * 10 + i);
+            exec_sql(db, sql);
+        }
+        /* The writer's own statements see its uncommitted rows */
+        ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), NROWS + b * 10 + 10);
+        exec_sql(db, "COMMIT;");
+    }
+
+    for (int i = 0; i < NREADERS; i++)
+        ck_assert(pthread_join(readers[i], NULL) == 0);
+
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t;"), NROWS + NBATCHES * 10);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+#define NSCANROWS (3000)
+#define NWORKERS (4)
+
+/* Partial results of a scan of a range of t */
+struct scan_part
+{
+    chidb *db;
+    uint32_t min, max;
+    int nrows;
+    long sum;
+};
+
+static void *scan_range_thread(void *arg)
+{
+    struct scan_part *part = arg;
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(part->db, "SELECT id, n FROM t;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_scan_range(stmt, part->min, part->max) == CHIDB_OK);
+    while (chidb_step(stmt) == CHIDB_ROW)
+    {
+        uint32_t id = chidb_column_int(stmt, 0);
+        ck_assert(id >= part->min && id <= part->max);
+        part->nrows++;
+        part->sum += chidb_column_int(stmt, 1);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    return NULL;
+}
+
+START_TEST (test_parallel_scan)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    uint32_t bounds[NWORKERS * 50];
+    uint32_t nbounds;
+    struct scan_part parts[NWORKERS];
+    pthread_t workers[NWORKERS];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open_v2(fname, &db, CHIDB_OPEN_THREADSAFE, 64) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(?, 'scanned', ?);", &stmt) == CHIDB_OK);
+    for (int i = 1; i <= NSCANROWS; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i % 7) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    exec_sql(db, "COMMIT;");
+
+    /* Any number of ranges, with increasing bounds */
+    for (uint32_t nparts = 1; nparts <= NWORKERS * 50; nparts *= 5)
+    {
+        ck_assert(chidb_partition(db, "t", nparts, bounds, &nbounds) == CHIDB_OK);
+        ck_assert(nbounds < nparts || nbounds == 0);
+        for (uint32_t i = 1; i < nbounds; i++)
+            ck_assert(bounds[i - 1] < bounds[i]);
+    }
+    ck_assert(chidb_partition(db, "nope", NWORKERS, bounds, &nbounds) == CHIDB_EMISUSE);
+
+    /* Scan the ranges in parallel, and merge the results */
+    ck_assert(chidb_partition(db, "t", NWORKERS, bounds, &nbounds) == CHIDB_OK);
+    ck_assert_int_eq(nbounds, NWORKERS - 1);
+    for (uint32_t i = 0; i <= nbounds; i++)
+    {
+        parts[i].db = db;
+        parts[i].min = i == 0 ? 0 : bounds[i - 1] + 1;
+        parts[i].max = i == nbounds ? UINT32_MAX : bounds[i];
+        parts[i].nrows = 0;
+        parts[i].sum = 0;
+        ck_assert(pthread_create(&workers[i], NULL, scan_range_thread, &parts[i]) == 0);
+    }
+    int nrows = 0;
+    long sum = 0;
+    for (uint32_t i = 0; i <= nbounds; i++)
+    {
+        ck_assert(pthread_join(workers[i], NULL) == 0);
+        ck_assert(parts[i].nrows > 0);
+        nrows += parts[i].nrows;
+        sum += parts[i].sum;
+    }
+    ck_assert_int_eq(nrows, NSCANROWS);
+    for (int i = 1; i <= NSCANROWS; i++)
+        sum -= i % 7;
+    ck_assert_int_eq(sum, 0);
+
+    /* The range applies to scans with a condition too, and is kept
+     * across resets */
+    ck_assert(chidb_prepare(db, "SELECT * FROM t WHERE n = 3;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_scan_range(stmt, 10, 30) == CHIDB_OK);
+    for (int run = 0; run < 2; run++)
+    {
+        int n = 0;
+        while (chidb_step(stmt) == CHIDB_ROW)
+            n++;
+        ck_assert_int_eq(n, 3);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_scan_range(stmt, 5000, 6000) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Only for statements that scan a table */
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(?, 'new', 0);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_scan_range(stmt, 0, 10) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+Suite* make_api_suite (void)
+{
+    Suite *s = suite_create ("API");
+
+    TCase *tc_open = tcase_create ("Opening databases");
+    tcase_add_test (tc_open, test_open_errors);
+    suite_add_tcase (s, tc_open);
+
+    TCase *tc_bind = tcase_create ("Prepared statements and parameters");
+    tcase_add_test (tc_bind, test_bind);
+    tcase_add_test (tc_bind, test_bind_errors);
+    suite_add_tcase (s, tc_bind);
+
+    TCase *tc_overflow = tcase_create ("Large rows");
+    tcase_add_test (tc_overflow, test_overflow);
+    tcase_add_test (tc_overflow, test_wide_rows);
+    suite_add_tcase (s, tc_overflow);
+
+    TCase *tc_delete = tcase_create ("Deleting rows");
+    tcase_add_test (tc_delete, test_delete);
+    suite_add_tcase (s, tc_delete);
+
+    TCase *tc_index = tcase_create ("Indexes");
+    tcase_add_test (tc_index, test_create_index);
+    tcase_add_test (tc_index, test_covering_index);
+    tcase_add_test (tc_index, test_covering_index_long_text);
+    suite_add_tcase (s, tc_index);
+
+    TCase *tc_peephole = tcase_create ("Peephole optimizer");
+    tcase_add_test (tc_peephole, test_peephole);
+    suite_add_tcase (s, tc_peephole);
+
+    TCase *tc_threads = tcase_create ("Threads");
+    tcase_add_test (tc_threads, test_threads);
+    tcase_add_test (tc_threads, test_parallel_scan);
+    suite_add_tcase (s, tc_threads);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_api_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -15,6 +15,10 @@ Suite* make_btree_suite (void)
     suite_add_tcase (s, make_btree_6_tc());
     suite_add_tcase (s, make_btree_7_tc());
     suite_add_tcase (s, make_btree_8_tc());
+    suite_add_tcase (s, make_btree_9_tc());
+    suite_add_tcase (s, make_btree_10_tc());
+    suite_add_tcase (s, make_btree_11_tc());
+    suite_add_tcase (s, make_btree_12_tc());
 
     return s;
 }
@@ -27,6 +27,10 @@ TCase* make_btree_5_tc(void);
 TCase* make_btree_6_tc(void);
 TCase* make_btree_7_tc(void);
 TCase* make_btree_8_tc(void);
+TCase* make_btree_9_tc(void);
+TCase* make_btree_10_tc(void);
+TCase* make_btree_11_tc(void);
+TCase* make_btree_12_tc(void);
 
 
 
@@ -40,6 +44,8 @@ void btnNew_sanity_check(BTree *bt, BTreeNode *btn, uint8_t type);
 
 void bt_sanity_check(BTree *bt, npage_t nroot);
 
+int check_tree_structure(BTree *bt, npage_t npage, int64_t lo, int64_t hi, bool root, int *nentries);
+
 void test_init_empty(BTree *bt, uint8_t type);
 
 void test_new_node(BTree *bt, uint8_t type);
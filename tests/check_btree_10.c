@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Size of the data of entry i (from a few bytes to several pages) */
+static uint32_t overflow_size(int i)
+{
+    return 1 + (i * 397) % 5000;
+}
+
+static void overflow_data(int i, uint8_t *buf)
+{
+    uint32_t size = overflow_size(i);
+    for(uint32_t j = 0; j < size; j++)
+        buf[j] = (uint8_t) (i + j * 7);
+}
+
+
+START_TEST (test_10_1)
+{
+    chidb *db;
+    npage_t npage;
+    uint8_t buf[5000];
+    int rc, nentries = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Entries are inserted out of order, so that leaves with overflow
+     * cells are split */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    for(int i = 0; i < 500; i++)
+    {
+        int k = (i * 7) % 500;
+        overflow_data(k, buf);
+        rc = chidb_Btree_insertInTable(db->bt, npage, k + 1, buf, overflow_size(k));
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, 500);
+
+    for(int i = 0; i < 500; i++)
+    {
+        BTreeView view;
+
+        overflow_data(i, buf);
+        rc = chidb_Btree_findView(db->bt, npage, i + 1, &view);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(view.size, overflow_size(i));
+        ck_assert(!memcmp(view.data, buf, view.size));
+        /* Only entries that are not contiguous are copied */
+        ck_assert((view.copy != NULL) == (view.size > BTREE_MAX_LOCAL(1024)));
+        ck_assert((view.page != NULL) == (view.copy == NULL));
+        chidb_Btree_releaseView(db->bt, &view);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_2)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell cell;
+    npage_t npage;
+    uint8_t buf[5000], part[5000];
+    uint32_t local = BTREE_MAX_LOCAL(1024);
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i = 0; i < 5000; i++)
+        buf[i] = (uint8_t) (i * 13);
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    ck_assert(chidb_Btree_insertInTable(db->bt, npage, 1, buf, sizeof(buf)) == CHIDB_OK);
+    /* The data is stored in the cell and five overflow pages */
+    ck_assert_int_eq(db->bt->pager->n_pages, npage + 5);
+
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    chidb_Btree_getCell(btn, 0, &cell);
+    ck_assert_int_eq(cell.fields.tableLeaf.data_size, sizeof(buf));
+    ck_assert_int_eq(cell.fields.tableLeaf.local_size, local);
+    ck_assert_int_eq(cell.fields.tableLeaf.overflow_page, npage + 1);
+
+    /* Ranges that start or end anywhere in the chain */
+    uint32_t ranges[][2] = {{0, 5000}, {0, 10}, {local - 5, 10}, {local, 1020},
+                            {local + 1015, 10}, {4990, 10}, {5000, 0}};
+    for(int i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+    {
+        memset(part, 0, sizeof(part));
+        rc = chidb_Btree_readPayload(db->bt, &cell, ranges[i][0], ranges[i][1], part);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(!memcmp(part, buf + ranges[i][0], ranges[i][1]));
+    }
+    ck_assert(chidb_Btree_readPayload(db->bt, &cell, 4990, 11, part) == CHIDB_EMISUSE);
+
+    /* Reading the part of the data stored in the cell reads no overflow pages */
+    cell.fields.tableLeaf.overflow_page = 0;
+    ck_assert(chidb_Btree_readPayload(db->bt, &cell, 0, local, part) == CHIDB_OK);
+    ck_assert(chidb_Btree_readPayload(db->bt, &cell, 0, local + 1, part) == CHIDB_ECORRUPT);
+
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_10_tc(void)
+{
+    TCase *tc = tcase_create ("Step 10: Overflow pages");
+    tcase_add_test (tc, test_10_1);
+    tcase_add_test (tc, test_10_2);
+
+    return tc;
+}
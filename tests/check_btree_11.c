@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Visits the keys 1..n in a scrambled (but deterministic) order */
+static int scrambled(int i, int n)
+{
+    return 1 + (int) (((int64_t) i * 7919) % n);
+}
+
+static void check_entries(BTree *bt, npage_t nroot, int expected)
+{
+    int nentries = 0;
+    check_tree_structure(bt, nroot, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, expected);
+}
+
+static uint32_t freelist_count(BTree *bt)
+{
+    MemPage *page;
+    uint32_t nfree;
+
+    ck_assert(chidb_Pager_readPage(bt->pager, 1, &page) == CHIDB_OK);
+    nfree = get4byte(page->data + HEADER_FREELIST_COUNT_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return nfree;
+}
+
+
+/* Removing cells from a node */
+START_TEST (test_11_1)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell cell;
+    npage_t npage;
+    uint8_t buf[32];
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.fields.tableLeaf.data = buf;
+    for(int i = 0; i < 10; i++)
+    {
+        memset(buf, i, sizeof(buf));
+        cell.key = i;
+        cell.fields.tableLeaf.data_size = 1 + 3 * i;
+        ck_assert(chidb_Btree_insertCell(btn, i, &cell) == CHIDB_OK);
+    }
+    uint16_t cells_offset = btn->cells_offset;
+
+    ck_assert(chidb_Btree_removeCell(btn, 10) == CHIDB_ECELLNO);
+    ck_assert(chidb_Btree_removeCell(btn, 4) == CHIDB_OK);
+    ck_assert(chidb_Btree_removeCell(btn, 0) == CHIDB_OK);
+    ck_assert(chidb_Btree_removeCell(btn, 7) == CHIDB_OK);
+    ck_assert_int_eq(btn->n_cells, 7);
+    ck_assert_int_eq(btn->cells_offset, cells_offset + (8 + 13) + (8 + 1) + (8 + 28));
+    btn_sanity_check(db->bt, btn, false);
+
+    int keys[] = {1, 2, 3, 5, 6, 7, 8};
+    for(int i = 0; i < 7; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+        ck_assert_int_eq(cell.key, keys[i]);
+        ck_assert_int_eq(cell.fields.tableLeaf.data_size, 1 + 3 * keys[i]);
+        ck_assert(cell.fields.tableLeaf.data[0] == keys[i]);
+        ck_assert(cell.fields.tableLeaf.data[3 * keys[i]] == keys[i]);
+    }
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting every entry of a table B-Tree, in a scrambled order */
+START_TEST (test_11_2)
+{
+    chidb *db;
+    npage_t nroot;
+    uint8_t buf[200];
+    int n = 3000, rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int i = 0; i < n; i++)
+    {
+        int key = scrambled(i, n);
+        memset(buf, key, sizeof(buf));
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, buf, 1 + key % sizeof(buf)) == CHIDB_OK);
+    }
+    check_entries(db->bt, nroot, n);
+    npage_t n_pages = db->bt->pager->n_pages;
+
+    ck_assert(chidb_Btree_delete(db->bt, nroot, n + 1) == CHIDB_ENOTFOUND);
+    for(int i = 0; i < n; i++)
+    {
+        int key = scrambled(i * 13 + 5, n);
+        ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_OK);
+        ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_ENOTFOUND);
+
+        if (i % 250 == 0 || i == n - 1)
+        {
+            check_entries(db->bt, nroot, n - i - 1);
+            for(int j = i + 1; j < n; j++)
+            {
+                uint8_t *data;
+                uint16_t size;
+                int k = scrambled(j * 13 + 5, n);
+
+                ck_assert(chidb_Btree_find(db->bt, nroot, k, &data, &size) == CHIDB_OK);
+                ck_assert_int_eq(size, 1 + k % sizeof(buf));
+                ck_assert(data[size - 1] == (uint8_t) k);
+                free(data);
+            }
+        }
+    }
+
+    /* Only the root is left, and every other page is in the freelist */
+    ck_assert_int_eq(freelist_count(db->bt), n_pages - 2);
+
+    /* The freed pages are reused before the file is grown */
+    for(int i = 1; i <= n; i++)
+    {
+        memset(buf, i, sizeof(buf));
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, i, buf, 1 + i % sizeof(buf)) == CHIDB_OK);
+    }
+    check_entries(db->bt, nroot, n);
+    ck_assert(db->bt->pager->n_pages <= n_pages);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting entries from an index B-Tree (where entries in
+ * internal nodes are replaced by their predecessors) */
+START_TEST (test_11_3)
+{
+    chidb *db;
+    npage_t nroot;
+    int n = 4000, rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(int i = 0; i < n; i++)
+    {
+        int key = scrambled(i, n);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, key, 2 * key) == CHIDB_OK);
+    }
+    check_entries(db->bt, nroot, n);
+
+    /* Delete every key that is not a multiple of 4 */
+    for(int i = 0; i < n; i++)
+    {
+        int key = scrambled(i * 3 + 1, n);
+        if (key % 4 != 0)
+            ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_OK);
+    }
+    check_entries(db->bt, nroot, n / 4);
+    for(int key = 1; key <= n; key++)
+    {
+        chidb_key_t pkey;
+        rc = chidb_Btree_findInIndex(db->bt, nroot, key, &pkey);
+        if (key % 4 == 0)
+        {
+            ck_assert(rc == CHIDB_OK);
+            ck_assert_int_eq(pkey, 2 * key);
+        }
+        else
+            ck_assert(rc == CHIDB_ENOTFOUND);
+    }
+
+    /* The deleted keys can be inserted again */
+    for(int key = 1; key <= n; key++)
+        if (key % 4 != 0)
+            ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, key, 3 * key) == CHIDB_OK);
+    check_entries(db->bt, nroot, n);
+
+    for(int key = n; key >= 1; key--)
+        ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_OK);
+    check_entries(db->bt, nroot, 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting entries with overflow pages, and from the B-Tree in page 1.
+ * The freelist is kept in the file. */
+START_TEST (test_11_4)
+{
+    chidb *db;
+    uint8_t *buf = malloc(5000);
+    int n = 200, rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i = 1; i <= n; i++)
+    {
+        memset(buf, i, 5000);
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, i, buf, 100 + (i * 37) % 4900) == CHIDB_OK);
+    }
+    npage_t n_pages = db->bt->pager->n_pages;
+    for(int i = 2; i <= n; i += 2)
+        ck_assert(chidb_Btree_delete(db->bt, 1, i) == CHIDB_OK);
+    check_entries(db->bt, 1, n / 2);
+    uint32_t nfree = freelist_count(db->bt);
+    ck_assert(nfree > n_pages / 3);
+    chidb_Btree_close(db->bt);
+
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(freelist_count(db->bt), nfree);
+    for(int i = 1; i <= n; i += 2)
+    {
+        uint8_t *data;
+        uint16_t size;
+
+        ck_assert(chidb_Btree_find(db->bt, 1, i, &data, &size) == CHIDB_OK);
+        ck_assert_int_eq(size, 100 + (i * 37) % 4900);
+        ck_assert(data[0] == i && data[size - 1] == i);
+        free(data);
+    }
+    for(int i = 2; i <= n; i += 2)
+    {
+        memset(buf, i, 5000);
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, i, buf, 100 + (i * 37) % 4900) == CHIDB_OK);
+    }
+    check_entries(db->bt, 1, n);
+    ck_assert(db->bt->pager->n_pages <= n_pages + 2);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+    free(buf);
+}
+END_TEST
+
+
+/* A deleted row whose key is still a separator in an internal node can be
+ * inserted again */
+START_TEST (test_11_5)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell cell;
+    npage_t nroot;
+    uint8_t buf[100];
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int key = 1; key < 200; key += 2)
+    {
+        memset(buf, key, sizeof(buf));
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, buf, sizeof(buf)) == CHIDB_OK);
+    }
+
+    /* The first separator of the root */
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, nroot, &btn) == CHIDB_OK);
+    ck_assert_int_eq(btn->type, PGTYPE_TABLE_INTERNAL);
+    chidb_Btree_getCell(btn, 0, &cell);
+    chidb_key_t separator = cell.key;
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    ck_assert(chidb_Btree_delete(db->bt, nroot, separator) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, separator, buf, 10) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, separator, buf, 10) == CHIDB_EDUPLICATE);
+    check_entries(db->bt, nroot, 100);
+
+    for(int key = 1; key < 200; key += 2)
+    {
+        uint8_t *data;
+        uint16_t size;
+
+        memset(buf, key + 1, sizeof(buf));
+        ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_OK);
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, buf, sizeof(buf)) == CHIDB_OK);
+        ck_assert(chidb_Btree_find(db->bt, nroot, key, &data, &size) == CHIDB_OK);
+        ck_assert(data[0] == (uint8_t) (key + 1));
+        free(data);
+    }
+    check_entries(db->bt, nroot, 100);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_11_tc(void)
+{
+    TCase *tc = tcase_create ("Step 11: Deleting entries");
+    tcase_add_test (tc, test_11_1);
+    tcase_add_test (tc, test_11_2);
+    tcase_add_test (tc, test_11_3);
+    tcase_add_test (tc, test_11_4);
+    tcase_add_test (tc, test_11_5);
+
+    return tc;
+}
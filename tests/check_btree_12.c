@@ -0,0 +1,376 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Visits 0..n-1 in a scrambled (but deterministic) order */
+static int scrambled(int i, int n)
+{
+    return (int) (((int64_t) i * 7919) % n);
+}
+
+/* The ith key. Keys share long prefixes, and some of them are prefixes
+ * of others (e.g., "customer/12" and "customer/123") */
+static int make_key(int i, char *key)
+{
+    if (i % 5 == 0)
+        return sprintf(key, "customer/%d/orders/%d", i, i % 97);
+    return sprintf(key, "customer/%d", i);
+}
+
+/* Checks the ordering of the keys of a text index B-Tree, and that all
+ * its leaves are at the same depth. Returns the height of the tree. */
+static int check_text_tree(BTree *bt, npage_t npage, uint8_t *lo, int lo_size,
+                           uint8_t *hi, int hi_size, bool root, int *nentries)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    uint8_t prev[UINT8_MAX];
+    int prev_size = -1, height = -1;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    ck_assert(btn->type == PGTYPE_TEXTINDEX_INTERNAL || btn->type == PGTYPE_TEXTINDEX_LEAF);
+    if (!root)
+        ck_assert(btn->n_cells > 0);
+    if (btn->type == PGTYPE_TEXTINDEX_INTERNAL)
+        ck_assert_int_eq(btn->prefix_size, 0);
+
+    for(int i = 0; i <= btn->n_cells; i++)
+    {
+        uint8_t key[UINT8_MAX];
+        int size = -1;
+
+        if (i < btn->n_cells)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            ck_assert(cell.tkey.prefix_size + cell.tkey.suffix_size <= BTREE_MAX_TEXTKEY(btn->page_size));
+            memcpy(key, cell.tkey.prefix, cell.tkey.prefix_size);
+            memcpy(key + cell.tkey.prefix_size, cell.tkey.suffix, cell.tkey.suffix_size);
+            size = cell.tkey.prefix_size + cell.tkey.suffix_size;
+
+            /* Every key is in (lo, hi), and larger than the previous one */
+            if (lo != NULL)
+                ck_assert(chidb_Btree_compareTextKey(&cell.tkey, lo, lo_size) > 0);
+            if (hi != NULL)
+                ck_assert(chidb_Btree_compareTextKey(&cell.tkey, hi, hi_size) < 0);
+            if (prev_size >= 0)
+                ck_assert(chidb_Btree_compareTextKey(&cell.tkey, prev, prev_size) > 0);
+            (*nentries)++;
+        }
+
+        if (btn->type == PGTYPE_TEXTINDEX_INTERNAL)
+        {
+            npage_t child = i < btn->n_cells ? cell.fields.indexInternal.child_page : btn->right_page;
+            int h = check_text_tree(bt, child,
+                                    prev_size >= 0 ? prev : lo, prev_size >= 0 ? prev_size : lo_size,
+                                    size >= 0 ? key : hi, size >= 0 ? size : hi_size,
+                                    false, nentries);
+            if (height != -1)
+                ck_assert_int_eq(h, height);
+            height = h;
+        }
+
+        if (size >= 0)
+        {
+            memcpy(prev, key, size);
+            prev_size = size;
+        }
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return height + 1;
+}
+
+static void check_text_entries(BTree *bt, npage_t nroot, int expected)
+{
+    int nentries = 0;
+    check_text_tree(bt, nroot, NULL, 0, NULL, 0, true, &nentries);
+    ck_assert_int_eq(nentries, expected);
+}
+
+
+/* Inserting and finding text keys, in a scrambled order */
+START_TEST (test_12_1)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_key_t keyPk;
+    char key[64];
+    int n = 3000, rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TEXTINDEX_LEAF);
+    ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) "a", 1, &keyPk) == CHIDB_ENOTFOUND);
+    for(int i = 0; i < n; i++)
+    {
+        int k = scrambled(i, n);
+        int size = make_key(k, key);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) key, size, k + 1) == CHIDB_OK);
+
+        if (i % 500 == 0)
+            check_text_entries(db->bt, nroot, i + 1);
+    }
+    check_text_entries(db->bt, nroot, n);
+
+    for(int i = 0; i < n; i++)
+    {
+        int size = make_key(i, key);
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, i + 1);
+
+        /* A key that is a prefix of (or extends) an existing key is not found */
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size - 1, &keyPk) != CHIDB_OK ||
+                  keyPk != i + 1);
+        key[size] = '/';
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size + 1, &keyPk) == CHIDB_ENOTFOUND);
+    }
+
+    /* The index is still there after the file is reopened */
+    chidb_Btree_close(db->bt);
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    check_text_entries(db->bt, nroot, n);
+    for(int i = 0; i < n; i += 7)
+    {
+        int size = make_key(i, key);
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, i + 1);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* The common prefix of the keys in a leaf is only stored once */
+START_TEST (test_12_2)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell cell;
+    npage_t nroot;
+    char key[64];
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TEXTINDEX_LEAF);
+    for(int i = 0; i < 20; i++)
+    {
+        int size = sprintf(key, "https://www.example.com/%02d", i);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) key, size, i + 1) == CHIDB_OK);
+    }
+
+    chidb_Btree_getNodeByPage(db->bt, nroot, &btn);
+    ck_assert(btn->type == PGTYPE_TEXTINDEX_LEAF);
+    ck_assert_int_eq(btn->n_cells, 20);
+    ck_assert_int_eq(btn->prefix_size, strlen("https://www.example.com/"));
+    for(int i = 0; i < 20; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+        ck_assert_int_eq(cell.tkey.suffix_size, 2);
+        ck_assert(cell.tkey.suffix[0] == '0' + i / 10 && cell.tkey.suffix[1] == '0' + i % 10);
+        ck_assert_int_eq(cell.fields.indexLeaf.keyPk, i + 1);
+    }
+    /* Each cell only stores its two distinct bytes */
+    ck_assert_int_eq(btn->cells_offset, btn->page_size - btn->prefix_size - 20 * (TEXTLEAFCELL_SIZE_WITHOUTKEY + 2));
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* A key with a shorter common prefix shrinks the prefix of the leaf */
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) "https://www.example.org", 23, 21) == CHIDB_OK);
+    chidb_Btree_getNodeByPage(db->bt, nroot, &btn);
+    ck_assert_int_eq(btn->prefix_size, strlen("https://www.example."));
+    chidb_Btree_freeMemNode(db->bt, btn);
+    check_text_entries(db->bt, nroot, 21);
+
+    /* And an empty key leaves no common prefix at all */
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) "", 0, 22) == CHIDB_OK);
+    chidb_Btree_getNodeByPage(db->bt, nroot, &btn);
+    ck_assert_int_eq(btn->prefix_size, 0);
+    chidb_Btree_freeMemNode(db->bt, btn);
+    check_text_entries(db->bt, nroot, 22);
+
+    for(int i = 0; i < 20; i++)
+    {
+        chidb_key_t keyPk;
+        int size = sprintf(key, "https://www.example.com/%02d", i);
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, i + 1);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Keys inserted in increasing order, with long common prefixes */
+START_TEST (test_12_3)
+{
+    chidb *db;
+    npage_t nroot;
+    char key[UINT8_MAX + 1];
+    int n = 5000, rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    memset(key, 'x', 200);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TEXTINDEX_LEAF);
+    for(int i = 0; i < n; i++)
+    {
+        int size = 200 + sprintf(key + 200, "%06d", i);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) key, size, i + 1) == CHIDB_OK);
+    }
+    check_text_entries(db->bt, nroot, n);
+    for(int i = 0; i < n; i++)
+    {
+        chidb_key_t keyPk;
+        int size = 200 + sprintf(key + 200, "%06d", i);
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, i + 1);
+    }
+
+    /* The shared 200 bytes are stored once per leaf, so the keys take much less than
+     * the 206 * n bytes they would take otherwise */
+    ck_assert(db->bt->pager->n_pages < (206 * n) / db->bt->pager->page_size / 4);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Duplicates, keys that are too long, and other errors */
+START_TEST (test_12_4)
+{
+    chidb *db;
+    npage_t nroot, nindex;
+    uint8_t key[UINT8_MAX + 1];
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TEXTINDEX_LEAF);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) "abc", 3, 1) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) "abc", 3, 2) == CHIDB_EDUPLICATE);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) "ab", 2, 2) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) "abcd", 4, 3) == CHIDB_OK);
+
+    memset(key, 'k', sizeof(key));
+    uint16_t max = BTREE_MAX_TEXTKEY(db->bt->pager->page_size);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, key, max + 1, 4) == CHIDB_ERANGE);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, key, max, 4) == CHIDB_OK);
+    check_text_entries(db->bt, nroot, 4);
+
+    /* Text and integer keys cannot be mixed */
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nindex, (uint8_t *) "abc", 3, 1) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_findInTextIndex(db->bt, nindex, (uint8_t *) "abc", 3, NULL) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, 1, 1) == CHIDB_EMISUSE);
+
+    /* Entries cannot be deleted from text indexes */
+    ck_assert(chidb_Btree_delete(db->bt, nroot, 1) == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleted entries are only marked, and inserting them again reuses their cells */
+START_TEST (test_12_5)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_key_t keyPk;
+    char key[64];
+    int n = 2000, rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TEXTINDEX_LEAF);
+    for(int i = 0; i < n; i++)
+    {
+        int size = make_key(scrambled(i, n), key);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) key, size, scrambled(i, n) + 1) == CHIDB_OK);
+    }
+    npage_t n_pages = db->bt->pager->n_pages;
+
+    for(int i = 0; i < n; i += 3)
+    {
+        int size = make_key(i, key);
+        ck_assert(chidb_Btree_deleteFromTextIndex(db->bt, nroot, (uint8_t *) key, size) == CHIDB_OK);
+        ck_assert(chidb_Btree_deleteFromTextIndex(db->bt, nroot, (uint8_t *) key, size) == CHIDB_ENOTFOUND);
+    }
+    ck_assert(chidb_Btree_deleteFromTextIndex(db->bt, nroot, (uint8_t *) "nope", 4) == CHIDB_ENOTFOUND);
+
+    /* The marked cells are still in the tree */
+    check_text_entries(db->bt, nroot, n);
+    for(int i = 0; i < n; i++)
+    {
+        int size = make_key(i, key);
+        rc = chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size, &keyPk);
+        if (i % 3 == 0)
+            ck_assert(rc == CHIDB_ENOTFOUND);
+        else
+        {
+            ck_assert(rc == CHIDB_OK);
+            ck_assert_int_eq(keyPk, i + 1);
+        }
+    }
+
+    /* Inserting a marked key unmarks its cell, with the new primary key */
+    for(int i = 0; i < n; i += 3)
+    {
+        int size = make_key(i, key);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) key, size, n + i) == CHIDB_OK);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, (uint8_t *) key, size, n + i) == CHIDB_EDUPLICATE);
+    }
+    check_text_entries(db->bt, nroot, n);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+    for(int i = 0; i < n; i++)
+    {
+        int size = make_key(i, key);
+        ck_assert(chidb_Btree_findInTextIndex(db->bt, nroot, (uint8_t *) key, size, &keyPk) == CHIDB_OK);
+        ck_assert_int_eq(keyPk, i % 3 == 0 ? n + i : i + 1);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_12_tc(void)
+{
+    TCase *tc = tcase_create ("Step 12: Text indexes");
+    tcase_add_test (tc, test_12_1);
+    tcase_add_test (tc, test_12_2);
+    tcase_add_test (tc, test_12_3);
+    tcase_add_test (tc, test_12_4);
+    tcase_add_test (tc, test_12_5);
+
+    return tc;
+}
@@ -72,12 +72,48 @@ START_TEST (test_1b_3)
 END_TEST
 
 
+START_TEST (test_1b_4)
+{
+    int rc;
+    chidb *db;
+    uint32_t cookie;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_getSchemaCookie(db->bt, &cookie);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(cookie == 0);
+
+    rc = chidb_Btree_setSchemaCookie(db->bt, 5);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_close(db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A nonzero cookie must not be mistaken for a corrupt header */
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_getSchemaCookie(db->bt, &cookie);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(cookie == 5);
+
+    rc = chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_1b_tc(void)
 {
     TCase *tc = tcase_create ("Step 1b: Opening a new chidb file");
     tcase_add_test (tc, test_1b_1);
     tcase_add_test (tc, test_1b_2);
     tcase_add_test (tc, test_1b_3);
+    tcase_add_test (tc, test_1b_4);
 
     return tc;
 }
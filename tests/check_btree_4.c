@@ -140,6 +140,44 @@ START_TEST (test_4_4)
 END_TEST
 
 
+START_TEST (test_4_5)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    npage_t npages[] = {1, 5};
+
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-4-5.dat");
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+
+    for(int p = 0; p < 2; p++)
+    {
+        chidb_Btree_getNodeByPage(db->bt, npages[p], &btn);
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+
+            ck_assert(chidb_Btree_searchNode(btn, btc.key, &ncell) == CHIDB_OK);
+            ck_assert(ncell == i);
+
+            /* Keys in the test file are not consecutive */
+            ck_assert(chidb_Btree_searchNode(btn, btc.key - 1, &ncell) == CHIDB_ENOTFOUND);
+            ck_assert(ncell == i);
+        }
+        ck_assert(chidb_Btree_searchNode(btn, btc.key + 1, &ncell) == CHIDB_ENOTFOUND);
+        ck_assert(ncell == btn->n_cells);
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_4_tc(void)
 {
     TCase *tc = tcase_create ("Step 4: Manipulating B-Tree cells");
@@ -147,6 +185,7 @@ TCase* make_btree_4_tc(void)
     tcase_add_test (tc, test_4_2);
     tcase_add_test (tc, test_4_3);
     tcase_add_test (tc, test_4_4);
+    tcase_add_test (tc, test_4_5);
 
     return tc;
 }
@@ -40,11 +40,49 @@ START_TEST (test_5_2)
 END_TEST
 
 
+START_TEST (test_5_3)
+{
+    chidb *db;
+    BTreeView view;
+    MemPage *page;
+    int rc;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-5-3.dat");
+    chidb_Btree_open(fname, db, &db->bt);
+    for(int i = 0; i<file1_nvalues; i++)
+    {
+        rc = chidb_Btree_findView(db->bt, 1, file1_keys[i], &view);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(view.size == 128);
+        ck_assert_str_eq((char *) view.data, file1_values[i]);
+
+        /* The view points into the cached page, which stays pinned */
+        rc = chidb_Pager_readPage(db->bt->pager, view.page->npage, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page == view.page);
+        ck_assert(page->refs == 2);
+        chidb_Pager_releaseMemPage(db->bt->pager, page);
+        ck_assert(view.page->refs == 1);
+
+        chidb_Btree_releaseView(db->bt, &view);
+        ck_assert(view.page == NULL);
+    }
+    rc = chidb_Btree_findView(db->bt, 1, 4500, &view);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_5_tc(void)
 {
     TCase *tc = tcase_create ("Step 5: Finding a value in a B-Tree");
     tcase_add_test (tc, test_5_1);
     tcase_add_test (tc, test_5_2);
+    tcase_add_test (tc, test_5_3);
 
     return tc;
 }
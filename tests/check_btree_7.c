@@ -70,12 +70,128 @@ START_TEST (test_7_3)
 END_TEST
 
 
+/* Appends (keys inserted in increasing order) leave full nodes behind */
+START_TEST (test_7_4)
+{
+    chidb *db;
+    npage_t npage;
+    uint8_t buf[100];
+    int rc, nentries = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    for(int i = 1; i <= 3000; i++)
+    {
+        memset(buf, i, sizeof(buf));
+        rc = chidb_Btree_insertInTable(db->bt, npage, i * 2, buf, sizeof(buf));
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(chidb_Btree_insertInTable(db->bt, npage, 6000, buf, sizeof(buf)) == CHIDB_EDUPLICATE);
+
+    /* Nine 108-byte cells fit in a leaf, so the 3000 entries need 334 leaves
+     * (and a few internal nodes). Splitting leaves in half would need ~600. */
+    check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, 3000);
+    ck_assert(db->bt->pager->n_pages < 350);
+
+    /* Inserting in the middle of the B-Tree, and then appending again */
+    for(int i = 1; i <= 3000; i += 10)
+    {
+        memset(buf, i, sizeof(buf));
+        rc = chidb_Btree_insertInTable(db->bt, npage, i * 2 + 1, buf, sizeof(buf));
+        ck_assert(rc == CHIDB_OK);
+    }
+    for(int i = 3001; i <= 4000; i++)
+    {
+        memset(buf, i, sizeof(buf));
+        rc = chidb_Btree_insertInTable(db->bt, npage, i * 2, buf, sizeof(buf));
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    nentries = 0;
+    check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, 4300);
+    for(int i = 1; i <= 4000; i++)
+    {
+        uint8_t *data;
+        uint16_t size;
+
+        rc = chidb_Btree_find(db->bt, npage, i * 2, &data, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == sizeof(buf) && data[0] == (uint8_t) i);
+        free(data);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Appends to an index B-Tree, and appends that are rolled back */
+START_TEST (test_7_5)
+{
+    chidb *db;
+    npage_t npage, other;
+    int rc, nentries = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i = 1; i <= 5000; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, i, i * 3);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    /* 72 cells fit in an index leaf */
+    check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, 5000);
+    ck_assert(db->bt->pager->n_pages < 80);
+
+    /* The pages allocated by the rolled back appends go away (and may be
+     * reused by other B-Trees), so they must not be used by later appends */
+    ck_assert(chidb_Pager_begin(db->bt->pager) == CHIDB_OK);
+    for(int i = 5001; i <= 6000; i++)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, npage, i, i * 3) == CHIDB_OK);
+    ck_assert(chidb_Pager_rollback(db->bt->pager) == CHIDB_OK);
+
+    for(int i = 0; i < 20; i++)
+        chidb_Btree_newNode(db->bt, &other, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_insertInIndex(db->bt, npage, 7000, 1) == CHIDB_OK);
+    for(int i = 5001; i <= 5500; i++)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, npage, i, i * 3) == CHIDB_OK);
+
+    nentries = 0;
+    check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, 5501);
+    nentries = 0;
+    check_tree_structure(db->bt, other, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_7_tc(void)
 {
     TCase *tc = tcase_create ("Step 7: Insertion with splitting");
     tcase_add_test (tc, test_7_1);
     tcase_add_test (tc, test_7_2);
     tcase_add_test (tc, test_7_3);
+    tcase_add_test (tc, test_7_4);
+    tcase_add_test (tc, test_7_5);
 
     return tc;
 }
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+static int compare_bigfile_ikeys(const void *a, const void *b)
+{
+    return bigfile_ikeys[*(int *) a] - bigfile_ikeys[*(int *) b];
+}
+
+/* Bulk loads keys 1..n into a new index B-Tree */
+static npage_t bulk_load_index(BTree *bt, int n, uint8_t fill)
+{
+    BTreeLoader *bl;
+    BTreeCell cell;
+    npage_t npage;
+
+    chidb_Btree_newNode(bt, &npage, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_bulkLoadBegin(bt, npage, fill, &bl) == CHIDB_OK);
+    cell.type = PGTYPE_INDEX_LEAF;
+    for(int i = 1; i <= n; i++)
+    {
+        cell.key = i;
+        cell.fields.indexLeaf.keyPk = 2 * i;
+        ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_OK);
+    }
+    ck_assert(chidb_Btree_bulkLoadEnd(bl) == CHIDB_OK);
+
+    return npage;
+}
+
+
+START_TEST (test_9_1)
+{
+    chidb *db;
+    BTreeLoader *bl;
+    BTreeCell cell;
+    npage_t npage;
+    uint8_t buf[64];
+    int rc, nentries = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    rc = chidb_Btree_bulkLoadBegin(db->bt, npage, BTREE_BULKLOAD_DEFAULT_FILL, &bl);
+    ck_assert(rc == CHIDB_OK);
+
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.fields.tableLeaf.data = buf;
+    for(int i = 1; i <= 5000; i++)
+    {
+        memset(buf, i, sizeof(buf));
+        cell.key = i * 3;
+        cell.fields.tableLeaf.data_size = 1 + i % sizeof(buf);
+        ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_OK);
+    }
+    ck_assert(chidb_Btree_bulkLoadEnd(bl) == CHIDB_OK);
+
+    ck_assert(check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries) == 3);
+    ck_assert_int_eq(nentries, 5000);
+
+    for(int i = 1; i <= 5000; i++)
+    {
+        uint8_t *data;
+        uint16_t size;
+
+        rc = chidb_Btree_find(db->bt, npage, i * 3, &data, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(size, 1 + i % sizeof(buf));
+        ck_assert(data[0] == (uint8_t) i && data[size - 1] == (uint8_t) i);
+        free(data);
+    }
+
+    /* The B-Tree can be modified as usual after it has been loaded */
+    memset(buf, 0, sizeof(buf));
+    ck_assert(chidb_Btree_insertInTable(db->bt, npage, 3001, buf, sizeof(buf)) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTable(db->bt, npage, 3000, buf, sizeof(buf)) == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_2)
+{
+    chidb *db;
+    BTreeLoader *bl;
+    BTreeCell cell;
+    npage_t npage;
+    int rc, nentries = 0;
+    int *order;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    order = malloc(bigfile_nvalues * sizeof(int));
+    for(int i=0; i<bigfile_nvalues; i++)
+        order[i] = i;
+    qsort(order, bigfile_nvalues, sizeof(int), compare_bigfile_ikeys);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_bulkLoadBegin(db->bt, npage, 100, &bl);
+    ck_assert(rc == CHIDB_OK);
+    cell.type = PGTYPE_INDEX_LEAF;
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        cell.key = bigfile_ikeys[order[i]];
+        cell.fields.indexLeaf.keyPk = bigfile_pkeys[order[i]];
+        ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_OK);
+    }
+    ck_assert(chidb_Btree_bulkLoadEnd(bl) == CHIDB_OK);
+
+    check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+    ck_assert_int_eq(nentries, bigfile_nvalues);
+    test_index_bigfile(db, npage);
+
+    free(order);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Every number of entries (including the ones that exactly fill
+ * a node, or leave a single entry for the last node) */
+START_TEST (test_9_3)
+{
+    chidb *db;
+    npage_t npage;
+    uint8_t fills[] = {100, 90, 50, 1};
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int f = 0; f < sizeof(fills); f++)
+        for(int n = 0; n <= 300; n++)
+        {
+            int nentries = 0;
+
+            npage = bulk_load_index(db->bt, n, fills[f]);
+            check_tree_structure(db->bt, npage, 0, UINT32_MAX, true, &nentries);
+            ck_assert_int_eq(nentries, n);
+        }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_4)
+{
+    chidb *db;
+    BTreeLoader *bl;
+    BTreeCell cell;
+    npage_t npage;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Only empty B-Trees can be loaded */
+    ck_assert(chidb_Btree_bulkLoadBegin(db->bt, 1, 90, &bl) == CHIDB_EMISUSE);
+    npage = bulk_load_index(db->bt, 10, 90);
+    ck_assert(chidb_Btree_bulkLoadBegin(db->bt, npage, 90, &bl) == CHIDB_EMISUSE);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_bulkLoadBegin(db->bt, npage, 0, &bl) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_bulkLoadBegin(db->bt, npage, 101, &bl) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_bulkLoadBegin(db->bt, npage, 90, &bl) == CHIDB_OK);
+
+    /* Cells must be index cells, in increasing order */
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.key = 5;
+    ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_EMISUSE);
+    cell.type = PGTYPE_INDEX_LEAF;
+    cell.fields.indexLeaf.keyPk = 1;
+    ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_OK);
+    ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_EDUPLICATE);
+    cell.key = 4;
+    ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_EMISUSE);
+    cell.key = 6;
+    ck_assert(chidb_Btree_bulkLoadAppend(bl, &cell) == CHIDB_OK);
+    ck_assert(chidb_Btree_bulkLoadEnd(bl) == CHIDB_OK);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_9_tc(void)
+{
+    TCase *tc = tcase_create ("Step 9: Bulk loading B-Trees");
+    tcase_add_test (tc, test_9_1);
+    tcase_add_test (tc, test_9_2);
+    tcase_add_test (tc, test_9_3);
+    tcase_add_test (tc, test_9_4);
+
+    return tc;
+}
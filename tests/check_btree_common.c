@@ -60,6 +60,56 @@ void bt_sanity_check(BTree *bt, npage_t nroot)
     return;
 }
 
+/* Checks the structure of the B-Tree rooted at npage: all its keys must be
+ * in (lo, hi], in order, and all its leaves must be at the same depth.
+ * Returns the height of the B-Tree, and adds the number of entries in it
+ * to *nentries. */
+int check_tree_structure(BTree *bt, npage_t npage, int64_t lo, int64_t hi, bool root, int *nentries)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int height = -1;
+    int64_t prev = lo;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    btn_sanity_check(bt, btn, false);
+    ck_assert(root || btn->n_cells > 0);
+
+    for(int i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+        ck_assert(cell.key > prev && cell.key <= hi);
+
+        if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+        {
+            npage_t child = btn->type == PGTYPE_TABLE_INTERNAL ?
+                            cell.fields.tableInternal.child_page : cell.fields.indexInternal.child_page;
+            /* Index B-Trees store entries in internal nodes too */
+            int64_t child_hi = btn->type == PGTYPE_TABLE_INTERNAL ? cell.key : (int64_t) cell.key - 1;
+            int h = check_tree_structure(bt, child, prev, child_hi, false, nentries);
+            ck_assert(height == -1 || h == height);
+            height = h;
+        }
+        if (btn->type != PGTYPE_TABLE_INTERNAL)
+            (*nentries)++;
+        prev = cell.key;
+    }
+
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        int h = check_tree_structure(bt, btn->right_page, prev, hi, false, nentries);
+        ck_assert(height == -1 || h == height);
+        height = h + 1;
+    }
+    else
+    {
+        height = 1;
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return height;
+}
+
 void test_init_empty(BTree *bt, uint8_t type)
 {
     BTreeNode *btn;
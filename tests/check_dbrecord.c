@@ -177,6 +177,35 @@ START_TEST (test_packunpack)
 END_TEST
 
 
+START_TEST (test_unpackview)
+{
+    DBRecord *dbr1, *dbr2;
+    char *s;
+    int32_t i32;
+    uint8_t *buf;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr1, "|s|i4|", str_values[i], int32_values[i]);
+        chidb_DBRecord_pack(dbr1, &buf);
+
+        /* The unpacked record reads its values straight from buf */
+        chidb_DBRecord_unpackView(&dbr2, buf);
+        ck_assert(dbr2->data == buf + (dbr2->packed_len - dbr2->data_len));
+
+        chidb_DBRecord_getString(dbr2, 0, &s);
+        ck_assert_str_eq(str_values[i], s);
+        chidb_DBRecord_getInt32(dbr2, 1, &i32);
+        ck_assert_int_eq(int32_values[i], i32);
+
+        chidb_DBRecord_destroy(dbr1);
+        chidb_DBRecord_destroy(dbr2);
+        free(buf);
+    }
+}
+END_TEST
+
+
 Suite* make_dbrecord_suite (void)
 {
     Suite *s = suite_create ("DB Record");
@@ -195,6 +224,7 @@ Suite* make_dbrecord_suite (void)
 
     TCase *tc_packunpack = tcase_create ("Packing/unpacking a record");
     tcase_add_test (tc_packunpack, test_packunpack);
+    tcase_add_test (tc_packunpack, test_unpackview);
     suite_add_tcase (s, tc_packunpack);
 
     return s;
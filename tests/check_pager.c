@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <check.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
+#include "libchidb/wal.h"
 
 #define NVALUES (256)
 #define PAGE_SIZE (1024)
@@ -146,6 +149,472 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+START_TEST (test_writepages)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pages[MAXPAGES];
+    /* Two runs of adjacent pages (1-3 and 5-8), in no particular order */
+    npage_t order[MAXPAGES - 1] = {6, 2, 8, 1, 5, 3, 7};
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+
+    for(int j=0; j<MAXPAGES - 1; j++)
+    {
+        chidb_Pager_readPage(pg, order[j], &pages[j]);
+        for(int k=0; k<NVALUES; k++)
+            pages[j]->data[pagepos[k]] = values[(k + order[j]) % NVALUES];
+    }
+    rc = chidb_Pager_writePages(pg, pages, MAXPAGES - 1);
+    ck_assert(rc == CHIDB_OK);
+    for(int j=1; j<MAXPAGES - 1; j++)
+        ck_assert(pages[j-1]->npage < pages[j]->npage);
+    for(int j=0; j<MAXPAGES - 1; j++)
+        chidb_Pager_releaseMemPage(pg, pages[j]);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    for(int j=0; j<MAXPAGES - 1; j++)
+    {
+        chidb_Pager_readPage(pg, order[j], &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != values[(k + order[j]) % NVALUES])
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache)
+{
+    int rc;
+    Pager *pg;
+    MemPage *page, *page2, *pinned[MAXPAGES];
+
+    char *fname = create_copy(TESTFILE, "pager-test-cache.dat");
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_setCacheSize(pg, MAXPAGES / 2);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A cached page is shared by everyone who reads it */
+    chidb_Pager_readPage(pg, 1, &page);
+    chidb_Pager_readPage(pg, 1, &page2);
+    ck_assert(page == page2);
+    ck_assert_int_eq(page->refs, 2);
+    page->data[0] = 42;
+    ck_assert_int_eq(page2->data[0], 42);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page2);
+
+    /* The cache does not grow beyond its size... */
+    for(int j=1; j<=pg->n_pages; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+        ck_assert(pg->n_resident <= MAXPAGES / 2);
+    }
+
+    /* ...unless more pages than that are pinned */
+    for(int j=0; j<MAXPAGES; j++)
+        chidb_Pager_readPage(pg, j + 1, &pinned[j]);
+    ck_assert_int_eq(pg->n_resident, MAXPAGES);
+    for(int j=0; j<MAXPAGES; j++)
+        ck_assert_int_eq(pinned[j]->npage, j + 1);
+    for(int j=0; j<MAXPAGES; j++)
+        chidb_Pager_releaseMemPage(pg, pinned[j]);
+    ck_assert(pg->n_resident <= MAXPAGES / 2);
+
+    /* A page that is re-read soon after being evicted is considered hot,
+     * and is not evicted by a sequential scan */
+    for(int j=MAXPAGES+1; j<=pg->n_pages; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_readPage(pg, 1, &page);
+    chidb_Pager_releaseMemPage(pg, page);
+    for(int j=2; pg->a1out.head == NULL || pg->a1out.head->npage != 1; j++)
+    {
+        ck_assert(j <= pg->n_pages);
+        chidb_Pager_readPage(pg, j, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(page->queue == PGCACHE_AM);
+    chidb_Pager_releaseMemPage(pg, page);
+    for(int j=MAXPAGES+1; j<=pg->n_pages; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(page->queue == PGCACHE_AM);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    chidb_Pager_close(pg);
+    delete_copy(fname);
+}
+END_TEST
+
+
+START_TEST (test_mmap)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *first;
+    /* Enough pages to force the mapping to grow at least once */
+    int npages = 4 * MAXPAGES * MAXPAGES;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_enableMmap(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Keep the first page pinned while the file grows */
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, 1, &first);
+    ck_assert(!first->mapped);
+    first->data[0] = 42;
+    chidb_Pager_writePage(pg, first);
+
+    for(int j=2; j<=npages; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        ck_assert(npage == j);
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[(k + j) % NVALUES];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->map->next != NULL);
+
+    ck_assert_int_eq(first->data[0], 42);
+    chidb_Pager_releaseMemPage(pg, first);
+    chidb_Pager_close(pg);
+
+    /* Pages that are only read come from the mapping, and are copied
+     * to the heap when they are read to be modified */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(chidb_Pager_enableMmap(pg) == CHIDB_OK);
+    chidb_Pager_readPageReadOnly(pg, 2, &page);
+    ck_assert(page->mapped);
+    uint8_t *mapped_data = page->data;
+    ck_assert(chidb_Pager_readPage(pg, 2, &page) == CHIDB_OK);
+    ck_assert(!page->mapped);
+    page->data[pagepos[0]]++;
+    ck_assert(mapped_data[pagepos[0]] == values[2 % NVALUES]);
+    page->data[pagepos[0]]--;
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    /* Read the file back without the mapping */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, npages);
+    for(int j=2; j<=npages; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != values[(k + j) % NVALUES])
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Pages written with a small cache are evicted and read again from the
+ * mapping, which must show what was written */
+START_TEST (test_mmap_cache)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    int npages = 4 * MAXPAGES * MAXPAGES;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(chidb_Pager_setCacheSize(pg, 10) == CHIDB_OK);
+    ck_assert(chidb_Pager_enableMmap(pg) == CHIDB_OK);
+
+    for(int j=1; j<=npages; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        memset(page->data, j, PAGE_SIZE);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Each round rewrites some of the pages (adjacent pages share the
+     * pages of the mapping), and then reads all of them back */
+    for(int round=1; round<=4; round++)
+    {
+        for(int j=round; j<=npages; j+=round)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            memset(page->data, j + round, PAGE_SIZE);
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        ck_assert(pg->n_resident <= 10);
+        for(int j=1; j<=npages; j++)
+        {
+            int last = 0;
+            for(int r=1; r<=round; r++)
+                if(j % r == 0)
+                    last = r;
+            ck_assert(chidb_Pager_readPageReadOnly(pg, j, &page) == CHIDB_OK);
+            ck_assert_int_eq(page->data[0], (uint8_t) (j + last));
+            ck_assert_int_eq(page->data[PAGE_SIZE - 1], (uint8_t) (j + last));
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+    }
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Fills page npage with the given byte, and writes it */
+static void fill_page(Pager *pg, npage_t npage, uint8_t value)
+{
+    MemPage *page;
+
+    ck_assert(chidb_Pager_readPage(pg, npage, &page) == CHIDB_OK);
+    memset(page->data, value, PAGE_SIZE);
+    ck_assert(chidb_Pager_writePage(pg, page) == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+}
+
+static uint8_t peek_page(Pager *pg, npage_t npage)
+{
+    MemPage *page;
+    uint8_t value;
+
+    ck_assert(chidb_Pager_readPage(pg, npage, &page) == CHIDB_OK);
+    value = page->data[PAGE_SIZE - 1];
+    chidb_Pager_releaseMemPage(pg, page);
+    return value;
+}
+
+START_TEST (test_wal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg1, *pg2;
+    MemPage *page;
+    struct stat st;
+
+    char *fname = create_tmp_file();
+    char *wname = malloc(strlen(fname) + 5);
+    sprintf(wname, "%s-wal", fname);
+
+    rc = chidb_Pager_open(&pg1, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg1, PAGE_SIZE);
+    rc = chidb_Pager_enableWal(pg1, wname);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg1, &npage);
+        fill_page(pg1, npage, j);
+    }
+    ck_assert(chidb_Pager_commit(pg1) == CHIDB_OK);
+
+    /* Committed pages are in the log, not in the database file */
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, 0);
+
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    rc = chidb_Pager_enableWal(pg2, wname);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+
+    /* A reader does not see commits made after its snapshot */
+    ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+    ck_assert_int_eq(peek_page(pg2, 1), 1);
+    fill_page(pg1, 2, 100);
+    ck_assert(chidb_Pager_commit(pg1) == CHIDB_OK);
+    ck_assert_int_eq(peek_page(pg2, 2), 2);
+
+    /* ...so it cannot write, and the log cannot be checkpointed */
+    ck_assert(chidb_Pager_readPage(pg2, 3, &page) == CHIDB_OK);
+    ck_assert(chidb_Pager_writePage(pg2, page) == CHIDB_EBUSY);
+    chidb_Pager_releaseMemPage(pg2, page);
+    ck_assert(chidb_Pager_checkpoint(pg1) == CHIDB_EBUSY);
+    chidb_Pager_endRead(pg2);
+
+    ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+    ck_assert_int_eq(peek_page(pg2, 2), 100);
+    chidb_Pager_endRead(pg2);
+
+    /* Only one connection can write at a time */
+    fill_page(pg1, 3, 101);
+    ck_assert(chidb_Pager_beginWrite(pg2) == CHIDB_EBUSY);
+    ck_assert(chidb_Pager_commit(pg1) == CHIDB_OK);
+
+    /* ...and only on the latest version of the database */
+    ck_assert(chidb_Pager_beginWrite(pg2) == CHIDB_EBUSY);
+    ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+    ck_assert(chidb_Pager_beginWrite(pg2) == CHIDB_OK);
+    fill_page(pg2, 4, 102);
+    ck_assert(chidb_Pager_commit(pg2) == CHIDB_OK);
+    chidb_Pager_endRead(pg2);
+
+    /* Checkpointing copies the pages to the database file */
+    ck_assert(chidb_Pager_checkpoint(pg1) == CHIDB_EBUSY);
+    ck_assert(chidb_Pager_beginRead(pg1) == CHIDB_OK);
+    ck_assert(chidb_Pager_checkpoint(pg1) == CHIDB_OK);
+    chidb_Pager_endRead(pg1);
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, MAXPAGES * PAGE_SIZE);
+    stat(wname, &st);
+    ck_assert_int_eq(st.st_size, WAL_HEADER_SIZE);
+
+    ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+    ck_assert_int_eq(peek_page(pg2, 3), 101);
+    ck_assert_int_eq(peek_page(pg2, 4), 102);
+    chidb_Pager_endRead(pg2);
+
+    chidb_Pager_close(pg2);
+    chidb_Pager_close(pg1);
+
+    /* Read the file back without the log */
+    rc = chidb_Pager_open(&pg1, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg1, PAGE_SIZE);
+    ck_assert_int_eq(pg1->n_pages, MAXPAGES);
+    ck_assert_int_eq(peek_page(pg1, 1), 1);
+    ck_assert_int_eq(peek_page(pg1, 2), 100);
+    ck_assert_int_eq(peek_page(pg1, 3), 101);
+    ck_assert_int_eq(peek_page(pg1, 4), 102);
+    ck_assert_int_eq(peek_page(pg1, MAXPAGES), MAXPAGES);
+    chidb_Pager_close(pg1);
+
+    remove(wname);
+    free(wname);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_transaction)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+
+    /* Without and with the mmap backend */
+    for(int use_mmap=0; use_mmap<2; use_mmap++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Pager_open(&pg, fname);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        if(use_mmap)
+            ck_assert(chidb_Pager_enableMmap(pg) == CHIDB_OK);
+
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_allocatePage(pg, &npage);
+            fill_page(pg, npage, j);
+        }
+
+        /* Pages are written once, at commit */
+        ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+        ck_assert(chidb_Pager_begin(pg) == CHIDB_EMISUSE);
+        fill_page(pg, 2, 100);
+        fill_page(pg, 2, 101);
+        chidb_Pager_allocatePage(pg, &npage);
+        fill_page(pg, npage, 102);
+        ck_assert_int_eq(pg->n_dirty, 2);
+        ck_assert_int_eq(peek_page(pg, 2), 101);
+        ck_assert(chidb_Pager_commit(pg) == CHIDB_OK);
+        ck_assert_int_eq(pg->n_dirty, 0);
+        stat(fname, &st);
+        ck_assert_int_eq(st.st_size, (MAXPAGES + 1) * PAGE_SIZE);
+
+        /* Rolling back restores the pages, and deallocates new pages */
+        ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+        fill_page(pg, 3, 103);
+        chidb_Pager_allocatePage(pg, &npage);
+        fill_page(pg, npage, 104);
+        ck_assert(chidb_Pager_readPage(pg, 3, &page) == CHIDB_OK);
+        ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+        ck_assert_int_eq(page->data[0], 3);
+        chidb_Pager_releaseMemPage(pg, page);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES + 1);
+        ck_assert(chidb_Pager_rollback(pg) == CHIDB_EMISUSE);
+
+        /* An unfinished transaction is rolled back on close */
+        ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+        fill_page(pg, 4, 105);
+        chidb_Pager_close(pg);
+
+        rc = chidb_Pager_open(&pg, fname);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES + 1);
+        ck_assert_int_eq(peek_page(pg, 1), 1);
+        ck_assert_int_eq(peek_page(pg, 2), 101);
+        ck_assert_int_eq(peek_page(pg, 3), 3);
+        ck_assert_int_eq(peek_page(pg, 4), 4);
+        ck_assert_int_eq(peek_page(pg, MAXPAGES + 1), 102);
+        chidb_Pager_close(pg);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -160,8 +629,26 @@ Suite* make_pager_suite (void)
 
     TCase *tc_readwrite = tcase_create ("Reading/writing a file");
     tcase_add_test (tc_readwrite, test_readwrite);
+    tcase_add_test (tc_readwrite, test_writepages);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_cache = tcase_create ("Page cache");
+    tcase_add_test (tc_cache, test_cache);
+    suite_add_tcase (s, tc_cache);
+
+    TCase *tc_mmap = tcase_create ("Memory-mapped file");
+    tcase_add_test (tc_mmap, test_mmap);
+    tcase_add_test (tc_mmap, test_mmap_cache);
+    suite_add_tcase (s, tc_mmap);
+
+    TCase *tc_txn = tcase_create ("Transactions");
+    tcase_add_test (tc_txn, test_transaction);
+    suite_add_tcase (s, tc_txn);
+
+    TCase *tc_wal = tcase_create ("Write-ahead log");
+    tcase_add_test (tc_wal, test_wal);
+    suite_add_tcase (s, tc_wal);
+
     return s;
 }
 
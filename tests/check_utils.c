@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "libchidb/util.h"
+#include "libchidb/arena.h"
 
 #define NVALUES (8)
 
@@ -55,6 +57,45 @@ START_TEST (test_varint32)
 }
 END_TEST
 
+START_TEST (test_arena)
+{
+    Arena arena;
+    uint8_t *p[64];
+
+    chidb_Arena_init(&arena, 256);
+
+    /* Allocations are aligned and do not overlap */
+    for(int i=0; i<64; i++)
+    {
+        p[i] = chidb_Arena_alloc(&arena, 1 + i % 13);
+        ck_assert(p[i] != NULL);
+        ck_assert_int_eq((uintptr_t) p[i] % 8, 0);
+        memset(p[i], i, 1 + i % 13);
+    }
+    for(int i=0; i<64; i++)
+        for(int j=0; j < 1 + i % 13; j++)
+            ck_assert_int_eq(p[i][j], i);
+
+    /* Allocations larger than a block */
+    uint8_t *big = chidb_Arena_alloc(&arena, 1000);
+    ck_assert(big != NULL);
+    memset(big, 0xAB, 1000);
+    ck_assert_int_eq(p[63][0], 63);
+
+    char *s = chidb_Arena_strndup(&arena, "hello world", 5);
+    ck_assert_str_eq(s, "hello");
+
+    /* After a reset, the same blocks are used again */
+    ArenaBlock *first = arena.first;
+    chidb_Arena_reset(&arena);
+    ck_assert(arena.first == first);
+    ck_assert(chidb_Arena_alloc(&arena, 8) == (void *) first->data);
+
+    chidb_Arena_free(&arena);
+    ck_assert(arena.first == NULL);
+}
+END_TEST
+
 
 Suite* make_utils_suite (void)
 {
@@ -66,6 +107,10 @@ Suite* make_utils_suite (void)
     tcase_add_test (tc_integer, test_varint32);
     suite_add_tcase (s, tc_integer);
 
+    TCase *tc_arena = tcase_create ("Arena");
+    tcase_add_test (tc_arena, test_arena);
+    suite_add_tcase (s, tc_arena);
+
     return s;
 }
 